@@ -0,0 +1,969 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "audio_codec.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AUDIO_X86
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AUDIO_NEON
+#endif
+
+using namespace std;
+
+// G.711 mu-law on 16 bit samples
+static const int ULAW_BIAS = 0x84;
+static const int ULAW_CLIP = 32635;
+
+// IMA-ADPCM step sizes and index changes per code
+static const int16_t ADPCM_STEPS[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+	253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+	1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+	3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+	11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+	32767
+};
+
+static const int ADPCM_INDEX_ADJUST[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+static const char * CODEC_NAMES[AudioCodec::CODEC_COUNT] = {"pcm", "ulaw", "alaw", "adpcm"};
+
+static uint8_t ulaw_encode(int16_t sample);
+static int16_t ulaw_decode(uint8_t code);
+static uint8_t alaw_encode(int16_t sample);
+static int16_t alaw_decode(uint8_t code);
+static int adpcm_step(AudioCodec::AdpcmState & state, int code);
+static int16_t dot_scalar(const int16_t * samples, const int16_t * coefficients, int taps);
+
+#ifdef AUDIO_X86
+static void ulaw_encode_sse2(const int16_t * pcm, int count, uint8_t * data);
+static void alaw_encode_sse2(const int16_t * pcm, int count, uint8_t * data);
+static int16_t dot_sse2(const int16_t * samples, const int16_t * coefficients, int taps);
+static void ulaw_encode_avx2(const int16_t * pcm, int count, uint8_t * data);
+static void alaw_encode_avx2(const int16_t * pcm, int count, uint8_t * data);
+static int16_t dot_avx2(const int16_t * samples, const int16_t * coefficients, int taps);
+#endif
+
+#ifdef AUDIO_NEON
+static void ulaw_encode_neon(const int16_t * pcm, int count, uint8_t * data);
+static void alaw_encode_neon(const int16_t * pcm, int count, uint8_t * data);
+static int16_t dot_neon(const int16_t * samples, const int16_t * coefficients, int taps);
+#endif
+
+// filled once, decoding is a lookup
+static int16_t ulaw_table[256];
+static int16_t alaw_table[256];
+
+static bool build_tables()
+{
+	for (int i = 0; i < 256; i++) {
+		ulaw_table[i] = ulaw_decode(i);
+		alaw_table[i] = alaw_decode(i);
+	}
+
+	return true;
+}
+
+static bool tables_built = build_tables();
+
+AudioCodec::Simd AudioCodec::simd = AudioCodec::BestSimd();
+
+// public methods
+
+/**
+ * Bytes a frame of samples takes in a codec
+ * @param int codec
+ * @param int samples
+ * @return size_t 0 for unknown codecs
+ */
+size_t AudioCodec::EncodedSize(int codec, int samples)
+{
+	switch (codec) {
+		case CODEC_PCM:
+			return samples * 2;
+
+		case CODEC_ULAW:
+		case CODEC_ALAW:
+			return samples;
+
+		case CODEC_ADPCM:
+			return ADPCM_HEADER_SIZE + (samples + 1) / 2;
+	}
+
+	return 0;
+}
+
+/**
+ * Encode a frame
+ * @param int codec
+ * @param int16_t* pcm
+ * @param int count
+ * @param uint8_t* data EncodedSize() bytes
+ * @param AdpcmState state Carried from frame to frame, ADPCM only
+ * @return size_t Bytes written
+ */
+size_t AudioCodec::Encode(int codec, const int16_t * pcm, int count, uint8_t * data, AdpcmState & state)
+{
+	switch (codec) {
+		case CODEC_PCM:
+			// little-endian like the rest of the stream, as on the Pi and x86
+			memcpy(data, pcm, count * 2);
+			return count * 2;
+
+		case CODEC_ULAW:
+			EncodeUlaw(pcm, count, data);
+			return count;
+
+		case CODEC_ALAW:
+			EncodeAlaw(pcm, count, data);
+			return count;
+
+		case CODEC_ADPCM:
+			return EncodeAdpcm(state, pcm, count, data);
+	}
+
+	return 0;
+}
+
+/**
+ * Decode a frame
+ * @param int codec
+ * @param uint8_t* data
+ * @param size_t length Must be EncodedSize() of count
+ * @param int16_t* pcm
+ * @param int count Samples
+ * @return bool
+ */
+bool AudioCodec::Decode(int codec, const uint8_t * data, size_t length, int16_t * pcm, int count)
+{
+	if (length != EncodedSize(codec, count)) {
+		return false;
+	}
+
+	switch (codec) {
+		case CODEC_PCM:
+			memcpy(pcm, data, length);
+			return true;
+
+		case CODEC_ULAW:
+			DecodeUlaw(data, count, pcm);
+			return true;
+
+		case CODEC_ALAW:
+			DecodeAlaw(data, count, pcm);
+			return true;
+
+		case CODEC_ADPCM:
+			DecodeAdpcm(data, count, pcm);
+			return true;
+	}
+
+	return false;
+}
+
+void AudioCodec::EncodeUlaw(const int16_t * pcm, int count, uint8_t * data)
+{
+	switch (simd) {
+#ifdef AUDIO_X86
+		case SIMD_AVX2:
+			ulaw_encode_avx2(pcm, count, data);
+			return;
+
+		case SIMD_SSE2:
+			ulaw_encode_sse2(pcm, count, data);
+			return;
+#endif
+
+#ifdef AUDIO_NEON
+		case SIMD_NEON:
+			ulaw_encode_neon(pcm, count, data);
+			return;
+#endif
+
+		default:
+			for (int i = 0; i < count; i++) {
+				data[i] = ulaw_encode(pcm[i]);
+			}
+	}
+}
+
+void AudioCodec::DecodeUlaw(const uint8_t * data, int count, int16_t * pcm)
+{
+	for (int i = 0; i < count; i++) {
+		pcm[i] = ulaw_table[data[i]];
+	}
+}
+
+void AudioCodec::EncodeAlaw(const int16_t * pcm, int count, uint8_t * data)
+{
+	switch (simd) {
+#ifdef AUDIO_X86
+		case SIMD_AVX2:
+			alaw_encode_avx2(pcm, count, data);
+			return;
+
+		case SIMD_SSE2:
+			alaw_encode_sse2(pcm, count, data);
+			return;
+#endif
+
+#ifdef AUDIO_NEON
+		case SIMD_NEON:
+			alaw_encode_neon(pcm, count, data);
+			return;
+#endif
+
+		default:
+			for (int i = 0; i < count; i++) {
+				data[i] = alaw_encode(pcm[i]);
+			}
+	}
+}
+
+void AudioCodec::DecodeAlaw(const uint8_t * data, int count, int16_t * pcm)
+{
+	for (int i = 0; i < count; i++) {
+		pcm[i] = alaw_table[data[i]];
+	}
+}
+
+/**
+ * One ADPCM block: predictor (int16) and step index, then two samples per
+ * byte, first sample in the low nibble
+ * @param AdpcmState state
+ * @param int16_t* pcm
+ * @param int count
+ * @param uint8_t* data
+ * @return size_t Bytes written
+ */
+size_t AudioCodec::EncodeAdpcm(AdpcmState & state, const int16_t * pcm, int count, uint8_t * data)
+{
+	data[0] = state.predictor;
+	data[1] = state.predictor >> 8;
+	data[2] = state.index;
+	data[3] = 0;
+
+	uint8_t * out = data + ADPCM_HEADER_SIZE;
+
+	for (int i = 0; i < count; i++) {
+		int step = ADPCM_STEPS[state.index];
+		int diff = pcm[i] - state.predictor;
+		int code = 0;
+
+		if (diff < 0) {
+			code = 8;
+			diff = -diff;
+		}
+
+		if (diff >= step) {
+			code |= 4;
+			diff -= step;
+		}
+
+		step >>= 1;
+
+		if (diff >= step) {
+			code |= 2;
+			diff -= step;
+		}
+
+		if (diff >= step >> 1) {
+			code |= 1;
+		}
+
+		// decoder's view of the sample, so both sides stay in step
+		adpcm_step(state, code);
+
+		if (i & 1) {
+			out[i >> 1] |= code << 4;
+		} else {
+			out[i >> 1] = code;
+		}
+	}
+
+	return ADPCM_HEADER_SIZE + (count + 1) / 2;
+}
+
+/**
+ * Decode one ADPCM block, the state comes from its header
+ * @param uint8_t* data
+ * @param int count Samples
+ * @param int16_t* pcm
+ * @return void
+ */
+void AudioCodec::DecodeAdpcm(const uint8_t * data, int count, int16_t * pcm)
+{
+	AdpcmState state;
+	state.predictor = (int16_t)(data[0] | (data[1] << 8));
+	state.index = data[2] > 88 ? 88 : data[2];
+
+	const uint8_t * in = data + ADPCM_HEADER_SIZE;
+
+	for (int i = 0; i < count; i++) {
+		pcm[i] = adpcm_step(state, (i & 1) ? in[i >> 1] >> 4 : in[i >> 1] & 0x0F);
+	}
+}
+
+/**
+ * @param string name pcm, ulaw, alaw or adpcm
+ * @return int -1 if unknown
+ */
+int AudioCodec::CodecByName(const string & name)
+{
+	for (int i = 0; i < CODEC_COUNT; i++) {
+		if (name == CODEC_NAMES[i]) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+const char * AudioCodec::CodecName(int codec)
+{
+	return codec >= 0 && codec < CODEC_COUNT ? CODEC_NAMES[codec] : "unknown";
+}
+
+/**
+ * Fastest instruction set this CPU runs
+ * @return Simd
+ */
+AudioCodec::Simd AudioCodec::BestSimd()
+{
+#ifdef AUDIO_NEON
+	return SIMD_NEON;
+#elif defined(AUDIO_X86)
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")) {
+		return SIMD_AVX2;
+	}
+
+	if (__builtin_cpu_supports("sse2")) {
+		return SIMD_SSE2;
+	}
+
+	return SIMD_SCALAR;
+#else
+	return SIMD_SCALAR;
+#endif
+}
+
+AudioCodec::Simd AudioCodec::GetSimd()
+{
+	return simd;
+}
+
+/**
+ * Use another code path, e.g. to compare it with the scalar one
+ * @param Simd level
+ * @return bool False if this build or CPU can't run it
+ */
+bool AudioCodec::SetSimd(Simd level)
+{
+	Simd best = BestSimd();
+
+	if (level != SIMD_SCALAR && level != best && !(best == SIMD_AVX2 && level == SIMD_SSE2)) {
+		return false;
+	}
+
+	simd = level;
+
+	return true;
+}
+
+const char * AudioCodec::SimdName(Simd level)
+{
+	switch (level) {
+		case SIMD_SSE2:
+			return "sse2";
+
+		case SIMD_AVX2:
+			return "avx2";
+
+		case SIMD_NEON:
+			return "neon";
+
+		default:
+			return "scalar";
+	}
+}
+
+// Resampler
+
+Resampler::Resampler()
+{
+	factor = 1;
+	taps = 0;
+	coefficients = NULL;
+	buffer = NULL;
+	buffered = 0;
+	next = 0;
+}
+
+Resampler::~Resampler()
+{
+	delete[] coefficients;
+	delete[] buffer;
+}
+
+/**
+ * Design the low pass for a rate pair
+ * @param int in_rate
+ * @param int out_rate Must divide in_rate
+ * @return bool
+ */
+bool Resampler::Setup(int in_rate, int out_rate)
+{
+	if (out_rate <= 0 || in_rate < out_rate || in_rate % out_rate != 0) {
+		return false;
+	}
+
+	delete[] coefficients;
+	delete[] buffer;
+
+	factor = in_rate / out_rate;
+	taps = TAPS_PER_OUTPUT * factor;
+	coefficients = new int16_t[taps];
+	buffer = new int16_t[taps + CHUNK];
+
+	// cutoff as a fraction of the input rate
+	double cutoff = 0.42 / factor;
+	double * h = new double[taps];
+	double sum = 0;
+
+	for (int i = 0; i < taps; i++) {
+		double x = i - (taps - 1) / 2.0;
+		double sinc = x == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x);
+		double window = 0.42 - 0.5 * cos(2 * M_PI * i / (taps - 1)) + 0.08 * cos(4 * M_PI * i / (taps - 1));
+
+		h[i] = sinc * window;
+		sum += h[i];
+	}
+
+	// unity gain at DC, Q15, reversed so the newest sample meets the first tap
+	int magnitude = 0;
+
+	for (int i = 0; i < taps; i++) {
+		coefficients[taps - 1 - i] = lround(h[i] / sum * 32768);
+		magnitude += abs(coefficients[taps - 1 - i]);
+	}
+
+	delete[] h;
+
+	// no partial sum can overflow 32 bits, whatever order SIMD adds in
+	if (magnitude >= 65536) {
+		return false;
+	}
+
+	Reset();
+
+	return true;
+}
+
+/**
+ * Forget the history, e.g. after a gap in the input
+ * @return void
+ */
+void Resampler::Reset()
+{
+	memset(buffer, 0, (taps - 1) * sizeof(int16_t));
+	buffered = taps - 1;
+	next = 0;
+}
+
+/**
+ * Filter and decimate
+ * @param int16_t* in
+ * @param int count
+ * @param int16_t* out Room for count / factor + 1 samples
+ * @return int Samples written to out
+ */
+int Resampler::Process(const int16_t * in, int count, int16_t * out)
+{
+	AudioCodec::Simd simd = AudioCodec::GetSimd();
+	int produced = 0;
+
+	while (count > 0) {
+		int n = count < CHUNK ? count : CHUNK;
+
+		memcpy(buffer + buffered, in, n * sizeof(int16_t));
+		buffered += n;
+		in += n;
+		count -= n;
+
+		for (; next + taps <= buffered; next += factor) {
+			switch (simd) {
+#ifdef AUDIO_X86
+				case AudioCodec::SIMD_AVX2:
+					out[produced++] = dot_avx2(buffer + next, coefficients, taps);
+					break;
+
+				case AudioCodec::SIMD_SSE2:
+					out[produced++] = dot_sse2(buffer + next, coefficients, taps);
+					break;
+#endif
+
+#ifdef AUDIO_NEON
+				case AudioCodec::SIMD_NEON:
+					out[produced++] = dot_neon(buffer + next, coefficients, taps);
+					break;
+#endif
+
+				default:
+					out[produced++] = dot_scalar(buffer + next, coefficients, taps);
+			}
+		}
+
+		// keep what the next outputs still need
+		buffered -= next;
+		memmove(buffer, buffer + next, buffered * sizeof(int16_t));
+		next = 0;
+	}
+
+	return produced;
+}
+
+int Resampler::GetFactor()
+{
+	return factor;
+}
+
+// helpers
+
+static uint8_t ulaw_encode(int16_t sample)
+{
+	int sign = sample < 0 ? 0x80 : 0;
+	int magnitude = sample < 0 ? -sample : sample;
+
+	if (magnitude > ULAW_CLIP) {
+		magnitude = ULAW_CLIP;
+	}
+
+	magnitude += ULAW_BIAS;
+
+	int exponent = 31 - __builtin_clz(magnitude) - 7;
+	int mantissa = (magnitude >> (exponent + 3)) & 0x0F;
+
+	return ~(sign | exponent << 4 | mantissa);
+}
+
+static int16_t ulaw_decode(uint8_t code)
+{
+	code = ~code;
+	int magnitude = (((code & 0x0F) << 3) + ULAW_BIAS) << ((code & 0x70) >> 4);
+
+	return code & 0x80 ? ULAW_BIAS - magnitude : magnitude - ULAW_BIAS;
+}
+
+static uint8_t alaw_encode(int16_t sample)
+{
+	int value = sample >> 3;
+	int mask = 0xD5;
+
+	if (value < 0) {
+		mask = 0x55;
+		value = -value - 1;
+	}
+
+	// 13 bit magnitude, segment is the highest bit above the 4 bit mantissa
+	if (value < 32) {
+		return (value >> 1) ^ mask;
+	}
+
+	int segment = 31 - __builtin_clz(value) - 4;
+
+	return (segment << 4 | ((value >> segment) & 0x0F)) ^ mask;
+}
+
+static int16_t alaw_decode(uint8_t code)
+{
+	code ^= 0x55;
+
+	int magnitude = (code & 0x0F) << 4;
+	int segment = (code & 0x70) >> 4;
+
+	if (segment == 0) {
+		magnitude += 8;
+	} else {
+		magnitude = (magnitude + 0x108) << (segment - 1);
+	}
+
+	return code & 0x80 ? magnitude : -magnitude;
+}
+
+/**
+ * Apply one ADPCM code to the state
+ * @param AdpcmState state
+ * @param int code
+ * @return int The decoded sample
+ */
+static int adpcm_step(AudioCodec::AdpcmState & state, int code)
+{
+	int step = ADPCM_STEPS[state.index];
+	int delta = step >> 3;
+
+	if (code & 4) {
+		delta += step;
+	}
+
+	if (code & 2) {
+		delta += step >> 1;
+	}
+
+	if (code & 1) {
+		delta += step >> 2;
+	}
+
+	state.predictor += code & 8 ? -delta : delta;
+
+	if (state.predictor > 32767) {
+		state.predictor = 32767;
+	} else if (state.predictor < -32768) {
+		state.predictor = -32768;
+	}
+
+	state.index += ADPCM_INDEX_ADJUST[code];
+
+	if (state.index < 0) {
+		state.index = 0;
+	} else if (state.index > 88) {
+		state.index = 88;
+	}
+
+	return state.predictor;
+}
+
+/**
+ * Q15 dot product, rounded and saturated
+ * @param int16_t* samples
+ * @param int16_t* coefficients
+ * @param int taps
+ * @return int16_t
+ */
+static int16_t dot_scalar(const int16_t * samples, const int16_t * coefficients, int taps)
+{
+	int32_t sum = 0;
+
+	for (int i = 0; i < taps; i++) {
+		sum += samples[i] * coefficients[i];
+	}
+
+	sum = (sum + (1 << 14)) >> 15;
+
+	return sum > 32767 ? 32767 : sum < -32768 ? -32768 : sum;
+}
+
+#ifdef AUDIO_X86
+
+/**
+ * mu-law codes of four samples in 32 bit lanes. Converted to float, the
+ * biased magnitude's exponent field is the segment + 134 and the top four
+ * mantissa bits are the G.711 mantissa, so one shift gives both.
+ * @param __m128i x
+ * @return __m128i
+ */
+static inline __m128i ulaw_lanes_sse2(__m128i x)
+{
+	__m128i sign = _mm_srai_epi32(x, 31);
+	__m128i magnitude = _mm_sub_epi32(_mm_xor_si128(x, sign), sign);
+	__m128i clip = _mm_set1_epi32(ULAW_CLIP);
+	__m128i over = _mm_cmpgt_epi32(magnitude, clip);
+
+	magnitude = _mm_or_si128(_mm_and_si128(over, clip), _mm_andnot_si128(over, magnitude));
+	magnitude = _mm_add_epi32(magnitude, _mm_set1_epi32(ULAW_BIAS));
+
+	__m128i bits = _mm_castps_si128(_mm_cvtepi32_ps(magnitude));
+	__m128i code = _mm_sub_epi32(_mm_srli_epi32(bits, 19), _mm_set1_epi32(134 << 4));
+
+	code = _mm_or_si128(code, _mm_and_si128(sign, _mm_set1_epi32(0x80)));
+
+	return _mm_xor_si128(code, _mm_set1_epi32(0xFF));
+}
+
+/**
+ * A-law codes of four samples in 32 bit lanes, the float trick for
+ * segments 1 to 7, half the magnitude for segment 0
+ * @param __m128i x
+ * @return __m128i
+ */
+static inline __m128i alaw_lanes_sse2(__m128i x)
+{
+	__m128i sign = _mm_srai_epi32(x, 31);
+	__m128i value = _mm_xor_si128(_mm_srai_epi32(x, 3), sign);
+	__m128i bits = _mm_castps_si128(_mm_cvtepi32_ps(value));
+	__m128i large = _mm_sub_epi32(_mm_srli_epi32(bits, 19), _mm_set1_epi32(131 << 4));
+	__m128i is_large = _mm_cmpgt_epi32(value, _mm_set1_epi32(31));
+	__m128i code = _mm_or_si128(_mm_and_si128(is_large, large), _mm_andnot_si128(is_large, _mm_srli_epi32(value, 1)));
+	__m128i mask = _mm_or_si128(_mm_set1_epi32(0x55), _mm_andnot_si128(sign, _mm_set1_epi32(0x80)));
+
+	return _mm_xor_si128(code, mask);
+}
+
+static void ulaw_encode_sse2(const int16_t * pcm, int count, uint8_t * data)
+{
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(pcm + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(pcm + i + 8));
+
+		// sign extend to 32 bits
+		__m128i a0 = ulaw_lanes_sse2(_mm_srai_epi32(_mm_unpacklo_epi16(a, a), 16));
+		__m128i a1 = ulaw_lanes_sse2(_mm_srai_epi32(_mm_unpackhi_epi16(a, a), 16));
+		__m128i b0 = ulaw_lanes_sse2(_mm_srai_epi32(_mm_unpacklo_epi16(b, b), 16));
+		__m128i b1 = ulaw_lanes_sse2(_mm_srai_epi32(_mm_unpackhi_epi16(b, b), 16));
+
+		__m128i codes = _mm_packus_epi16(_mm_packs_epi32(a0, a1), _mm_packs_epi32(b0, b1));
+		_mm_storeu_si128((__m128i *)(data + i), codes);
+	}
+
+	for (; i < count; i++) {
+		data[i] = ulaw_encode(pcm[i]);
+	}
+}
+
+static void alaw_encode_sse2(const int16_t * pcm, int count, uint8_t * data)
+{
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(pcm + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(pcm + i + 8));
+
+		__m128i a0 = alaw_lanes_sse2(_mm_srai_epi32(_mm_unpacklo_epi16(a, a), 16));
+		__m128i a1 = alaw_lanes_sse2(_mm_srai_epi32(_mm_unpackhi_epi16(a, a), 16));
+		__m128i b0 = alaw_lanes_sse2(_mm_srai_epi32(_mm_unpacklo_epi16(b, b), 16));
+		__m128i b1 = alaw_lanes_sse2(_mm_srai_epi32(_mm_unpackhi_epi16(b, b), 16));
+
+		__m128i codes = _mm_packus_epi16(_mm_packs_epi32(a0, a1), _mm_packs_epi32(b0, b1));
+		_mm_storeu_si128((__m128i *)(data + i), codes);
+	}
+
+	for (; i < count; i++) {
+		data[i] = alaw_encode(pcm[i]);
+	}
+}
+
+static int16_t dot_sse2(const int16_t * samples, const int16_t * coefficients, int taps)
+{
+	__m128i sum = _mm_setzero_si128();
+
+	// taps are a multiple of 32
+	for (int i = 0; i < taps; i += 8) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(samples + i));
+		__m128i c = _mm_loadu_si128((const __m128i *)(coefficients + i));
+		sum = _mm_add_epi32(sum, _mm_madd_epi16(s, c));
+	}
+
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+	int32_t total = (_mm_cvtsi128_si32(sum) + (1 << 14)) >> 15;
+
+	return total > 32767 ? 32767 : total < -32768 ? -32768 : total;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i ulaw_lanes_avx2(__m256i x)
+{
+	__m256i sign = _mm256_srai_epi32(x, 31);
+	__m256i magnitude = _mm256_min_epi32(_mm256_abs_epi32(x), _mm256_set1_epi32(ULAW_CLIP));
+
+	magnitude = _mm256_add_epi32(magnitude, _mm256_set1_epi32(ULAW_BIAS));
+
+	__m256i bits = _mm256_castps_si256(_mm256_cvtepi32_ps(magnitude));
+	__m256i code = _mm256_sub_epi32(_mm256_srli_epi32(bits, 19), _mm256_set1_epi32(134 << 4));
+
+	code = _mm256_or_si256(code, _mm256_and_si256(sign, _mm256_set1_epi32(0x80)));
+
+	return _mm256_xor_si256(code, _mm256_set1_epi32(0xFF));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i alaw_lanes_avx2(__m256i x)
+{
+	__m256i sign = _mm256_srai_epi32(x, 31);
+	__m256i value = _mm256_xor_si256(_mm256_srai_epi32(x, 3), sign);
+	__m256i bits = _mm256_castps_si256(_mm256_cvtepi32_ps(value));
+	__m256i large = _mm256_sub_epi32(_mm256_srli_epi32(bits, 19), _mm256_set1_epi32(131 << 4));
+	__m256i is_large = _mm256_cmpgt_epi32(value, _mm256_set1_epi32(31));
+	__m256i code = _mm256_blendv_epi8(_mm256_srli_epi32(value, 1), large, is_large);
+	__m256i mask = _mm256_or_si256(_mm256_set1_epi32(0x55), _mm256_andnot_si256(sign, _mm256_set1_epi32(0x80)));
+
+	return _mm256_xor_si256(code, mask);
+}
+
+/**
+ * Pack 16 codes in 32 bit lanes to bytes. packs works within 128 bit
+ * lanes, the permute puts the four groups back in order.
+ * @param __m256i low Codes 0-7
+ * @param __m256i high Codes 8-15
+ * @return __m128i
+ */
+__attribute__((target("avx2")))
+static inline __m128i pack_codes_avx2(__m256i low, __m256i high)
+{
+	__m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), _MM_SHUFFLE(3, 1, 2, 0));
+
+	return _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+}
+
+__attribute__((target("avx2")))
+static void ulaw_encode_avx2(const int16_t * pcm, int count, uint8_t * data)
+{
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m256i low = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(pcm + i)));
+		__m256i high = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(pcm + i + 8)));
+
+		_mm_storeu_si128((__m128i *)(data + i), pack_codes_avx2(ulaw_lanes_avx2(low), ulaw_lanes_avx2(high)));
+	}
+
+	for (; i < count; i++) {
+		data[i] = ulaw_encode(pcm[i]);
+	}
+}
+
+__attribute__((target("avx2")))
+static void alaw_encode_avx2(const int16_t * pcm, int count, uint8_t * data)
+{
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m256i low = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(pcm + i)));
+		__m256i high = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(pcm + i + 8)));
+
+		_mm_storeu_si128((__m128i *)(data + i), pack_codes_avx2(alaw_lanes_avx2(low), alaw_lanes_avx2(high)));
+	}
+
+	for (; i < count; i++) {
+		data[i] = alaw_encode(pcm[i]);
+	}
+}
+
+__attribute__((target("avx2")))
+static int16_t dot_avx2(const int16_t * samples, const int16_t * coefficients, int taps)
+{
+	__m256i sum = _mm256_setzero_si256();
+
+	for (int i = 0; i < taps; i += 16) {
+		__m256i s = _mm256_loadu_si256((const __m256i *)(samples + i));
+		__m256i c = _mm256_loadu_si256((const __m256i *)(coefficients + i));
+		sum = _mm256_add_epi32(sum, _mm256_madd_epi16(s, c));
+	}
+
+	__m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+	half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+	half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+
+	int32_t total = (_mm_cvtsi128_si32(half) + (1 << 14)) >> 15;
+
+	return total > 32767 ? 32767 : total < -32768 ? -32768 : total;
+}
+
+#endif
+
+#ifdef AUDIO_NEON
+
+static inline int32x4_t ulaw_lanes_neon(int32x4_t x)
+{
+	int32x4_t sign = vshrq_n_s32(x, 31);
+	int32x4_t magnitude = vminq_s32(vabsq_s32(x), vdupq_n_s32(ULAW_CLIP));
+
+	magnitude = vaddq_s32(magnitude, vdupq_n_s32(ULAW_BIAS));
+
+	int32x4_t bits = vreinterpretq_s32_f32(vcvtq_f32_s32(magnitude));
+	int32x4_t code = vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(bits), 19)), vdupq_n_s32(134 << 4));
+
+	code = vorrq_s32(code, vandq_s32(sign, vdupq_n_s32(0x80)));
+
+	return veorq_s32(code, vdupq_n_s32(0xFF));
+}
+
+static inline int32x4_t alaw_lanes_neon(int32x4_t x)
+{
+	int32x4_t sign = vshrq_n_s32(x, 31);
+	int32x4_t value = veorq_s32(vshrq_n_s32(x, 3), sign);
+	int32x4_t bits = vreinterpretq_s32_f32(vcvtq_f32_s32(value));
+	int32x4_t large = vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(bits), 19)), vdupq_n_s32(131 << 4));
+	uint32x4_t is_large = vcgtq_s32(value, vdupq_n_s32(31));
+	int32x4_t code = vbslq_s32(is_large, large, vshrq_n_s32(value, 1));
+	int32x4_t mask = vorrq_s32(vdupq_n_s32(0x55), vbicq_s32(vdupq_n_s32(0x80), sign));
+
+	return veorq_s32(code, mask);
+}
+
+static inline uint8x8_t pack_codes_neon(int32x4_t low, int32x4_t high)
+{
+	return vmovn_u16(vreinterpretq_u16_s16(vcombine_s16(vmovn_s32(low), vmovn_s32(high))));
+}
+
+static void ulaw_encode_neon(const int16_t * pcm, int count, uint8_t * data)
+{
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		int16x8_t x = vld1q_s16(pcm + i);
+
+		vst1_u8(data + i, pack_codes_neon(ulaw_lanes_neon(vmovl_s16(vget_low_s16(x))), ulaw_lanes_neon(vmovl_s16(vget_high_s16(x)))));
+	}
+
+	for (; i < count; i++) {
+		data[i] = ulaw_encode(pcm[i]);
+	}
+}
+
+static void alaw_encode_neon(const int16_t * pcm, int count, uint8_t * data)
+{
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		int16x8_t x = vld1q_s16(pcm + i);
+
+		vst1_u8(data + i, pack_codes_neon(alaw_lanes_neon(vmovl_s16(vget_low_s16(x))), alaw_lanes_neon(vmovl_s16(vget_high_s16(x)))));
+	}
+
+	for (; i < count; i++) {
+		data[i] = alaw_encode(pcm[i]);
+	}
+}
+
+static int16_t dot_neon(const int16_t * samples, const int16_t * coefficients, int taps)
+{
+	int32x4_t sum = vdupq_n_s32(0);
+
+	for (int i = 0; i < taps; i += 8) {
+		int16x8_t s = vld1q_s16(samples + i);
+		int16x8_t c = vld1q_s16(coefficients + i);
+
+		sum = vmlal_s16(sum, vget_low_s16(s), vget_low_s16(c));
+		sum = vmlal_s16(sum, vget_high_s16(s), vget_high_s16(c));
+	}
+
+	int32x2_t pair = vadd_s32(vget_low_s32(sum), vget_high_s32(sum));
+	int32_t total = (vget_lane_s32(vpadd_s32(pair, pair), 0) + (1 << 14)) >> 15;
+
+	return total > 32767 ? 32767 : total < -32768 ? -32768 : total;
+}
+
+#endif
@@ -0,0 +1,116 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+#ifndef AUDIO_CODEC_H
+#define AUDIO_CODEC_H
+
+/**
+ * Compression for the audio stream: G.711 mu-law and A-law (8 bit, half
+ * of PCM) and IMA-ADPCM (4 bit, a quarter). ADPCM is coded in blocks that
+ * start with the coder state, so every frame decodes on its own and a lost
+ * frame costs nothing but itself.
+ *
+ * The G.711 encoders have SSE2, AVX2 and NEON versions next to the scalar
+ * one. They take the segment and mantissa straight from the bits of the
+ * sample converted to float, which is exact for 16 bit integers, so every
+ * path produces the same bytes. Decoding is one table load per sample and
+ * ADPCM depends on the previous sample, both stay scalar. The fastest path
+ * the CPU supports is picked at startup, SetSimd() forces one for testing.
+ */
+class AudioCodec
+{
+	public:
+		enum Codec {
+			CODEC_PCM = 0,
+			CODEC_ULAW,
+			CODEC_ALAW,
+			CODEC_ADPCM,
+			CODEC_COUNT
+		};
+
+		enum Simd {
+			SIMD_SCALAR = 0,
+			SIMD_SSE2,
+			SIMD_AVX2,
+			SIMD_NEON
+		};
+
+		struct AdpcmState {
+			int predictor;
+			int index;
+		};
+
+		// predictor and step index in front of every ADPCM block
+		static const size_t ADPCM_HEADER_SIZE = 4;
+
+		static size_t EncodedSize(int codec, int samples);
+		static size_t Encode(int codec, const int16_t * pcm, int count, uint8_t * data, AdpcmState & state);
+		static bool Decode(int codec, const uint8_t * data, size_t length, int16_t * pcm, int count);
+
+		static void EncodeUlaw(const int16_t * pcm, int count, uint8_t * data);
+		static void DecodeUlaw(const uint8_t * data, int count, int16_t * pcm);
+		static void EncodeAlaw(const int16_t * pcm, int count, uint8_t * data);
+		static void DecodeAlaw(const uint8_t * data, int count, int16_t * pcm);
+		static size_t EncodeAdpcm(AdpcmState & state, const int16_t * pcm, int count, uint8_t * data);
+		static void DecodeAdpcm(const uint8_t * data, int count, int16_t * pcm);
+
+		static int CodecByName(const string & name);
+		static const char * CodecName(int codec);
+
+		static Simd BestSimd();
+		static Simd GetSimd();
+		static bool SetSimd(Simd level);
+		static const char * SimdName(Simd level);
+
+	private:
+		static Simd simd;
+};
+
+/**
+ * Integer factor decimation, e.g. 48 kHz from the sound card to 8 or 12 kHz
+ * for the stream. A Blackman windowed sinc low pass with 32 taps per output
+ * sample, passing up to 84 % of the new Nyquist frequency, with Q15 integer
+ * taps so the SIMD dot products give exactly the scalar result. Input may
+ * come in blocks of any size, the filter history is carried over.
+ */
+class Resampler
+{
+	public:
+		static const int TAPS_PER_OUTPUT = 32;
+
+		Resampler();
+		~Resampler();
+
+		bool Setup(int in_rate, int out_rate);
+		void Reset();
+		int Process(const int16_t * in, int count, int16_t * out);
+		int GetFactor();
+
+	private:
+		// input samples filtered per pass
+		static const int CHUNK = 1920;
+
+		int factor;
+		int taps;
+		int16_t * coefficients;
+		int16_t * buffer;
+		int buffered;
+		int next;
+};
+
+#endif
@@ -0,0 +1,421 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "audio_device.h"
+#include "audio_packet.h"
+#include "clock.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <iostream>
+
+using namespace std;
+
+// constructor
+
+AudioDevice::AudioDevice()
+{
+	direction = CAPTURE;
+	rate = 8000;
+	loop = false;
+	fd = -1;
+	paced = false;
+	wav = false;
+	data_start = 0;
+	frames_done = 0;
+	started_us = 0;
+	xruns = 0;
+
+#ifdef HAVE_ALSA
+	pcm = NULL;
+#endif
+}
+
+// destructor
+
+AudioDevice::~AudioDevice()
+{
+	Close();
+}
+
+// public methods
+
+/**
+ * Open sound card or file
+ * @param string spec alsa:<pcm>, - or a path
+ * @param Direction direction
+ * @param int rate Hz
+ * @return bool
+ */
+bool AudioDevice::Open(const string & spec, Direction d, int r)
+{
+	Close();
+
+	direction = d;
+	rate = r;
+	frames_done = 0;
+	started_us = 0;
+
+	if (spec.compare(0, 5, "alsa:") == 0) {
+#ifdef HAVE_ALSA
+		int error = snd_pcm_open(&pcm, spec.substr(5).c_str(), direction == CAPTURE ? SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK, 0);
+
+		if (error < 0) {
+			cout << "Can't open audio device " << spec << ": " << snd_strerror(error) << endl;
+			pcm = NULL;
+			return false;
+		}
+
+		// soft resampling lets cards without the rate work too
+		error = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED, 1, rate, 1, BUFFER_US);
+
+		if (error < 0) {
+			cout << "Can't set up audio device " << spec << ": " << snd_strerror(error) << endl;
+			Close();
+			return false;
+		}
+
+		return true;
+#else
+		cout << "Built without ALSA, compile with -DHAVE_ALSA and link -lasound to use " << spec << endl;
+		return false;
+#endif
+	}
+
+	if (spec == "-") {
+		fd = direction == CAPTURE ? 0 : 1;
+		return true;
+	}
+
+	struct stat buffer;
+	bool fifo = stat(spec.c_str(), &buffer) == 0 && S_ISFIFO(buffer.st_mode);
+
+	// a FIFO opened both ways neither blocks here nor sees EOF when the other end comes and goes
+	if (fifo) {
+		fd = open(spec.c_str(), O_RDWR | O_CLOEXEC);
+	} else if (direction == CAPTURE) {
+		fd = open(spec.c_str(), O_RDONLY | O_CLOEXEC);
+	} else {
+		fd = open(spec.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	}
+
+	if (fd == -1) {
+		cout << "Can't open audio file " << spec << ": " << strerror(errno) << endl;
+		return false;
+	}
+
+	paced = !fifo && fstat(fd, &buffer) == 0 && S_ISREG(buffer.st_mode);
+	wav = paced && spec.size() > 4 && spec.compare(spec.size() - 4, 4, ".wav") == 0;
+	data_start = 0;
+
+	if (wav && direction == CAPTURE && !ReadWavHeader()) {
+		cout << "Audio file " << spec << " is not 16 bit mono PCM" << endl;
+		Close();
+		return false;
+	}
+
+	if (wav && direction == PLAYBACK) {
+		WriteWavHeader(0);
+		data_start = lseek(fd, 0, SEEK_CUR);
+	}
+
+	return true;
+}
+
+void AudioDevice::Close()
+{
+#ifdef HAVE_ALSA
+	if (pcm != NULL) {
+		snd_pcm_close(pcm);
+		pcm = NULL;
+	}
+#endif
+
+	if (fd >= 0) {
+		// sizes are only known now
+		if (wav && direction == PLAYBACK) {
+			WriteWavHeader(lseek(fd, 0, SEEK_END) - data_start);
+		}
+
+		if (fd > 2) {
+			close(fd);
+		}
+
+		fd = -1;
+	}
+}
+
+/**
+ * Start captured files over when they end
+ * @param bool enabled
+ * @return void
+ */
+void AudioDevice::SetLoop(bool enabled)
+{
+	loop = enabled;
+}
+
+/**
+ * Block until count samples were captured
+ * @param int16_t* samples
+ * @param int count
+ * @return int Samples read, 0 at the end of the input, -1 on error
+ */
+int AudioDevice::Read(int16_t * samples, int count)
+{
+#ifdef HAVE_ALSA
+	if (pcm != NULL) {
+		snd_pcm_sframes_t n;
+
+		while ((n = snd_pcm_readi(pcm, samples, count)) < 0) {
+			// overrun, we were too slow to collect the samples
+			xruns++;
+
+			if (snd_pcm_recover(pcm, n, 1) < 0) {
+				return -1;
+			}
+		}
+
+		return n;
+	}
+#endif
+
+	size_t wanted = count * sizeof(int16_t), got = 0;
+	char * p = (char *)samples;
+
+	while (got < wanted) {
+		ssize_t n = read(fd, p + got, wanted - got);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (n < 0) {
+			return -1;
+		}
+
+		if (n == 0) {
+			if (loop && paced && lseek(fd, data_start, SEEK_SET) == data_start) {
+				continue;
+			}
+
+			break;
+		}
+
+		got += n;
+	}
+
+	int read_count = got / sizeof(int16_t);
+
+	frames_done += read_count;
+	Pace();
+
+	return read_count;
+}
+
+/**
+ * Block until count samples were handed to the device
+ * @param int16_t* samples
+ * @param int count
+ * @return int Samples written, -1 on error
+ */
+int AudioDevice::Write(const int16_t * samples, int count)
+{
+#ifdef HAVE_ALSA
+	if (pcm != NULL) {
+		snd_pcm_sframes_t n;
+
+		while ((n = snd_pcm_writei(pcm, samples, count)) < 0) {
+			// underrun, the card ran out of samples
+			xruns++;
+
+			if (snd_pcm_recover(pcm, n, 1) < 0) {
+				return -1;
+			}
+		}
+
+		return n;
+	}
+#endif
+
+	size_t wanted = count * sizeof(int16_t), done = 0;
+	const char * p = (const char *)samples;
+
+	while (done < wanted) {
+		ssize_t n = write(fd, p + done, wanted - done);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (n <= 0) {
+			return -1;
+		}
+
+		done += n;
+	}
+
+	frames_done += count;
+	Pace();
+
+	return count;
+}
+
+/**
+ * Wait until everything written was played
+ * @return void
+ */
+void AudioDevice::Drain()
+{
+#ifdef HAVE_ALSA
+	if (pcm != NULL) {
+		snd_pcm_drain(pcm);
+		snd_pcm_prepare(pcm);
+	}
+#endif
+}
+
+/**
+ * Start a new burst after an idle gap, the pacing clock restarts
+ * @return void
+ */
+void AudioDevice::Restart()
+{
+	frames_done = 0;
+	started_us = 0;
+
+#ifdef HAVE_ALSA
+	if (pcm != NULL && direction == PLAYBACK) {
+		snd_pcm_prepare(pcm);
+	}
+#endif
+}
+
+int AudioDevice::GetRate()
+{
+	return rate;
+}
+
+/**
+ * Overruns while capturing, underruns while playing
+ * @return uint64_t
+ */
+uint64_t AudioDevice::GetXruns()
+{
+	return xruns;
+}
+
+// private methods
+
+/**
+ * Find the data chunk, checking the format on the way
+ * @return bool
+ */
+bool AudioDevice::ReadWavHeader()
+{
+	uint8_t header[12], chunk[8], format[16];
+
+	if (read(fd, header, 12) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+		return false;
+	}
+
+	bool format_ok = false;
+
+	while (read(fd, chunk, 8) == 8) {
+		uint32_t size = chunk[4] | (chunk[5] << 8) | (chunk[6] << 16) | ((uint32_t)chunk[7] << 24);
+
+		if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+			if (read(fd, format, 16) != 16) {
+				return false;
+			}
+
+			int channels = format[2] | (format[3] << 8);
+			int file_rate = format[4] | (format[5] << 8) | (format[6] << 16) | (format[7] << 24);
+			int bits = format[14] | (format[15] << 8);
+
+			if (format[0] != 1 || channels != 1 || bits != 16) {
+				return false;
+			}
+
+			if (file_rate != rate) {
+				cout << "Audio file is " << file_rate << " Hz, playing it at " << rate << " Hz" << endl;
+			}
+
+			format_ok = true;
+			lseek(fd, size - 16 + (size & 1), SEEK_CUR);
+		} else if (memcmp(chunk, "data", 4) == 0) {
+			data_start = lseek(fd, 0, SEEK_CUR);
+			return format_ok;
+		} else {
+			lseek(fd, size + (size & 1), SEEK_CUR);
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Canonical 44 byte header at the start of the file
+ * @param uint32_t data_bytes
+ * @return void
+ */
+void AudioDevice::WriteWavHeader(uint32_t data_bytes)
+{
+	uint8_t header[44];
+	uint32_t values[] = {36 + data_bytes, 16, (uint32_t)rate, (uint32_t)rate * 2, data_bytes};
+
+	memcpy(header, "RIFF....WAVEfmt ....", 20);
+	memcpy(header + 36, "data", 4);
+
+	// PCM, mono, 16 bit
+	const uint8_t format[] = {1, 0, 1, 0};
+	const uint8_t alignment[] = {2, 0, 16, 0};
+	memcpy(header + 20, format, 4);
+	memcpy(header + 32, alignment, 4);
+
+	const int offsets[] = {4, 16, 24, 28, 40};
+
+	for (int i = 0; i < 5; i++) {
+		for (int j = 0; j < 4; j++) {
+			header[offsets[i] + j] = values[i] >> (8 * j);
+		}
+	}
+
+	if (pwrite(fd, header, 44, 0) != 44) {
+		cout << "Can't write WAV header" << endl;
+	}
+}
+
+/**
+ * Sleep until the samples done so far would have passed a sound card
+ * @return void
+ */
+void AudioDevice::Pace()
+{
+	if (!paced) {
+		return;
+	}
+
+	if (started_us == 0) {
+		started_us = Clock::MonotonicUs();
+	}
+
+	uint64_t due_us = started_us + frames_done * 1000000 / rate;
+	struct timespec due;
+	due.tv_sec = due_us / 1000000;
+	due.tv_nsec = (due_us % 1000000) * 1000;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR);
+}
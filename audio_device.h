@@ -0,0 +1,83 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+
+#ifdef HAVE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+using namespace std;
+
+#ifndef AUDIO_DEVICE_H
+#define AUDIO_DEVICE_H
+
+/**
+ * 16 bit mono PCM in or out of the sound card the tcvr is wired to.
+ * "alsa:<pcm>" (e.g. alsa:hw:1,0 or alsa:default) opens an ALSA device,
+ * which needs compiling with -DHAVE_ALSA and linking -lasound. Anything
+ * else is a file: "-" for stdin/stdout, a FIFO, or a regular file (raw
+ * samples, or a WAV file when the name ends in .wav). Regular files have
+ * no clock of their own, so reads and writes are paced to the sample
+ * rate as a sound card would; captured files start over at the end when
+ * looping. Read() and Write() block like the real device does.
+ */
+class AudioDevice
+{
+	public:
+		enum Direction {
+			CAPTURE = 0,
+			PLAYBACK
+		};
+
+		// ALSA buffer, the playback latency we accept
+		static const int BUFFER_US = 40000;
+
+		AudioDevice();
+		~AudioDevice();
+
+		bool Open(const string & spec, Direction direction, int rate);
+		void Close();
+		void SetLoop(bool enabled);
+
+		int Read(int16_t * samples, int count);
+		int Write(const int16_t * samples, int count);
+		void Drain();
+		void Restart();
+
+		int GetRate();
+		uint64_t GetXruns();
+
+	private:
+		Direction direction;
+		int rate;
+		bool loop;
+		int fd;
+		bool paced;
+		bool wav;
+		off_t data_start;
+		uint64_t frames_done;
+		uint64_t started_us;
+		uint64_t xruns;
+
+#ifdef HAVE_ALSA
+		snd_pcm_t * pcm;
+#endif
+
+		bool ReadWavHeader();
+		void WriteWavHeader(uint32_t data_bytes);
+		void Pace();
+};
+
+#endif
@@ -0,0 +1,243 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "audio_fec.h"
+#include <string.h>
+
+using namespace std;
+
+// constructor
+
+AudioFec::AudioFec()
+{
+	group = 0;
+	history = new Stored[HISTORY];
+	parities = new Parity[PARITIES];
+
+	Reset();
+}
+
+// destructor
+
+AudioFec::~AudioFec()
+{
+	delete[] history;
+	delete[] parities;
+}
+
+// public methods
+
+/**
+ * Packets per parity packet, 0 sends none
+ * @param int frames
+ * @return void
+ */
+void AudioFec::SetGroup(int frames)
+{
+	group = frames < 0 ? 0 : frames > MAX_GROUP ? MAX_GROUP : frames;
+	sending.valid = false;
+}
+
+int AudioFec::GetGroup()
+{
+	return group;
+}
+
+/**
+ * Forget everything, e.g. when another sender takes over
+ * @return void
+ */
+void AudioFec::Reset()
+{
+	sending.valid = false;
+	next_parity = 0;
+
+	for (int i = 0; i < HISTORY; i++) {
+		history[i].valid = false;
+	}
+
+	for (int i = 0; i < PARITIES; i++) {
+		parities[i].valid = false;
+	}
+}
+
+/**
+ * Add a sent audio packet to the running parity
+ * @param uint8_t* packet
+ * @param size_t length
+ * @param uint8_t* parity MAX_PARITY_SIZE bytes
+ * @return size_t Length of the parity packet to send now, 0 if the group is not complete
+ */
+size_t AudioFec::Protect(const uint8_t * packet, size_t length, uint8_t * parity)
+{
+	AudioPacket::Header header;
+
+	if (group < 2 || AudioPacket::ReadHeader(packet, length, header) <= 0 || !AudioPacket::IsAudio(header.type)) {
+		return 0;
+	}
+
+	// a gap in the sequence starts a new group
+	if (!sending.valid || header.sequence != sending.first + sending.count) {
+		sending.valid = true;
+		sending.first = header.sequence;
+		sending.count = 0;
+		sending.length = 0;
+	}
+
+	if (length > sending.length) {
+		memset(sending.data + sending.length, 0, length - sending.length);
+		sending.length = length;
+	}
+
+	for (size_t i = 0; i < length; i++) {
+		sending.data[i] ^= packet[i];
+	}
+
+	if (++sending.count < group) {
+		return 0;
+	}
+
+	AudioPacket::Header out;
+	out.type = AudioPacket::TYPE_FEC;
+	out.codec = header.codec;
+	out.samples = group;
+	out.rate = header.rate;
+	out.sequence = sending.first;
+	out.payload = sending.length;
+	out.time_us = header.time_us;
+
+	AudioPacket::WriteHeader(parity, out);
+	memcpy(parity + AudioPacket::HEADER_SIZE, sending.data, sending.length);
+	sending.valid = false;
+
+	return AudioPacket::HEADER_SIZE + out.payload;
+}
+
+/**
+ * Note a received packet, audio or parity, and repair what it makes repairable
+ * @param uint8_t* packet
+ * @param size_t length
+ * @param uint8_t* recovered MAX_SIZE bytes
+ * @return size_t Length of a recovered audio packet, 0 if none
+ */
+size_t AudioFec::Receive(const uint8_t * packet, size_t length, uint8_t * recovered)
+{
+	AudioPacket::Header header;
+	int packet_length = AudioPacket::ReadHeader(packet, length, header);
+
+	if (packet_length <= 0) {
+		return 0;
+	}
+
+	if (AudioPacket::IsAudio(header.type)) {
+		Store(header, packet, packet_length);
+
+		// a late member may complete a group whose parity is already here
+		for (int i = 0; i < PARITIES; i++) {
+			Parity & parity = parities[i];
+
+			if (parity.valid && header.sequence - parity.first < (uint32_t)parity.count) {
+				return Repair(parity, recovered);
+			}
+		}
+
+		return 0;
+	}
+
+	if (header.type != AudioPacket::TYPE_FEC || header.samples < 2 || header.samples > MAX_GROUP) {
+		return 0;
+	}
+
+	Parity & parity = parities[next_parity];
+	next_parity = (next_parity + 1) % PARITIES;
+
+	parity.valid = true;
+	parity.first = header.sequence;
+	parity.count = header.samples;
+	parity.length = header.payload;
+	memcpy(parity.data, packet + AudioPacket::HEADER_SIZE, header.payload);
+
+	return Repair(parity, recovered);
+}
+
+// private methods
+
+void AudioFec::Store(const AudioPacket::Header & header, const uint8_t * packet, size_t length)
+{
+	Stored & stored = history[header.sequence % HISTORY];
+
+	stored.valid = true;
+	stored.sequence = header.sequence;
+	stored.length = length;
+	memcpy(stored.data, packet, length);
+}
+
+/**
+ * Rebuild the one missing packet of a group
+ * @param Parity parity
+ * @param uint8_t* recovered
+ * @return size_t Packet length, 0 if nothing or more than one is missing
+ */
+size_t AudioFec::Repair(Parity & parity, uint8_t * recovered)
+{
+	uint32_t missing = 0;
+	int missing_count = 0;
+
+	for (int i = 0; i < parity.count; i++) {
+		uint32_t sequence = parity.first + i;
+		Stored & stored = history[sequence % HISTORY];
+
+		if (!stored.valid || stored.sequence != sequence) {
+			missing = sequence;
+			missing_count++;
+		}
+	}
+
+	// all there, the parity has done its job either way
+	if (missing_count == 0) {
+		parity.valid = false;
+		return 0;
+	}
+
+	if (missing_count > 1) {
+		return 0;
+	}
+
+	memcpy(recovered, parity.data, parity.length);
+
+	for (int i = 0; i < parity.count; i++) {
+		uint32_t sequence = parity.first + i;
+
+		if (sequence == missing) {
+			continue;
+		}
+
+		Stored & stored = history[sequence % HISTORY];
+
+		for (size_t j = 0; j < stored.length && j < parity.length; j++) {
+			recovered[j] ^= stored.data[j];
+		}
+	}
+
+	parity.valid = false;
+
+	AudioPacket::Header header;
+	int length = AudioPacket::ReadHeader(recovered, parity.length, header);
+
+	if (length <= 0 || !AudioPacket::IsAudio(header.type) || header.sequence != missing) {
+		return 0;
+	}
+
+	Store(header, recovered, length);
+
+	return length;
+}
@@ -0,0 +1,80 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "audio_packet.h"
+#include <stddef.h>
+#include <stdint.h>
+
+using namespace std;
+
+#ifndef AUDIO_FEC_H
+#define AUDIO_FEC_H
+
+/**
+ * XOR parity over groups of audio packets sent by UDP. After every group
+ * of N consecutive packets the sender adds one TYPE_FEC packet holding the
+ * XOR of the N whole packets, each padded with zeros to the longest. If
+ * exactly one packet of a group is lost, XOR of the parity with the other
+ * N - 1 gives it back, header and all. Costs 1/N more bandwidth and repairs
+ * scattered single losses; a burst of two in one group stays lost and is
+ * left to the jitter buffer's concealment.
+ */
+class AudioFec
+{
+	public:
+		static const int MAX_GROUP = 16;
+
+		AudioFec();
+		~AudioFec();
+
+		void SetGroup(int frames);
+		int GetGroup();
+		void Reset();
+
+		size_t Protect(const uint8_t * packet, size_t length, uint8_t * parity);
+		size_t Receive(const uint8_t * packet, size_t length, uint8_t * recovered);
+
+	private:
+		// packets and parities kept for repairs, about a second
+		static const int HISTORY = 64;
+		static const int PARITIES = 8;
+
+		struct Stored {
+			bool valid;
+			uint32_t sequence;
+			size_t length;
+			uint8_t data[AudioPacket::MAX_SIZE];
+		};
+
+		struct Parity {
+			bool valid;
+			uint32_t first;
+			int count;
+			size_t length;
+			uint8_t data[AudioPacket::MAX_SIZE];
+		};
+
+		int group;
+
+		// sender
+		Parity sending;
+
+		// receiver
+		Stored * history;
+		Parity * parities;
+		int next_parity;
+
+		void Store(const AudioPacket::Header & header, const uint8_t * packet, size_t length);
+		size_t Repair(Parity & parity, uint8_t * recovered);
+};
+
+#endif
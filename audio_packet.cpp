@@ -0,0 +1,179 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "audio_packet.h"
+
+using namespace std;
+
+static void put16(uint8_t * p, uint16_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static void put32(uint8_t * p, uint32_t value)
+{
+	put16(p, value);
+	put16(p + 2, value >> 16);
+}
+
+static uint16_t get16(const uint8_t * p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t * p)
+{
+	return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+// public methods
+
+/**
+ * Header into the first HEADER_SIZE bytes of a buffer
+ * @param uint8_t* buffer
+ * @param Header header
+ * @return void
+ */
+void AudioPacket::WriteHeader(uint8_t * buffer, const Header & header)
+{
+	buffer[0] = 'Y';
+	buffer[1] = 'A';
+	buffer[2] = VERSION;
+	buffer[3] = header.type;
+	put16(buffer + 4, header.samples);
+	put16(buffer + 6, header.rate);
+	put32(buffer + 8, header.sequence);
+	put16(buffer + 12, header.payload);
+	buffer[14] = header.codec;
+	buffer[15] = 0;
+	put32(buffer + 16, header.time_us);
+	put32(buffer + 20, header.time_us >> 32);
+}
+
+/**
+ * Parse and check the header at the start of a buffer
+ * @param uint8_t* buffer
+ * @param size_t length Bytes available
+ * @param Header header
+ * @return int Packet length, 0 if incomplete, -1 if malformed
+ */
+int AudioPacket::ReadHeader(const uint8_t * buffer, size_t length, Header & header)
+{
+	if (length < HEADER_SIZE) {
+		return 0;
+	}
+
+	if (buffer[0] != 'Y' || buffer[1] != 'A' || buffer[2] != VERSION) {
+		return -1;
+	}
+
+	header.type = buffer[3];
+	header.samples = get16(buffer + 4);
+	header.rate = get16(buffer + 6);
+	header.sequence = get32(buffer + 8);
+	header.payload = get16(buffer + 12);
+	header.codec = buffer[14];
+	header.time_us = get32(buffer + 16) | ((uint64_t)get32(buffer + 20) << 32);
+
+	if (header.samples > AUDIO_MAX_SAMPLES) {
+		return -1;
+	}
+
+	// parity covers whole packets, control packets carry no payload
+	if (IsAudio(header.type)) {
+		if (header.payload != AudioCodec::EncodedSize(header.codec, header.samples)) {
+			return -1;
+		}
+	} else if (header.payload > (header.type == TYPE_FEC ? MAX_SIZE : 0)) {
+		return -1;
+	}
+
+	if (length < HEADER_SIZE + header.payload) {
+		return 0;
+	}
+
+	return HEADER_SIZE + header.payload;
+}
+
+bool AudioPacket::IsAudio(uint8_t type)
+{
+	return type == TYPE_RX_AUDIO || type == TYPE_TX_AUDIO;
+}
+
+/**
+ * Header and payload into a buffer of at least MAX_SIZE bytes
+ * @param uint8_t type
+ * @param AudioFrame frame
+ * @param uint8_t* buffer
+ * @param uint8_t codec
+ * @param AdpcmState state Encoder state of this stream
+ * @return size_t Packet length
+ */
+size_t AudioPacket::Encode(uint8_t type, const AudioFrame & frame, uint8_t * buffer, uint8_t codec, AudioCodec::AdpcmState & state)
+{
+	Header header;
+	header.type = type;
+	header.codec = codec;
+	header.samples = IsAudio(type) ? frame.samples : 0;
+	header.rate = frame.rate;
+	header.sequence = frame.sequence;
+	header.payload = IsAudio(type) ? AudioCodec::Encode(codec, frame.pcm, frame.samples, buffer + HEADER_SIZE, state) : 0;
+	header.time_us = frame.time_us;
+
+	WriteHeader(buffer, header);
+
+	return HEADER_SIZE + header.payload;
+}
+
+/**
+ * Parse one packet from the start of a buffer, audio is decoded to PCM
+ * @param uint8_t* buffer
+ * @param size_t length Bytes available
+ * @param uint8_t type
+ * @param uint8_t codec
+ * @param AudioFrame frame
+ * @return int Packet length, 0 if incomplete, -1 if malformed
+ */
+int AudioPacket::Decode(const uint8_t * buffer, size_t length, uint8_t & type, uint8_t & codec, AudioFrame & frame)
+{
+	Header header;
+	int packet_length = ReadHeader(buffer, length, header);
+
+	if (packet_length <= 0) {
+		return packet_length;
+	}
+
+	type = header.type;
+	codec = header.codec;
+	frame.samples = header.samples;
+	frame.rate = header.rate;
+	frame.sequence = header.sequence;
+	frame.time_us = header.time_us;
+	frame.arrival_us = 0;
+
+	if (IsAudio(type) && !AudioCodec::Decode(codec, buffer + HEADER_SIZE, header.payload, frame.pcm, header.samples)) {
+		return -1;
+	}
+
+	return packet_length;
+}
+
+/**
+ * Samples in one frame at a rate
+ * @param int rate
+ * @return int
+ */
+int AudioPacket::FrameSamples(int rate)
+{
+	return rate * AUDIO_FRAME_MS / 1000;
+}
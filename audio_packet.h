@@ -0,0 +1,100 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "audio_codec.h"
+#include <stddef.h>
+#include <stdint.h>
+
+using namespace std;
+
+#ifndef AUDIO_PACKET_H
+#define AUDIO_PACKET_H
+
+// 20 ms frames, up to 48 kHz mono
+#define AUDIO_FRAME_MS 20
+#define AUDIO_MAX_SAMPLES 960
+
+/**
+ * One frame of 16 bit mono PCM as it moves through the rings
+ */
+struct AudioFrame {
+	uint32_t sequence;
+	uint64_t time_us;					// first sample, CLOCK_MONOTONIC
+	uint16_t rate;
+	uint16_t samples;
+	uint64_t arrival_us;				// receiver's clock, 0 if not measured
+	int16_t pcm[AUDIO_MAX_SAMPLES];
+};
+
+/**
+ * Audio frames on the wire. Every packet is a 24 byte little-endian header
+ * followed by the payload:
+ *
+ *   0  magic 'Y' 'A'
+ *   2  version
+ *   3  type (TYPE_*)
+ *   4  uint16 sample count
+ *   6  uint16 sample rate in Hz
+ *   8  uint32 sequence
+ *  12  uint16 payload length in bytes
+ *  14  codec (AudioCodec::CODEC_*)
+ *  15  reserved, 0
+ *  16  uint64 capture time of the first sample, microseconds
+ *
+ * RX audio flows from the server, TX audio to it; TYPE_TX_END tells the
+ * server the last TX frame was sent so PTT can drop once it was played.
+ * TYPE_CODEC asks the server to send RX audio in the packet's codec. The
+ * payload is the frame in its codec, Decode() returns it as PCM.
+ *
+ * Over UDP every datagram is one packet. TYPE_FEC carries the XOR of the
+ * whole packets (header included) of the sample count's worth of audio
+ * packets starting at its sequence, see AudioFec.
+ */
+class AudioPacket
+{
+	public:
+		enum Type {
+			TYPE_RX_AUDIO = 1,
+			TYPE_TX_AUDIO,
+			TYPE_TX_END,
+			TYPE_CODEC,
+			TYPE_FEC
+		};
+
+		struct Header {
+			uint8_t type;
+			uint8_t codec;
+			uint16_t samples;
+			uint16_t rate;
+			uint32_t sequence;
+			uint16_t payload;
+			uint64_t time_us;
+		};
+
+		static const uint8_t VERSION = 2;
+		static const size_t HEADER_SIZE = 24;
+		static const size_t MAX_SIZE = HEADER_SIZE + AUDIO_MAX_SAMPLES * 2;
+
+		// a parity packet covers whole packets
+		static const size_t MAX_PARITY_SIZE = HEADER_SIZE + MAX_SIZE;
+
+		static void WriteHeader(uint8_t * buffer, const Header & header);
+		static int ReadHeader(const uint8_t * buffer, size_t length, Header & header);
+		static bool IsAudio(uint8_t type);
+
+		static size_t Encode(uint8_t type, const AudioFrame & frame, uint8_t * buffer, uint8_t codec, AudioCodec::AdpcmState & state);
+		static int Decode(const uint8_t * buffer, size_t length, uint8_t & type, uint8_t & codec, AudioFrame & frame);
+
+		static int FrameSamples(int rate);
+};
+
+#endif
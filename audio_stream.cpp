@@ -0,0 +1,989 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "audio_stream.h"
+#include "clock.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+const int AudioStream::AUDIO_CLIENT = -2;
+
+// constructor
+
+AudioStream::AudioStream(CatQueue * q) : rx_ring(RING_FRAMES), tx_ring(RING_FRAMES)
+{
+	queue = q;
+	has_capture = false;
+	has_playback = false;
+	rate = 8000;
+	frame_samples = AudioPacket::FrameSamples(rate);
+	capture_rate = rate;
+	listen_fd = -1;
+	udp_fd = -1;
+	rx_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	tx_event = eventfd(0, EFD_CLOEXEC);
+	ptt_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	running = false;
+	tx_owner = -1;
+	last_tx_us = 0;
+	tx_open = false;
+	ptt_wanted = false;
+	ptt_keyed = false;
+	ptt_requested = false;
+	ptt_confirmed = false;
+	adpcm.predictor = 0;
+	adpcm.index = 0;
+	captured = 0;
+	capture_overruns = 0;
+	sent = 0;
+	bytes_sent = 0;
+	client_drops = 0;
+	udp_sent = 0;
+	udp_drops = 0;
+	fec_sent = 0;
+	tx_recovered = 0;
+	tx_received = 0;
+	tx_dropped = 0;
+	played = 0;
+	underruns = 0;
+	bursts = 0;
+	ptt_switches = 0;
+	client_count = 0;
+	peer_count = 0;
+
+	// all client buffers up front, nothing is allocated per frame
+	clients = new Client[MAX_CLIENTS];
+	peers = new UdpPeer[MAX_CLIENTS];
+
+	for (int i = 0; i < MAX_CLIENTS; i++) {
+		clients[i].fd = -1;
+		peers[i].active = false;
+	}
+
+	SetFecGroup(FEC_GROUP);
+}
+
+// destructor
+
+AudioStream::~AudioStream()
+{
+	Stop();
+
+	for (int i = 0; i < MAX_CLIENTS; i++) {
+		if (clients[i].fd >= 0) {
+			close(clients[i].fd);
+		}
+	}
+
+	delete[] clients;
+	delete[] peers;
+
+	if (listen_fd >= 0) {
+		close(listen_fd);
+	}
+
+	if (udp_fd >= 0) {
+		close(udp_fd);
+	}
+
+	close(rx_event);
+	close(tx_event);
+	close(ptt_event);
+}
+
+// public methods
+
+/**
+ * Open sound card (or files) for either direction, empty spec skips it
+ * @param string capture_spec Receiver audio
+ * @param string playback_spec Transmitter audio
+ * @param int rate Stream rate, Hz, 8000 to 48000
+ * @param int capture_rate Sound card rate if higher, a multiple of rate, or 0
+ * @return bool
+ */
+bool AudioStream::Open(const string & capture_spec, const string & playback_spec, int r, int c)
+{
+	if (r < 8000 || AudioPacket::FrameSamples(r) > AUDIO_MAX_SAMPLES) {
+		cout << "Unsupported audio rate " << r << " Hz" << endl;
+		return false;
+	}
+
+	rate = r;
+	frame_samples = AudioPacket::FrameSamples(rate);
+	capture_rate = c > 0 ? c : rate;
+
+	if (AudioPacket::FrameSamples(capture_rate) > AUDIO_MAX_SAMPLES || (capture_rate != rate && !resampler.Setup(capture_rate, rate))) {
+		cout << "Can't resample " << capture_rate << " Hz audio to " << rate << " Hz" << endl;
+		return false;
+	}
+
+	if (!capture_spec.empty()) {
+		if (!capture.Open(capture_spec, AudioDevice::CAPTURE, capture_rate)) {
+			return false;
+		}
+
+		// test recordings play over and over
+		capture.SetLoop(true);
+		has_capture = true;
+	}
+
+	if (!playback_spec.empty()) {
+		if (!playback.Open(playback_spec, AudioDevice::PLAYBACK, rate)) {
+			return false;
+		}
+
+		has_playback = true;
+	}
+
+	return true;
+}
+
+/**
+ * Listen for audio clients, TCP and UDP on the same port
+ * @param int port
+ * @return bool
+ */
+bool AudioStream::Listen(int port)
+{
+	struct sockaddr_in address;
+	int on = 1;
+
+	listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (listen_fd < 0) {
+		perror("ERROR opening audio socket");
+		return false;
+	}
+
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = INADDR_ANY;
+	address.sin_port = htons(port);
+
+	if (bind(listen_fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+		perror("ERROR on binding audio port");
+		return false;
+	}
+
+	if (listen(listen_fd, MAX_CLIENTS) < 0 || !Reactor::SetNonBlocking(listen_fd)) {
+		perror("ERROR on listen");
+		return false;
+	}
+
+	udp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (udp_fd < 0 || bind(udp_fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+		perror("ERROR on binding audio UDP port");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * RX frames per parity packet sent to UDP clients
+ * @param int frames 0 sends no parity
+ * @return void
+ */
+void AudioStream::SetFecGroup(int frames)
+{
+	for (int i = 0; i < AudioCodec::CODEC_COUNT; i++) {
+		rx_fec[i].SetGroup(frames);
+	}
+}
+
+/**
+ * Start the threads
+ * @return bool
+ */
+bool AudioStream::Start()
+{
+	if (rx_event < 0 || tx_event < 0 || ptt_event < 0) {
+		cout << "Can't create audio eventfds" << endl;
+		return false;
+	}
+
+	reactor.Add(listen_fd, EPOLLIN, [this](uint32_t) {
+		Accept();
+	});
+
+	reactor.Add(udp_fd, EPOLLIN, [this](uint32_t) {
+		ReceiveUdp();
+	});
+
+	reactor.Add(rx_event, EPOLLIN, [this](uint32_t) {
+		uint64_t value;
+
+		if (read(rx_event, &value, sizeof(value)) < 0) {
+			return;
+		}
+
+		if (!running) {
+			reactor.Stop();
+			return;
+		}
+
+		Broadcast();
+	});
+
+	reactor.AddTimer(TX_TIMEOUT_MS / 5, [this]() {
+		CheckTx();
+		ExpirePeers();
+	});
+
+	running = true;
+
+	if (has_capture) {
+		capture_thread = thread(&AudioStream::CaptureLoop, this);
+	}
+
+	if (has_playback) {
+		playback_thread = thread(&AudioStream::PlaybackLoop, this);
+	}
+
+	network_thread = thread(&AudioStream::NetworkLoop, this);
+
+	return true;
+}
+
+/**
+ * Stop and join the threads
+ * @return void
+ */
+void AudioStream::Stop()
+{
+	if (!running.exchange(false)) {
+		return;
+	}
+
+	Signal(rx_event);
+	Signal(tx_event);
+
+	if (capture_thread.joinable()) {
+		capture_thread.join();
+	}
+
+	if (playback_thread.joinable()) {
+		playback_thread.join();
+	}
+
+	if (network_thread.joinable()) {
+		network_thread.join();
+	}
+}
+
+/**
+ * Readable when the playback thread wants PTT switched
+ * @return int
+ */
+int AudioStream::GetPttEventFd()
+{
+	return ptt_event;
+}
+
+/**
+ * Forward a PTT request to the CAT queue, on the server's event loop.
+ * Completions arrive in order there too, so a release that was overtaken
+ * by a new burst can not unkey it.
+ * @return void
+ */
+void AudioStream::HandlePttEvent()
+{
+	uint64_t value;
+
+	if (read(ptt_event, &value, sizeof(value)) < 0 && errno == EAGAIN) {
+		return;
+	}
+
+	bool wanted = ptt_wanted.load();
+
+	if (wanted == ptt_requested) {
+		// released and keyed again before we looked, still on
+		ptt_keyed = wanted && ptt_confirmed;
+		return;
+	}
+
+	ptt_requested = wanted;
+
+	CatCommand command;
+	command.opcode = wanted ? Cat::CMD_PTT_ON : Cat::CMD_PTT_OFF;
+	command.frequency = 0;
+	command.client = AUDIO_CLIENT;
+	command.callback = [this, wanted](const CatResult & result) {
+		if (!wanted) {
+			ptt_confirmed = false;
+		} else if (ptt_requested) {
+			ptt_confirmed = result.ok;
+		}
+
+		ptt_keyed = ptt_requested && ptt_confirmed;
+		ptt_switches++;
+	};
+
+	// the burst times out and is dropped without PTT
+	if (!queue->Submit(command) && wanted) {
+		ptt_requested = false;
+	}
+}
+
+/**
+ * Counters as key:value lines
+ * @return string
+ */
+string AudioStream::Stats()
+{
+	stringstream output;
+	output << fixed << setprecision(3);
+
+	output << "audio_rate:" << rate << "\n";
+	output << "audio_capture_rate:" << capture_rate << "\n";
+	output << "audio_simd:" << AudioCodec::SimdName(AudioCodec::GetSimd()) << "\n";
+	output << "audio_clients:" << client_count.load() << "\n";
+	output << "audio_captured:" << captured.load() << "\n";
+	output << "audio_capture_overruns:" << capture_overruns.load() + capture.GetXruns() << "\n";
+	output << "audio_sent:" << sent.load() << "\n";
+	output << "audio_bytes_sent:" << bytes_sent.load() << "\n";
+	output << "audio_client_drops:" << client_drops.load() << "\n";
+	output << "audio_udp_peers:" << peer_count.load() << "\n";
+	output << "audio_udp_sent:" << udp_sent.load() << "\n";
+	output << "audio_udp_drops:" << udp_drops.load() << "\n";
+	output << "audio_fec_group:" << rx_fec[0].GetGroup() << "\n";
+	output << "audio_fec_sent:" << fec_sent.load() << "\n";
+	output << "audio_rx_p50_ms:" << rx_latency.Percentile(0.5) << "\n";
+	output << "audio_rx_p99_ms:" << rx_latency.Percentile(0.99) << "\n";
+	output << "audio_tx_received:" << tx_received.load() << "\n";
+	output << "audio_tx_dropped:" << tx_dropped.load() << "\n";
+	output << "audio_tx_recovered:" << tx_recovered.load() << "\n";
+	output << jitter.Stats("audio_tx_buffer_");
+	output << "audio_played:" << played.load() << "\n";
+	output << "audio_underruns:" << underruns.load() + playback.GetXruns() << "\n";
+	output << "audio_tx_p50_ms:" << tx_latency.Percentile(0.5) << "\n";
+	output << "audio_tx_p99_ms:" << tx_latency.Percentile(0.99) << "\n";
+	output << "audio_bursts:" << bursts.load() << "\n";
+	output << "audio_ptt_switches:" << ptt_switches.load() << "\n";
+	output << "audio_ptt:" << (ptt_keyed ? 1 : 0) << "\n";
+
+	return output.str();
+}
+
+// private methods
+
+/**
+ * Sound card -> rx ring, one frame per read
+ * @return void
+ */
+void AudioStream::CaptureLoop()
+{
+	AudioFrame dropped;
+	uint32_t sequence = 0;
+	int16_t card[AUDIO_MAX_SAMPLES];
+	int card_samples = AudioPacket::FrameSamples(capture_rate);
+
+	while (running) {
+		AudioFrame * frame = rx_ring.Claim();
+
+		// network thread is behind, the frame is lost
+		if (frame == NULL) {
+			frame = &dropped;
+		}
+
+		int n = capture_rate == rate ? capture.Read(frame->pcm, frame_samples) : capture.Read(card, card_samples);
+
+		if (n <= 0) {
+			cout << "Audio capture ended" << endl;
+			break;
+		}
+
+		uint64_t duration_us = (uint64_t)n * 1000000 / capture_rate;
+
+		if (capture_rate != rate) {
+			n = resampler.Process(card, n, frame->pcm);
+		}
+
+		frame->sequence = sequence++;
+		frame->time_us = Clock::MonotonicUs() - duration_us;
+		frame->rate = rate;
+		frame->samples = n;
+		captured++;
+
+		if (frame == &dropped) {
+			capture_overruns++;
+			continue;
+		}
+
+		rx_ring.Publish();
+		Signal(rx_event);
+	}
+}
+
+/**
+ * Clients and rx ring, until Stop()
+ * @return void
+ */
+void AudioStream::NetworkLoop()
+{
+	reactor.Run();
+}
+
+/**
+ * tx ring -> sound card, one burst at a time with PTT around it
+ * @return void
+ */
+void AudioStream::PlaybackLoop()
+{
+	int16_t silence[AUDIO_MAX_SAMPLES];
+	memset(silence, 0, sizeof(silence));
+
+	while (running) {
+		uint64_t value;
+
+		if (!tx_open && tx_ring.Peek() == NULL) {
+			// idle until the network thread sees TX audio
+			if (read(tx_event, &value, sizeof(value)) < 0 && errno != EINTR) {
+				break;
+			}
+
+			continue;
+		}
+
+		bursts++;
+
+		// a confirmation from an earlier burst does not count
+		ptt_keyed = false;
+		SetPttWanted(true);
+
+		if (!WaitFor(ptt_keyed, PTT_TIMEOUT_MS)) {
+			cout << "Audio: PTT not confirmed, dropping TX audio" << endl;
+
+			while (tx_open && running) {
+				for (AudioFrame * frame; (frame = tx_ring.Peek()) != NULL; tx_ring.Release()) {
+					tx_dropped++;
+				}
+
+				usleep(AUDIO_FRAME_MS * 1000);
+			}
+		} else {
+			AudioFrame frame;
+			bool started = false;
+
+			jitter.Reset();
+			playback.Restart();
+
+			while (running) {
+				// frames published before the end was signalled are in the ring by now
+				bool end = !tx_open;
+
+				for (AudioFrame * received; (received = tx_ring.Peek()) != NULL; tx_ring.Release()) {
+					jitter.Put(*received);
+				}
+
+				JitterBuffer::Playout playout = jitter.Get(frame, end);
+
+				if (playout == JitterBuffer::PLAYOUT_FRAME) {
+					tx_latency.Record((Clock::MonotonicUs() - frame.time_us) / 1000.0);
+					playback.Write(frame.pcm, frame.samples);
+					played++;
+					started = true;
+				} else if (playout == JitterBuffer::PLAYOUT_CONCEALED) {
+					playback.Write(frame.pcm, frame.samples);
+				} else if (!end) {
+					// buffering, keep the sound card fed
+					playback.Write(silence, frame_samples);
+
+					if (started) {
+						underruns++;
+					}
+				} else {
+					break;
+				}
+			}
+
+			// PTT drops only after the last sample left the sound card
+			playback.Drain();
+		}
+
+		// whatever arrived after the end belongs to nobody
+		for (AudioFrame * frame; (frame = tx_ring.Peek()) != NULL; tx_ring.Release()) {
+			tx_dropped++;
+		}
+
+		SetPttWanted(false);
+	}
+}
+
+/**
+ * Accept all pending audio clients
+ * @return void
+ */
+void AudioStream::Accept()
+{
+	int fd;
+
+	while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		int slot = -1;
+
+		for (int i = 0; i < MAX_CLIENTS; i++) {
+			if (clients[i].fd < 0) {
+				slot = i;
+				break;
+			}
+		}
+
+		if (slot < 0) {
+			close(fd);
+			continue;
+		}
+
+		// frames are small and late ones are useless
+		int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+		Client & client = clients[slot];
+		client.fd = fd;
+		client.out_length = 0;
+		client.in_length = 0;
+		client.dropped = 0;
+		client.codec = AudioCodec::CODEC_PCM;
+		client_count++;
+
+		reactor.Add(fd, EPOLLIN | EPOLLRDHUP, [this, slot](uint32_t events) {
+			if (events & EPOLLERR) {
+				Disconnect(slot);
+				return;
+			}
+
+			if (events & EPOLLOUT) {
+				Flush(slot);
+			}
+
+			// the last frames and TX_END often come together with the FIN, Receive() sees the end after them
+			if ((events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) && clients[slot].fd >= 0) {
+				Receive(slot);
+			}
+		});
+	}
+}
+
+/**
+ * Packets from a TCP client
+ * @param int slot
+ * @return void
+ */
+void AudioStream::Receive(int slot)
+{
+	Client & client = clients[slot];
+	ssize_t n;
+
+	while ((n = read(client.fd, client.in + client.in_length, IN_BYTES - client.in_length)) > 0) {
+		uint64_t now = Clock::MonotonicUs();
+		size_t offset = 0;
+		int length;
+
+		client.in_length += n;
+
+		while ((length = Dispatch(slot, client.in + offset, client.in_length - offset, now)) > 0) {
+			offset += length;
+		}
+
+		if (length < 0) {
+			Disconnect(slot);
+			return;
+		}
+
+		memmove(client.in, client.in + offset, client.in_length - offset);
+		client.in_length -= offset;
+	}
+
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+		Disconnect(slot);
+	}
+}
+
+/**
+ * Datagrams from UDP clients, each one packet. Parity from the client that
+ * owns TX may rebuild a lost frame, which goes the same way late.
+ * @return void
+ */
+void AudioStream::ReceiveUdp()
+{
+	for (;;) {
+		struct sockaddr_in address;
+		socklen_t address_length = sizeof(address);
+		ssize_t n = recvfrom(udp_fd, datagram, sizeof(datagram), 0, (struct sockaddr *) &address, &address_length);
+
+		if (n < 0) {
+			break;
+		}
+
+		AudioPacket::Header header;
+
+		if (AudioPacket::ReadHeader(datagram, n, header) != n) {
+			continue;
+		}
+
+		int peer = FindPeer(address);
+
+		if (peer < 0) {
+			continue;
+		}
+
+		int owner = MAX_CLIENTS + peer;
+		uint64_t now = Clock::MonotonicUs();
+
+		peers[peer].last_heard_us = now;
+		Dispatch(owner, datagram, n, now);
+
+		if (tx_owner == owner) {
+			size_t length = tx_fec.Receive(datagram, n, recovered);
+
+			if (length > 0) {
+				tx_recovered++;
+				Dispatch(owner, recovered, length, 0);
+			}
+		}
+	}
+}
+
+/**
+ * Act on one packet from a client. The first client to send TX audio owns
+ * TX until it ends the burst, frames from anybody else are dropped.
+ * @param int owner TCP slot, or MAX_CLIENTS + UDP peer
+ * @param uint8_t* data
+ * @param size_t length Bytes available
+ * @param uint64_t arrival_us When it was received, 0 if recovered
+ * @return int Packet length, 0 if incomplete, -1 if malformed
+ */
+int AudioStream::Dispatch(int owner, const uint8_t * data, size_t length, uint64_t arrival_us)
+{
+	uint8_t type, codec;
+	AudioFrame * frame = tx_ring.Claim();
+	AudioFrame * target = frame != NULL ? frame : &scratch;
+	int packet_length = AudioPacket::Decode(data, length, type, codec, *target);
+
+	if (packet_length <= 0) {
+		return packet_length;
+	}
+
+	if (type == AudioPacket::TYPE_TX_END) {
+		if (tx_owner == owner) {
+			EndTx();
+		}
+
+		return packet_length;
+	}
+
+	if (type == AudioPacket::TYPE_CODEC && codec < AudioCodec::CODEC_COUNT) {
+		if (owner < MAX_CLIENTS) {
+			clients[owner].codec = codec;
+		} else {
+			peers[owner - MAX_CLIENTS].codec = codec;
+		}
+
+		return packet_length;
+	}
+
+	if (type != AudioPacket::TYPE_TX_AUDIO) {
+		return packet_length;
+	}
+
+	tx_received++;
+
+	if (!has_playback || (tx_owner >= 0 && tx_owner != owner) || target->rate != rate || frame == NULL) {
+		tx_dropped++;
+		return packet_length;
+	}
+
+	if (tx_owner < 0) {
+		tx_owner = owner;
+		tx_open = true;
+		tx_fec.Reset();
+	}
+
+	target->arrival_us = arrival_us;
+	last_tx_us = Clock::MonotonicUs();
+	tx_ring.Publish();
+	Signal(tx_event);
+
+	return packet_length;
+}
+
+/**
+ * Peer slot of an address, a new one is taken if there is room
+ * @param sockaddr_in address
+ * @return int -1 if all are taken
+ */
+int AudioStream::FindPeer(const struct sockaddr_in & address)
+{
+	int free_slot = -1;
+
+	for (int i = 0; i < MAX_CLIENTS; i++) {
+		UdpPeer & peer = peers[i];
+
+		if (!peer.active) {
+			if (free_slot < 0) {
+				free_slot = i;
+			}
+
+			continue;
+		}
+
+		if (peer.address.sin_addr.s_addr == address.sin_addr.s_addr && peer.address.sin_port == address.sin_port) {
+			return i;
+		}
+	}
+
+	if (free_slot >= 0) {
+		UdpPeer & peer = peers[free_slot];
+		peer.active = true;
+		peer.address = address;
+		peer.codec = AudioCodec::CODEC_PCM;
+		peer_count++;
+	}
+
+	return free_slot;
+}
+
+/**
+ * Write what the socket takes, watch for EPOLLOUT if anything is left
+ * @param int slot
+ * @return void
+ */
+void AudioStream::Flush(int slot)
+{
+	Client & client = clients[slot];
+
+	if (client.out_length == 0) {
+		return;
+	}
+
+	ssize_t n = write(client.fd, client.out, client.out_length);
+
+	if (n < 0 && errno != EAGAIN && errno != EINTR) {
+		Disconnect(slot);
+		return;
+	}
+
+	if (n > 0) {
+		memmove(client.out, client.out + n, client.out_length - n);
+		client.out_length -= n;
+	}
+
+	reactor.Modify(client.fd, EPOLLIN | EPOLLRDHUP | (client.out_length > 0 ? (uint32_t)EPOLLOUT : 0u));
+}
+
+void AudioStream::Disconnect(int slot)
+{
+	Client & client = clients[slot];
+
+	if (client.fd < 0) {
+		return;
+	}
+
+	reactor.Remove(client.fd);
+	close(client.fd);
+	client.fd = -1;
+	client_count--;
+
+	// a transmitting client that vanishes must not leave the tcvr keyed
+	if (tx_owner == slot) {
+		EndTx();
+	}
+}
+
+/**
+ * rx ring -> every client's buffer and every UDP peer, encoded once per
+ * codec in use
+ * @return void
+ */
+void AudioStream::Broadcast()
+{
+	for (AudioFrame * frame; (frame = rx_ring.Peek()) != NULL; rx_ring.Release()) {
+		for (int i = 0; i < AudioCodec::CODEC_COUNT; i++) {
+			packet_lengths[i] = 0;
+			parity_done[i] = false;
+		}
+
+		for (int i = 0; i < MAX_CLIENTS; i++) {
+			Client & client = clients[i];
+
+			if (client.fd < 0) {
+				continue;
+			}
+
+			size_t length = EncodeOnce(client.codec, *frame);
+
+			if (client.out_length + length > OUT_BYTES) {
+				client.dropped++;
+				client_drops++;
+				continue;
+			}
+
+			bool idle = client.out_length == 0;
+
+			memcpy(client.out + client.out_length, packets[client.codec], length);
+			client.out_length += length;
+			bytes_sent += length;
+			sent++;
+
+			// otherwise EPOLLOUT is already armed
+			if (idle) {
+				Flush(i);
+			}
+		}
+
+		for (int i = 0; i < MAX_CLIENTS; i++) {
+			UdpPeer & peer = peers[i];
+
+			if (!peer.active) {
+				continue;
+			}
+
+			size_t length = EncodeOnce(peer.codec, *frame);
+
+			// the parity goes out right after the last frame of its group
+			if (!parity_done[peer.codec]) {
+				parity_lengths[peer.codec] = rx_fec[peer.codec].Protect(packets[peer.codec], length, parities[peer.codec]);
+				parity_done[peer.codec] = true;
+			}
+
+			if (sendto(udp_fd, packets[peer.codec], length, MSG_DONTWAIT, (struct sockaddr *) &peer.address, sizeof(peer.address)) < 0) {
+				udp_drops++;
+				continue;
+			}
+
+			bytes_sent += length;
+			udp_sent++;
+			sent++;
+
+			size_t parity_length = parity_lengths[peer.codec];
+
+			if (parity_length > 0 && sendto(udp_fd, parities[peer.codec], parity_length, MSG_DONTWAIT, (struct sockaddr *) &peer.address, sizeof(peer.address)) >= 0) {
+				bytes_sent += parity_length;
+				fec_sent++;
+			}
+		}
+
+		rx_latency.Record((Clock::MonotonicUs() - frame->time_us) / 1000.0);
+	}
+}
+
+/**
+ * RX packet of a frame in a codec, encoded on first use
+ * @param int codec
+ * @param AudioFrame frame
+ * @return size_t Length of packets[codec]
+ */
+size_t AudioStream::EncodeOnce(int codec, const AudioFrame & frame)
+{
+	if (packet_lengths[codec] == 0) {
+		packet_lengths[codec] = AudioPacket::Encode(AudioPacket::TYPE_RX_AUDIO, frame, packets[codec], codec, adpcm);
+	}
+
+	return packet_lengths[codec];
+}
+
+/**
+ * Burst over, playback drains and releases PTT
+ * @return void
+ */
+void AudioStream::EndTx()
+{
+	tx_owner = -1;
+	tx_open = false;
+	Signal(tx_event);
+}
+
+/**
+ * End a burst whose client stopped sending without saying so
+ * @return void
+ */
+void AudioStream::CheckTx()
+{
+	if (tx_owner >= 0 && Clock::MonotonicUs() - last_tx_us > TX_TIMEOUT_MS * 1000ull) {
+		EndTx();
+	}
+}
+
+/**
+ * Forget UDP clients that stopped sending keepalives
+ * @return void
+ */
+void AudioStream::ExpirePeers()
+{
+	uint64_t now = Clock::MonotonicUs();
+
+	for (int i = 0; i < MAX_CLIENTS; i++) {
+		UdpPeer & peer = peers[i];
+
+		if (!peer.active || now - peer.last_heard_us < PEER_TIMEOUT_MS * 1000ull) {
+			continue;
+		}
+
+		peer.active = false;
+		peer_count--;
+
+		if (tx_owner == MAX_CLIENTS + i) {
+			EndTx();
+		}
+	}
+}
+
+/**
+ * Sleep in 1 ms steps until a flag is set
+ * @param atomic<bool> flag
+ * @param int timeout_ms
+ * @return bool False on timeout
+ */
+bool AudioStream::WaitFor(const atomic<bool> & flag, int timeout_ms)
+{
+	for (int waited = 0; !flag && running; waited++) {
+		if (waited >= timeout_ms) {
+			return false;
+		}
+
+		usleep(1000);
+	}
+
+	return flag;
+}
+
+void AudioStream::SetPttWanted(bool wanted)
+{
+	ptt_wanted = wanted;
+	Signal(ptt_event);
+}
+
+/**
+ * Wake whoever waits on an eventfd
+ * @param int fd
+ * @return void
+ */
+void AudioStream::Signal(int fd)
+{
+	uint64_t one = 1;
+
+	if (write(fd, &one, sizeof(one)) < 0) {
+		// counter full, the reader is awake anyway
+	}
+}
@@ -0,0 +1,218 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "audio_codec.h"
+#include "audio_device.h"
+#include "audio_fec.h"
+#include "audio_packet.h"
+#include "cat_queue.h"
+#include "cat_stats.h"
+#include "jitter_buffer.h"
+#include "reactor.h"
+#include "spsc_ring.h"
+#include <stdint.h>
+#include <netinet/in.h>
+#include <atomic>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+#ifndef AUDIO_STREAM_H
+#define AUDIO_STREAM_H
+
+/**
+ * Receiver audio out to TCP and UDP clients and transmitter audio back in,
+ * next to the CAT server. Three threads, each blocking on one thing only:
+ *
+ *   capture   sound card -> rx ring
+ *   network   rx ring -> every client, TX client -> tx ring (own epoll)
+ *   playback  tx ring -> sound card
+ *
+ * The rings are single producer/single consumer and lock-free, frames are
+ * filled in place and client buffers are allocated up front, so the per
+ * frame path takes no lock and allocates nothing. A client that can not
+ * keep up loses frames instead of delaying the others. Each client picks
+ * a codec for its RX audio; a frame is encoded once per codec in use, not
+ * once per client. A 48 kHz sound card is decimated to the stream rate on
+ * the capture thread.
+ *
+ * UDP clients share the TCP port number. They register with any packet,
+ * usually TYPE_CODEC, and must repeat it at least every PEER_TIMEOUT_MS.
+ * Every group of RX frames is followed by an XOR parity packet so single
+ * losses are repaired, TX audio from a UDP client is repaired the same
+ * way. TX audio of either transport goes through a jitter buffer on the
+ * playback thread, which reorders it, sizes the playout delay to the
+ * measured jitter and conceals what is still missing.
+ *
+ * PTT follows the TX audio: the playback thread asks for PTT when a TX
+ * burst starts and holds the audio until the tcvr confirmed it, then asks
+ * for release once the last frame was played. The request reaches the
+ * server's event loop through an eventfd; HandlePttEvent() turns it into
+ * CatQueue commands there, like every other CAT command.
+ */
+class AudioStream
+{
+	public:
+		// CatQueue client id of PTT commands
+		static const int AUDIO_CLIENT;
+
+		static const int MAX_CLIENTS = 8;
+
+		// 320 ms each way
+		static const int RING_FRAMES = 16;
+
+		// burst dropped if PTT is not confirmed by then
+		static const int PTT_TIMEOUT_MS = 500;
+
+		// burst ends if the TX client goes quiet without TX_END
+		static const int TX_TIMEOUT_MS = 500;
+
+		// UDP clients not heard from for this long are forgotten
+		static const int PEER_TIMEOUT_MS = 5000;
+
+		// RX frames per parity packet for UDP clients
+		static const int FEC_GROUP = 4;
+
+		AudioStream(CatQueue * q);
+		~AudioStream();
+
+		bool Open(const string & capture_spec, const string & playback_spec, int rate, int capture_rate);
+		bool Listen(int port);
+		void SetFecGroup(int frames);
+		bool Start();
+		void Stop();
+
+		int GetPttEventFd();
+		void HandlePttEvent();
+
+		string Stats();
+
+	private:
+		// 16 frames of backlog per client, then frames are dropped
+		static const size_t OUT_BYTES = 16 * AudioPacket::MAX_SIZE;
+		static const size_t IN_BYTES = 4 * AudioPacket::MAX_SIZE;
+
+		struct Client {
+			int fd;
+			uint8_t out[OUT_BYTES];
+			size_t out_length;
+			uint8_t in[IN_BYTES];
+			size_t in_length;
+			uint64_t dropped;
+			uint8_t codec;
+		};
+
+		struct UdpPeer {
+			bool active;
+			struct sockaddr_in address;
+			uint8_t codec;
+			uint64_t last_heard_us;
+		};
+
+		CatQueue * queue;
+		AudioDevice capture;
+		AudioDevice playback;
+		bool has_capture;
+		bool has_playback;
+		int rate;
+		int frame_samples;
+		int capture_rate;
+		Resampler resampler;
+
+		SpscRing<AudioFrame> rx_ring;
+		SpscRing<AudioFrame> tx_ring;
+
+		int listen_fd;
+		int udp_fd;
+		int rx_event;
+		int tx_event;
+		int ptt_event;
+
+		thread capture_thread;
+		thread network_thread;
+		thread playback_thread;
+		atomic<bool> running;
+
+		// network thread
+		Reactor reactor;
+		Client * clients;
+		UdpPeer * peers;
+		int tx_owner;
+		uint64_t last_tx_us;
+		uint8_t packets[AudioCodec::CODEC_COUNT][AudioPacket::MAX_SIZE];
+		size_t packet_lengths[AudioCodec::CODEC_COUNT];
+		uint8_t parities[AudioCodec::CODEC_COUNT][AudioPacket::MAX_PARITY_SIZE];
+		size_t parity_lengths[AudioCodec::CODEC_COUNT];
+		bool parity_done[AudioCodec::CODEC_COUNT];
+		AudioCodec::AdpcmState adpcm;
+		AudioFrame scratch;
+		AudioFec rx_fec[AudioCodec::CODEC_COUNT];
+		AudioFec tx_fec;
+		uint8_t datagram[AudioPacket::MAX_PARITY_SIZE];
+		uint8_t recovered[AudioPacket::MAX_SIZE];
+
+		// playback thread
+		JitterBuffer jitter;
+
+		// playback thread asks, event loop answers
+		atomic<bool> tx_open;
+		atomic<bool> ptt_wanted;
+		atomic<bool> ptt_keyed;
+
+		// event loop
+		bool ptt_requested;
+		bool ptt_confirmed;
+
+		atomic<uint64_t> captured;
+		atomic<uint64_t> capture_overruns;
+		atomic<uint64_t> sent;
+		atomic<uint64_t> bytes_sent;
+		atomic<uint64_t> client_drops;
+		atomic<uint64_t> udp_sent;
+		atomic<uint64_t> udp_drops;
+		atomic<uint64_t> fec_sent;
+		atomic<uint64_t> tx_recovered;
+		atomic<uint64_t> tx_received;
+		atomic<uint64_t> tx_dropped;
+		atomic<uint64_t> played;
+		atomic<uint64_t> underruns;
+		atomic<uint64_t> bursts;
+		atomic<uint64_t> ptt_switches;
+		atomic<int> client_count;
+		atomic<int> peer_count;
+		LatencyHistogram rx_latency;
+		LatencyHistogram tx_latency;
+
+		void CaptureLoop();
+		void NetworkLoop();
+		void PlaybackLoop();
+
+		void Accept();
+		void Receive(int slot);
+		void ReceiveUdp();
+		int Dispatch(int owner, const uint8_t * data, size_t length, uint64_t arrival_us);
+		int FindPeer(const struct sockaddr_in & address);
+		void Flush(int slot);
+		void Disconnect(int slot);
+		void Broadcast();
+		size_t EncodeOnce(int codec, const AudioFrame & frame);
+		void EndTx();
+		void CheckTx();
+		void ExpirePeers();
+
+		bool WaitFor(const atomic<bool> & flag, int timeout_ms);
+		void SetPttWanted(bool wanted);
+		static void Signal(int fd);
+};
+
+#endif
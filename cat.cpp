@@ -11,6 +11,10 @@
  * Please add attribution to your code.
  */
 #include "cat.h"
+#include "clock.h"
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
 
 using namespace std;
 
@@ -25,6 +29,8 @@ const char Cat::CMD_LOCK_OFF = 0x80;
 const char Cat::CMD_PTT_OFF = 0x88;
 const char Cat::CMD_GET_RX_STATUS = 0xe7;
 const char Cat::CMD_GET_TX_STATUS = 0xf7;
+const char Cat::CMD_READ_EEPROM = 0xbb;
+const char Cat::CMD_WRITE_EEPROM = 0xbc;
 
 const char Cat::OP_MODE_LSB = 0x00;
 const char Cat::OP_MODE_USB = 0x01;
@@ -59,8 +65,18 @@ const map<string, char> Cat::OP_MODES {
  */
 Cat::Cat()
 {
-	uart0_filestream = -1;
+	uart0_speed = B9600;
 	verbose = false;
+	pending_count = 0;
+	in_flight = false;
+	received = 0;
+	deadline = 0;
+	baud = 9600;
+	connected = false;
+	lost_at = 0;
+	reconnect_hold_ms = 0;
+	status.Clear();
+	published.Write(status);
 }
 
 // destructor
@@ -71,7 +87,7 @@ Cat::~Cat()
 		cout << "Closing port" << endl;
 	}
 
-	close(uart0_filestream);
+	transport.Close();
 }
 
 // getters / setters
@@ -86,122 +102,249 @@ void Cat::SetVerbose(bool v)
 	verbose = v;
 }
 
+/**
+ * Status as key:value strings, kept for older callers
+ * @return map
+ */
 map<string, string> Cat::GetTcvrStatus()
 {
-	return tcvr_status;
+	return GetStatus().Map();
+}
+
+/**
+ * Consistent copy of last known status, lock free, safe from any thread
+ * @return TcvrStatus
+ */
+TcvrStatus Cat::GetStatus()
+{
+	TcvrStatus snapshot;
+	published.Read(snapshot);
+
+	return snapshot;
+}
+
+/**
+ * Same as GetStatus(), into caller's struct
+ * @param TcvrStatus snapshot
+ * @return void
+ */
+void Cat::GetStatus(TcvrStatus & snapshot)
+{
+	published.Read(snapshot);
+}
+
+/**
+ * Serial port descriptor, so event loops can watch it
+ * @return int
+ */
+int Cat::GetFileDescriptor()
+{
+	return transport.GetFileDescriptor();
+}
+
+/**
+ * Poll events to watch the serial port for, POLLOUT is added while a
+ * command waits for room in the output buffer
+ * @return uint32_t
+ */
+uint32_t Cat::GetEvents()
+{
+	return transport.IsWriting() ? POLLIN | POLLOUT : POLLIN;
+}
+
+/**
+ * Transaction counters and latency histograms, safe to read from any thread
+ * @return CatStats*
+ */
+CatStats * Cat::GetStats()
+{
+	return &stats;
+}
+
+/**
+ * Reply timeouts and link state, safe to read from any thread
+ * @return LinkHealth*
+ */
+LinkHealth * Cat::GetLinkHealth()
+{
+	return &health;
+}
+
+/**
+ * Transaction counters and link health in one document
+ * @param string format text, json or prometheus
+ * @return string
+ */
+string Cat::Stats(const string & format)
+{
+	if (format == "json") {
+		string json = stats.Json();
+
+		// opcode objects, then the link as one more key
+		json.erase(json.size() - 1);
+
+		return json + (json.size() > 1 ? "," : "") + "\"link\":" + health.Json() + "}";
+	}
+
+	if (format == "prometheus") {
+		return stats.Prometheus() + health.Prometheus();
+	}
+
+	return stats.Text() + health.Text();
 }
 
 // private methods
 
 /**
- * Send CAT packet to tcvr
- * @param char[5] packet Five bytes to write to tcvr
+ * Send several CAT packets in one write, replies are read in order
+ * @param char[][5] packets
+ * @param int count
  * @return char Byte count
  */
-char Cat::SendPacket(char packet[5])
+char Cat::SendPackets(char packets[][5], int count)
 {
-	char byte_count = 0;
+	transport.Flush();
 
-	for (int i = 0; i < 5; i++) {
-		byte_count += write(uart0_filestream, &packet[i], 1);
+	pending_count = 0;
+
+	for (int i = 0; i < count && i < 16; i++) {
+		pending[pending_count++] = packets[i][4];
+		stats.Sent(packets[i][4], 5);
+	}
+
+	// a full output buffer is finished from HandleEvents()
+	if (!transport.StartWrite(packets, count)) {
+		for (int i = 0; i < pending_count; i++) {
+			stats.Completed(pending[i], CatStats::OUTCOME_ERROR, 0, 0);
+		}
+
+		pending_count = 0;
+
+		return 0;
 	}
 
-	return byte_count;
+	return 5 * count;
 }
 
 /**
- * Read response packet from tcvr. Timeout after 3 seconds.
+ * Book reply against the commands sent and report problems
  * @param char* packet
- * @return char
+ * @param int byte_count -1 on read error
+ * @param int expected Reply length of the commands sent
+ * @return void
  */
-char Cat::ReadPacket(char * packet)
+void Cat::Account(const char * packet, int byte_count, int expected)
 {
-	char byte_count = 0;
-
-	// initialize file descriptor sets
-	fd_set read_fds, write_fds, except_fds;
-	FD_ZERO(&read_fds);
-	FD_ZERO(&write_fds);
-	FD_ZERO(&except_fds);
-	FD_SET(uart0_filestream, &read_fds);
+	TransportTiming timing = transport.GetTiming();
+	int remaining = byte_count < 0 ? 0 : byte_count;
 
-	// set timeout
-	struct timeval timeout;
-	timeout.tv_sec = 3;
-	timeout.tv_usec = 0;
-
-	if (select(uart0_filestream + 1, &read_fds, &write_fds, &except_fds, &timeout) == 1) {
-		byte_count = read(uart0_filestream, packet, 5);
+	// hand each command sent its share of the reply
+	for (int i = 0; i < pending_count; i++) {
+		int length = ReplyLength(pending[i]);
+		int share = remaining < length ? remaining : length;
+		CatStats::Outcome outcome = CatStats::OUTCOME_OK;
 
 		if (byte_count < 0) {
-			cout << "Error reading from serial device." << endl;
-		} else if (byte_count == 0) {
-			cout << "No data was read from serial device." << endl;
-		} else {
-			if (verbose) {
-				cout << "Bytes: " << (int)packet[0] << " "<< (int)packet[1] << " "<< (int)packet[2] << " "<< (int)packet[3] << " "<< (int)packet[4] << endl;
-			}
+			outcome = CatStats::OUTCOME_ERROR;
+		} else if (share == 0) {
+			outcome = CatStats::OUTCOME_TIMEOUT;
+		} else if (share < length) {
+			outcome = CatStats::OUTCOME_SHORT;
 		}
+
+		stats.Completed(pending[i], outcome, share, timing.write_ms + timing.complete_ms);
+		remaining -= share;
 	}
 
-	return byte_count;
+	pending_count = 0;
+
+	if (byte_count < 0) {
+		cout << "Error reading from serial device." << endl;
+	} else if (!verbose) {
+		// timeouts and short replies are counted by stats and link health,
+		// a silent tcvr would otherwise print a line every poll
+		return;
+	} else if (byte_count == 0) {
+		cout << "No data was read from serial device." << endl;
+	} else if (byte_count < expected) {
+		cout << "Short reply from serial device: " << byte_count << " of " << expected << " bytes." << endl;
+	} else {
+		cout << "Bytes:";
+
+		for (int i = 0; i < byte_count; i++) {
+			cout << " " << (int)(unsigned char)packet[i];
+		}
+
+		cout << " (write " << timing.write_ms << " ms, first byte " << timing.first_byte_ms << " ms, complete " << timing.complete_ms << " ms)" << endl;
+	}
 }
 
 /**
- * Find map key by value
- * @param map dictionary
- * @param char value
- * @return string
+ * Reply length tcvr sends back for given command
+ * @param char opcode
+ * @return int
  */
-string Cat::FindKeyByValue(const map<string, char> dictionary, char value)
+int Cat::ReplyLength(char opcode)
 {
-	for (auto it = dictionary.begin(); it != dictionary.end(); ++it) {
-		if (it->second == value) {
-			return it->first;
-		}
+	if (opcode == CMD_GET_FREQUENCY_MODE) {
+		return 5;
 	}
 
-	return "";
+	return opcode == CMD_READ_EEPROM ? 2 : 1;
 }
 
 /**
- * Convert int which is really hex to int
- * @param doube value
- * @param char base
- * @return char
+ * Convert MHz to whole Hz, once, so no digit gets lost on the way to BCD
+ * @param double frequency
+ * @return uint32_t
  */
-char Cat::ConvertToBase(double value, char base)
+uint32_t Cat::ToHz(double frequency)
 {
-	return stoi(to_string(value), nullptr, base);
+	return frequency > 0 ? (uint32_t)llround(frequency * 1000000) : 0;
 }
 
 /**
- * Convert char array into double representing frequency
- * @param char* bytes
- * @return double
- */ 
-double Cat::BytesToFrequency(char * bytes)
+ * Stamp updated field group and make it visible to readers
+ * @param Group group
+ * @return void
+ */
+void Cat::Publish(TcvrStatus::Group group)
 {
-	stringstream strs;
-	strs << setfill('0') << setw(2) << std::hex << (int)bytes[0] << setw(2) << std::hex << (int)bytes[1] << setw(2) << std::hex << (int)bytes[2] << setw(2) << std::hex << (int)bytes[3];
-
-	double f;
-	strs >> f;
-	return f / 100000;
+	status.generation[group]++;
+	status.updated_ms[group] = Clock::MonotonicMs();
+	published.Write(status);
 }
 
-// public methods
+/**
+ * Store receiver status byte in status
+ * @param char rx_status
+ * @return void
+ */
+void Cat::ParseRxStatus(char rx_status)
+{
+	int signal = rx_status & 0x0f;
+	bool centered = !(rx_status & 0x20);
+	bool ctcss_dcs = rx_status & 0x40;
+	bool squelched = rx_status & 0x80;
+
+	if (verbose) {
+		cout << "Command> GetRxStatus: Signal: " << signal << " Centered: " << centered << " CTCSS/DCS: " << ctcss_dcs << " Squelched: " << squelched  << endl;
+	}
+
+	status.rx_signal = signal;
+	status.centered = centered;
+	status.ctcss_dcs = ctcss_dcs;
+	status.rx_squelched = squelched;
+	Publish(TcvrStatus::GROUP_RX);
+}
 
 /**
- * Connecto to serial port at given speed
- * @param string serial_device
+ * Pick baud rate, unknown ones fall back to 9600
  * @param int port_speed
- * @return bool
+ * @return void
  */
-bool Cat::Connect(string serial_device, int port_speed)
+void Cat::SetSpeed(int port_speed)
 {
-	struct stat buffer;
-
 	switch(port_speed) {
 		case 2400:
 			uart0_speed = B2400;
@@ -209,12 +352,52 @@ bool Cat::Connect(string serial_device, int port_speed)
 		case 4800:
 			uart0_speed = B4800;
 			break;
+		case 38400:
+			uart0_speed = B38400;
+			break;
 		case 9600:
 		default:
 			uart0_speed = B9600;
+			port_speed = 9600;
 			break;
 	}
 
+	baud = port_speed;
+	health.SetBaud(port_speed);
+}
+
+/**
+ * Serial device failed or went away: close it and keep the queued
+ * commands until it is back
+ * @return void
+ */
+void Cat::Lost()
+{
+	if (connected) {
+		cout << "Serial device " << uart0_device << " went away, waiting for it to return." << endl;
+	}
+
+	transport.Close();
+	connected = false;
+	in_flight = false;
+	lost_at = Clock::MonotonicMs();
+	health.Lost();
+}
+
+// public methods
+
+/**
+ * Connecto to serial port at given speed
+ * @param string serial_device
+ * @param int port_speed 0 to find the speed the tcvr answers at
+ * @return bool
+ */
+bool Cat::Connect(string serial_device, int port_speed)
+{
+	struct stat buffer;
+
+	SetSpeed(port_speed);
+
 	// if new values were supplied, replace old ones
 	uart0_device = serial_device.empty() ? uart0_device : serial_device;
 
@@ -224,37 +407,120 @@ bool Cat::Connect(string serial_device, int port_speed)
 	}
 
 	// open device
-	uart0_filestream = open(uart0_device.c_str(), O_RDWR | O_NOCTTY);
-
-	if (uart0_filestream == -1) {
+	if (!transport.Open(uart0_device, uart0_speed)) {
 		cout << "Can't open serial device " << uart0_device << endl;
 		return false;
-	} else {
-		if (verbose) {
-			cout << "Serial device " << uart0_device << " successfully opened at " << port_speed << " bauds."<< endl;
-		}
 	}
 
-	struct termios options;
-	tcgetattr(uart0_filestream, &options);
+	connected = true;
 
-	cfsetispeed(&options, uart0_speed);
-	cfsetospeed(&options, uart0_speed);
+	// notice the adapter going away and coming back
+	watch.Watch(uart0_device);
 
-	options.c_cflag &= ~PARENB;
-	options.c_cflag &= ~CSIZE;
-	options.c_cflag = uart0_speed | CS8 | CLOCAL | CREAD | CSTOPB;
-	options.c_iflag = IGNPAR;
-	options.c_oflag = 0;
-	options.c_lflag = 0;
-	options.c_cc[VMIN] = 5;
-	options.c_cc[VTIME] = 5;
-	tcflush(uart0_filestream, TCIFLUSH);
-	tcsetattr(uart0_filestream, TCSANOW, &options);
+	if (port_speed == 0 && !DetectSpeed()) {
+		cout << "No answer from tcvr at any speed, using " << baud << " bauds." << endl;
+	}
+
+	if (verbose) {
+		cout << "Serial device " << uart0_device << " successfully opened at " << baud << " bauds."<< endl;
+	}
 
 	return true;
 }
 
+/**
+ * How long queued commands wait for a lost serial device to return before
+ * they fail. 0 fails them right away, -1 waits forever.
+ * @param int ms
+ * @return void
+ */
+void Cat::SetReconnectHold(int ms)
+{
+	reconnect_hold_ms = ms;
+}
+
+/**
+ * Serial device is open
+ * @return bool
+ */
+bool Cat::IsConnected()
+{
+	return connected;
+}
+
+/**
+ * Reopen a lost serial device if it is back, at the speed it was used at
+ * or, failing that, any speed the tcvr answers at
+ * @return bool
+ */
+bool Cat::Reconnect()
+{
+	if (connected) {
+		return true;
+	}
+
+	if (!watch.Exists() || !transport.Open(uart0_device, uart0_speed)) {
+		return false;
+	}
+
+	connected = true;
+
+	// the radio may be off or still booting, the link health will tell
+	DetectSpeed();
+
+	cout << "Serial device " << uart0_device << " is back at " << baud << " bauds." << endl;
+
+	return true;
+}
+
+/**
+ * Probe speeds with a frequency/mode query until the tcvr answers with a
+ * valid frequency, the current speed first
+ * @return bool
+ */
+bool Cat::DetectSpeed()
+{
+	const int speeds[] = {baud, 9600, 4800, 38400, 2400};
+	char packet[1][5] = {{0x00, 0x00, 0x00, 0x00, CMD_GET_FREQUENCY_MODE}};
+	int current = baud;
+
+	for (size_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+		if (i > 0 && speeds[i] == current) {
+			continue;
+		}
+
+		SetSpeed(speeds[i]);
+
+		if (!transport.SetSpeed(uart0_speed)) {
+			return false;
+		}
+
+		char rx_packet[5];
+		int timeout = (int)health.WireMs(5 + 5) + PROBE_TIMEOUT_MS;
+
+		transport.Flush();
+
+		// garbage at the wrong speed hardly ever decodes to a valid frequency
+		if (transport.WriteFrames(packet, 1) && transport.ReadFrame(rx_packet, 5, timeout) == 5 && CatCodec::IsValidFrequency(rx_packet)) {
+			status.frequency_hz = CatCodec::DecodeFrequency(rx_packet);
+			status.mode = rx_packet[4];
+			Publish(TcvrStatus::GROUP_FREQUENCY_MODE);
+
+			if (verbose) {
+				cout << "Tcvr answers at " << baud << " bauds." << endl;
+			}
+
+			return true;
+		}
+	}
+
+	// nothing answered, stay where we were
+	SetSpeed(current);
+	transport.SetSpeed(uart0_speed);
+
+	return false;
+}
+
 /**
  * Produce JSON formatted status string
  * @param bool print
@@ -262,6 +528,7 @@ bool Cat::Connect(string serial_device, int port_speed)
  */
 string Cat::Json(bool print)
 {
+	map<string, string> tcvr_status = GetTcvrStatus();
 	int item_count = tcvr_status.size();
 	stringstream output;
 
@@ -282,44 +549,35 @@ string Cat::Json(bool print)
 	return output.str();
 }
 
-bool Cat::Lock(bool enabled)
+/**
+ * Drop any bytes tcvr sent that nobody asked for
+ * @return void
+ */
+void Cat::DiscardInput()
 {
-	// form the packet
-	char packet[5] = {0x00, 0x00, 0x00, 0x00, 0x00};
-	packet[4] = enabled ? CMD_LOCK_ON : CMD_LOCK_OFF;
+	transport.Flush();
+}
 
-	// send packet to device
-	char count = SendPacket(packet);
+bool Cat::Lock(bool enabled)
+{
+	bool result = false;
 
-	// check if we sent 5 bytes
-	if (count != 5) {
-		return false;
+	if (LockAsync(enabled, [&result](bool ok) { result = ok; })) {
+		Wait();
 	}
 
-	if (verbose)
-		cout << "Command> Lock: " << enabled << endl;
-
-	return true;
+	return result;
 }
 
 bool Cat::Ptt(bool enabled)
 {
-	// form the packet
-	char packet[5] = {0x00, 0x00, 0x00, 0x00, 0x00};
-	packet[4] = enabled ? CMD_PTT_ON : CMD_PTT_OFF;
+	bool result = false;
 
-	// send packet to device
-	char count = SendPacket(packet);
-
-	// check if we sent 5 bytes
-	if (count != 5) {
-		return false;
+	if (PttAsync(enabled, [&result](bool ok) { result = ok; })) {
+		Wait();
 	}
 
-	if (verbose)
-		cout << "Command> PTT: " << enabled << endl;
-
-	return true;
+	return result;
 }
 
 /**
@@ -329,214 +587,675 @@ bool Cat::Ptt(bool enabled)
  */
 bool Cat::SetFrequency(double frequency)
 {
-	// form the packet
-	char packet[5] = {0x00, 0x00, 0x00, 0x00, CMD_SET_FREQUENCY};
-	double intpart;
+	bool result = false;
 
-	double f = modf(frequency * 1000, &intpart) * 100;
-	packet[3] = ConvertToBase(f, 16);
+	if (SetFrequencyAsync(frequency, [&result](bool ok) { result = ok; })) {
+		Wait();
+	}
 
-	f = modf(intpart / 100, &intpart) * 100;
-	packet[2] = ConvertToBase(f, 16);
+	return result;
+}
 
-	f = modf(intpart / 100, &intpart) * 100;
-	packet[1] = ConvertToBase(f, 16);
+/**
+ * Set tcvr operating mode
+ * @param char mode
+ * @return bool
+ * @see OP_MODE_XXXXXX
+ */
+bool Cat::SetOperatingMode(char mode)
+{
+	bool result = false;
 
-	f =  modf(intpart / 100, &intpart) * 100;
-	packet[0] = ConvertToBase(f, 16);
+	if (SetOperatingModeAsync(mode, [&result](bool ok) { result = ok; })) {
+		Wait();
+	}
 
-	// send packet to device
-	char count = SendPacket(packet);
+	return result;
+}
 
-	ReadPacket(packet);
+/**
+ * Set tcvr operating mode
+ * @param string text_mode
+ * @return bool
+ * @see OP_MODES
+ */
+bool Cat::SetOperatingMode(string text_mode)
+{
+	bool result = false;
 
-	// check if we sent 5 bytes
-	if (count != 5) {
-		return false;
+	if (SetOperatingModeAsync(text_mode, [&result](bool ok) { result = ok; })) {
+		Wait();
 	}
 
-	if (verbose) {
-		cout << "Command> SetFrequency: " << frequency << " MHz" << endl;
+	return result;
+}
+
+/**
+ * Get tcvr's transmitter status
+ * @return bool
+ */
+bool Cat::GetTxStatus()
+{
+	bool result = false;
+
+	if (GetTxStatusAsync([&result](bool ok) { result = ok; })) {
+		Wait();
 	}
 
-	return true;
+	return result;
 }
 
 /**
- * Set tcvr operating mode
- * @param char mode
+ * Get tcvr's receiver status
  * @return bool
- * @see OP_MODE_XXXXXX
  */
-bool Cat::SetOperatingMode(char mode)
+bool Cat::GetRxStatus()
 {
-	// form the packet
-	char packet[5] = {mode, 0x00, 0x00, 0x00, CMD_SET_MODE};
+	bool result = false;
 
-	// send packet to device
-	char count = SendPacket(packet);
+	if (GetRxStatusAsync([&result](bool ok) { result = ok; })) {
+		Wait();
+	}
 
-	ReadPacket(packet);
+	return result;
+}
 
-	// check if we sent 5 bytes
-	if (count != 5) {
-		return false;
+/**
+ * Read current frequency and mode
+ * @return bool
+ */
+bool Cat::GetFrequencyModeStatus()
+{
+	bool result = false;
+
+	if (GetFrequencyModeStatusAsync([&result](bool ok) { result = ok; })) {
+		Wait();
 	}
 
-	string text_mode = FindKeyByValue(OP_MODES, mode);
+	return result;
+}
 
-	if (verbose) {
-		cout << "Command> SetOperatingMode: " << text_mode << endl;
+/**
+ * Read receiver status on current frequency and retune in one go. Both
+ * commands are sent back to back so the tcvr starts settling on the next
+ * frequency without waiting for another round trip.
+ * @param double next_frequency
+ * @return bool
+ */
+bool Cat::GetRxStatusAndSetFrequency(double next_frequency)
+{
+	bool result = false;
+
+	if (GetRxStatusAndSetFrequencyAsync(next_frequency, [&result](bool ok) { result = ok; })) {
+		Wait();
 	}
 
-	return true;
+	return result;
 }
 
 /**
- * Set tcvr operating mode
- * @param string text_mode
+ * Read EEPROM bytes
+ * @param uint16_t address
+ * @param uint8_t* data
+ * @param int length Even, up to MAX_EEPROM_BLOCK
  * @return bool
- * @see OP_MODES
  */
-bool Cat::SetOperatingMode(string text_mode)
+bool Cat::ReadEeprom(uint16_t address, uint8_t * data, int length)
 {
-	locale loc;
-	text_mode = toupper(text_mode, loc);
+	bool result = false;
 
-	// WFM cannot be set, it might cause tcvr to freeze
-	if (text_mode != "WFM") {
-		try {
-			char mode = OP_MODES.at(text_mode);
+	if (ReadEepromAsync(address, data, length, [&result](bool ok) { result = ok; })) {
+		Wait();
+	}
 
-			return SetOperatingMode(mode);
-		} catch (const out_of_range& oor) {
-			return false;
-		}
+	return result;
+}
+
+/**
+ * Write EEPROM bytes, the tcvr stores them as they arrive
+ * @param uint16_t address
+ * @param uint8_t* data
+ * @param int length Even, up to MAX_EEPROM_BLOCK
+ * @return bool
+ */
+bool Cat::WriteEeprom(uint16_t address, const uint8_t * data, int length)
+{
+	bool result = false;
+
+	if (WriteEepromAsync(address, data, length, [&result](bool ok) { result = ok; })) {
+		Wait();
 	}
 
-	return false;
+	return result;
 }
 
 /**
- * Get tcvr's transmitter status
+ * Lock front panel, callback gets true once the command went out
+ * @param bool enabled
+ * @param Callback callback
  * @return bool
  */
-bool Cat::GetTxStatus()
+bool Cat::LockAsync(bool enabled, Callback callback)
 {
-	// form the packet
-	char packet[5] = {0x00, 0x00, 0x00, 0x00, CMD_GET_TX_STATUS};
+	char packet[1][5] = {{0x00, 0x00, 0x00, 0x00, enabled ? CMD_LOCK_ON : CMD_LOCK_OFF}};
 
-	// send packet to device
-	char count = SendPacket(packet);
+	// the ack is collected so it is not mistaken for the next reply
+	return Submit(packet, 1, 1, callback);
+}
 
-	// check if we sent 5 bytes
-	if (count != 5) {
+bool Cat::PttAsync(bool enabled, Callback callback)
+{
+	char packet[1][5] = {{0x00, 0x00, 0x00, 0x00, enabled ? CMD_PTT_ON : CMD_PTT_OFF}};
+
+	return Submit(packet, 1, 1, callback);
+}
+
+bool Cat::SetFrequencyAsync(double frequency, Callback callback)
+{
+	char packet[1][5] = {{0x00, 0x00, 0x00, 0x00, CMD_SET_FREQUENCY}};
+	CatCodec::EncodeFrequency(ToHz(frequency), packet[0]);
+
+	return Submit(packet, 1, 1, callback);
+}
+
+bool Cat::SetOperatingModeAsync(char mode, Callback callback)
+{
+	char packet[1][5] = {{mode, 0x00, 0x00, 0x00, CMD_SET_MODE}};
+
+	return Submit(packet, 1, 1, callback);
+}
+
+/**
+ * Set operating mode by name
+ * @param string text_mode
+ * @param Callback callback
+ * @return bool False for unknown modes and WFM
+ */
+bool Cat::SetOperatingModeAsync(string text_mode, Callback callback)
+{
+	int mode = CatCodec::ModeCode(text_mode.c_str());
+
+	// WFM cannot be set, it might cause tcvr to freeze
+	if (mode < 0 || mode == (unsigned char)OP_MODE_WFM) {
 		return false;
 	}
 
-	// read packet
-	char rx_packet[5] = {0};
-	char bytes_read = ReadPacket(rx_packet);
+	return SetOperatingModeAsync((char)mode, callback);
+}
 
-	if (bytes_read && rx_packet[0] != 255) {
-		int power = rx_packet[0] & 0x0f;
-		bool split = ~(rx_packet[0] & 0x20);
-		bool swr = rx_packet[0] & 0x40;
-		bool ptt = rx_packet[0] & 0x80;
+/**
+ * Status queries, callback gets true once the reply was parsed into status
+ * @param Callback callback
+ * @return bool
+ */
+bool Cat::GetTxStatusAsync(Callback callback)
+{
+	char packet[1][5] = {{0x00, 0x00, 0x00, 0x00, CMD_GET_TX_STATUS}};
 
-		if (verbose) {
-			cout << "Command> GetTxStatus: Power: " << power << " Split: " << split << " SWR: " << swr << " PTT: " << ptt << endl;
+	return Submit(packet, 1, 1, callback);
+}
+
+bool Cat::GetRxStatusAsync(Callback callback)
+{
+	char packet[1][5] = {{0x00, 0x00, 0x00, 0x00, CMD_GET_RX_STATUS}};
+
+	return Submit(packet, 1, 1, callback);
+}
+
+bool Cat::GetFrequencyModeStatusAsync(Callback callback)
+{
+	char packet[1][5] = {{0x00, 0x00, 0x00, 0x00, CMD_GET_FREQUENCY_MODE}};
+
+	return Submit(packet, 1, 5, callback);
+}
+
+bool Cat::GetRxStatusAndSetFrequencyAsync(double next_frequency, Callback callback)
+{
+	char packets[2][5] = {
+		{0x00, 0x00, 0x00, 0x00, CMD_GET_RX_STATUS},
+		{0x00, 0x00, 0x00, 0x00, CMD_SET_FREQUENCY}
+	};
+
+	CatCodec::EncodeFrequency(ToHz(next_frequency), packets[1]);
+
+	// status byte comes first, then the frequency ack
+	return Submit(packets, 2, 2, callback);
+}
+
+/**
+ * Read EEPROM bytes, one read command per two bytes sent in one go; data
+ * must stay valid until the callback ran
+ * @param uint16_t address
+ * @param uint8_t* data
+ * @param int length Even, up to MAX_EEPROM_BLOCK
+ * @param Callback callback
+ * @return bool
+ */
+bool Cat::ReadEepromAsync(uint16_t address, uint8_t * data, int length, Callback callback)
+{
+	char packets[MAX_PACKETS][5];
+	int count = length / 2;
+
+	if (length <= 0 || length % 2 != 0 || length > MAX_EEPROM_BLOCK) {
+		return false;
+	}
+
+	for (int i = 0; i < count; i++) {
+		uint16_t at = address + 2 * i;
+		char packet[5] = {(char)(at >> 8), (char)at, 0x00, 0x00, CMD_READ_EEPROM};
+		memcpy(packets[i], packet, 5);
+	}
+
+	return Submit(packets, count, length, callback, data);
+}
+
+/**
+ * Write EEPROM bytes, two per command, each acknowledged with one byte
+ * @param uint16_t address
+ * @param uint8_t* data Copied right away
+ * @param int length Even, up to MAX_EEPROM_BLOCK
+ * @param Callback callback
+ * @return bool
+ */
+bool Cat::WriteEepromAsync(uint16_t address, const uint8_t * data, int length, Callback callback)
+{
+	char packets[MAX_PACKETS][5];
+	int count = length / 2;
+
+	if (length <= 0 || length % 2 != 0 || length > MAX_EEPROM_BLOCK) {
+		return false;
+	}
+
+	for (int i = 0; i < count; i++) {
+		uint16_t at = address + 2 * i;
+		char packet[5] = {(char)(at >> 8), (char)at, (char)data[2 * i], (char)data[2 * i + 1], CMD_WRITE_EEPROM};
+		memcpy(packets[i], packet, 5);
+	}
+
+	return Submit(packets, count, count, callback);
+}
+
+/**
+ * A command is on the wire or waiting for its turn
+ * @return bool
+ */
+bool Cat::IsBusy()
+{
+	return in_flight || !requests.empty();
+}
+
+/**
+ * Time left until the command on the wire is given up on, or until the
+ * next look for a lost device
+ * @return int Milliseconds, -1 when idle
+ */
+int Cat::GetTimeoutMs()
+{
+	if (!connected && !requests.empty()) {
+		double remaining = reconnect_hold_ms < 0 ? DeviceWatch::POLL_MS : lost_at + reconnect_hold_ms - Clock::MonotonicMs();
+
+		return remaining <= 0 ? 0 : (remaining < DeviceWatch::POLL_MS ? (int)(remaining + 0.999) : DeviceWatch::POLL_MS);
+	}
+
+	if (!in_flight) {
+		return -1;
+	}
+
+	double remaining = deadline - Clock::MonotonicMs();
+
+	return remaining > 0 ? (int)(remaining + 0.999) : 0;
+}
+
+/**
+ * Serial fd became ready, takes poll() or epoll event bits
+ * @param uint32_t events
+ * @return void
+ */
+void Cat::HandleEvents(uint32_t events)
+{
+	// device went away (USB adapter unplugged)
+	if (events & (POLLERR | POLLHUP | POLLNVAL)) {
+		if (in_flight) {
+			Finish(-1);
+		} else {
+			Lost();
 		}
 
-		tcvr_status["tx_power"] = to_string(power);
-		tcvr_status["split"] = to_string(split);
-		tcvr_status["swr_high"] = to_string(swr);
-		tcvr_status["ptt_on"] = to_string(ptt);
+		return;
+	}
 
-		return true;
+	if (!in_flight) {
+		// nobody asked, must be garbage or a late reply
+		if (events & POLLIN) {
+			transport.Flush();
+		}
+
+		return;
 	}
 
-	return false;
+	if ((events & POLLOUT) && !transport.ContinueWrite()) {
+		Finish(-1);
+		return;
+	}
+
+	if (events & POLLIN) {
+		int n = transport.ReadAvailable(reply, received, requests.front().expected);
+
+		if (n < 0) {
+			Finish(-1);
+			return;
+		}
+
+		received = n;
+
+		if (received == requests.front().expected) {
+			Finish(received);
+		}
+	}
 }
 
 /**
- * Get tcvr's receiver status
+ * Give up on a reply once its deadline passed
+ * @return void
+ */
+void Cat::HandleTimeout()
+{
+	if (in_flight && Clock::MonotonicMs() >= deadline) {
+		Finish(received);
+	}
+
+	// no event for the device, look for it anyway
+	if (!connected && !requests.empty()) {
+		StartNext();
+	}
+}
+
+/**
+ * Readable when the directory of the serial device changed, -1 if the
+ * host loop has to rely on GetTimeoutMs() alone
+ * @return int
+ */
+int Cat::GetWatchDescriptor()
+{
+	return watch.GetFileDescriptor();
+}
+
+/**
+ * Watch descriptor became readable, reopen the device if it is back
+ * @return void
+ */
+void Cat::HandleWatchEvents()
+{
+	if (watch.HandleEvents() && !connected && Reconnect()) {
+		StartNext();
+	}
+}
+
+/**
+ * Run queued commands to completion on the calling thread
+ * @return void
+ */
+void Cat::Wait()
+{
+	while (in_flight || (!connected && !requests.empty())) {
+		struct pollfd pfds[2] = {
+			{GetFileDescriptor(), (short)GetEvents(), 0},
+			{GetWatchDescriptor(), POLLIN, 0}
+		};
+
+		int ready = poll(pfds, 2, GetTimeoutMs());
+
+		if (ready < 0 && errno != EINTR) {
+			if (in_flight) {
+				Finish(-1);
+			}
+
+			continue;
+		}
+
+		if (ready > 0 && pfds[0].revents) {
+			HandleEvents(pfds[0].revents);
+		}
+
+		if (ready > 0 && pfds[1].revents) {
+			HandleWatchEvents();
+		}
+
+		HandleTimeout();
+	}
+}
+
+// state machine
+
+/**
+ * Queue command, sent right away if the line is free. Should the write
+ * fail, callback runs before this returns.
+ * @param char[][5] packets
+ * @param int count
+ * @param int expected Reply length
+ * @param Callback callback
+ * @param uint8_t* data Where read replies go, NULL for other commands
  * @return bool
  */
-bool Cat::GetRxStatus()
+bool Cat::Submit(const char packets[][5], int count, int expected, Callback callback, uint8_t * data)
 {
-	// form the packet
-	char packet[5] = {0x00, 0x00, 0x00, 0x00, CMD_GET_RX_STATUS};
+	Request request;
+	memcpy(request.packets, packets, count * 5);
+	request.count = count;
+	request.expected = expected;
+	request.attempts = 0;
+	request.data = data;
+	request.callback = callback;
+
+	requests.push_back(request);
+
+	if (!in_flight) {
+		StartNext();
+	}
 
-	// send packet to device
-	char count = SendPacket(packet);
+	return true;
+}
 
-	// check if we sent 5 bytes
-	if (count != 5) {
-		return false;
+/**
+ * Write the next queued command
+ * @return void
+ */
+void Cat::StartNext()
+{
+	while (!in_flight && !requests.empty()) {
+		if (!connected && !Reconnect()) {
+			// keep commands for the device to return, or give up on all of them
+			if (reconnect_hold_ms < 0 || Clock::MonotonicMs() - lost_at < reconnect_hold_ms) {
+				return;
+			}
+
+			Request request = requests.front();
+			requests.pop_front();
+
+			if (request.callback) {
+				request.callback(false);
+			}
+
+			continue;
+		}
+
+		Request & request = requests.front();
+		request.attempts++;
+
+		if (SendPackets(request.packets, request.count) == 5 * request.count) {
+			in_flight = true;
+			received = 0;
+			deadline = Clock::MonotonicMs() + health.GetTimeoutMs(5 * request.count, request.expected);
+			return;
+		}
+
+		// a write only fails once the device is gone
+		request.attempts = 0;
+		Lost();
 	}
+}
 
-	// read packet
-	char rx_packet[5] = {0};
-	char bytes_read = ReadPacket(rx_packet);
+/**
+ * Reply complete, timed out or failed: parse it, report and move on
+ * @param int byte_count -1 on read error
+ * @return void
+ */
+void Cat::Finish(int byte_count)
+{
+	Request request = requests.front();
+	in_flight = false;
 
-	if (bytes_read) {
-		int signal = rx_packet[0] & 0x0f;
-		bool centered = ~(rx_packet[0] & 0x20);
-		bool ctcss_dcs = rx_packet[0] & 0x40;
-		bool squelched = rx_packet[0] & 0x80;
+	// timed out before it was even sent in full
+	transport.CancelWrite();
 
-		if (verbose) {
-			cout << "Command> GetRxStatus: Signal: " << signal << " Centered: " << centered << " CTCSS/DCS: " << ctcss_dcs << " Squelched: " << squelched  << endl;
+	Account(reply, byte_count, request.expected);
+
+	if (byte_count == request.expected) {
+		TransportTiming timing = transport.GetTiming();
+
+		// Karn: a reply to a resent command may belong to either attempt
+		health.Success(timing.write_ms + timing.complete_ms, 5 * request.count, request.expected, request.attempts == 1);
+	} else {
+		health.Failure();
+
+		// the command is resent once the device is back
+		if (byte_count < 0) {
+			requests.front().attempts = 0;
+			Lost();
+			StartNext();
+			return;
 		}
 
-		// add to map
-		tcvr_status["rx_signal"] = to_string(signal);
-		tcvr_status["centered"] = to_string(centered);
-		tcvr_status["ctcss_dcs"] = to_string(ctcss_dcs);
-		tcvr_status["rx_squelched"] = to_string(squelched);
+		// timeouts and short replies are worth another try
+		if (request.attempts <= health.GetRetries()) {
+			if (verbose) {
+				cout << "Retrying " << CatStats::OpcodeName(request.packets[0][4]) << ", attempt " << request.attempts + 1 << endl;
+			}
 
-		return true;
+			StartNext();
+			return;
+		}
 	}
 
-	return false;
+	requests.pop_front();
+
+	bool ok = ParseReply(request, reply, byte_count < 0 ? 0 : byte_count);
+
+	if (request.callback) {
+		request.callback(ok);
+	}
+
+	// callback may have queued and started another command already
+	if (!in_flight) {
+		StartNext();
+	}
 }
 
 /**
- * Read current frequency and mode
+ * Store reply in status
+ * @param Request request
+ * @param char* packet
+ * @param int byte_count
  * @return bool
  */
-bool Cat::GetFrequencyModeStatus()
+bool Cat::ParseReply(const Request & request, const char * packet, int byte_count)
 {
-	// form the packet
-	char packet[5] = {0x00, 0x00, 0x00, 0x00, CMD_GET_FREQUENCY_MODE};
+	char opcode = request.packets[0][4];
 
-	// send packet to device
-	char count = SendPacket(packet);
+	if (opcode == CMD_READ_EEPROM) {
+		if (byte_count != request.expected) {
+			return false;
+		}
 
-	// check if we sent 5 bytes
-	if (count != 5) {
-		return false;
+		memcpy(request.data, packet, byte_count);
+
+		if (verbose) {
+			cout << "Command> ReadEeprom: " << byte_count << " bytes at 0x" << hex << setw(4) << setfill('0') << (((unsigned char)request.packets[0][0] << 8) | (unsigned char)request.packets[0][1]) << dec << setfill(' ') << endl;
+		}
+
+		return true;
+	}
+
+	if (request.count == 2 && opcode == CMD_GET_RX_STATUS) {
+		if (byte_count != 2) {
+			return false;
+		}
+
+		ParseRxStatus(packet[0]);
+
+		if (verbose) {
+			cout << "Command> SetFrequency: " << TcvrStatus::FormatFrequency(CatCodec::DecodeFrequency(request.packets[1])) << " MHz" << endl;
+		}
+
+		return true;
 	}
 
-	// read packet
-	char rx_packet[5] = {0};
-	char bytes_read = ReadPacket(rx_packet);
+	if (opcode == CMD_GET_TX_STATUS) {
+		if (byte_count != 1) {
+			return false;
+		}
+
+		unsigned char tx_status = packet[0];
 
-	if (bytes_read) {
-		string text_mode = FindKeyByValue(OP_MODES, rx_packet[4]);
-		double frequency = BytesToFrequency(rx_packet);
+		// tcvr answers 0xff while receiving, PTT bit is active low
+		int power = tx_status == 0xff ? 0 : tx_status & 0x0f;
+		bool split = !(tx_status & 0x20);
+		bool swr = tx_status != 0xff && (tx_status & 0x40);
+		bool ptt = !(tx_status & 0x80);
 
 		if (verbose) {
-			cout << "Command> GetFrequencyModeStatus: Mode: " << text_mode << " Frequency: " << frequency << " MHz" << endl;
+			cout << "Command> GetTxStatus: Power: " << power << " Split: " << split << " SWR: " << swr << " PTT: " << ptt << endl;
 		}
 
-		// add to map
-		tcvr_status["tcvr_mode"] = text_mode;
-		tcvr_status["tcvr_frequency"] = to_string(frequency);
+		status.tx_power = power;
+		status.split = split;
+		status.swr_high = swr;
+		status.ptt_on = ptt;
+		Publish(TcvrStatus::GROUP_TX);
 
 		return true;
 	}
 
-	return false;
+	if (opcode == CMD_GET_RX_STATUS) {
+		if (byte_count != 1) {
+			return false;
+		}
+
+		ParseRxStatus(packet[0]);
+
+		return true;
+	}
+
+	if (opcode == CMD_GET_FREQUENCY_MODE) {
+		if (byte_count != 5 || !CatCodec::IsValidFrequency(packet)) {
+			return false;
+		}
+
+		status.frequency_hz = CatCodec::DecodeFrequency(packet);
+		status.mode = packet[4];
+		Publish(TcvrStatus::GROUP_FREQUENCY_MODE);
+
+		if (verbose) {
+			cout << "Command> GetFrequencyModeStatus: Mode: " << CatCodec::ModeName(status.mode) << " Frequency: " << TcvrStatus::FormatFrequency(status.frequency_hz) << " MHz" << endl;
+		}
+
+		return true;
+	}
+
+	// set commands count as done once sent, the ack carries no information
+	if (verbose) {
+		if (opcode == CMD_LOCK_ON || opcode == CMD_LOCK_OFF) {
+			cout << "Command> Lock: " << (opcode == CMD_LOCK_ON) << endl;
+		} else if (opcode == CMD_PTT_ON || opcode == CMD_PTT_OFF) {
+			cout << "Command> PTT: " << (opcode == CMD_PTT_ON) << endl;
+		} else if (opcode == CMD_SET_FREQUENCY) {
+			cout << "Command> SetFrequency: " << TcvrStatus::FormatFrequency(CatCodec::DecodeFrequency(request.packets[0])) << " MHz" << endl;
+		} else if (opcode == CMD_SET_MODE) {
+			cout << "Command> SetOperatingMode: " << CatCodec::ModeName(request.packets[0][0]) << endl;
+		} else if (opcode == CMD_WRITE_EEPROM) {
+			cout << "Command> WriteEeprom: " << 2 * request.count << " bytes at 0x" << hex << setw(4) << setfill('0') << (((unsigned char)request.packets[0][0] << 8) | (unsigned char)request.packets[0][1]) << dec << setfill(' ') << endl;
+		}
+	}
+
+	return true;
 }
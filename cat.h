@@ -23,28 +23,111 @@
 #include <iomanip>
 #include <sys/stat.h>
 #include <locale>
+#include <deque>
+#include <functional>
+#include "serial_transport.h"
+#include "cat_stats.h"
+#include "link_health.h"
+#include "device_watch.h"
+#include "cat_codec.h"
+#include "seqlock.h"
+#include "tcvr_status.h"
 
 using namespace std;
 
 #ifndef APRS_H
 #define APRS_H
 
+/**
+ * FT-817/857/897 CAT protocol. Commands are queued and run one at a time
+ * by a small state machine over the serial fd: a command is written, then
+ * the reply is collected from HandleEvents() whenever the fd is readable,
+ * or given up on in HandleTimeout() once LinkHealth's timeout for the baud
+ * rate and the tcvr's learned response time passed. Timed out commands are
+ * resent a few times unless the link is down. Should the serial device
+ * fail or vanish, it is closed and the queue held (see SetReconnectHold())
+ * until the device shows up again, announced on GetWatchDescriptor() or
+ * found by HandleTimeout(); then it is reopened and the command resent.
+ * The *Async() methods return right away and report through a callback,
+ * so a host event loop can watch GetFileDescriptor() for GetEvents() and
+ * GetTimeoutMs() for the next deadline. The plain methods are wrappers
+ * that wait on the fd with poll(). Use one Cat from one thread.
+ *
+ * The EEPROM commands are undocumented but answered by every FT-8xx: a
+ * read returns the two bytes at an address, a write stores two. Blocks
+ * of up to MAX_EEPROM_BLOCK bytes go out as one write of back to back
+ * commands, so a bulk transfer waits for the tcvr once per block rather
+ * than once per two bytes.
+ */
 class Cat
 {
+	public:
+		typedef function<void(bool ok)> Callback;
+
 	private:
-		int uart0_filestream, uart0_speed;
+		// commands sent back to back in one request
+		static const int MAX_PACKETS = 8;
+
+		struct Request {
+			char packets[MAX_PACKETS][5];
+			int count;
+			int expected;
+			int attempts;
+			uint8_t * data;
+			Callback callback;
+		};
+
+		int uart0_speed;
+		int baud;
 		string uart0_device;
+		SerialTransport transport;
+		DeviceWatch watch;
+		CatStats stats;
+		LinkHealth health;
+
+		// commands whose replies are being collected
+		char pending[16];
+		int pending_count;
+
+		// command state machine
+		deque<Request> requests;
+		bool in_flight;
+		char reply[2 * MAX_PACKETS];
+		int received;
+		double deadline;
+
+		// lost serial device
+		bool connected;
+		double lost_at;
+		int reconnect_hold_ms;
 
 		bool verbose;
-		map<string, string> tcvr_status;
 
-		char SendPacket(char packet[5]);
-		char ReadPacket(char * packet);
-		string FindKeyByValue(const map<string, char> dictionary, char value);
-		double BytesToFrequency(char * bytes);
-		char ConvertToBase(double value, char base);
+		// written by the thread talking to the tcvr, published for everyone else
+		TcvrStatus status;
+		SeqLock<TcvrStatus> published;
+
+		char SendPackets(char packets[][5], int count);
+		void Account(const char * packet, int byte_count, int expected);
+		bool Submit(const char packets[][5], int count, int expected, Callback callback, uint8_t * data = NULL);
+		void StartNext();
+		void Finish(int byte_count);
+		void SetSpeed(int port_speed);
+		bool DetectSpeed();
+		void Lost();
+		bool ParseReply(const Request & request, const char * packet, int byte_count);
+		static uint32_t ToHz(double frequency);
+		void Publish(TcvrStatus::Group group);
+		void ParseRxStatus(char rx_status);
+		static int ReplyLength(char opcode);
 
 	public:
+		// reply wait per speed when looking for the tcvr's baud rate, on top of wire time
+		static const int PROBE_TIMEOUT_MS = 60;
+
+		// EEPROM bytes per read or write call, even
+		static const int MAX_EEPROM_BLOCK = 2 * MAX_PACKETS;
+
 		static const char CMD_LOCK_ON;
 		static const char CMD_LOCK_OFF;
 		static const char CMD_PTT_ON;
@@ -54,6 +137,8 @@ class Cat
 		static const char CMD_SET_MODE;
 		static const char CMD_GET_RX_STATUS;
 		static const char CMD_GET_TX_STATUS;
+		static const char CMD_READ_EEPROM;
+		static const char CMD_WRITE_EEPROM;
 
 		static const char OP_MODE_LSB;
 		static const char OP_MODE_USB;
@@ -75,9 +160,20 @@ class Cat
 		// setters & getters
 		void SetVerbose(bool v);
 		map<string, string> GetTcvrStatus();
+		TcvrStatus GetStatus();
+		void GetStatus(TcvrStatus & snapshot);
+		int GetFileDescriptor();
+		uint32_t GetEvents();
+		CatStats * GetStats();
+		LinkHealth * GetLinkHealth();
+		string Stats(const string & format);
 
 		bool Connect(string serial_device = "", int port_speed = B9600);
+		void SetReconnectHold(int ms);
+		bool IsConnected();
+		bool Reconnect();
 		string Json(bool print = true);
+		void DiscardInput();
 
 		// CAT functions
 		bool Lock(bool enabled);
@@ -98,6 +194,31 @@ class Cat
 		bool GetTxStatus();
 		bool GetRxStatus();
 		bool GetFrequencyModeStatus();
+		bool GetRxStatusAndSetFrequency(double next_frequency);
+		bool ReadEeprom(uint16_t address, uint8_t * data, int length);
+		bool WriteEeprom(uint16_t address, const uint8_t * data, int length);
+
+		// asynchronous CAT functions, false if the command can not be formed
+		bool LockAsync(bool enabled, Callback callback);
+		bool PttAsync(bool enabled, Callback callback);
+		bool SetFrequencyAsync(double frequency, Callback callback);
+		bool SetOperatingModeAsync(char mode, Callback callback);
+		bool SetOperatingModeAsync(string mode, Callback callback);
+		bool GetTxStatusAsync(Callback callback);
+		bool GetRxStatusAsync(Callback callback);
+		bool GetFrequencyModeStatusAsync(Callback callback);
+		bool GetRxStatusAndSetFrequencyAsync(double next_frequency, Callback callback);
+		bool ReadEepromAsync(uint16_t address, uint8_t * data, int length, Callback callback);
+		bool WriteEepromAsync(uint16_t address, const uint8_t * data, int length, Callback callback);
+
+		// event loop integration
+		bool IsBusy();
+		int GetTimeoutMs();
+		void HandleEvents(uint32_t events);
+		void HandleTimeout();
+		int GetWatchDescriptor();
+		void HandleWatchEvents();
+		void Wait();
 };
 
 #endif
@@ -0,0 +1,178 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include <stdint.h>
+
+using namespace std;
+
+#ifndef CAT_CODEC_H
+#define CAT_CODEC_H
+
+/**
+ * Packed BCD frequency and operating mode codec for CAT frames. Frequency
+ * is carried as 8 BCD digits in 10 Hz units, most significant first, so
+ * 14.190 MHz is 01 41 90 00. Everything works on integer Hz and table
+ * lookups, nothing allocates and all of it can run at compile time.
+ */
+namespace CatCodec
+{
+	// value 0 - 99 to packed BCD byte
+	#define CAT_CODEC_ENCODE_ROW(t) \
+		(t << 4) | 0, (t << 4) | 1, (t << 4) | 2, (t << 4) | 3, (t << 4) | 4, \
+		(t << 4) | 5, (t << 4) | 6, (t << 4) | 7, (t << 4) | 8, (t << 4) | 9
+
+	constexpr unsigned char BCD_ENCODE[100] = {
+		CAT_CODEC_ENCODE_ROW(0), CAT_CODEC_ENCODE_ROW(1), CAT_CODEC_ENCODE_ROW(2), CAT_CODEC_ENCODE_ROW(3), CAT_CODEC_ENCODE_ROW(4),
+		CAT_CODEC_ENCODE_ROW(5), CAT_CODEC_ENCODE_ROW(6), CAT_CODEC_ENCODE_ROW(7), CAT_CODEC_ENCODE_ROW(8), CAT_CODEC_ENCODE_ROW(9)
+	};
+
+	// packed BCD byte to value 0 - 99, BCD_INVALID for nibbles above 9
+	const unsigned char BCD_INVALID = 0xff;
+
+	#define CAT_CODEC_DECODE(h, l) ((h) < 10 && (l) < 10 ? (h) * 10 + (l) : BCD_INVALID)
+	#define CAT_CODEC_DECODE_ROW(h) \
+		CAT_CODEC_DECODE(h, 0), CAT_CODEC_DECODE(h, 1), CAT_CODEC_DECODE(h, 2), CAT_CODEC_DECODE(h, 3), \
+		CAT_CODEC_DECODE(h, 4), CAT_CODEC_DECODE(h, 5), CAT_CODEC_DECODE(h, 6), CAT_CODEC_DECODE(h, 7), \
+		CAT_CODEC_DECODE(h, 8), CAT_CODEC_DECODE(h, 9), CAT_CODEC_DECODE(h, 10), CAT_CODEC_DECODE(h, 11), \
+		CAT_CODEC_DECODE(h, 12), CAT_CODEC_DECODE(h, 13), CAT_CODEC_DECODE(h, 14), CAT_CODEC_DECODE(h, 15)
+
+	constexpr unsigned char BCD_DECODE[256] = {
+		CAT_CODEC_DECODE_ROW(0), CAT_CODEC_DECODE_ROW(1), CAT_CODEC_DECODE_ROW(2), CAT_CODEC_DECODE_ROW(3),
+		CAT_CODEC_DECODE_ROW(4), CAT_CODEC_DECODE_ROW(5), CAT_CODEC_DECODE_ROW(6), CAT_CODEC_DECODE_ROW(7),
+		CAT_CODEC_DECODE_ROW(8), CAT_CODEC_DECODE_ROW(9), CAT_CODEC_DECODE_ROW(10), CAT_CODEC_DECODE_ROW(11),
+		CAT_CODEC_DECODE_ROW(12), CAT_CODEC_DECODE_ROW(13), CAT_CODEC_DECODE_ROW(14), CAT_CODEC_DECODE_ROW(15)
+	};
+
+	#undef CAT_CODEC_ENCODE_ROW
+	#undef CAT_CODEC_DECODE
+	#undef CAT_CODEC_DECODE_ROW
+
+	// highest frequency 8 digits of 10 Hz can carry
+	const uint32_t MAX_FREQUENCY_HZ = 999999990;
+
+	/**
+	 * Frequency as the four frame bytes packed into one word, first byte on top
+	 * @param uint32_t hz Rounded to 10 Hz
+	 * @return uint32_t
+	 */
+	constexpr uint32_t PackFrequency(uint32_t hz)
+	{
+		return hz > MAX_FREQUENCY_HZ ? PackFrequency(MAX_FREQUENCY_HZ) :
+			(uint32_t)BCD_ENCODE[(hz + 5) / 10 / 1000000 % 100] << 24 |
+			(uint32_t)BCD_ENCODE[(hz + 5) / 10 / 10000 % 100] << 16 |
+			(uint32_t)BCD_ENCODE[(hz + 5) / 10 / 100 % 100] << 8 |
+			(uint32_t)BCD_ENCODE[(hz + 5) / 10 % 100];
+	}
+
+	/**
+	 * Write frequency into first four bytes of a frame
+	 * @param uint32_t hz
+	 * @param char* bytes
+	 * @return void
+	 */
+	inline void EncodeFrequency(uint32_t hz, char * bytes)
+	{
+		uint32_t packed = PackFrequency(hz);
+
+		bytes[0] = packed >> 24;
+		bytes[1] = packed >> 16;
+		bytes[2] = packed >> 8;
+		bytes[3] = packed;
+	}
+
+	/**
+	 * Read frequency from first four bytes of a reply
+	 * @param char* bytes
+	 * @return uint32_t Hz
+	 */
+	constexpr uint32_t DecodeFrequency(const char * bytes)
+	{
+		return (((BCD_DECODE[(unsigned char)bytes[0]] * 100u +
+			BCD_DECODE[(unsigned char)bytes[1]]) * 100u +
+			BCD_DECODE[(unsigned char)bytes[2]]) * 100u +
+			BCD_DECODE[(unsigned char)bytes[3]]) * 10u;
+	}
+
+	/**
+	 * All eight nibbles are decimal digits
+	 * @param char* bytes
+	 * @return bool
+	 */
+	constexpr bool IsValidFrequency(const char * bytes)
+	{
+		return BCD_DECODE[(unsigned char)bytes[0]] != BCD_INVALID && BCD_DECODE[(unsigned char)bytes[1]] != BCD_INVALID &&
+			BCD_DECODE[(unsigned char)bytes[2]] != BCD_INVALID && BCD_DECODE[(unsigned char)bytes[3]] != BCD_INVALID;
+	}
+
+	struct Mode {
+		unsigned char code;
+		const char * name;
+	};
+
+	// same codes as Cat::OP_MODE_XXX
+	constexpr Mode MODES[] = {
+		{0x00, "LSB"},
+		{0x01, "USB"},
+		{0x02, "CW"},
+		{0x03, "CWR"},
+		{0x04, "AM"},
+		{0x06, "WFM"},
+		{0x08, "FM"},
+		{0x88, "FMN"},
+		{0x0a, "DIG"},
+		{0x0c, "PKT"}
+	};
+
+	const int MODE_COUNT = sizeof(MODES) / sizeof(MODES[0]);
+
+	/**
+	 * Mode name for code reported by tcvr
+	 * @param unsigned char code
+	 * @param int i Search start, leave default
+	 * @return const char* Empty for unknown code
+	 */
+	constexpr const char * ModeName(unsigned char code, int i = 0)
+	{
+		return i == MODE_COUNT ? "" : MODES[i].code == code ? MODES[i].name : ModeName(code, i + 1);
+	}
+
+	/**
+	 * Compare mode names, ASCII case insensitive
+	 * @param char* a
+	 * @param char* b
+	 * @return bool
+	 */
+	constexpr bool SameName(const char * a, const char * b)
+	{
+		return *a == 0 || *b == 0 ? *a == *b : (*a | 0x20) != (*b | 0x20) ? false : SameName(a + 1, b + 1);
+	}
+
+	/**
+	 * Mode code for name
+	 * @param char* name e.g. USB or usb
+	 * @param int i Search start, leave default
+	 * @return int -1 for unknown name
+	 */
+	constexpr int ModeCode(const char * name, int i = 0)
+	{
+		return i == MODE_COUNT ? -1 : SameName(MODES[i].name, name) ? MODES[i].code : ModeCode(name, i + 1);
+	}
+
+	static_assert(PackFrequency(14190000) == 0x01419000, "14.190 MHz must encode as 01 41 90 00");
+	static_assert(PackFrequency(145787500) == 0x14578750, "145.7875 MHz must encode as 14 57 87 50");
+	static_assert(DecodeFrequency("\x43\x94\x50\x00") == 439450000, "43 94 50 00 must decode as 439.450 MHz");
+	static_assert(!IsValidFrequency("\x01\x4a\x90\x00"), "nibbles above 9 are not BCD");
+	static_assert(ModeCode(ModeName(0x88)) == 0x88, "mode lookups must round trip");
+	static_assert(ModeCode("usb") == 0x01 && ModeCode("XYZ") == -1, "mode names are case insensitive");
+}
+
+#endif
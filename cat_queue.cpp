@@ -0,0 +1,477 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "cat_queue.h"
+#include "clock.h"
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/eventfd.h>
+
+using namespace std;
+
+static const char * PRIORITY_NAMES[CatQueue::PRIORITY_COUNT] = {"urgent", "set", "poll"};
+
+// constructor
+
+/**
+ * Constructor
+ * @param Cat* c Connected tcvr, owned by the queue from now on
+ * @param size_t client_limit Max commands one client may have queued
+ */
+CatQueue::CatQueue(Cat * c, size_t client_limit)
+{
+	cat = c;
+	per_client_limit = client_limit;
+	cpu = -1;
+	running = false;
+	rejected = 0;
+	service_total_ms = 0;
+	depth_max = 0;
+	tcvr_status.Clear();
+
+	for (int i = 0; i < PRIORITY_COUNT; i++) {
+		lanes[i].depth = 0;
+		executed[i] = 0;
+		wait_total_ms[i] = 0;
+		wait_max_ms[i] = 0;
+	}
+
+	event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+// destructor
+
+CatQueue::~CatQueue()
+{
+	Stop();
+
+	if (event_fd >= 0) {
+		close(event_fd);
+	}
+}
+
+// setters & getters
+
+/**
+ * Pin worker thread to one core, takes effect on Start()
+ * @param int core -1 lets the scheduler pick
+ * @return void
+ */
+void CatQueue::SetCpu(int core)
+{
+	cpu = core;
+}
+
+// public methods
+
+/**
+ * Start worker thread
+ * @return bool
+ */
+bool CatQueue::Start()
+{
+	if (running || event_fd < 0) {
+		return false;
+	}
+
+	running = true;
+	worker = thread(&CatQueue::Worker, this);
+
+	if (cpu >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+
+		int result = pthread_setaffinity_np(worker.native_handle(), sizeof(cpus), &cpus);
+
+		if (result != 0) {
+			cout << "Unable to pin CAT worker to CPU " << cpu << ": " << strerror(result) << endl;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Drain queued commands and stop worker thread
+ * @return void
+ */
+void CatQueue::Stop()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		running = false;
+	}
+
+	wake.notify_all();
+
+	if (worker.joinable()) {
+		worker.join();
+	}
+}
+
+/**
+ * Map CAT opcode to queue priority
+ * @param char opcode
+ * @return int
+ */
+int CatQueue::PriorityOf(char opcode)
+{
+	if (opcode == Cat::CMD_PTT_OFF || opcode == Cat::CMD_LOCK_ON || opcode == Cat::CMD_LOCK_OFF) {
+		return PRIORITY_URGENT;
+	}
+
+	if (opcode == Cat::CMD_GET_FREQUENCY_MODE || opcode == Cat::CMD_GET_RX_STATUS || opcode == Cat::CMD_GET_TX_STATUS || opcode == Cat::CMD_READ_EEPROM) {
+		return PRIORITY_POLL;
+	}
+
+	return PRIORITY_SET;
+}
+
+/**
+ * Queue command for execution
+ * @param CatCommand command
+ * @return bool False if client has too many commands queued
+ */
+bool CatQueue::Submit(CatCommand command)
+{
+	command.priority = PriorityOf(command.opcode);
+	command.queued = Clock::MonotonicMs();
+
+	{
+		lock_guard<mutex> guard(lock);
+
+		// PTT release must never be refused
+		if (client_depth[command.client] >= per_client_limit && command.priority != PRIORITY_URGENT) {
+			rejected++;
+			return false;
+		}
+
+		Lane & lane = lanes[command.priority];
+		deque<CatCommand> & pending = lane.clients[command.client];
+
+		if (pending.empty()) {
+			lane.order.push_back(command.client);
+		}
+
+		pending.push_back(command);
+		lane.depth++;
+		client_depth[command.client]++;
+
+		size_t depth = 0;
+
+		for (int i = 0; i < PRIORITY_COUNT; i++) {
+			depth += lanes[i].depth;
+		}
+
+		depth_max = max(depth_max, depth);
+	}
+
+	wake.notify_one();
+
+	return true;
+}
+
+/**
+ * Drop everything a client still has queued, e.g. after disconnect
+ * @param int client
+ * @return void
+ */
+void CatQueue::Forget(int client)
+{
+	lock_guard<mutex> guard(lock);
+
+	for (int i = 0; i < PRIORITY_COUNT; i++) {
+		Lane & lane = lanes[i];
+		auto it = lane.clients.find(client);
+
+		if (it == lane.clients.end()) {
+			continue;
+		}
+
+		// urgent commands (PTT off) still go out
+		if (i == PRIORITY_URGENT) {
+			for (auto command = it->second.begin(); command != it->second.end(); ++command) {
+				command->callback = nullptr;
+			}
+
+			continue;
+		}
+
+		lane.depth -= it->second.size();
+		lane.clients.erase(it);
+
+		for (auto order = lane.order.begin(); order != lane.order.end(); ++order) {
+			if (*order == client) {
+				lane.order.erase(order);
+				break;
+			}
+		}
+	}
+
+	if (lanes[PRIORITY_URGENT].clients.count(client)) {
+		client_depth[client] = lanes[PRIORITY_URGENT].clients[client].size();
+	} else {
+		client_depth.erase(client);
+	}
+}
+
+/**
+ * Descriptor that becomes readable when DispatchCompletions() has work
+ * @return int
+ */
+int CatQueue::GetEventFd()
+{
+	return event_fd;
+}
+
+/**
+ * Run callbacks of finished commands on the calling (event loop) thread
+ * @return void
+ */
+void CatQueue::DispatchCompletions()
+{
+	uint64_t value;
+
+	if (read(event_fd, &value, sizeof(value)) < 0) {
+		// nothing signalled, completions may still be there
+	}
+
+	deque<Completion> ready;
+
+	{
+		lock_guard<mutex> guard(lock);
+		ready.swap(completed);
+	}
+
+	for (auto it = ready.begin(); it != ready.end(); ++it) {
+		tcvr_status = it->result.status;
+
+		if (it->command.callback) {
+			it->command.callback(it->result);
+		}
+
+		if (it->result.ok && status_listener) {
+			status_listener(tcvr_status);
+		}
+	}
+}
+
+/**
+ * Number of queued commands
+ * @return size_t
+ */
+size_t CatQueue::GetDepth()
+{
+	lock_guard<mutex> guard(lock);
+	size_t depth = 0;
+
+	for (int i = 0; i < PRIORITY_COUNT; i++) {
+		depth += lanes[i].depth;
+	}
+
+	return depth;
+}
+
+/**
+ * Status as of the last completed command (event loop thread only)
+ * @return TcvrStatus
+ */
+TcvrStatus CatQueue::GetTcvrStatus()
+{
+	return tcvr_status;
+}
+
+/**
+ * Typed status snapshot, safe from any thread
+ * @return TcvrStatus
+ */
+TcvrStatus CatQueue::GetStatus()
+{
+	return cat->GetStatus();
+}
+
+/**
+ * Get told about every status update (event loop thread)
+ * @param function listener
+ * @return void
+ */
+void CatQueue::SetStatusListener(function<void(const TcvrStatus &)> listener)
+{
+	status_listener = listener;
+}
+
+/**
+ * Queue statistics as key:value lines
+ * @return string
+ */
+string CatQueue::Stats()
+{
+	lock_guard<mutex> guard(lock);
+	stringstream output;
+	size_t depth = 0;
+	uint64_t total = 0;
+
+	for (int i = 0; i < PRIORITY_COUNT; i++) {
+		depth += lanes[i].depth;
+		total += executed[i];
+	}
+
+	output << fixed << setprecision(3);
+	output << "queue_depth:" << depth << "\n";
+	output << "queue_depth_max:" << depth_max << "\n";
+	output << "queue_rejected:" << rejected << "\n";
+	output << "queue_service_avg_ms:" << (total ? service_total_ms / total : 0) << "\n";
+
+	for (int i = 0; i < PRIORITY_COUNT; i++) {
+		output << "queue_" << PRIORITY_NAMES[i] << "_depth:" << lanes[i].depth << "\n";
+		output << "queue_" << PRIORITY_NAMES[i] << "_executed:" << executed[i] << "\n";
+		output << "queue_" << PRIORITY_NAMES[i] << "_wait_avg_ms:" << (executed[i] ? wait_total_ms[i] / executed[i] : 0) << "\n";
+		output << "queue_" << PRIORITY_NAMES[i] << "_wait_max_ms:" << wait_max_ms[i] << "\n";
+	}
+
+	return output.str();
+}
+
+// private methods
+
+/**
+ * Pop next command: highest priority lane first, round robin over
+ * clients inside a lane. Caller holds the lock.
+ * @param CatCommand command
+ * @return bool
+ */
+bool CatQueue::Next(CatCommand & command)
+{
+	for (int i = 0; i < PRIORITY_COUNT; i++) {
+		Lane & lane = lanes[i];
+
+		if (lane.order.empty()) {
+			continue;
+		}
+
+		int client = lane.order.front();
+		lane.order.pop_front();
+
+		deque<CatCommand> & pending = lane.clients[client];
+		command = pending.front();
+		pending.pop_front();
+		lane.depth--;
+
+		// client goes to the back of the line if it has more
+		if (pending.empty()) {
+			lane.clients.erase(client);
+		} else {
+			lane.order.push_back(client);
+		}
+
+		if (--client_depth[client] == 0) {
+			client_depth.erase(client);
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Run one CAT transaction, an EEPROM read fills command.data
+ * @param CatCommand command
+ * @return bool
+ */
+bool CatQueue::Execute(CatCommand & command)
+{
+	if (command.opcode == Cat::CMD_LOCK_ON || command.opcode == Cat::CMD_LOCK_OFF) {
+		return cat->Lock(command.opcode == Cat::CMD_LOCK_ON);
+	} else if (command.opcode == Cat::CMD_PTT_ON || command.opcode == Cat::CMD_PTT_OFF) {
+		return cat->Ptt(command.opcode == Cat::CMD_PTT_ON);
+	} else if (command.opcode == Cat::CMD_SET_FREQUENCY) {
+		return cat->SetFrequency(command.frequency);
+	} else if (command.opcode == Cat::CMD_SET_MODE) {
+		return cat->SetOperatingMode(command.mode);
+	} else if (command.opcode == Cat::CMD_GET_FREQUENCY_MODE) {
+		return cat->GetFrequencyModeStatus();
+	} else if (command.opcode == Cat::CMD_GET_RX_STATUS) {
+		return cat->GetRxStatus();
+	} else if (command.opcode == Cat::CMD_GET_TX_STATUS) {
+		return cat->GetTxStatus();
+	} else if (command.opcode == Cat::CMD_READ_EEPROM) {
+		return cat->ReadEeprom(command.address, command.data.data(), command.data.size());
+	} else if (command.opcode == Cat::CMD_WRITE_EEPROM) {
+		return cat->WriteEeprom(command.address, command.data.data(), command.data.size());
+	}
+
+	return false;
+}
+
+/**
+ * Worker thread, the only place that touches the serial port
+ * @return void
+ */
+void CatQueue::Worker()
+{
+	while (true) {
+		CatCommand command;
+
+		{
+			unique_lock<mutex> guard(lock);
+			wake.wait(guard, [this] {
+				return !running || lanes[PRIORITY_URGENT].depth || lanes[PRIORITY_SET].depth || lanes[PRIORITY_POLL].depth;
+			});
+
+			if (!Next(command)) {
+				// queue drained and asked to stop
+				return;
+			}
+		}
+
+		double started = Clock::MonotonicMs();
+
+		if (command.prepare) {
+			command.prepare(command);
+		}
+
+		Completion completion;
+		completion.result.ok = Execute(command);
+		cat->GetStatus(completion.result.status);
+
+		if (command.opcode == Cat::CMD_READ_EEPROM && completion.result.ok) {
+			completion.result.data = command.data;
+		}
+
+		double finished = Clock::MonotonicMs();
+
+		completion.result.wait_ms = started - command.queued;
+		completion.result.service_ms = finished - started;
+		completion.command = command;
+
+		{
+			lock_guard<mutex> guard(lock);
+			int priority = command.priority;
+
+			executed[priority]++;
+			wait_total_ms[priority] += completion.result.wait_ms;
+			wait_max_ms[priority] = max(wait_max_ms[priority], completion.result.wait_ms);
+			service_total_ms += completion.result.service_ms;
+
+			completed.push_back(completion);
+		}
+
+		uint64_t one = 1;
+
+		if (write(event_fd, &one, sizeof(one)) < 0) {
+			// counter is saturated, loop will wake up anyway
+		}
+	}
+}
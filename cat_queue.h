@@ -0,0 +1,134 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "cat.h"
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#ifndef CAT_QUEUE_H
+#define CAT_QUEUE_H
+
+struct CatResult {
+	bool ok;
+	TcvrStatus status;			// snapshot taken right after the command
+	double wait_ms;
+	double service_ms;
+	vector<uint8_t> data;		// bytes read by CMD_READ_EEPROM
+
+	CatResult() : ok(false), wait_ms(0), service_ms(0) { status.Clear(); }
+};
+
+struct CatCommand {
+	char opcode;
+	double frequency;
+	string mode;
+	uint16_t address;			// EEPROM commands
+	vector<uint8_t> data;		// bytes to write, or read length
+	int client;
+	function<void(const CatResult &)> callback;
+
+	// runs on the worker thread right before the command goes out and may
+	// still change it, so only thread safe state is allowed in there
+	function<void(CatCommand &)> prepare;
+
+	// filled in by CatQueue
+	int priority;
+	double queued;
+
+	CatCommand() : opcode(0), frequency(0), address(0), client(0), priority(0), queued(0) {}
+};
+
+/**
+ * Single owner of the serial port. Commands from any number of clients are
+ * queued by priority and executed one CAT transaction at a time on a worker
+ * thread; results are handed back to the host event loop through an eventfd.
+ */
+class CatQueue
+{
+	public:
+		enum Priority {
+			PRIORITY_URGENT = 0,
+			PRIORITY_SET,
+			PRIORITY_POLL,
+			PRIORITY_COUNT
+		};
+
+		CatQueue(Cat * c, size_t client_limit = 16);
+		~CatQueue();
+
+		void SetCpu(int core);
+
+		bool Start();
+		void Stop();
+
+		bool Submit(CatCommand command);
+		void Forget(int client);
+
+		int GetEventFd();
+		void DispatchCompletions();
+
+		size_t GetDepth();
+		TcvrStatus GetTcvrStatus();
+		TcvrStatus GetStatus();
+		void SetStatusListener(function<void(const TcvrStatus &)> listener);
+		string Stats();
+
+		static int PriorityOf(char opcode);
+
+	private:
+		struct Lane {
+			map<int, deque<CatCommand> > clients;
+			deque<int> order;
+			size_t depth;
+		};
+
+		struct Completion {
+			CatCommand command;
+			CatResult result;
+		};
+
+		Cat * cat;
+		size_t per_client_limit;
+		int event_fd;
+		int cpu;
+		bool running;
+
+		thread worker;
+		mutex lock;
+		condition_variable wake;
+
+		Lane lanes[PRIORITY_COUNT];
+		map<int, size_t> client_depth;
+		deque<Completion> completed;
+		TcvrStatus tcvr_status;
+		function<void(const TcvrStatus &)> status_listener;
+
+		uint64_t executed[PRIORITY_COUNT];
+		uint64_t rejected;
+		double wait_total_ms[PRIORITY_COUNT];
+		double wait_max_ms[PRIORITY_COUNT];
+		double service_total_ms;
+		size_t depth_max;
+
+		void Worker();
+		bool Next(CatCommand & command);
+		bool Execute(CatCommand & command);
+};
+
+#endif
@@ -0,0 +1,324 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "cat_stats.h"
+#include "cat.h"
+
+using namespace std;
+
+const char * CatStats::OUTCOME_NAMES[4] = {"ok", "timeout", "short", "error"};
+
+// constructor
+
+LatencyHistogram::LatencyHistogram()
+{
+	for (int i = 0; i < BUCKET_COUNT; i++) {
+		buckets[i].store(0);
+	}
+
+	count.store(0);
+	sum_us.store(0);
+	max_us.store(0);
+}
+
+// public methods
+
+/**
+ * Add one sample
+ * @param double ms
+ * @return void
+ */
+void LatencyHistogram::Record(double ms)
+{
+	uint64_t us = ms > 0 ? (uint64_t)(ms * 1000) : 0;
+	int bucket = 63 - __builtin_clzll(us | 1);
+
+	if (bucket >= BUCKET_COUNT) {
+		bucket = BUCKET_COUNT - 1;
+	}
+
+	buckets[bucket].fetch_add(1, memory_order_relaxed);
+	count.fetch_add(1, memory_order_relaxed);
+	sum_us.fetch_add(us, memory_order_relaxed);
+
+	uint64_t seen = max_us.load(memory_order_relaxed);
+
+	while (us > seen && !max_us.compare_exchange_weak(seen, us, memory_order_relaxed)) {
+	}
+}
+
+uint64_t LatencyHistogram::GetCount()
+{
+	return count.load(memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::GetBucket(int i)
+{
+	return buckets[i].load(memory_order_relaxed);
+}
+
+double LatencyHistogram::GetSumMs()
+{
+	return sum_us.load(memory_order_relaxed) / 1000.0;
+}
+
+double LatencyHistogram::GetMaxMs()
+{
+	return max_us.load(memory_order_relaxed) / 1000.0;
+}
+
+/**
+ * Upper bound of the bucket holding given quantile, never above max
+ * @param double p 0 - 1
+ * @return double Milliseconds
+ */
+double LatencyHistogram::Percentile(double p)
+{
+	uint64_t total = GetCount();
+
+	if (total == 0) {
+		return 0;
+	}
+
+	uint64_t rank = (uint64_t)(p * total + 0.5);
+	uint64_t seen = 0;
+
+	if (rank < 1) {
+		rank = 1;
+	}
+
+	for (int i = 0; i < BUCKET_COUNT; i++) {
+		seen += GetBucket(i);
+
+		if (seen >= rank) {
+			double bound = BucketBoundMs(i);
+			return bound < GetMaxMs() ? bound : GetMaxMs();
+		}
+	}
+
+	return GetMaxMs();
+}
+
+/**
+ * Upper bound of bucket
+ * @param int i
+ * @return double Milliseconds
+ */
+double LatencyHistogram::BucketBoundMs(int i)
+{
+	return (double)(1ULL << (i + 1)) / 1000.0;
+}
+
+// constructor
+
+CatStats::CatStats()
+{
+	for (int i = 0; i < 256; i++) {
+		opcodes[i].sent.store(0);
+		opcodes[i].bytes_out.store(0);
+		opcodes[i].bytes_in.store(0);
+
+		for (int j = 0; j < 4; j++) {
+			opcodes[i].outcomes[j].store(0);
+		}
+	}
+}
+
+// public methods
+
+/**
+ * Command went out on the wire
+ * @param char opcode
+ * @param size_t bytes
+ * @return void
+ */
+void CatStats::Sent(char opcode, size_t bytes)
+{
+	Counters & counters = opcodes[(unsigned char)opcode];
+	counters.sent.fetch_add(1, memory_order_relaxed);
+	counters.bytes_out.fetch_add(bytes, memory_order_relaxed);
+}
+
+/**
+ * Reply arrived (or did not), latency is only kept for complete replies
+ * @param char opcode
+ * @param Outcome outcome
+ * @param size_t bytes Reply bytes received
+ * @param double round_trip_ms Start of write to last reply byte
+ * @return void
+ */
+void CatStats::Completed(char opcode, Outcome outcome, size_t bytes, double round_trip_ms)
+{
+	Counters & counters = opcodes[(unsigned char)opcode];
+	counters.outcomes[outcome].fetch_add(1, memory_order_relaxed);
+	counters.bytes_in.fetch_add(bytes, memory_order_relaxed);
+
+	if (outcome == OUTCOME_OK) {
+		counters.latency.Record(round_trip_ms);
+	}
+}
+
+/**
+ * Same key:value lines the server uses for queue and cache stats
+ * @return string
+ */
+string CatStats::Text()
+{
+	stringstream output;
+	output << fixed << setprecision(3);
+
+	for (int i = 0; i < 256; i++) {
+		Counters & counters = opcodes[i];
+
+		if (!counters.sent.load(memory_order_relaxed)) {
+			continue;
+		}
+
+		string prefix = "cat_" + OpcodeName(i) + "_";
+
+		output << prefix << "sent:" << counters.sent.load(memory_order_relaxed) << "\n";
+
+		for (int j = 0; j < 4; j++) {
+			output << prefix << OUTCOME_NAMES[j] << ":" << counters.outcomes[j].load(memory_order_relaxed) << "\n";
+		}
+
+		output << prefix << "bytes_out:" << counters.bytes_out.load(memory_order_relaxed) << "\n";
+		output << prefix << "bytes_in:" << counters.bytes_in.load(memory_order_relaxed) << "\n";
+		output << prefix << "p50_ms:" << counters.latency.Percentile(0.5) << "\n";
+		output << prefix << "p99_ms:" << counters.latency.Percentile(0.99) << "\n";
+		output << prefix << "max_ms:" << counters.latency.GetMaxMs() << "\n";
+	}
+
+	return output.str();
+}
+
+/**
+ * One JSON object keyed by opcode name
+ * @return string
+ */
+string CatStats::Json()
+{
+	stringstream output;
+	bool first = true;
+
+	output << fixed << setprecision(3) << "{";
+
+	for (int i = 0; i < 256; i++) {
+		Counters & counters = opcodes[i];
+
+		if (!counters.sent.load(memory_order_relaxed)) {
+			continue;
+		}
+
+		output << (first ? "" : ",") << "\"" << OpcodeName(i) << "\":{";
+		output << "\"sent\":" << counters.sent.load(memory_order_relaxed);
+
+		for (int j = 0; j < 4; j++) {
+			output << ",\"" << OUTCOME_NAMES[j] << "\":" << counters.outcomes[j].load(memory_order_relaxed);
+		}
+
+		output << ",\"bytes_out\":" << counters.bytes_out.load(memory_order_relaxed);
+		output << ",\"bytes_in\":" << counters.bytes_in.load(memory_order_relaxed);
+		output << ",\"p50_ms\":" << counters.latency.Percentile(0.5);
+		output << ",\"p99_ms\":" << counters.latency.Percentile(0.99);
+		output << ",\"max_ms\":" << counters.latency.GetMaxMs() << "}";
+
+		first = false;
+	}
+
+	output << "}";
+
+	return output.str();
+}
+
+/**
+ * Prometheus text exposition format, latency as a cumulative histogram
+ * in seconds
+ * @return string
+ */
+string CatStats::Prometheus()
+{
+	stringstream sent, replies, bytes_out, bytes_in, latency;
+
+	sent << "# HELP yaesu_cat_sent_total CAT commands sent to the tcvr.\n";
+	sent << "# TYPE yaesu_cat_sent_total counter\n";
+	replies << "# HELP yaesu_cat_replies_total CAT replies by outcome.\n";
+	replies << "# TYPE yaesu_cat_replies_total counter\n";
+	bytes_out << "# HELP yaesu_cat_bytes_out_total Bytes written to the tcvr.\n";
+	bytes_out << "# TYPE yaesu_cat_bytes_out_total counter\n";
+	bytes_in << "# HELP yaesu_cat_bytes_in_total Bytes read from the tcvr.\n";
+	bytes_in << "# TYPE yaesu_cat_bytes_in_total counter\n";
+	latency << "# HELP yaesu_cat_round_trip_seconds Write start to complete reply.\n";
+	latency << "# TYPE yaesu_cat_round_trip_seconds histogram\n";
+
+	for (int i = 0; i < 256; i++) {
+		Counters & counters = opcodes[i];
+
+		if (!counters.sent.load(memory_order_relaxed)) {
+			continue;
+		}
+
+		string label = "opcode=\"" + OpcodeName(i) + "\"";
+
+		sent << "yaesu_cat_sent_total{" << label << "} " << counters.sent.load(memory_order_relaxed) << "\n";
+
+		for (int j = 0; j < 4; j++) {
+			replies << "yaesu_cat_replies_total{" << label << ",outcome=\"" << OUTCOME_NAMES[j] << "\"} " << counters.outcomes[j].load(memory_order_relaxed) << "\n";
+		}
+
+		bytes_out << "yaesu_cat_bytes_out_total{" << label << "} " << counters.bytes_out.load(memory_order_relaxed) << "\n";
+		bytes_in << "yaesu_cat_bytes_in_total{" << label << "} " << counters.bytes_in.load(memory_order_relaxed) << "\n";
+
+		uint64_t cumulative = 0;
+
+		for (int j = 0; j < LatencyHistogram::BUCKET_COUNT - 1; j++) {
+			cumulative += counters.latency.GetBucket(j);
+			latency << "yaesu_cat_round_trip_seconds_bucket{" << label << ",le=\"" << LatencyHistogram::BucketBoundMs(j) / 1000 << "\"} " << cumulative << "\n";
+		}
+
+		latency << "yaesu_cat_round_trip_seconds_bucket{" << label << ",le=\"+Inf\"} " << counters.latency.GetCount() << "\n";
+		latency << "yaesu_cat_round_trip_seconds_sum{" << label << "} " << counters.latency.GetSumMs() / 1000 << "\n";
+		latency << "yaesu_cat_round_trip_seconds_count{" << label << "} " << counters.latency.GetCount() << "\n";
+	}
+
+	return sent.str() + replies.str() + bytes_out.str() + bytes_in.str() + latency.str();
+}
+
+/**
+ * Readable opcode name for stats keys
+ * @param char opcode
+ * @return string
+ */
+string CatStats::OpcodeName(char opcode)
+{
+	const char codes[] = {
+		Cat::CMD_LOCK_ON, Cat::CMD_LOCK_OFF, Cat::CMD_PTT_ON, Cat::CMD_PTT_OFF, Cat::CMD_SET_FREQUENCY,
+		Cat::CMD_GET_FREQUENCY_MODE, Cat::CMD_SET_MODE, Cat::CMD_GET_RX_STATUS, Cat::CMD_GET_TX_STATUS,
+		Cat::CMD_READ_EEPROM, Cat::CMD_WRITE_EEPROM
+	};
+	const char * names[] = {
+		"lock_on", "lock_off", "ptt_on", "ptt_off", "set_frequency",
+		"get_frequency_mode", "set_mode", "get_rx_status", "get_tx_status",
+		"read_eeprom", "write_eeprom"
+	};
+
+	for (size_t i = 0; i < sizeof(codes); i++) {
+		if (codes[i] == opcode) {
+			return names[i];
+		}
+	}
+
+	stringstream name;
+	name << "0x" << hex << setw(2) << setfill('0') << (int)(unsigned char)opcode;
+
+	return name.str();
+}
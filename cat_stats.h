@@ -0,0 +1,90 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+#ifndef CAT_STATS_H
+#define CAT_STATS_H
+
+/**
+ * Round trip latency histogram with power of two buckets in microseconds,
+ * bucket i counts samples below 2^(i+1) us. Recording is a handful of
+ * relaxed atomic adds, so the serial worker never waits for a reader.
+ */
+class LatencyHistogram
+{
+	public:
+		static const int BUCKET_COUNT = 24;
+
+		LatencyHistogram();
+
+		void Record(double ms);
+		uint64_t GetCount();
+		uint64_t GetBucket(int i);
+		double GetSumMs();
+		double GetMaxMs();
+		double Percentile(double p);
+
+		static double BucketBoundMs(int i);
+
+	private:
+		atomic<uint64_t> buckets[BUCKET_COUNT];
+		atomic<uint64_t> count;
+		atomic<uint64_t> sum_us;
+		atomic<uint64_t> max_us;
+};
+
+/**
+ * Per opcode CAT transaction counters. Written by whoever owns the serial
+ * port, read from any thread.
+ */
+class CatStats
+{
+	public:
+		enum Outcome {
+			OUTCOME_OK = 0,
+			OUTCOME_TIMEOUT,
+			OUTCOME_SHORT,
+			OUTCOME_ERROR
+		};
+
+		CatStats();
+
+		void Sent(char opcode, size_t bytes);
+		void Completed(char opcode, Outcome outcome, size_t bytes, double round_trip_ms);
+
+		string Text();
+		string Json();
+		string Prometheus();
+
+		static string OpcodeName(char opcode);
+
+	private:
+		struct Counters {
+			atomic<uint64_t> sent;
+			atomic<uint64_t> outcomes[4];
+			atomic<uint64_t> bytes_out;
+			atomic<uint64_t> bytes_in;
+			LatencyHistogram latency;
+		};
+
+		// indexed by opcode byte, only the few the tcvr knows are ever used
+		Counters opcodes[256];
+
+		static const char * OUTCOME_NAMES[4];
+};
+
+#endif
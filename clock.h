@@ -0,0 +1,65 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include <stdint.h>
+#include <time.h>
+
+using namespace std;
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+/**
+ * The two time sources everything else uses. The monotonic clock never
+ * jumps and times intervals and deadlines, TcvrStatus::updated_ms among
+ * them; the wall clock stamps what people and files read.
+ */
+namespace Clock
+{
+	/**
+	 * Monotonic clock
+	 * @return double Milliseconds
+	 */
+	inline double MonotonicMs()
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+	}
+
+	/**
+	 * Monotonic clock in whole microseconds, the time base of audio frames
+	 * @return uint64_t
+	 */
+	inline uint64_t MonotonicUs()
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		return now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+	}
+
+	/**
+	 * Wall clock
+	 * @return int64_t Milliseconds since epoch
+	 */
+	inline int64_t WallClockMs()
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+
+		return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+	}
+}
+
+#endif
@@ -0,0 +1,120 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "device_watch.h"
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// constructor
+
+DeviceWatch::DeviceWatch()
+{
+	fd = -1;
+}
+
+// destructor
+
+DeviceWatch::~DeviceWatch()
+{
+	Close();
+}
+
+// public methods
+
+/**
+ * Start watching the directory of a device node
+ * @param string device
+ * @return bool False if only polling is possible
+ */
+bool DeviceWatch::Watch(const string & device)
+{
+	Close();
+
+	size_t slash = device.rfind('/');
+	directory = slash == string::npos ? "." : (slash == 0 ? "/" : device.substr(0, slash));
+	name = slash == string::npos ? device : device.substr(slash + 1);
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (fd == -1) {
+		return false;
+	}
+
+	// udev creates the node first and fixes its permissions afterwards
+	if (inotify_add_watch(fd, directory.c_str(), IN_CREATE | IN_ATTRIB | IN_MOVED_TO | IN_DELETE) == -1) {
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void DeviceWatch::Close()
+{
+	if (fd >= 0) {
+		close(fd);
+		fd = -1;
+	}
+}
+
+/**
+ * Readable when something changed in the directory, -1 when polling
+ * @return int
+ */
+int DeviceWatch::GetFileDescriptor()
+{
+	return fd;
+}
+
+/**
+ * Drain pending events
+ * @return bool True if one of them was about the device
+ */
+bool DeviceWatch::HandleEvents()
+{
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	bool touched = false;
+	ssize_t length;
+
+	if (fd < 0) {
+		return false;
+	}
+
+	while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+		for (char * p = buffer; p < buffer + length; ) {
+			struct inotify_event * event = (struct inotify_event *)p;
+
+			if (event->len > 0 && name == event->name) {
+				touched = true;
+			}
+
+			p += sizeof(struct inotify_event) + event->len;
+		}
+	}
+
+	return touched;
+}
+
+/**
+ * Device node is there, following symlinks
+ * @return bool
+ */
+bool DeviceWatch::Exists()
+{
+	struct stat buffer;
+
+	return stat((directory + "/" + name).c_str(), &buffer) == 0;
+}
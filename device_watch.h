@@ -0,0 +1,48 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include <string>
+
+using namespace std;
+
+#ifndef DEVICE_WATCH_H
+#define DEVICE_WATCH_H
+
+/**
+ * Notices a serial device node going away and coming back. The directory
+ * holding the node (/dev, or /dev/serial/by-id for a stable name) is
+ * watched with inotify, so a USB adapter that re-enumerates is seen the
+ * moment udev creates or relabels the node. Without inotify the owner
+ * just checks Exists() every POLL_MS.
+ */
+class DeviceWatch
+{
+	private:
+		int fd;
+		string directory;
+		string name;
+
+	public:
+		// how often to look for the device when no event arrives
+		static const int POLL_MS = 250;
+
+		DeviceWatch();
+		~DeviceWatch();
+
+		bool Watch(const string & device);
+		void Close();
+		int GetFileDescriptor();
+		bool HandleEvents();
+		bool Exists();
+};
+
+#endif
@@ -0,0 +1,548 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "eeprom_image.h"
+#include "cat.h"
+#include "tcvr_status.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+using namespace std;
+
+const char EepromImage::MAGIC[8] = {'Y', 'A', 'E', 'S', 'U', 'E', 'E', 'P'};
+const uint32_t EepromImage::VERSION;
+
+// the 50 CTCSS tones in the order the tcvr numbers them
+static const double TONES[] = {
+	67.0, 69.3, 71.9, 74.4, 77.0, 79.7, 82.5, 85.4, 88.5, 91.5,
+	94.8, 97.4, 100.0, 103.5, 107.2, 110.9, 114.8, 118.8, 123.0, 127.3,
+	131.8, 136.5, 141.3, 146.2, 151.4, 156.7, 159.8, 162.2, 165.5, 167.9,
+	171.3, 173.8, 177.3, 179.9, 183.5, 186.2, 189.9, 192.8, 196.6, 199.5,
+	203.5, 206.5, 210.7, 218.1, 225.7, 229.1, 233.6, 241.8, 250.3, 254.1
+};
+
+// the 104 DCS codes, octal digits
+static const int DCS_CODES[] = {
+	23, 25, 26, 31, 32, 36, 43, 47, 51, 53, 54, 65, 71, 72, 73, 74,
+	114, 115, 116, 122, 125, 131, 132, 134, 143, 145, 152, 155, 156, 162, 165, 172,
+	174, 205, 212, 223, 225, 226, 243, 244, 245, 246, 251, 252, 255, 261, 263, 265,
+	266, 271, 274, 306, 311, 315, 325, 331, 332, 343, 346, 351, 356, 364, 365, 371,
+	411, 412, 413, 423, 431, 432, 445, 446, 452, 454, 455, 462, 464, 465, 466, 503,
+	506, 516, 523, 526, 532, 546, 565, 606, 612, 624, 627, 631, 632, 654, 662, 664,
+	703, 712, 723, 731, 732, 734, 743, 754
+};
+
+static const int TONE_COUNT = sizeof(TONES) / sizeof(TONES[0]);
+static const int DCS_COUNT = sizeof(DCS_CODES) / sizeof(DCS_CODES[0]);
+
+// constructor
+
+EepromImage::EepromImage()
+{
+	Clear();
+}
+
+// public methods
+
+/**
+ * Forget every byte
+ * @return void
+ */
+void EepromImage::Clear()
+{
+	memset(bytes, 0xff, sizeof(bytes));
+	memset(known, 0, sizeof(known));
+}
+
+uint8_t EepromImage::Get(int address) const
+{
+	return bytes[address];
+}
+
+/**
+ * Store a byte and mark it known
+ * @param int address
+ * @param uint8_t value
+ * @return void
+ */
+void EepromImage::Set(int address, uint8_t value)
+{
+	bytes[address] = value;
+	known[address / 8] |= 1 << (address % 8);
+}
+
+bool EepromImage::IsKnown(int address) const
+{
+	return known[address / 8] & (1 << (address % 8));
+}
+
+/**
+ * Every byte of a range is known
+ * @param int address
+ * @param int length
+ * @return bool
+ */
+bool EepromImage::IsKnown(int address, int length) const
+{
+	for (int i = address; i < address + length; i++) {
+		if (!IsKnown(i)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * First byte not read yet
+ * @param int from
+ * @return int Address, -1 if the rest is known
+ */
+int EepromImage::NextUnknown(int from) const
+{
+	for (int i = from; i < SIZE; i++) {
+		if (known[i / 8] == 0xff) {
+			i |= 7;
+		} else if (!IsKnown(i)) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+int EepromImage::GetKnownCount() const
+{
+	int count = 0;
+
+	for (int i = 0; i < SIZE; i++) {
+		count += IsKnown(i);
+	}
+
+	return count;
+}
+
+bool EepromImage::IsComplete() const
+{
+	return NextUnknown(0) < 0;
+}
+
+/**
+ * Decode one memory channel
+ * @param int number 1 - CHANNEL_COUNT
+ * @param MemoryChannel& channel
+ * @return bool False if out of range or not all of it was read yet
+ */
+bool EepromImage::GetChannel(int number, MemoryChannel & channel) const
+{
+	if (number < 1 || number > CHANNEL_COUNT) {
+		return false;
+	}
+
+	int index = number - 1;
+	const uint8_t * raw = bytes + CHANNEL_BASE + index * CHANNEL_SIZE;
+
+	if (!IsKnown(CHANNEL_BASE + index * CHANNEL_SIZE, CHANNEL_SIZE) || !IsKnown(VISIBLE_BASE + index / 8) || !IsKnown(FILLED_BASE + index / 8)) {
+		return false;
+	}
+
+	const char modes[] = {
+		Cat::OP_MODE_LSB, Cat::OP_MODE_USB, Cat::OP_MODE_CW, Cat::OP_MODE_CWR,
+		Cat::OP_MODE_AM, Cat::OP_MODE_FM, Cat::OP_MODE_DIG, Cat::OP_MODE_PKT
+	};
+
+	channel.number = number;
+	channel.filled = GetFlag(FILLED_BASE, index);
+	channel.visible = GetFlag(VISIBLE_BASE, index);
+	channel.skip = raw[2] & 0x80;
+	channel.mode = modes[raw[0] & 0x07];
+
+	// narrow FM is a flag on top of FM
+	if (channel.mode == Cat::OP_MODE_FM && (raw[1] & 0x08)) {
+		channel.mode = Cat::OP_MODE_FMN;
+	}
+
+	channel.duplex = (raw[1] >> 6) & 0x03;
+	channel.frequency_hz = (uint32_t)((raw[10] << 24) | (raw[11] << 16) | (raw[12] << 8) | raw[13]) * 10;
+	channel.offset_hz = (uint32_t)((raw[14] << 24) | (raw[15] << 16) | (raw[16] << 8) | raw[17]) * 10;
+	channel.tone_mode = raw[4] & 0x03;
+	channel.ctcss_hz = (raw[6] & 0x3f) < TONE_COUNT ? TONES[raw[6] & 0x3f] : 0;
+	channel.dcs_code = (raw[7] & 0x7f) < DCS_COUNT ? DCS_CODES[raw[7] & 0x7f] : 0;
+	channel.name.clear();
+
+	for (int i = 18; i < CHANNEL_SIZE && raw[i] != 0xff && raw[i] != 0x00; i++) {
+		channel.name += raw[i] >= 0x20 && raw[i] < 0x7f ? (char)raw[i] : '?';
+	}
+
+	channel.name.erase(channel.name.find_last_not_of(' ') + 1);
+
+	return true;
+}
+
+/**
+ * Encode one memory channel over what is there, bits without a field in
+ * MemoryChannel (band, steps, IPO/ATT, tags) are kept
+ * @param MemoryChannel& channel
+ * @return bool False if out of range, not read yet or not encodable
+ */
+bool EepromImage::SetChannel(const MemoryChannel & channel)
+{
+	if (channel.number < 1 || channel.number > CHANNEL_COUNT) {
+		return false;
+	}
+
+	int index = channel.number - 1;
+	int address = CHANNEL_BASE + index * CHANNEL_SIZE;
+
+	if (!IsKnown(address, CHANNEL_SIZE) || !IsKnown(VISIBLE_BASE + index / 8) || !IsKnown(FILLED_BASE + index / 8)) {
+		return false;
+	}
+
+	const char modes[] = {
+		Cat::OP_MODE_LSB, Cat::OP_MODE_USB, Cat::OP_MODE_CW, Cat::OP_MODE_CWR,
+		Cat::OP_MODE_AM, Cat::OP_MODE_FM, Cat::OP_MODE_DIG, Cat::OP_MODE_PKT
+	};
+	char mode = channel.mode == Cat::OP_MODE_FMN ? Cat::OP_MODE_FM : channel.mode;
+	int mode_index = -1, tone_index = 0, dcs_index = 0;
+
+	for (int i = 0; i < 8; i++) {
+		if (modes[i] == mode) {
+			mode_index = i;
+		}
+	}
+
+	if (mode_index < 0) {
+		return false;
+	}
+
+	for (int i = 0; i < TONE_COUNT; i++) {
+		if (channel.ctcss_hz > 0 && TONES[i] <= channel.ctcss_hz + 0.05) {
+			tone_index = i;
+		}
+	}
+
+	for (int i = 0; i < DCS_COUNT; i++) {
+		if (DCS_CODES[i] == channel.dcs_code) {
+			dcs_index = i;
+		}
+	}
+
+	uint8_t * raw = bytes + address;
+	uint32_t frequency = channel.frequency_hz / 10;
+	uint32_t offset = channel.offset_hz / 10;
+
+	raw[0] = (raw[0] & 0xf8) | mode_index;
+	raw[1] = (raw[1] & 0x37) | (channel.duplex << 6) | (channel.duplex != DUPLEX_NONE ? 0x20 : 0) | (channel.mode == Cat::OP_MODE_FMN ? 0x08 : 0);
+	raw[2] = (raw[2] & 0x7f) | (channel.skip ? 0x80 : 0);
+	raw[4] = (raw[4] & 0xfc) | (channel.tone_mode & 0x03);
+	raw[6] = (raw[6] & 0xc0) | tone_index;
+	raw[7] = (raw[7] & 0x80) | dcs_index;
+	raw[10] = frequency >> 24;
+	raw[11] = frequency >> 16;
+	raw[12] = frequency >> 8;
+	raw[13] = frequency;
+	raw[14] = offset >> 24;
+	raw[15] = offset >> 16;
+	raw[16] = offset >> 8;
+	raw[17] = offset;
+
+	for (int i = 0; i < 8; i++) {
+		raw[18 + i] = i < (int)channel.name.size() ? channel.name[i] : ' ';
+	}
+
+	SetFlag(FILLED_BASE, index, channel.filled);
+	SetFlag(VISIBLE_BASE, index, channel.visible);
+
+	return true;
+}
+
+/**
+ * Filled channels as key:value lines
+ * @return string
+ */
+string EepromImage::ChannelsText() const
+{
+	stringstream output;
+	MemoryChannel channel;
+	int filled = 0, unknown = 0;
+
+	for (int i = 1; i <= CHANNEL_COUNT; i++) {
+		if (!GetChannel(i, channel)) {
+			unknown++;
+		} else if (channel.filled) {
+			output << "channel_" << setw(3) << setfill('0') << i << ":" << FormatChannel(channel) << "\n";
+			filled++;
+		}
+	}
+
+	output << "channels_filled:" << filled << "\n";
+	output << "channels_unknown:" << unknown << "\n";
+
+	return output.str();
+}
+
+/**
+ * Ranges where both images know the bytes and they differ
+ * @param EepromImage& other
+ * @return vector<pair<int, int> > Address and length
+ */
+vector<pair<int, int> > EepromImage::Diff(const EepromImage & other) const
+{
+	vector<pair<int, int> > ranges;
+
+	for (int i = 0; i < SIZE; i++) {
+		if (!IsKnown(i) || !other.IsKnown(i) || bytes[i] == other.bytes[i]) {
+			continue;
+		}
+
+		if (!ranges.empty() && ranges.back().first + ranges.back().second == i) {
+			ranges.back().second++;
+		} else {
+			ranges.push_back(make_pair(i, 1));
+		}
+	}
+
+	return ranges;
+}
+
+/**
+ * Differences as key:value lines, memory channels decoded, the rest as
+ * hex bytes, this image on the left
+ * @param EepromImage& other
+ * @return string
+ */
+string EepromImage::DiffText(const EepromImage & other) const
+{
+	vector<pair<int, int> > ranges = Diff(other);
+	stringstream output;
+	set<int> channels;
+	int changed = 0, unknown = 0;
+
+	int flag_bytes = (CHANNEL_COUNT + 7) / 8;
+
+	for (size_t i = 0; i < ranges.size(); i++) {
+		int start = ranges[i].first, end = ranges[i].first + ranges[i].second;
+		int raw_start = -1;
+		changed += ranges[i].second;
+
+		for (int address = start; address <= end; address++) {
+			int base = -1;
+
+			if (address < end && address >= VISIBLE_BASE && address < VISIBLE_BASE + flag_bytes) {
+				base = VISIBLE_BASE;
+			} else if (address < end && address >= FILLED_BASE && address < FILLED_BASE + flag_bytes) {
+				base = FILLED_BASE;
+			}
+
+			bool raw = address < end && base < 0 && ChannelAt(address) == 0;
+
+			if (address < end && ChannelAt(address) > 0) {
+				channels.insert(ChannelAt(address));
+			}
+
+			for (int bit = 0; base >= 0 && bit < 8; bit++) {
+				if ((bytes[address] ^ other.bytes[address]) & (1 << bit)) {
+					channels.insert((address - base) * 8 + bit + 1);
+				}
+			}
+
+			if (raw && raw_start < 0) {
+				raw_start = address;
+			}
+
+			// settings and VFOs have no decoder, show the bytes
+			if (!raw && raw_start >= 0) {
+				output << "eeprom_0x" << hex << setw(4) << setfill('0') << raw_start << ":";
+
+				for (int j = raw_start; j < address; j++) {
+					output << setw(2) << (int)bytes[j];
+				}
+
+				output << " -> ";
+
+				for (int j = raw_start; j < address; j++) {
+					output << setw(2) << (int)other.bytes[j];
+				}
+
+				output << dec << "\n";
+				raw_start = -1;
+			}
+		}
+	}
+
+	for (set<int>::iterator it = channels.begin(); it != channels.end(); ++it) {
+		MemoryChannel left, right;
+
+		if (*it > CHANNEL_COUNT || !GetChannel(*it, left) || !other.GetChannel(*it, right)) {
+			continue;
+		}
+
+		output << "channel_" << setw(3) << setfill('0') << *it << ":";
+		output << (left.filled ? FormatChannel(left) : "empty") << " -> " << (right.filled ? FormatChannel(right) : "empty") << "\n";
+	}
+
+	for (int i = 0; i < SIZE; i++) {
+		unknown += !IsKnown(i) || !other.IsKnown(i);
+	}
+
+	output << "diff_bytes:" << changed << "\n";
+	output << "diff_ranges:" << ranges.size() << "\n";
+	output << "diff_channels:" << channels.size() << "\n";
+	output << "diff_unknown_bytes:" << unknown << "\n";
+
+	return output.str();
+}
+
+/**
+ * Read an image saved by Save()
+ * @param string path
+ * @return bool
+ */
+bool EepromImage::Load(const string & path)
+{
+	char header[16];
+	uint32_t version, size;
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	bool ok = read(fd, header, sizeof(header)) == sizeof(header);
+
+	memcpy(&version, header + 8, 4);
+	memcpy(&size, header + 12, 4);
+
+	ok = ok && memcmp(header, MAGIC, sizeof(MAGIC)) == 0 && version == VERSION && size == SIZE;
+	ok = ok && read(fd, bytes, sizeof(bytes)) == sizeof(bytes);
+	ok = ok && read(fd, known, sizeof(known)) == sizeof(known);
+
+	close(fd);
+
+	if (!ok) {
+		cout << "Error: " << path << " is not an EEPROM image" << endl;
+		Clear();
+	}
+
+	return ok;
+}
+
+/**
+ * Write to a temporary file and move it in place, a crash never leaves
+ * half an image behind
+ * @param string path
+ * @return bool
+ */
+bool EepromImage::Save(const string & path) const
+{
+	char header[16];
+	uint32_t version = VERSION, size = SIZE;
+	string temporary = path + ".tmp";
+	int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd < 0) {
+		cout << "Error: can not create " << temporary << ": " << strerror(errno) << endl;
+		return false;
+	}
+
+	memcpy(header, MAGIC, sizeof(MAGIC));
+	memcpy(header + 8, &version, 4);
+	memcpy(header + 12, &size, 4);
+
+	bool ok = write(fd, header, sizeof(header)) == sizeof(header);
+	ok = ok && write(fd, bytes, sizeof(bytes)) == sizeof(bytes);
+	ok = ok && write(fd, known, sizeof(known)) == sizeof(known);
+	ok = fsync(fd) == 0 && ok;
+	ok = close(fd) == 0 && ok;
+	ok = ok && rename(temporary.c_str(), path.c_str()) == 0;
+
+	if (!ok) {
+		cout << "Error: can not write " << path << ": " << strerror(errno) << endl;
+		unlink(temporary.c_str());
+	}
+
+	return ok;
+}
+
+/**
+ * One line per channel: frequency, mode, shift, tone, skip and name
+ * @param MemoryChannel& channel
+ * @return string
+ */
+string EepromImage::FormatChannel(const MemoryChannel & channel)
+{
+	stringstream output;
+	output << fixed << setprecision(1);
+	output << TcvrStatus::FormatFrequency(channel.frequency_hz) << " " << CatCodec::ModeName(channel.mode);
+
+	if (channel.duplex == DUPLEX_MINUS || channel.duplex == DUPLEX_PLUS) {
+		output << " " << (channel.duplex == DUPLEX_MINUS ? "-" : "+") << TcvrStatus::FormatFrequency(channel.offset_hz);
+	} else if (channel.duplex == DUPLEX_SPLIT) {
+		output << " split " << TcvrStatus::FormatFrequency(channel.offset_hz);
+	}
+
+	if (channel.tone_mode == TONE_ENCODE) {
+		output << " T" << channel.ctcss_hz;
+	} else if (channel.tone_mode == TONE_SQUELCH) {
+		output << " TSQL" << channel.ctcss_hz;
+	} else if (channel.tone_mode == TONE_DCS) {
+		output << " D" << setw(3) << setfill('0') << channel.dcs_code;
+	}
+
+	if (channel.skip) {
+		output << " skip";
+	}
+
+	if (!channel.visible) {
+		output << " hidden";
+	}
+
+	if (!channel.name.empty()) {
+		output << " \"" << channel.name << "\"";
+	}
+
+	return output.str();
+}
+
+// private methods
+
+/**
+ * Memory channel a byte belongs to
+ * @param int address
+ * @return int 1 - CHANNEL_COUNT, 0 outside the table
+ */
+int EepromImage::ChannelAt(int address)
+{
+	if (address < CHANNEL_BASE || address >= CHANNEL_BASE + CHANNEL_COUNT * CHANNEL_SIZE) {
+		return 0;
+	}
+
+	return (address - CHANNEL_BASE) / CHANNEL_SIZE + 1;
+}
+
+bool EepromImage::GetFlag(int base, int index) const
+{
+	return bytes[base + index / 8] & (1 << (index % 8));
+}
+
+void EepromImage::SetFlag(int base, int index, bool value)
+{
+	int address = base + index / 8;
+	Set(address, value ? bytes[address] | (1 << (index % 8)) : bytes[address] & ~(1 << (index % 8)));
+}
@@ -0,0 +1,114 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+#ifndef EEPROM_IMAGE_H
+#define EEPROM_IMAGE_H
+
+/**
+ * One decoded memory channel
+ */
+struct MemoryChannel {
+	int number;				// 1 - CHANNEL_COUNT
+	bool filled;
+	bool visible;
+	bool skip;
+	uint32_t frequency_hz;
+	char mode;				// Cat::OP_MODE_*
+	int duplex;				// EepromImage::DUPLEX_*
+	uint32_t offset_hz;		// repeater shift, TX frequency when split
+	int tone_mode;			// EepromImage::TONE_*
+	double ctcss_hz;
+	int dcs_code;			// octal digits as written, 23 for D023
+	string name;
+};
+
+/**
+ * Copy of the tcvr's EEPROM from address 0 up to the end of the memory
+ * channel table, with a flag per byte telling whether it was read yet.
+ * Channel layout is the FT-817ND one as documented by the CHIRP project;
+ * everything above the table, the calibration data among it, is left
+ * alone: never read, never written back.
+ *
+ * Saved to disk as a small header, the bytes and the known bitmap, so a
+ * restarted server only reads what it did not have. Diff() compares two
+ * images byte by byte, which is all a write back needs to send.
+ */
+class EepromImage
+{
+	public:
+		static const int SIZE = 0x18d4;
+
+		static const int CHANNEL_BASE = 0x484;
+		static const int CHANNEL_SIZE = 26;
+		static const int CHANNEL_COUNT = 200;
+
+		// one bit per channel, LSB first
+		static const int VISIBLE_BASE = 0x3fd;
+		static const int FILLED_BASE = 0x41b;
+
+		enum Duplex {
+			DUPLEX_NONE = 0,
+			DUPLEX_MINUS,
+			DUPLEX_PLUS,
+			DUPLEX_SPLIT
+		};
+
+		enum ToneMode {
+			TONE_OFF = 0,
+			TONE_ENCODE,
+			TONE_SQUELCH,
+			TONE_DCS
+		};
+
+		EepromImage();
+
+		void Clear();
+		uint8_t Get(int address) const;
+		void Set(int address, uint8_t value);
+		bool IsKnown(int address) const;
+		bool IsKnown(int address, int length) const;
+		int NextUnknown(int from) const;
+		int GetKnownCount() const;
+		bool IsComplete() const;
+
+		bool GetChannel(int number, MemoryChannel & channel) const;
+		bool SetChannel(const MemoryChannel & channel);
+		string ChannelsText() const;
+
+		vector<pair<int, int> > Diff(const EepromImage & other) const;
+		string DiffText(const EepromImage & other) const;
+
+		bool Load(const string & path);
+		bool Save(const string & path) const;
+
+		static string FormatChannel(const MemoryChannel & channel);
+
+	private:
+		static const char MAGIC[8];
+		static const uint32_t VERSION = 1;
+
+		uint8_t bytes[SIZE];
+		uint8_t known[(SIZE + 7) / 8];
+
+		static int ChannelAt(int address);
+		bool GetFlag(int base, int index) const;
+		void SetFlag(int base, int index, bool value);
+};
+
+#endif
@@ -0,0 +1,387 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "eeprom_sync.h"
+#include "clock.h"
+#include <unistd.h>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+
+const int EepromSync::EEPROM_CLIENT = -3;
+
+static string hex_address(int address)
+{
+	stringstream text;
+	text << "0x" << hex << setw(4) << setfill('0') << address;
+
+	return text.str();
+}
+
+// constructor
+
+EepromSync::EepromSync(CatQueue * q)
+{
+	queue = q;
+	state = STATE_IDLE;
+	full = false;
+	restoring = false;
+	cursor = 0;
+	block = 0;
+	block_size = Cat::MAX_EEPROM_BLOCK;
+	fetched = 0;
+	written = 0;
+
+	blocks_read = 0;
+	blocks_written = 0;
+	bytes_read = 0;
+	bytes_written = 0;
+	retries = 0;
+	verify_failures = 0;
+	failures = 0;
+	last_ms = 0;
+}
+
+// setters & getters
+
+/**
+ * Keep the image in given file, loading what an earlier run left there
+ * @param string path
+ * @return bool True if an image was loaded
+ */
+bool EepromSync::SetCachePath(const string & path)
+{
+	cache_path = path;
+
+	if (access(path.c_str(), F_OK) != 0) {
+		return false;
+	}
+
+	return image.Load(path);
+}
+
+const EepromImage & EepromSync::GetImage()
+{
+	return image;
+}
+
+bool EepromSync::IsBusy()
+{
+	return state != STATE_IDLE;
+}
+
+// public methods
+
+/**
+ * Bring the image up to date, callback runs once all of it is known
+ * @param bool full_read Read known bytes again too
+ * @param Callback callback
+ * @return bool False if a transfer is already running
+ */
+bool EepromSync::Read(bool full_read, Callback callback)
+{
+	if (IsBusy()) {
+		return false;
+	}
+
+	state = STATE_READING;
+	full = full_read;
+	restoring = false;
+	cursor = 0;
+	fetched = 0;
+	written = 0;
+	done = callback;
+	started = Clock::MonotonicMs();
+
+	ReadNext();
+
+	return true;
+}
+
+/**
+ * Make the tcvr's EEPROM equal to given image, reading what is not known
+ * yet first so only real differences go out
+ * @param EepromImage target Must be complete
+ * @param Callback callback
+ * @return bool False if busy or target is incomplete
+ */
+bool EepromSync::Restore(const EepromImage & target, Callback callback)
+{
+	if (IsBusy() || !target.IsComplete()) {
+		return false;
+	}
+
+	wanted = target;
+	state = STATE_READING;
+	full = false;
+	restoring = true;
+	cursor = 0;
+	fetched = 0;
+	written = 0;
+	done = callback;
+	started = Clock::MonotonicMs();
+
+	ReadNext();
+
+	return true;
+}
+
+/**
+ * Transfer counters as key:value lines
+ * @return string
+ */
+string EepromSync::Stats()
+{
+	const char * states[] = {"idle", "reading", "writing", "verifying"};
+	stringstream output;
+	output << fixed << setprecision(3);
+
+	output << "eeprom_state:" << states[state] << "\n";
+	output << "eeprom_size:" << EepromImage::SIZE << "\n";
+	output << "eeprom_known_bytes:" << image.GetKnownCount() << "\n";
+	output << "eeprom_cache:" << (cache_path.empty() ? "none" : cache_path) << "\n";
+	output << "eeprom_blocks_read:" << blocks_read << "\n";
+	output << "eeprom_bytes_read:" << bytes_read << "\n";
+	output << "eeprom_blocks_written:" << blocks_written << "\n";
+	output << "eeprom_bytes_written:" << bytes_written << "\n";
+	output << "eeprom_block_size:" << block_size << "\n";
+	output << "eeprom_retries:" << retries << "\n";
+	output << "eeprom_verify_failures:" << verify_failures << "\n";
+	output << "eeprom_failures:" << failures << "\n";
+	output << "eeprom_last_ms:" << last_ms << "\n";
+
+	return output.str();
+}
+
+// private methods
+
+/**
+ * Fetch the next block with anything unknown in it, or move on to
+ * writing once there is none
+ * @return void
+ */
+void EepromSync::ReadNext()
+{
+	int next = full ? (cursor < EepromImage::SIZE ? cursor : -1) : image.NextUnknown(cursor);
+
+	if (next < 0 && restoring) {
+		PlanBlocks();
+		block = 0;
+		state = STATE_WRITING;
+		WriteNext();
+		return;
+	}
+
+	if (next < 0) {
+		stringstream message;
+		message << "eeprom_read_bytes:" << fetched << "\n";
+		message << "eeprom_ms:" << fixed << setprecision(3) << Clock::MonotonicMs() - started << "\n";
+		Finish(true, message.str());
+		return;
+	}
+
+	int address = next & ~1;
+	int length = min(block_size, EepromImage::SIZE - address);
+
+	bool sent = Send(Cat::CMD_READ_EEPROM, address, vector<uint8_t>(length), [this, address, length](const CatResult & result) {
+		if ((!result.ok || (int)result.data.size() != length) && block_size > 2) {
+			// a noisy link loses fewer bytes with shorter blocks
+			block_size /= 2;
+			retries++;
+			ReadNext();
+			return;
+		}
+
+		if (!result.ok || (int)result.data.size() != length) {
+			Finish(false, "EEPROM read failed at " + hex_address(address));
+			return;
+		}
+
+		for (int i = 0; i < length; i++) {
+			image.Set(address + i, result.data[i]);
+		}
+
+		block_size = min(2 * block_size, (int)Cat::MAX_EEPROM_BLOCK);
+		blocks_read++;
+		bytes_read += length;
+		fetched += length;
+		cursor = address + length;
+		ReadNext();
+	});
+
+	if (!sent) {
+		Finish(false, "Too many pending commands");
+	}
+}
+
+/**
+ * Write the next planned block, or finish once all went out
+ * @return void
+ */
+void EepromSync::WriteNext()
+{
+	if (block >= blocks.size()) {
+		stringstream message;
+		message << "eeprom_read_bytes:" << fetched << "\n";
+		message << "eeprom_written_bytes:" << written << "\n";
+		message << "eeprom_written_blocks:" << blocks.size() << "\n";
+		message << "eeprom_ms:" << fixed << setprecision(3) << Clock::MonotonicMs() - started << "\n";
+		Finish(true, message.str());
+		return;
+	}
+
+	int address = blocks[block].first, length = blocks[block].second;
+	vector<uint8_t> data(length);
+
+	for (int i = 0; i < length; i++) {
+		data[i] = wanted.Get(address + i);
+	}
+
+	bool sent = Send(Cat::CMD_WRITE_EEPROM, address, data, [this, address, length](const CatResult & result) {
+		if (!result.ok) {
+			Finish(false, "EEPROM write failed at " + hex_address(address));
+			return;
+		}
+
+		blocks_written++;
+		bytes_written += length;
+		written += length;
+		state = STATE_VERIFYING;
+		Verify();
+	});
+
+	if (!sent) {
+		Finish(false, "Too many pending commands");
+	}
+}
+
+/**
+ * Read the block just written back, the image takes what the tcvr has
+ * @return void
+ */
+void EepromSync::Verify()
+{
+	int address = blocks[block].first, length = blocks[block].second;
+
+	bool sent = Send(Cat::CMD_READ_EEPROM, address, vector<uint8_t>(length), [this, address, length](const CatResult & result) {
+		if (!result.ok || (int)result.data.size() != length) {
+			Finish(false, "EEPROM verify read failed at " + hex_address(address));
+			return;
+		}
+
+		bool same = true;
+
+		for (int i = 0; i < length; i++) {
+			image.Set(address + i, result.data[i]);
+			same = same && result.data[i] == wanted.Get(address + i);
+		}
+
+		blocks_read++;
+		bytes_read += length;
+
+		if (!same) {
+			verify_failures++;
+			Finish(false, "EEPROM verify failed at " + hex_address(address));
+			return;
+		}
+
+		block++;
+		state = STATE_WRITING;
+		WriteNext();
+	});
+
+	if (!sent) {
+		Finish(false, "Too many pending commands");
+	}
+}
+
+/**
+ * Differing bytes as two byte words, grouped into blocks; a single
+ * unchanged word between two changed ones is written along, five more
+ * bytes on the wire are cheaper than another round trip
+ * @return void
+ */
+void EepromSync::PlanBlocks()
+{
+	vector<pair<int, int> > ranges = image.Diff(wanted);
+	int last_word = -2;
+
+	blocks.clear();
+
+	for (size_t i = 0; i < ranges.size(); i++) {
+		for (int word = ranges[i].first & ~1; word < ranges[i].first + ranges[i].second; word += 2) {
+			if (word == last_word) {
+				continue;
+			}
+
+			last_word = word;
+
+			if (!blocks.empty()) {
+				int end = blocks.back().first + blocks.back().second;
+
+				if (word - end <= 2 && word + 2 - blocks.back().first <= Cat::MAX_EEPROM_BLOCK) {
+					blocks.back().second = word + 2 - blocks.back().first;
+					continue;
+				}
+			}
+
+			blocks.push_back(make_pair(word, 2));
+		}
+	}
+}
+
+/**
+ * Queue one EEPROM command
+ * @param char opcode
+ * @param int address
+ * @param vector<uint8_t> data Bytes to write, or as many as to read
+ * @param function callback
+ * @return bool
+ */
+bool EepromSync::Send(char opcode, int address, const vector<uint8_t> & data, function<void(const CatResult &)> callback)
+{
+	CatCommand command;
+	command.opcode = opcode;
+	command.frequency = 0;
+	command.address = address;
+	command.data = data;
+	command.client = EEPROM_CLIENT;
+	command.callback = callback;
+
+	return queue->Submit(command);
+}
+
+/**
+ * Back to idle, the image goes to disk whether it worked or not so an
+ * interrupted read resumes where it stopped
+ * @param bool ok
+ * @param string message
+ * @return void
+ */
+void EepromSync::Finish(bool ok, const string & message)
+{
+	state = STATE_IDLE;
+	last_ms = Clock::MonotonicMs() - started;
+	failures += !ok;
+
+	if (!cache_path.empty()) {
+		image.Save(cache_path);
+	}
+
+	Callback callback;
+	callback.swap(done);
+
+	if (callback) {
+		callback(ok, message);
+	}
+}
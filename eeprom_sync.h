@@ -0,0 +1,104 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "cat_queue.h"
+#include "eeprom_image.h"
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+#ifndef EEPROM_SYNC_H
+#define EEPROM_SYNC_H
+
+/**
+ * Keeps an EepromImage of one tcvr in step with the real EEPROM through
+ * CatQueue, one block of Cat::MAX_EEPROM_BLOCK bytes per command, so
+ * status polls and set commands still get their turn in between.
+ *
+ * A failed read is tried again with half the block, down to two bytes,
+ * and blocks grow back with every success.
+ *
+ * Read() only fetches bytes the image does not know yet, the image is
+ * kept on disk, so after the first full read a restarted server reads
+ * nothing. Restore() writes only the two byte words that differ from the
+ * wanted image and reads every written block back to verify it. The cache
+ * assumes nobody else writes the EEPROM; after changes made on the front
+ * panel a full read brings it up to date.
+ *
+ * Lives on the event loop thread, no locking.
+ */
+class EepromSync
+{
+	public:
+		typedef function<void(bool ok, const string & message)> Callback;
+
+		// client id of the sync's queue submissions
+		static const int EEPROM_CLIENT;
+
+		EepromSync(CatQueue * q);
+
+		bool SetCachePath(const string & path);
+		const EepromImage & GetImage();
+		bool IsBusy();
+
+		bool Read(bool full_read, Callback callback);
+		bool Restore(const EepromImage & target, Callback callback);
+
+		string Stats();
+
+	private:
+		enum State {
+			STATE_IDLE = 0,
+			STATE_READING,
+			STATE_WRITING,
+			STATE_VERIFYING
+		};
+
+		CatQueue * queue;
+		string cache_path;
+		EepromImage image;
+		EepromImage wanted;
+
+		State state;
+		bool full;
+		bool restoring;
+		int cursor;
+		vector<pair<int, int> > blocks;
+		size_t block;
+		int block_size;
+		Callback done;
+		double started;
+		int fetched;
+		int written;
+
+		uint64_t blocks_read;
+		uint64_t blocks_written;
+		uint64_t bytes_read;
+		uint64_t bytes_written;
+		uint64_t retries;
+		uint64_t verify_failures;
+		uint64_t failures;
+		double last_ms;
+
+		void ReadNext();
+		void WriteNext();
+		void Verify();
+		void PlanBlocks();
+		bool Send(char opcode, int address, const vector<uint8_t> & data, function<void(const CatResult &)> callback);
+		void Finish(bool ok, const string & message);
+};
+
+#endif
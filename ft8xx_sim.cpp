@@ -0,0 +1,533 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "ft8xx_sim.h"
+#include "cat.h"
+#include "clock.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+using namespace std;
+
+// constructor
+
+FT8xxSim::FT8xxSim()
+{
+	master_fd = -1;
+	slave_fd = -1;
+	baud = 9600;
+	processing_ms = 2;
+	drop_rate = 0;
+	short_rate = 0;
+	verbose = false;
+	running = false;
+	rx_clock = 0;
+
+	frequency_hz = 14190000;
+	mode = Cat::OP_MODE_USB;
+	locked = false;
+	ptt = false;
+	split = false;
+	tx_power = 8;
+
+	stats.frames = 0;
+	stats.replies = 0;
+	stats.dropped = 0;
+	stats.shortened = 0;
+}
+
+// destructor
+
+FT8xxSim::~FT8xxSim()
+{
+	Stop();
+	Close();
+}
+
+// setters & getters
+
+/**
+ * Baud rate used to emulate wire time, 2400, 4800 or 9600
+ * @param int b
+ * @return void
+ */
+void FT8xxSim::SetBaud(int b)
+{
+	baud = b > 0 ? b : 9600;
+}
+
+/**
+ * Time the radio takes to act on a frame once it arrived
+ * @param double ms
+ * @return void
+ */
+void FT8xxSim::SetProcessingDelay(double ms)
+{
+	processing_ms = ms < 0 ? 0 : ms;
+}
+
+/**
+ * Fault injection, both rates 0 - 1
+ * @param double drop Share of frames that get no reply at all
+ * @param double shortened Share of multi byte replies cut short
+ * @return void
+ */
+void FT8xxSim::SetFaults(double drop, double shortened)
+{
+	drop_rate = drop;
+	short_rate = shortened;
+}
+
+/**
+ * Seed fault injection so runs can be repeated
+ * @param uint32_t seed
+ * @return void
+ */
+void FT8xxSim::SetSeed(uint32_t seed)
+{
+	generator.seed(seed);
+}
+
+void FT8xxSim::SetVerbose(bool v)
+{
+	verbose = v;
+}
+
+void FT8xxSim::SetFrequency(uint32_t hz)
+{
+	lock_guard<mutex> guard(lock);
+	frequency_hz = hz;
+}
+
+/**
+ * Slave side of the pty, give this to Cat::Connect()
+ * @return string
+ */
+string FT8xxSim::GetDevice()
+{
+	return link.empty() ? device : link;
+}
+
+uint32_t FT8xxSim::GetFrequency()
+{
+	lock_guard<mutex> guard(lock);
+	return frequency_hz;
+}
+
+char FT8xxSim::GetMode()
+{
+	lock_guard<mutex> guard(lock);
+	return mode;
+}
+
+bool FT8xxSim::GetPtt()
+{
+	lock_guard<mutex> guard(lock);
+	return ptt;
+}
+
+bool FT8xxSim::GetLock()
+{
+	lock_guard<mutex> guard(lock);
+	return locked;
+}
+
+SimStats FT8xxSim::GetStats()
+{
+	lock_guard<mutex> guard(lock);
+	return stats;
+}
+
+uint8_t FT8xxSim::GetEeprom(int address)
+{
+	lock_guard<mutex> guard(lock);
+	return address >= 0 && address < EEPROM_SIZE ? eeprom[address] : 0xff;
+}
+
+// public methods
+
+/**
+ * Create pseudo-terminal, optionally with a stable symlink to its slave
+ * @param string link_path e.g. /tmp/ft817
+ * @return bool
+ */
+bool FT8xxSim::Open(const string & link_path)
+{
+	Close();
+	SeedEeprom();
+
+	master_fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+
+	if (master_fd < 0 || grantpt(master_fd) != 0 || unlockpt(master_fd) != 0) {
+		cout << "Can't create pseudo-terminal" << endl;
+		Close();
+		return false;
+	}
+
+	device = ptsname(master_fd);
+
+	// keep slave open, otherwise the master reads EIO whenever Cat closes it
+	slave_fd = open(device.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+
+	if (slave_fd < 0) {
+		cout << "Can't open " << device << endl;
+		Close();
+		return false;
+	}
+
+	struct termios options;
+	tcgetattr(slave_fd, &options);
+	cfmakeraw(&options);
+	tcsetattr(slave_fd, TCSANOW, &options);
+
+	if (!link_path.empty()) {
+		unlink(link_path.c_str());
+
+		if (symlink(device.c_str(), link_path.c_str()) != 0) {
+			cout << "Can't create link " << link_path << endl;
+			Close();
+			return false;
+		}
+
+		link = link_path;
+	}
+
+	return true;
+}
+
+void FT8xxSim::Close()
+{
+	if (!link.empty()) {
+		unlink(link.c_str());
+		link.clear();
+	}
+
+	if (slave_fd >= 0) {
+		close(slave_fd);
+		slave_fd = -1;
+	}
+
+	if (master_fd >= 0) {
+		close(master_fd);
+		master_fd = -1;
+	}
+}
+
+/**
+ * Answer frames on a background thread
+ * @return bool
+ */
+bool FT8xxSim::Start()
+{
+	if (master_fd < 0 || running) {
+		return false;
+	}
+
+	running = true;
+	worker = thread(&FT8xxSim::Loop, this);
+
+	return true;
+}
+
+void FT8xxSim::Stop()
+{
+	running = false;
+
+	if (worker.joinable()) {
+		worker.join();
+	}
+}
+
+/**
+ * Time given number of bytes take on the wire, 8 data bits, 2 stop bits
+ * and a start bit
+ * @param size_t bytes
+ * @param int baud
+ * @return double Milliseconds
+ */
+double FT8xxSim::WireTimeMs(size_t bytes, int baud)
+{
+	return bytes * 11 * 1000.0 / baud;
+}
+
+// private methods
+
+void FT8xxSim::Loop()
+{
+	unsigned char buffer[256];
+	size_t length = 0;
+
+	while (running) {
+		struct pollfd pfd = {master_fd, POLLIN, 0};
+		int ready = poll(&pfd, 1, 100);
+
+		if (ready < 0 && errno != EINTR) {
+			break;
+		}
+
+		if (ready <= 0) {
+			continue;
+		}
+
+		ssize_t n = read(master_fd, buffer + length, sizeof(buffer) - length);
+
+		if (n <= 0) {
+			continue;
+		}
+
+		// bytes came in at once over the pty, on a real line they trickle in
+		double now = Clock::MonotonicMs();
+		rx_clock = rx_clock > now ? rx_clock : now;
+
+		length += n;
+		size_t offset = 0;
+
+		while (length - offset >= 5) {
+			rx_clock += WireTimeMs(5, baud);
+			Delay(rx_clock + processing_ms - Clock::MonotonicMs());
+
+			Handle(buffer + offset);
+			offset += 5;
+		}
+
+		length -= offset;
+		memmove(buffer, buffer + offset, length);
+	}
+}
+
+/**
+ * Act on one frame and answer it
+ * @param unsigned char* frame
+ * @return void
+ */
+void FT8xxSim::Handle(const unsigned char * frame)
+{
+	unsigned char reply[5];
+	size_t reply_length = 1;
+	char opcode = frame[4];
+
+	{
+		lock_guard<mutex> guard(lock);
+		stats.frames++;
+		reply[0] = 0x00;
+
+		if (opcode == Cat::CMD_SET_FREQUENCY) {
+			frequency_hz = CatCodec::DecodeFrequency((const char *)frame);
+		} else if (opcode == Cat::CMD_GET_FREQUENCY_MODE) {
+			CatCodec::EncodeFrequency(frequency_hz, (char *)reply);
+			reply[4] = mode;
+			reply_length = 5;
+		} else if (opcode == Cat::CMD_SET_MODE) {
+			mode = frame[0];
+		} else if (opcode == Cat::CMD_LOCK_ON || opcode == Cat::CMD_LOCK_OFF) {
+			bool enable = opcode == Cat::CMD_LOCK_ON;
+
+			// radio answers 0xf0 when already in requested state
+			reply[0] = locked == enable ? 0xf0 : 0x00;
+			locked = enable;
+		} else if (opcode == Cat::CMD_PTT_ON || opcode == Cat::CMD_PTT_OFF) {
+			bool enable = opcode == Cat::CMD_PTT_ON;
+
+			reply[0] = ptt == enable ? 0xf0 : 0x00;
+			ptt = enable;
+		} else if (opcode == Cat::CMD_GET_RX_STATUS) {
+			reply[0] = RxStatus();
+		} else if (opcode == Cat::CMD_GET_TX_STATUS) {
+			reply[0] = TxStatus();
+		} else if (opcode == Cat::CMD_READ_EEPROM || opcode == Cat::CMD_WRITE_EEPROM) {
+			int address = (frame[0] << 8) | frame[1];
+
+			if (address + 1 < EEPROM_SIZE && opcode == Cat::CMD_READ_EEPROM) {
+				reply[0] = eeprom[address];
+				reply[1] = eeprom[address + 1];
+			} else if (address + 1 < EEPROM_SIZE) {
+				eeprom[address] = frame[2];
+				eeprom[address + 1] = frame[3];
+			}
+
+			reply_length = opcode == Cat::CMD_READ_EEPROM ? 2 : 1;
+		}
+	}
+
+	if (verbose) {
+		cout << "Frame:";
+
+		for (int i = 0; i < 5; i++) {
+			cout << " " << hex << setw(2) << setfill('0') << (int)frame[i];
+		}
+
+		cout << dec << endl;
+	}
+
+	if (Chance(drop_rate)) {
+		lock_guard<mutex> guard(lock);
+		stats.dropped++;
+		return;
+	}
+
+	if (reply_length > 1 && Chance(short_rate)) {
+		reply_length = 1 + generator() % (reply_length - 1);
+
+		lock_guard<mutex> guard(lock);
+		stats.shortened++;
+	}
+
+	Reply(reply, reply_length);
+}
+
+/**
+ * Send reply paced at wire speed, one byte at a time
+ * @param unsigned char* reply
+ * @param size_t length
+ * @return void
+ */
+void FT8xxSim::Reply(const unsigned char * reply, size_t length)
+{
+	for (size_t i = 0; i < length; i++) {
+		Delay(WireTimeMs(1, baud));
+
+		if (write(master_fd, reply + i, 1) != 1) {
+			return;
+		}
+	}
+
+	lock_guard<mutex> guard(lock);
+	stats.replies++;
+}
+
+/**
+ * Sleep for given time
+ * @param double ms
+ * @return void
+ */
+void FT8xxSim::Delay(double ms)
+{
+	if (ms <= 0) {
+		return;
+	}
+
+	struct timespec wait;
+	wait.tv_sec = (time_t)(ms / 1000);
+	wait.tv_nsec = (long)((ms - wait.tv_sec * 1000.0) * 1000000);
+
+	while (nanosleep(&wait, &wait) != 0 && errno == EINTR) {
+	}
+}
+
+bool FT8xxSim::Chance(double rate)
+{
+	if (rate <= 0) {
+		return false;
+	}
+
+	return uniform_real_distribution<double>(0, 1)(generator) < rate;
+}
+
+/**
+ * Some channels carry a signal so scans have something to find: every
+ * 25 kHz channel whose hash hits is busy, the rest hears noise
+ * @return int S-meter 0 - 15
+ */
+int FT8xxSim::Signal()
+{
+	uint32_t channel = frequency_hz / 25000;
+	uint32_t hash = channel * 2654435761u;
+
+	if (hash % 8 == 0) {
+		return 9 + hash % 7;
+	}
+
+	return hash % 3;
+}
+
+/**
+ * Receiver status byte, caller holds the lock
+ * @return unsigned char
+ */
+unsigned char FT8xxSim::RxStatus()
+{
+	int signal = Signal();
+	bool squelched = signal < 4;
+
+	// bit 5 is low while centered, ctcss/dcs bit stays off
+	return signal | (squelched ? 0x80 : 0x00);
+}
+
+/**
+ * Transmitter status byte, caller holds the lock. Radio answers 0xff
+ * while receiving, PTT and split bits are active low.
+ * @return unsigned char
+ */
+unsigned char FT8xxSim::TxStatus()
+{
+	if (!ptt) {
+		return 0xff;
+	}
+
+	return tx_power | (split ? 0x00 : 0x20);
+}
+
+/**
+ * Blank EEPROM with a few memory channels, channel 1 at the starting
+ * frequency
+ * @return void
+ */
+void FT8xxSim::SeedEeprom()
+{
+	EepromImage image;
+	MemoryChannel channel;
+	const struct {
+		uint32_t frequency_hz;
+		char mode;
+		int duplex;
+		int tone_mode;
+		double ctcss_hz;
+		const char * name;
+	} seeds[] = {
+		{frequency_hz, mode, EepromImage::DUPLEX_NONE, EepromImage::TONE_OFF, 0, "HOME"},
+		{145500000, Cat::OP_MODE_FM, EepromImage::DUPLEX_NONE, EepromImage::TONE_OFF, 0, "CALL"},
+		{145650000, Cat::OP_MODE_FM, EepromImage::DUPLEX_MINUS, EepromImage::TONE_ENCODE, 88.5, "RPT1"},
+		{433500000, Cat::OP_MODE_FMN, EepromImage::DUPLEX_NONE, EepromImage::TONE_SQUELCH, 123.0, "UHF"},
+		{14074000, Cat::OP_MODE_USB, EepromImage::DUPLEX_NONE, EepromImage::TONE_OFF, 0, "FT8"}
+	};
+
+	for (int i = 0; i < EepromImage::SIZE; i++) {
+		image.Set(i, 0x00);
+	}
+
+	for (size_t i = 0; i < sizeof(seeds) / sizeof(seeds[0]); i++) {
+		channel.number = i + 1;
+		channel.filled = true;
+		channel.visible = true;
+		channel.skip = false;
+		channel.frequency_hz = seeds[i].frequency_hz;
+		channel.mode = seeds[i].mode;
+		channel.duplex = seeds[i].duplex;
+		channel.offset_hz = seeds[i].duplex == EepromImage::DUPLEX_NONE ? 0 : 600000;
+		channel.tone_mode = seeds[i].tone_mode;
+		channel.ctcss_hz = seeds[i].ctcss_hz;
+		channel.dcs_code = 23;
+		channel.name = seeds[i].name;
+		image.SetChannel(channel);
+	}
+
+	lock_guard<mutex> guard(lock);
+	memset(eeprom, 0xff, sizeof(eeprom));
+
+	for (int i = 0; i < EepromImage::SIZE; i++) {
+		eeprom[i] = image.Get(i);
+	}
+}
+
@@ -0,0 +1,112 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "eeprom_image.h"
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+#ifndef FT8XX_SIM_H
+#define FT8XX_SIM_H
+
+struct SimStats {
+	uint64_t frames;
+	uint64_t replies;
+	uint64_t dropped;
+	uint64_t shortened;
+};
+
+/**
+ * FT-817/857/897 stand-in on a pseudo-terminal. Cat opens the slave side
+ * like any serial device; the simulator reads 5 byte frames from the
+ * master side, updates radio state and answers after the time the frame
+ * and its reply would take on the wire at the configured baud rate plus
+ * a processing delay. Replies can be dropped or cut short on purpose.
+ *
+ * The EEPROM is emulated too, seeded with a few memory channels; channel
+ * 1 holds the starting frequency, so sims started with different -f
+ * have configurations that differ.
+ */
+class FT8xxSim
+{
+	private:
+		// FT-817ND, the image is the lower part
+		static const int EEPROM_SIZE = 0x1925;
+
+		int master_fd, slave_fd;
+		string device, link;
+		int baud;
+		double processing_ms;
+		double drop_rate, short_rate;
+		bool verbose;
+
+		thread worker;
+		atomic<bool> running;
+		mutex lock;
+		mt19937 generator;
+
+		// radio state
+		uint32_t frequency_hz;
+		char mode;
+		bool locked, ptt, split;
+		int tx_power;
+		uint8_t eeprom[EEPROM_SIZE];
+
+		SimStats stats;
+
+		void Loop();
+		void Handle(const unsigned char * frame);
+		void Reply(const unsigned char * reply, size_t length);
+		void Delay(double ms);
+		bool Chance(double rate);
+		unsigned char RxStatus();
+		unsigned char TxStatus();
+		int Signal();
+		void SeedEeprom();
+
+		// when the last byte sent to us finished arriving on the wire
+		double rx_clock;
+
+	public:
+		FT8xxSim();
+		~FT8xxSim();
+
+		bool Open(const string & link_path = "");
+		void Close();
+
+		bool Start();
+		void Stop();
+
+		void SetBaud(int b);
+		void SetProcessingDelay(double ms);
+		void SetFaults(double drop, double shortened);
+		void SetSeed(uint32_t seed);
+		void SetVerbose(bool v);
+		void SetFrequency(uint32_t hz);
+
+		string GetDevice();
+		uint32_t GetFrequency();
+		char GetMode();
+		bool GetPtt();
+		bool GetLock();
+		SimStats GetStats();
+		uint8_t GetEeprom(int address);
+
+		static double WireTimeMs(size_t bytes, int baud);
+};
+
+#endif
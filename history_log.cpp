@@ -0,0 +1,512 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "history_log.h"
+#include "clock.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iostream>
+
+using namespace std;
+
+static_assert(sizeof(HistoryRecord) == 32, "history record layout changed");
+
+const char HistoryLog::MAGIC[8] = {'Y', 'A', 'E', 'S', 'U', 'H', 'L', 'G'};
+const uint32_t HistoryLog::VERSION;
+const size_t HistoryLog::HEADER_SIZE;
+
+// HistoryRecord
+
+bool HistoryRecord::Has(TcvrStatus::Group group) const
+{
+	return groups & (1 << group);
+}
+
+bool HistoryRecord::Is(Flag flag) const
+{
+	return flags & flag;
+}
+
+// constructor
+
+HistoryLog::HistoryLog()
+{
+	fd = -1;
+	writable = false;
+	mapping = NULL;
+	map_size = 0;
+	header = NULL;
+	records = NULL;
+
+	next_sequence = 1;
+	synced_sequence = 1;
+	last_sync = 0;
+	sync_records = 256;
+	sync_ms = 5000;
+
+	memset(last_generation, 0, sizeof(last_generation));
+}
+
+// destructor
+
+HistoryLog::~HistoryLog()
+{
+	Close();
+}
+
+// setters & getters
+
+/**
+ * How often appended records are forced to disk
+ * @param int records Sync after this many records
+ * @param int ms Sync after this many milliseconds
+ * @return void
+ */
+void HistoryLog::SetSyncPolicy(int records, int ms)
+{
+	sync_records = records < 1 ? 1 : records;
+	sync_ms = ms < 0 ? 0 : ms;
+}
+
+bool HistoryLog::IsOpen()
+{
+	return mapping != NULL;
+}
+
+uint64_t HistoryLog::GetCapacity()
+{
+	return header ? header->capacity : 0;
+}
+
+/**
+ * Oldest sequence still in the ring
+ * @return uint64_t
+ */
+uint64_t HistoryLog::GetFirstSequence()
+{
+	uint64_t capacity = GetCapacity();
+
+	return next_sequence > capacity ? next_sequence - capacity : 1;
+}
+
+uint64_t HistoryLog::GetNextSequence()
+{
+	return next_sequence;
+}
+
+int64_t HistoryLog::GetCreatedMs()
+{
+	return header ? header->created_ms : 0;
+}
+
+// public methods
+
+/**
+ * Open history file for appending, create it if needed. The whole file is
+ * allocated up front so the disk can not fill up later.
+ * @param string path
+ * @param size_t max_bytes File size including header, used for new files
+ * @return bool
+ */
+bool HistoryLog::Open(const string & path, size_t max_bytes)
+{
+	Close();
+
+	fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+	if (fd < 0) {
+		perror("ERROR opening history file");
+		return false;
+	}
+
+	struct stat info;
+
+	if (fstat(fd, &info) < 0) {
+		perror("ERROR reading history file");
+		Close();
+		return false;
+	}
+
+	bool created = info.st_size == 0;
+
+	if (created) {
+		uint64_t capacity = max_bytes > HEADER_SIZE ? (max_bytes - HEADER_SIZE) / sizeof(HistoryRecord) : 0;
+
+		if (capacity < 1) {
+			cout << "History file limit too small: " << max_bytes << " bytes" << endl;
+			Close();
+			return false;
+		}
+
+		map_size = HEADER_SIZE + capacity * sizeof(HistoryRecord);
+		int result = posix_fallocate(fd, 0, map_size);
+
+		if (result != 0) {
+			errno = result;
+			perror("ERROR allocating history file");
+			Close();
+			return false;
+		}
+	} else {
+		map_size = info.st_size;
+	}
+
+	mapping = (char *)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (mapping == MAP_FAILED) {
+		perror("ERROR mapping history file");
+		mapping = NULL;
+		Close();
+		return false;
+	}
+
+	header = (Header *)mapping;
+	records = (HistoryRecord *)(mapping + HEADER_SIZE);
+
+	if (created) {
+		memcpy(header->magic, MAGIC, sizeof(MAGIC));
+		header->version = VERSION;
+		header->record_size = sizeof(HistoryRecord);
+		header->capacity = (map_size - HEADER_SIZE) / sizeof(HistoryRecord);
+		header->next_sequence = 1;
+		header->created_ms = Clock::WallClockMs();
+
+		msync(mapping, HEADER_SIZE, MS_SYNC);
+	}
+
+	if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION || header->record_size != sizeof(HistoryRecord) || HEADER_SIZE + header->capacity * sizeof(HistoryRecord) != map_size) {
+		cout << "Not a history file or different version: " << path << endl;
+		Close();
+		return false;
+	}
+
+	writable = true;
+
+	if (!created && max_bytes > HEADER_SIZE && map_size != HEADER_SIZE + (max_bytes - HEADER_SIZE) / sizeof(HistoryRecord) * sizeof(HistoryRecord)) {
+		cout << "History file " << path << " keeps its size of " << map_size << " bytes" << endl;
+	}
+
+	// replay records written after the header was last synced
+	next_sequence = header->next_sequence;
+
+	while (Valid(records[(next_sequence - 1) % header->capacity], next_sequence)) {
+		next_sequence++;
+	}
+
+	synced_sequence = next_sequence;
+	header->next_sequence = next_sequence;
+	last_sync = Clock::MonotonicMs();
+
+	return true;
+}
+
+/**
+ * Open history file for reading, e.g. while the daemon appends to it
+ * @param string path
+ * @return bool
+ */
+bool HistoryLog::OpenReadOnly(const string & path)
+{
+	Close();
+
+	fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		perror("ERROR opening history file");
+		return false;
+	}
+
+	struct stat info;
+
+	if (fstat(fd, &info) < 0 || (size_t)info.st_size < HEADER_SIZE) {
+		cout << "Not a history file: " << path << endl;
+		Close();
+		return false;
+	}
+
+	map_size = info.st_size;
+	mapping = (char *)mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	if (mapping == MAP_FAILED) {
+		perror("ERROR mapping history file");
+		mapping = NULL;
+		Close();
+		return false;
+	}
+
+	header = (Header *)mapping;
+	records = (HistoryRecord *)(mapping + HEADER_SIZE);
+
+	if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION || header->record_size != sizeof(HistoryRecord) || HEADER_SIZE + header->capacity * sizeof(HistoryRecord) != map_size) {
+		cout << "Not a history file or different version: " << path << endl;
+		Close();
+		return false;
+	}
+
+	next_sequence = header->next_sequence;
+
+	while (Valid(records[(next_sequence - 1) % header->capacity], next_sequence)) {
+		next_sequence++;
+	}
+
+	return true;
+}
+
+/**
+ * Sync what is left and unmap
+ * @return void
+ */
+void HistoryLog::Close()
+{
+	if (mapping) {
+		if (writable) {
+			Sync();
+		}
+
+		munmap(mapping, map_size);
+	}
+
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	fd = -1;
+	writable = false;
+	mapping = NULL;
+	map_size = 0;
+	header = NULL;
+	records = NULL;
+}
+
+/**
+ * Append status if it holds a reading not appended yet
+ * @param TcvrStatus status
+ * @return bool False if nothing was appended
+ */
+bool HistoryLog::Append(const TcvrStatus & status)
+{
+	uint8_t groups = 0;
+
+	for (int i = 0; i < TcvrStatus::GROUP_COUNT; i++) {
+		if (status.generation[i] != last_generation[i]) {
+			last_generation[i] = status.generation[i];
+			groups |= 1 << i;
+		}
+	}
+
+	if (groups == 0) {
+		return false;
+	}
+
+	return Append(FromStatus(status, Clock::WallClockMs(), groups));
+}
+
+/**
+ * Store record in the next slot, sequence and checksum are filled in here
+ * @param HistoryRecord record
+ * @return bool
+ */
+bool HistoryLog::Append(const HistoryRecord & record)
+{
+	if (!writable) {
+		return false;
+	}
+
+	HistoryRecord & slot = records[(next_sequence - 1) % header->capacity];
+
+	slot = record;
+	slot.sequence = next_sequence;
+	memset(slot.reserved, 0, sizeof(slot.reserved));
+	slot.checksum = Checksum(slot);
+
+	next_sequence++;
+
+	if (next_sequence - synced_sequence >= (uint64_t)sync_records) {
+		return Sync();
+	}
+
+	return true;
+}
+
+/**
+ * Call periodically, syncs once the sync interval passed
+ * @return void
+ */
+void HistoryLog::Tick()
+{
+	if (writable && next_sequence != synced_sequence && Clock::MonotonicMs() - last_sync >= sync_ms) {
+		Sync();
+	}
+}
+
+/**
+ * Write dirty records, then the header pointing past them
+ * @return bool
+ */
+bool HistoryLog::Sync()
+{
+	if (!writable) {
+		return false;
+	}
+
+	last_sync = Clock::MonotonicMs();
+
+	if (next_sequence == synced_sequence) {
+		return true;
+	}
+
+	uint64_t capacity = header->capacity;
+	uint64_t from = synced_sequence;
+
+	// more than a full ring behind, everything is dirty
+	if (next_sequence - from > capacity) {
+		from = next_sequence - capacity;
+	}
+
+	uint64_t first = (from - 1) % capacity;
+	uint64_t last = (next_sequence - 2) % capacity;
+	bool ok;
+
+	if (first <= last) {
+		ok = SyncRange(first, last + 1);
+	} else {
+		ok = SyncRange(first, capacity) && SyncRange(0, last + 1);
+	}
+
+	header->next_sequence = next_sequence;
+	ok = msync(mapping, HEADER_SIZE, MS_SYNC) == 0 && ok;
+
+	if (!ok) {
+		perror("ERROR syncing history file");
+	}
+
+	synced_sequence = next_sequence;
+
+	return ok;
+}
+
+/**
+ * Copy out one record
+ * @param uint64_t sequence
+ * @param HistoryRecord record
+ * @return bool False if sequence is not (or no longer) in the ring
+ */
+bool HistoryLog::Read(uint64_t sequence, HistoryRecord & record)
+{
+	if (!mapping || sequence < GetFirstSequence() || sequence >= next_sequence) {
+		return false;
+	}
+
+	record = records[(sequence - 1) % header->capacity];
+
+	return Valid(record, sequence);
+}
+
+/**
+ * First sequence at or after the given time, binary search over the ring
+ * @param int64_t time_ms
+ * @return uint64_t Next sequence if all records are older
+ */
+uint64_t HistoryLog::Find(int64_t time_ms)
+{
+	uint64_t low = GetFirstSequence(), high = next_sequence;
+	HistoryRecord record;
+
+	while (low < high) {
+		uint64_t middle = low + (high - low) / 2;
+
+		// overwritten under our feet, it was old
+		if (!Read(middle, record) || record.time_ms < time_ms) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return low;
+}
+
+/**
+ * Pack status into a record
+ * @param TcvrStatus status
+ * @param int64_t time_ms
+ * @param uint8_t groups Bit per TcvrStatus::Group read for this record
+ * @return HistoryRecord
+ */
+HistoryRecord HistoryLog::FromStatus(const TcvrStatus & status, int64_t time_ms, uint8_t groups)
+{
+	HistoryRecord record;
+	memset(&record, 0, sizeof(record));
+
+	record.time_ms = time_ms;
+	record.frequency_hz = status.frequency_hz;
+	record.mode = status.mode;
+	record.rx_signal = status.rx_signal;
+	record.tx_power = status.tx_power;
+	record.groups = groups;
+
+	record.flags = (status.centered ? HistoryRecord::FLAG_CENTERED : 0)
+		| (status.ctcss_dcs ? HistoryRecord::FLAG_CTCSS_DCS : 0)
+		| (status.rx_squelched ? HistoryRecord::FLAG_RX_SQUELCHED : 0)
+		| (status.split ? HistoryRecord::FLAG_SPLIT : 0)
+		| (status.swr_high ? HistoryRecord::FLAG_SWR_HIGH : 0)
+		| (status.ptt_on ? HistoryRecord::FLAG_PTT_ON : 0);
+
+	return record;
+}
+
+// private methods
+
+bool HistoryLog::Valid(const HistoryRecord & record, uint64_t sequence) const
+{
+	return record.sequence == sequence && record.checksum == Checksum(record);
+}
+
+/**
+ * msync record slots [from, to), widened to whole pages
+ * @param uint64_t from
+ * @param uint64_t to
+ * @return bool
+ */
+bool HistoryLog::SyncRange(uint64_t from, uint64_t to)
+{
+	static const size_t PAGE = sysconf(_SC_PAGESIZE);
+
+	size_t start = HEADER_SIZE + from * sizeof(HistoryRecord);
+	size_t end = HEADER_SIZE + to * sizeof(HistoryRecord);
+
+	start -= start % PAGE;
+
+	return msync(mapping + start, end - start, MS_SYNC) == 0;
+}
+
+/**
+ * FNV-1a over everything but the checksum itself
+ * @param HistoryRecord record
+ * @return uint32_t
+ */
+uint32_t HistoryLog::Checksum(const HistoryRecord & record)
+{
+	const unsigned char * bytes = (const unsigned char *)&record;
+	uint32_t hash = 2166136261u;
+
+	for (size_t i = 0; i < offsetof(HistoryRecord, checksum); i++) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+
+	return hash;
+}
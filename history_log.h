@@ -0,0 +1,128 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "tcvr_status.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+#ifndef HISTORY_LOG_H
+#define HISTORY_LOG_H
+
+/**
+ * One status sample on disk, 32 bytes. Sequence numbers start at 1 and a
+ * slot holding a sequence other than the one expected there is empty or
+ * stale; the checksum catches records torn by a crash.
+ */
+struct HistoryRecord {
+	uint64_t sequence;
+	int64_t time_ms;			// wall clock, ms since epoch
+	uint32_t frequency_hz;
+	uint8_t mode;
+	uint8_t rx_signal;
+	uint8_t tx_power;
+	uint8_t flags;
+	uint8_t groups;				// bit per TcvrStatus::Group read since the previous record
+	uint8_t reserved[3];
+	uint32_t checksum;
+
+	enum Flag {
+		FLAG_CENTERED = 0x01,
+		FLAG_CTCSS_DCS = 0x02,
+		FLAG_RX_SQUELCHED = 0x04,
+		FLAG_SPLIT = 0x08,
+		FLAG_SWR_HIGH = 0x10,
+		FLAG_PTT_ON = 0x20
+	};
+
+	bool Has(TcvrStatus::Group group) const;
+	bool Is(Flag flag) const;
+};
+
+/**
+ * Append-only status history in a fixed size file used as a ring. The
+ * file is one header page followed by fixed size record slots and is
+ * memory-mapped, so appending is a store into the page cache and the file
+ * never grows past the size it was created with; the oldest records are
+ * overwritten. Dirty records are msync'ed in batches, every so many
+ * records or milliseconds, and the header's write position only after
+ * them. On open, records past the header's position are replayed as long
+ * as sequence and checksum match, which recovers up to the last complete
+ * record after a crash.
+ */
+class HistoryLog
+{
+	private:
+		struct Header {
+			char magic[8];
+			uint32_t version;
+			uint32_t record_size;
+			uint64_t capacity;
+			uint64_t next_sequence;
+			int64_t created_ms;
+		};
+
+		int fd;
+		bool writable;
+		char * mapping;
+		size_t map_size;
+		Header * header;
+		HistoryRecord * records;
+
+		uint64_t next_sequence;
+		uint64_t synced_sequence;
+		double last_sync;
+		int sync_records;
+		int sync_ms;
+
+		uint64_t last_generation[TcvrStatus::GROUP_COUNT];
+
+		bool Valid(const HistoryRecord & record, uint64_t sequence) const;
+		bool SyncRange(uint64_t from, uint64_t to);
+
+		static uint32_t Checksum(const HistoryRecord & record);
+
+	public:
+		static const char MAGIC[8];
+		static const uint32_t VERSION = 1;
+
+		// records live on page boundaries past the header
+		static const size_t HEADER_SIZE = 4096;
+
+		HistoryLog();
+		~HistoryLog();
+
+		bool Open(const string & path, size_t max_bytes);
+		bool OpenReadOnly(const string & path);
+		void Close();
+		bool IsOpen();
+
+		void SetSyncPolicy(int records, int ms);
+
+		bool Append(const TcvrStatus & status);
+		bool Append(const HistoryRecord & record);
+		void Tick();
+		bool Sync();
+
+		uint64_t GetCapacity();
+		uint64_t GetFirstSequence();
+		uint64_t GetNextSequence();
+		int64_t GetCreatedMs();
+		bool Read(uint64_t sequence, HistoryRecord & record);
+		uint64_t Find(int64_t time_ms);
+
+		static HistoryRecord FromStatus(const TcvrStatus & status, int64_t time_ms, uint8_t groups);
+};
+
+#endif
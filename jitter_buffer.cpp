@@ -0,0 +1,292 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "jitter_buffer.h"
+#include <math.h>
+#include <string.h>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+
+// gain of the repeated frame, q8, then silence
+static const int FADE[] = {205, 128, 64, 32};
+static const int FADE_FRAMES = sizeof(FADE) / sizeof(FADE[0]);
+
+// constructor
+
+JitterBuffer::JitterBuffer()
+{
+	frames = new AudioFrame[CAPACITY];
+	present = new bool[CAPACITY];
+	jitter_us = 0;
+	depth = 0;
+	target = MIN_FRAMES;
+	jitter_ms_x10 = 0;
+	received = 0;
+	late = 0;
+	duplicates = 0;
+	lost = 0;
+	concealed = 0;
+	grown = 0;
+	shrunk = 0;
+
+	Reset();
+}
+
+// destructor
+
+JitterBuffer::~JitterBuffer()
+{
+	delete[] frames;
+	delete[] present;
+}
+
+// public methods
+
+/**
+ * Start over for a new stream, the jitter estimate is kept
+ * @return void
+ */
+void JitterBuffer::Reset()
+{
+	Clear();
+	has_transit = false;
+}
+
+/**
+ * Add a received frame
+ * @param AudioFrame frame With arrival_us set, or 0 to leave the estimate alone
+ * @return bool False if late or a duplicate
+ */
+bool JitterBuffer::Put(const AudioFrame & frame)
+{
+	if (frame.arrival_us != 0) {
+		int64_t transit = (int64_t)(frame.arrival_us - frame.time_us);
+
+		if (has_transit) {
+			jitter_us += (fabs((double)(transit - last_transit)) - jitter_us) / 16;
+		}
+
+		last_transit = transit;
+		has_transit = true;
+
+		int frames_needed = (int)ceil(4 * jitter_us / (AUDIO_FRAME_MS * 1000)) + 1;
+		target = frames_needed < MIN_FRAMES ? MIN_FRAMES : frames_needed > MAX_FRAMES ? MAX_FRAMES : frames_needed;
+		jitter_ms_x10 = (int)(jitter_us / 100);
+	}
+
+	if (!started) {
+		started = true;
+		next_sequence = frame.sequence;
+
+		// nothing to repeat yet, concealment before the first frame is silence
+		last.rate = frame.rate;
+		last.samples = frame.samples;
+		concealed_run = FADE_FRAMES;
+	}
+
+	int32_t offset = (int32_t)(frame.sequence - next_sequence);
+
+	// far behind is a sender that started over, far ahead one we lost track of
+	if (offset < -CAPACITY || offset >= CAPACITY) {
+		Clear();
+		return Put(frame);
+	}
+
+	if (offset < 0) {
+		late++;
+		return false;
+	}
+
+	int slot = frame.sequence % CAPACITY;
+
+	if (present[slot]) {
+		duplicates++;
+		return false;
+	}
+
+	frames[slot] = frame;
+	present[slot] = true;
+	stored++;
+	received++;
+	depth = stored;
+
+	return true;
+}
+
+/**
+ * Next frame to play, call once per frame period
+ * @param AudioFrame frame
+ * @param bool end No more frames are coming, play out the rest without waiting
+ * @return Playout What was written to frame, nothing for PLAYOUT_NONE
+ */
+JitterBuffer::Playout JitterBuffer::Get(AudioFrame & frame, bool end)
+{
+	if (!started) {
+		return PLAYOUT_NONE;
+	}
+
+	if (!playing) {
+		if (stored == 0 || (stored < target && !end)) {
+			return PLAYOUT_NONE;
+		}
+
+		playing = true;
+		empty_run = 0;
+	}
+
+	if (present[next_sequence % CAPACITY]) {
+		Take(frame);
+
+		// a second above target, drop a frame to bring the delay down
+		if (stored > target + 1) {
+			if (++excess_run >= SHRINK_AFTER && present[next_sequence % CAPACITY]) {
+				present[next_sequence % CAPACITY] = false;
+				next_sequence++;
+				stored--;
+				excess_run = 0;
+				shrunk++;
+			}
+		} else {
+			excess_run = 0;
+		}
+
+		depth = stored;
+
+		return PLAYOUT_FRAME;
+	}
+
+	// later frames are here, this one is lost
+	if (stored > 0) {
+		lost++;
+		Conceal(frame);
+		next_sequence++;
+
+		return PLAYOUT_CONCEALED;
+	}
+
+	// ran dry: stretch by a frame, the delay grows; after a few stop and buffer again
+	if (end || ++empty_run > MAX_STRETCH) {
+		playing = false;
+		empty_run = 0;
+
+		return PLAYOUT_NONE;
+	}
+
+	grown++;
+	Conceal(frame);
+
+	return PLAYOUT_CONCEALED;
+}
+
+int JitterBuffer::GetDepth()
+{
+	return depth;
+}
+
+int JitterBuffer::GetTarget()
+{
+	return target;
+}
+
+double JitterBuffer::GetJitterMs()
+{
+	return jitter_ms_x10 / 10.0;
+}
+
+/**
+ * Counters as key:value lines
+ * @param string prefix Key prefix
+ * @return string
+ */
+string JitterBuffer::Stats(const string & prefix)
+{
+	stringstream output;
+	output << fixed << setprecision(1);
+
+	output << prefix << "received:" << received.load() << "\n";
+	output << prefix << "late:" << late.load() << "\n";
+	output << prefix << "duplicates:" << duplicates.load() << "\n";
+	output << prefix << "lost:" << lost.load() << "\n";
+	output << prefix << "concealed:" << concealed.load() << "\n";
+	output << prefix << "grown:" << grown.load() << "\n";
+	output << prefix << "shrunk:" << shrunk.load() << "\n";
+	output << prefix << "depth:" << depth.load() << "\n";
+	output << prefix << "target:" << target.load() << "\n";
+	output << prefix << "jitter_ms:" << GetJitterMs() << "\n";
+
+	return output.str();
+}
+
+// private methods
+
+void JitterBuffer::Clear()
+{
+	for (int i = 0; i < CAPACITY; i++) {
+		present[i] = false;
+	}
+
+	stored = 0;
+	started = false;
+	playing = false;
+	concealed_run = 0;
+	empty_run = 0;
+	excess_run = 0;
+	depth = 0;
+}
+
+/**
+ * Hand out the frame at the playout point and keep it for concealment
+ * @param AudioFrame frame
+ * @return void
+ */
+void JitterBuffer::Take(AudioFrame & frame)
+{
+	int slot = next_sequence % CAPACITY;
+
+	frame = frames[slot];
+	present[slot] = false;
+	stored--;
+	next_sequence++;
+
+	memcpy(last.pcm, frame.pcm, frame.samples * sizeof(int16_t));
+	last.rate = frame.rate;
+	last.samples = frame.samples;
+	concealed_run = 0;
+	empty_run = 0;
+}
+
+/**
+ * Last frame again, quieter every time, then silence
+ * @param AudioFrame frame
+ * @return void
+ */
+void JitterBuffer::Conceal(AudioFrame & frame)
+{
+	frame.sequence = next_sequence;
+	frame.time_us = 0;
+	frame.arrival_us = 0;
+	frame.rate = last.rate;
+	frame.samples = last.samples;
+
+	if (concealed_run < FADE_FRAMES) {
+		for (int i = 0; i < frame.samples; i++) {
+			frame.pcm[i] = (last.pcm[i] * FADE[concealed_run]) >> 8;
+		}
+	} else {
+		memset(frame.pcm, 0, frame.samples * sizeof(int16_t));
+	}
+
+	concealed_run++;
+	concealed++;
+}
@@ -0,0 +1,108 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "audio_packet.h"
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+/**
+ * Reorders received audio frames by sequence number and hands them out one
+ * per frame period, holding just enough back to ride out network jitter.
+ *
+ * Jitter is estimated like RFC 3550 does, from the difference of transit
+ * times of consecutive frames, smoothed over 16. The target depth is four
+ * times that, rounded up to whole frames, plus one. Playout starts once
+ * the target is buffered. When the buffer runs dry the delay grows by a
+ * concealed frame, when it stays above target for a second one frame is
+ * dropped to shrink it back.
+ *
+ * A missing frame is concealed by repeating the last one, fading out over
+ * four frames, then silence. Frames after the playout point are late and
+ * dropped. Put() and Get() are for a single consumer thread, the counters
+ * may be read from anywhere.
+ */
+class JitterBuffer
+{
+	public:
+		enum Playout {
+			PLAYOUT_NONE = 0,		// still buffering, or empty at the end
+			PLAYOUT_FRAME,
+			PLAYOUT_CONCEALED
+		};
+
+		// frames held at most, a sequence jump further restarts the stream
+		static const int CAPACITY = 64;
+
+		// target depth limits, 40 to 500 ms
+		static const int MIN_FRAMES = 2;
+		static const int MAX_FRAMES = 25;
+
+		// frames above target before one is dropped
+		static const int SHRINK_AFTER = 50;
+
+		// empty frames concealed before playout stops and buffers again
+		static const int MAX_STRETCH = 3;
+
+		JitterBuffer();
+		~JitterBuffer();
+
+		void Reset();
+		bool Put(const AudioFrame & frame);
+		Playout Get(AudioFrame & frame, bool end);
+
+		int GetDepth();
+		int GetTarget();
+		double GetJitterMs();
+
+		string Stats(const string & prefix);
+
+	private:
+		AudioFrame * frames;
+		bool * present;
+		int stored;
+		bool started;
+		bool playing;
+		uint32_t next_sequence;
+
+		bool has_transit;
+		int64_t last_transit;
+		double jitter_us;
+
+		AudioFrame last;
+		int concealed_run;
+		int empty_run;
+		int excess_run;
+
+		atomic<int> depth;
+		atomic<int> target;
+		atomic<int> jitter_ms_x10;
+
+		atomic<uint64_t> received;
+		atomic<uint64_t> late;
+		atomic<uint64_t> duplicates;
+		atomic<uint64_t> lost;
+		atomic<uint64_t> concealed;
+		atomic<uint64_t> grown;
+		atomic<uint64_t> shrunk;
+
+		void Clear();
+		void Take(AudioFrame & frame);
+		void Conceal(AudioFrame & frame);
+};
+
+#endif
@@ -0,0 +1,295 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "link_health.h"
+#include <math.h>
+#include <stdlib.h>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+
+// error rate above which a link that answers counts as degraded
+static const uint32_t DEGRADED_ERROR_PPM = 50000;
+
+// constructor
+
+LinkHealth::LinkHealth()
+{
+	baud = 9600;
+	state = STATE_UP;
+	backoff = 0;
+	srtt_us = -1;
+	rttvar_us = 0;
+	rto_us = INITIAL_RTO_MS * 1000;
+	error_ppm = 0;
+	consecutive_failures = 0;
+	transitions = 0;
+}
+
+// public methods
+
+void LinkHealth::SetBaud(int b)
+{
+	baud = b > 0 ? b : 9600;
+}
+
+/**
+ * Time the bytes spend on the wire, 8N2 framing
+ * @param int bytes
+ * @return double Milliseconds
+ */
+double LinkHealth::WireMs(int bytes)
+{
+	return bytes * 11 * 1000.0 / baud.load(memory_order_relaxed);
+}
+
+/**
+ * How long to wait for a reply, from the write to the last byte
+ * @param int bytes_out Bytes of the command(s) sent
+ * @param int bytes_in Bytes of the expected reply
+ * @return int Milliseconds
+ */
+int LinkHealth::GetTimeoutMs(int bytes_out, int bytes_in)
+{
+	int64_t rto = rto_us.load(memory_order_relaxed) << backoff.load(memory_order_relaxed);
+
+	if (rto > MAX_RTO_MS * 1000) {
+		rto = MAX_RTO_MS * 1000;
+	}
+
+	return (int)ceil(WireMs(bytes_out + bytes_in) + rto / 1000.0);
+}
+
+/**
+ * Resends allowed for a command that timed out
+ * @return int
+ */
+int LinkHealth::GetRetries()
+{
+	// a dead link fails fast, each command is a single probe
+	return state.load(memory_order_relaxed) == STATE_DOWN ? 0 : MAX_RETRIES;
+}
+
+/**
+ * Complete reply received
+ * @param double round_trip_ms Write start to last byte
+ * @param int bytes_out
+ * @param int bytes_in
+ * @param bool sample False for resent commands, the reply may belong to either attempt
+ * @return void
+ */
+void LinkHealth::Success(double round_trip_ms, int bytes_out, int bytes_in, bool sample)
+{
+	if (sample) {
+		// response time of the tcvr itself, the wire time is added per command
+		int64_t r = (int64_t)((round_trip_ms - WireMs(bytes_out + bytes_in)) * 1000);
+		int64_t srtt = srtt_us.load(memory_order_relaxed);
+		int64_t rttvar = rttvar_us.load(memory_order_relaxed);
+
+		if (r < 0) {
+			r = 0;
+		}
+
+		if (srtt < 0) {
+			srtt = r;
+			rttvar = r / 2;
+		} else {
+			rttvar = (3 * rttvar + llabs(srtt - r)) / 4;
+			srtt = (7 * srtt + r) / 8;
+		}
+
+		int64_t rto = srtt + 4 * rttvar;
+
+		if (rto < MIN_RTO_MS * 1000) {
+			rto = MIN_RTO_MS * 1000;
+		} else if (rto > MAX_RTO_MS * 1000) {
+			rto = MAX_RTO_MS * 1000;
+		}
+
+		srtt_us.store(srtt, memory_order_relaxed);
+		rttvar_us.store(rttvar, memory_order_relaxed);
+		rto_us.store(rto, memory_order_relaxed);
+		backoff.store(0, memory_order_relaxed);
+	}
+
+	error_ppm.store(error_ppm.load(memory_order_relaxed) * 15 / 16, memory_order_relaxed);
+	consecutive_failures.store(0, memory_order_relaxed);
+
+	UpdateState();
+}
+
+/**
+ * Attempt timed out, came back short or the write failed
+ * @return void
+ */
+void LinkHealth::Failure()
+{
+	int b = backoff.load(memory_order_relaxed);
+
+	// back off at most to four times the learned timeout, probes stay quick
+	if (b < 2) {
+		backoff.store(b + 1, memory_order_relaxed);
+	}
+
+	error_ppm.store((error_ppm.load(memory_order_relaxed) * 15 + 1000000) / 16, memory_order_relaxed);
+	consecutive_failures.fetch_add(1, memory_order_relaxed);
+
+	UpdateState();
+}
+
+/**
+ * Device went away, down until a reply arrives again
+ * @return void
+ */
+void LinkHealth::Lost()
+{
+	if (consecutive_failures.load(memory_order_relaxed) < (uint64_t)DOWN_AFTER) {
+		consecutive_failures.store(DOWN_AFTER, memory_order_relaxed);
+	}
+
+	UpdateState();
+}
+
+LinkHealth::State LinkHealth::GetState()
+{
+	return (State)state.load(memory_order_relaxed);
+}
+
+double LinkHealth::GetSrttMs()
+{
+	int64_t srtt = srtt_us.load(memory_order_relaxed);
+
+	return srtt < 0 ? 0 : srtt / 1000.0;
+}
+
+double LinkHealth::GetRttvarMs()
+{
+	return rttvar_us.load(memory_order_relaxed) / 1000.0;
+}
+
+double LinkHealth::GetRtoMs()
+{
+	return GetTimeoutMs(0, 0);
+}
+
+double LinkHealth::GetErrorRate()
+{
+	return error_ppm.load(memory_order_relaxed) / 1000000.0;
+}
+
+uint64_t LinkHealth::GetConsecutiveFailures()
+{
+	return consecutive_failures.load(memory_order_relaxed);
+}
+
+/**
+ * Lines of "name:value" like the server's status output
+ * @return string
+ */
+string LinkHealth::Text()
+{
+	stringstream output;
+	output << fixed << setprecision(3);
+
+	output << "link_state:" << StateName(GetState()) << "\n";
+	output << "link_srtt_ms:" << GetSrttMs() << "\n";
+	output << "link_rttvar_ms:" << GetRttvarMs() << "\n";
+	output << "link_rto_ms:" << GetRtoMs() << "\n";
+	output << "link_error_rate:" << GetErrorRate() << "\n";
+	output << "link_consecutive_failures:" << GetConsecutiveFailures() << "\n";
+	output << "link_transitions:" << transitions.load(memory_order_relaxed) << "\n";
+
+	return output.str();
+}
+
+/**
+ * One JSON object
+ * @return string
+ */
+string LinkHealth::Json()
+{
+	stringstream output;
+	output << fixed << setprecision(3);
+
+	output << "{\"state\":\"" << StateName(GetState()) << "\"";
+	output << ",\"srtt_ms\":" << GetSrttMs();
+	output << ",\"rttvar_ms\":" << GetRttvarMs();
+	output << ",\"rto_ms\":" << GetRtoMs();
+	output << ",\"error_rate\":" << GetErrorRate();
+	output << ",\"consecutive_failures\":" << GetConsecutiveFailures();
+	output << ",\"transitions\":" << transitions.load(memory_order_relaxed) << "}";
+
+	return output.str();
+}
+
+/**
+ * Prometheus text exposition format
+ * @return string
+ */
+string LinkHealth::Prometheus()
+{
+	stringstream output;
+
+	output << "# HELP yaesu_link_state Serial link state, 0 up, 1 degraded, 2 down.\n";
+	output << "# TYPE yaesu_link_state gauge\n";
+	output << "yaesu_link_state " << GetState() << "\n";
+	output << "# HELP yaesu_link_srtt_seconds Smoothed tcvr response time.\n";
+	output << "# TYPE yaesu_link_srtt_seconds gauge\n";
+	output << "yaesu_link_srtt_seconds " << GetSrttMs() / 1000 << "\n";
+	output << "# HELP yaesu_link_rto_seconds Current reply timeout without wire time.\n";
+	output << "# TYPE yaesu_link_rto_seconds gauge\n";
+	output << "yaesu_link_rto_seconds " << GetRtoMs() / 1000 << "\n";
+	output << "# HELP yaesu_link_error_rate Decaying share of failed attempts.\n";
+	output << "# TYPE yaesu_link_error_rate gauge\n";
+	output << "yaesu_link_error_rate " << GetErrorRate() << "\n";
+	output << "# HELP yaesu_link_transitions_total Link state changes.\n";
+	output << "# TYPE yaesu_link_transitions_total counter\n";
+	output << "yaesu_link_transitions_total " << transitions.load(memory_order_relaxed) << "\n";
+
+	return output.str();
+}
+
+const char * LinkHealth::StateName(State state)
+{
+	switch (state) {
+		case STATE_UP:
+			return "up";
+		case STATE_DEGRADED:
+			return "degraded";
+		default:
+			return "down";
+	}
+}
+
+// private methods
+
+/**
+ * Down after DOWN_AFTER failures in a row, degraded while failures are
+ * recent, up once the error rate decayed
+ * @return void
+ */
+void LinkHealth::UpdateState()
+{
+	int next = STATE_UP;
+	uint64_t failures = consecutive_failures.load(memory_order_relaxed);
+
+	if (failures >= (uint64_t)DOWN_AFTER) {
+		next = STATE_DOWN;
+	} else if (failures > 0 || error_ppm.load(memory_order_relaxed) > DEGRADED_ERROR_PPM) {
+		next = STATE_DEGRADED;
+	}
+
+	if (state.exchange(next, memory_order_relaxed) != next) {
+		transitions.fetch_add(1, memory_order_relaxed);
+	}
+}
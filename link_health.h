@@ -0,0 +1,90 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+#ifndef LINK_HEALTH_H
+#define LINK_HEALTH_H
+
+/**
+ * Reply timeouts and health of the serial link to the tcvr. A reply may
+ * take the wire time of the frames at the current baud rate plus a
+ * retransmission timeout learned from the tcvr's response times the way
+ * TCP does it (smoothed RTT plus four times its variance, doubled per
+ * timeout, only sampled from first attempts). Attempts feed a consecutive
+ * failure count and a decaying error rate that move the link between up,
+ * degraded and down. Written by the thread talking to the tcvr, read from
+ * any thread.
+ */
+class LinkHealth
+{
+	public:
+		enum State {
+			STATE_UP = 0,
+			STATE_DEGRADED,
+			STATE_DOWN
+		};
+
+		// response time allowed before the first reply was measured
+		static const int INITIAL_RTO_MS = 100;
+		static const int MIN_RTO_MS = 20;
+		static const int MAX_RTO_MS = 3000;
+
+		// resends of a command that timed out, none while down
+		static const int MAX_RETRIES = 2;
+
+		// consecutive failed attempts until the link counts as down
+		static const int DOWN_AFTER = 3;
+
+		LinkHealth();
+
+		void SetBaud(int baud);
+		double WireMs(int bytes);
+		int GetTimeoutMs(int bytes_out, int bytes_in);
+		int GetRetries();
+
+		void Success(double round_trip_ms, int bytes_out, int bytes_in, bool sample);
+		void Failure();
+		void Lost();
+
+		State GetState();
+		double GetSrttMs();
+		double GetRttvarMs();
+		double GetRtoMs();
+		double GetErrorRate();
+		uint64_t GetConsecutiveFailures();
+
+		string Text();
+		string Json();
+		string Prometheus();
+
+		static const char * StateName(State state);
+
+	private:
+		atomic<int> baud;
+		atomic<int> state;
+		atomic<int> backoff;
+		atomic<int64_t> srtt_us;		// -1 until the first sample
+		atomic<int64_t> rttvar_us;
+		atomic<int64_t> rto_us;
+		atomic<uint32_t> error_ppm;		// failed attempts, 1/16 weight per attempt
+		atomic<uint64_t> consecutive_failures;
+		atomic<uint64_t> transitions;
+
+		void UpdateState();
+};
+
+#endif
@@ -0,0 +1,340 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "ndjson_writer.h"
+#include "cat_codec.h"
+#include "clock.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace std;
+
+const size_t NdjsonWriter::MAX_RECORD;
+
+// constructor
+
+NdjsonWriter::NdjsonWriter(size_t buffer_size)
+{
+	capacity = buffer_size < MAX_RECORD ? MAX_RECORD : buffer_size;
+	buffer = new char[capacity];
+	length = 0;
+	record_start = 0;
+	overflow = false;
+	first_field = true;
+	sequence = 0;
+
+	fd = -1;
+	flush_ms = 0;
+	last_flush = 0;
+}
+
+// destructor
+
+NdjsonWriter::~NdjsonWriter()
+{
+	Flush();
+	delete[] buffer;
+}
+
+// setters & getters
+
+/**
+ * Write records to a file descriptor instead of keeping them for the caller
+ * @param int output_fd
+ * @param int flush_interval_ms 0 writes every record right away
+ * @return void
+ */
+void NdjsonWriter::SetOutput(int output_fd, int flush_interval_ms)
+{
+	fd = output_fd;
+	flush_ms = flush_interval_ms < 0 ? 0 : flush_interval_ms;
+	last_flush = Clock::MonotonicMs();
+}
+
+const char * NdjsonWriter::GetData()
+{
+	return buffer;
+}
+
+size_t NdjsonWriter::GetLength()
+{
+	return length;
+}
+
+/**
+ * Drop buffered records, buffer itself is kept
+ * @return void
+ */
+void NdjsonWriter::Clear()
+{
+	length = 0;
+}
+
+// public methods
+
+/**
+ * Start a record
+ * @return void
+ */
+void NdjsonWriter::Begin()
+{
+	if (fd >= 0 && capacity - length < MAX_RECORD) {
+		Flush();
+	}
+
+	record_start = length;
+	overflow = false;
+	first_field = true;
+
+	AppendChar('{');
+}
+
+void NdjsonWriter::Integer(const char * name, int64_t value)
+{
+	AppendName(name);
+
+	if (value < 0) {
+		AppendChar('-');
+		AppendUnsigned(-(uint64_t)value);
+	} else {
+		AppendUnsigned(value);
+	}
+}
+
+/**
+ * Fixed point number, e.g. value 14190000 with 6 decimals is 14.190000
+ * @param char* name
+ * @param int64_t value
+ * @param int decimals 1 - 18
+ * @return void
+ */
+void NdjsonWriter::Fixed(const char * name, int64_t value, int decimals)
+{
+	uint64_t scale = 1;
+
+	for (int i = 0; i < decimals; i++) {
+		scale *= 10;
+	}
+
+	AppendName(name);
+
+	uint64_t magnitude = value < 0 ? -(uint64_t)value : value;
+
+	if (value < 0) {
+		AppendChar('-');
+	}
+
+	AppendUnsigned(magnitude / scale);
+
+	if (decimals > 0) {
+		char digits[20];
+		uint64_t fraction = magnitude % scale;
+
+		for (int i = decimals - 1; i >= 0; i--) {
+			digits[i] = '0' + fraction % 10;
+			fraction /= 10;
+		}
+
+		AppendChar('.');
+		Append(digits, decimals);
+	}
+}
+
+void NdjsonWriter::Bool(const char * name, bool value)
+{
+	AppendName(name);
+
+	if (value) {
+		Append("true", 4);
+	} else {
+		Append("false", 5);
+	}
+}
+
+/**
+ * String field, quotes, backslashes and control characters escaped
+ * @param char* name
+ * @param char* value
+ * @return void
+ */
+void NdjsonWriter::String(const char * name, const char * value)
+{
+	static const char HEX[] = "0123456789abcdef";
+
+	AppendName(name);
+	AppendChar('"');
+
+	for (const char * c = value; *c; c++) {
+		if (*c == '"' || *c == '\\') {
+			AppendChar('\\');
+			AppendChar(*c);
+		} else if ((unsigned char)*c < 0x20) {
+			char escape[6] = {'\\', 'u', '0', '0', HEX[(*c >> 4) & 0x0f], HEX[*c & 0x0f]};
+			Append(escape, 6);
+		} else {
+			AppendChar(*c);
+		}
+	}
+
+	AppendChar('"');
+}
+
+/**
+ * Finish record, written out if fd output is set and flush is due
+ * @return bool False if record did not fit and was dropped
+ */
+bool NdjsonWriter::End()
+{
+	AppendChar('}');
+	AppendChar('\n');
+
+	if (overflow) {
+		length = record_start;
+		return false;
+	}
+
+	if (fd >= 0 && (flush_ms == 0 || Clock::MonotonicMs() - last_flush >= flush_ms)) {
+		return Flush();
+	}
+
+	return true;
+}
+
+/**
+ * One status record with sequence number, wall clock time in seconds and
+ * the field groups read so far, numbers and booleans typed
+ * @param TcvrStatus status
+ * @param char* radio Name, left out if NULL
+ * @return void
+ */
+void NdjsonWriter::Status(const TcvrStatus & status, const char * radio)
+{
+	Begin();
+	Integer("seq", ++sequence);
+
+	if (radio) {
+		String("radio", radio);
+	}
+
+	Fixed("ts", Clock::WallClockMs(), 3);
+
+	if (status.Has(TcvrStatus::GROUP_FREQUENCY_MODE)) {
+		Integer("tcvr_frequency_hz", status.frequency_hz);
+		Fixed("tcvr_frequency", status.frequency_hz, 6);
+		String("tcvr_mode", CatCodec::ModeName(status.mode));
+	}
+
+	if (status.Has(TcvrStatus::GROUP_RX)) {
+		Integer("rx_signal", status.rx_signal);
+		Bool("centered", status.centered);
+		Bool("ctcss_dcs", status.ctcss_dcs);
+		Bool("rx_squelched", status.rx_squelched);
+	}
+
+	if (status.Has(TcvrStatus::GROUP_TX)) {
+		Integer("tx_power", status.tx_power);
+		Bool("split", status.split);
+		Bool("swr_high", status.swr_high);
+		Bool("ptt_on", status.ptt_on);
+	}
+
+	End();
+}
+
+/**
+ * Write buffered records to fd
+ * @return bool False on write error
+ */
+bool NdjsonWriter::Flush()
+{
+	if (fd < 0) {
+		return true;
+	}
+
+	size_t written = 0;
+
+	while (written < length) {
+		ssize_t n = write(fd, buffer + written, length - written);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (n <= 0) {
+			length = 0;
+			return false;
+		}
+
+		written += n;
+	}
+
+	length = 0;
+	last_flush = Clock::MonotonicMs();
+
+	return true;
+}
+
+// private methods
+
+void NdjsonWriter::Append(const char * text, size_t count)
+{
+	if (overflow || length + count > capacity) {
+		overflow = true;
+		return;
+	}
+
+	memcpy(buffer + length, text, count);
+	length += count;
+}
+
+void NdjsonWriter::AppendChar(char c)
+{
+	if (overflow || length >= capacity) {
+		overflow = true;
+		return;
+	}
+
+	buffer[length++] = c;
+}
+
+void NdjsonWriter::AppendUnsigned(uint64_t value)
+{
+	char digits[20];
+	int count = 0;
+
+	do {
+		digits[19 - count++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	Append(digits + 20 - count, count);
+}
+
+/**
+ * Field separator and quoted name
+ * @param char* name
+ * @return void
+ */
+void NdjsonWriter::AppendName(const char * name)
+{
+	if (!first_field) {
+		AppendChar(',');
+	}
+
+	first_field = false;
+
+	AppendChar('"');
+	Append(name, strlen(name));
+	AppendChar('"');
+	AppendChar(':');
+}
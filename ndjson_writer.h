@@ -0,0 +1,74 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "tcvr_status.h"
+#include <stddef.h>
+#include <stdint.h>
+
+using namespace std;
+
+#ifndef NDJSON_WRITER_H
+#define NDJSON_WRITER_H
+
+/**
+ * Writes one JSON object per line into a buffer allocated once. Numbers
+ * are formatted from integers by hand, so a record costs no allocation
+ * and fixed point values (MHz, seconds) come out exact. The buffer is
+ * either drained by the caller or written to a file descriptor, every
+ * record or at most every flush interval.
+ */
+class NdjsonWriter
+{
+	private:
+		char * buffer;
+		size_t capacity;
+		size_t length;
+		size_t record_start;
+		bool overflow;
+		bool first_field;
+		uint64_t sequence;
+
+		int fd;
+		int flush_ms;
+		double last_flush;
+
+		void Append(const char * text, size_t count);
+		void AppendChar(char c);
+		void AppendUnsigned(uint64_t value);
+		void AppendName(const char * name);
+
+	public:
+		// records are never longer than this
+		static const size_t MAX_RECORD = 1024;
+
+		NdjsonWriter(size_t buffer_size = 64 * 1024);
+		~NdjsonWriter();
+
+		void SetOutput(int output_fd, int flush_interval_ms);
+
+		void Begin();
+		void Integer(const char * name, int64_t value);
+		void Fixed(const char * name, int64_t value, int decimals);
+		void Bool(const char * name, bool value);
+		void String(const char * name, const char * value);
+		bool End();
+
+		void Status(const TcvrStatus & status, const char * radio = NULL);
+
+		const char * GetData();
+		size_t GetLength();
+		void Clear();
+		bool Flush();
+
+};
+
+#endif
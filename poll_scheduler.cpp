@@ -0,0 +1,290 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "poll_scheduler.h"
+#include "clock.h"
+
+using namespace std;
+
+const int PollScheduler::TICK_MS = 10;
+
+// polling intervals in milliseconds
+static const int INTERVAL_FAST = 100;
+static const int INTERVAL_NORMAL = 500;
+static const int INTERVAL_SLOW = 2000;
+static const int INTERVAL_IDLE = 5000;
+
+// time tcvr needs to start answering a command
+static const double TURNAROUND_MS = 10;
+
+// achieved rates are averaged over this window
+static const int RATE_WINDOW_MS = 10000;
+
+// constructor
+
+/**
+ * Constructor
+ * @param StatusCache* c
+ * @param int baud_rate 2400, 4800 or 9600
+ * @param double link_share Fraction of link time polling may use
+ */
+PollScheduler::PollScheduler(StatusCache * c, int baud_rate, double link_share)
+{
+	cache = c;
+	baud = baud_rate > 0 ? baud_rate : 9600;
+	share = link_share;
+	in_flight = false;
+	squelched = true;
+	transmitting = false;
+
+	polls[0].opcode = Cat::CMD_GET_RX_STATUS;
+	polls[0].name = "r";
+	polls[0].reply_bytes = 1;
+
+	polls[1].opcode = Cat::CMD_GET_TX_STATUS;
+	polls[1].name = "t";
+	polls[1].reply_bytes = 1;
+
+	polls[2].opcode = Cat::CMD_GET_FREQUENCY_MODE;
+	polls[2].name = "s";
+	polls[2].reply_bytes = 5;
+
+	for (int i = 0; i < 3; i++) {
+		polls[i].subscribers = 0;
+		polls[i].interval_ms = INTERVAL_IDLE;
+		polls[i].last = 0;
+	}
+
+	Plan();
+}
+
+// public methods
+
+/**
+ * Tell scheduler how many clients want a query type kept fresh
+ * @param char opcode CMD_GET_XXXXXX
+ * @param int subscribers
+ * @return void
+ */
+void PollScheduler::SetDemand(char opcode, int subscribers)
+{
+	for (int i = 0; i < 3; i++) {
+		if (polls[i].opcode == opcode) {
+			polls[i].subscribers = subscribers;
+		}
+	}
+
+	Plan();
+}
+
+/**
+ * Set fraction of serial link time polling may use
+ * @param double link_share 0 < share <= 1
+ * @return void
+ */
+void PollScheduler::SetLinkShare(double link_share)
+{
+	if (link_share > 0 && link_share <= 1) {
+		share = link_share;
+		Plan();
+	}
+}
+
+/**
+ * Issue the most overdue query, at most one at a time
+ * @return void
+ */
+void PollScheduler::Tick()
+{
+	if (in_flight) {
+		return;
+	}
+
+	double now = Clock::MonotonicMs();
+	Poll * next = NULL;
+	double most_overdue = 1;
+
+	for (int i = 0; i < 3; i++) {
+		Poll & poll = polls[i];
+		int age = cache->Age(poll.opcode);
+
+		// a client query refreshed it already
+		if (age >= 0 && age < poll.interval_ms) {
+			double fetched = now - age;
+
+			if (fetched > poll.last) {
+				poll.last = fetched;
+			}
+
+			continue;
+		}
+
+		double overdue = (now - poll.last) / poll.interval_ms;
+
+		if (overdue >= most_overdue) {
+			most_overdue = overdue;
+			next = &poll;
+		}
+	}
+
+	if (next == NULL) {
+		return;
+	}
+
+	Poll * poll = next;
+	in_flight = true;
+	poll->last = now;
+
+	bool queued = cache->Query(poll->opcode, [this, poll](const CatResult & result) {
+		Sampled(*poll, result);
+	}, true);
+
+	if (!queued) {
+		in_flight = false;
+	}
+}
+
+/**
+ * Current polling interval of a query type
+ * @param char opcode CMD_GET_XXXXXX
+ * @return int Milliseconds
+ */
+int PollScheduler::GetInterval(char opcode)
+{
+	for (int i = 0; i < 3; i++) {
+		if (polls[i].opcode == opcode) {
+			return polls[i].interval_ms;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Planned and achieved polling rates as key:value lines
+ * @return string
+ */
+string PollScheduler::Stats()
+{
+	double now = Clock::MonotonicMs();
+	stringstream output;
+	double planned = 0, achieved = 0;
+
+	output << fixed << setprecision(2);
+
+	for (int i = 0; i < 3; i++) {
+		Poll & poll = polls[i];
+
+		while (!poll.samples.empty() && now - poll.samples.front() > RATE_WINDOW_MS) {
+			poll.samples.pop_front();
+		}
+
+		double rate = poll.samples.size() * 1000.0 / RATE_WINDOW_MS;
+
+		planned += Cost(poll) / poll.interval_ms;
+		achieved += Cost(poll) * rate / 1000;
+
+		output << "poll_" << poll.name << "_subscribers:" << poll.subscribers << "\n";
+		output << "poll_" << poll.name << "_interval_ms:" << poll.interval_ms << "\n";
+		output << "poll_" << poll.name << "_rate_hz:" << rate << "\n";
+	}
+
+	output << "poll_link_share:" << share << "\n";
+	output << "poll_link_planned:" << planned << "\n";
+	output << "poll_link_used:" << achieved << "\n";
+
+	return output.str();
+}
+
+// private methods
+
+/**
+ * Serial link time one query occupies
+ * @param Poll poll
+ * @return double Milliseconds
+ */
+double PollScheduler::Cost(const Poll & poll)
+{
+	// 8 data bits, start bit and 2 stop bits per byte
+	return (5 + poll.reply_bytes) * 11 * 1000.0 / baud + TURNAROUND_MS;
+}
+
+/**
+ * Pick intervals from tcvr state and demand, then stretch them to fit
+ * the link budget
+ * @return void
+ */
+void PollScheduler::Plan()
+{
+	// S-meter only moves while something is heard
+	if (!polls[0].subscribers) {
+		polls[0].interval_ms = INTERVAL_IDLE;
+	} else if (transmitting) {
+		polls[0].interval_ms = INTERVAL_SLOW;
+	} else {
+		polls[0].interval_ms = squelched ? INTERVAL_NORMAL : INTERVAL_FAST;
+	}
+
+	// power/SWR only matter while keyed, but keep an eye on front panel PTT
+	if (!polls[1].subscribers) {
+		polls[1].interval_ms = INTERVAL_IDLE;
+	} else {
+		polls[1].interval_ms = transmitting ? INTERVAL_FAST : INTERVAL_SLOW;
+	}
+
+	polls[2].interval_ms = polls[2].subscribers ? INTERVAL_NORMAL : INTERVAL_IDLE;
+
+	double utilization = 0;
+
+	for (int i = 0; i < 3; i++) {
+		utilization += Cost(polls[i]) / polls[i].interval_ms;
+	}
+
+	if (utilization > share) {
+		double stretch = utilization / share;
+
+		for (int i = 0; i < 3; i++) {
+			polls[i].interval_ms = (int)(polls[i].interval_ms * stretch + 0.5);
+		}
+	}
+}
+
+/**
+ * Record finished poll and adapt to new tcvr state
+ * @param Poll poll
+ * @param CatResult result
+ * @return void
+ */
+void PollScheduler::Sampled(Poll & poll, const CatResult & result)
+{
+	in_flight = false;
+
+	if (!result.ok) {
+		return;
+	}
+
+	poll.samples.push_back(Clock::MonotonicMs());
+
+	if (poll.samples.size() > 10000) {
+		poll.samples.pop_front();
+	}
+
+	if (result.status.Has(TcvrStatus::GROUP_RX)) {
+		squelched = result.status.rx_squelched;
+	}
+
+	if (result.status.Has(TcvrStatus::GROUP_TX)) {
+		transmitting = result.status.ptt_on;
+	}
+
+	Plan();
+}
@@ -0,0 +1,65 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "status_cache.h"
+
+using namespace std;
+
+#ifndef POLL_SCHEDULER_H
+#define POLL_SCHEDULER_H
+
+/**
+ * Background status poller. Splits the serial link between RX, TX and
+ * frequency/mode queries depending on what the tcvr is doing and on how
+ * many clients want each field, and keeps total traffic within a share
+ * of what the baud rate allows. Call Tick() from an event loop timer.
+ */
+class PollScheduler
+{
+	public:
+		// how often Tick() should be called
+		static const int TICK_MS;
+
+		PollScheduler(StatusCache * c, int baud_rate, double link_share = 0.5);
+
+		void SetDemand(char opcode, int subscribers);
+		void SetLinkShare(double share);
+		void Tick();
+
+		int GetInterval(char opcode);
+		string Stats();
+
+	private:
+		struct Poll {
+			char opcode;
+			const char * name;
+			int reply_bytes;
+			int subscribers;
+			int interval_ms;
+			double last;
+			deque<double> samples;
+		};
+
+		StatusCache * cache;
+		int baud;
+		double share;
+		bool in_flight;
+		bool squelched;
+		bool transmitting;
+		Poll polls[3];
+
+		double Cost(const Poll & poll);
+		void Plan();
+		void Sampled(Poll & poll, const CatResult & result);
+};
+
+#endif
@@ -0,0 +1,404 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "protocol.h"
+#include "cat.h"
+#include <stdlib.h>
+
+using namespace std;
+
+const unsigned char Protocol::MAGIC = 0xa5;
+const unsigned char Protocol::VERSION = 1;
+const size_t Protocol::MAX_PAYLOAD = 4096;
+
+// names match the keys Cat uses in its status map
+static const char * FIELD_NAMES[Protocol::FIELD_COUNT] = {
+	"rx_signal", "centered", "ctcss_dcs", "rx_squelched",
+	"tx_power", "split", "swr_high", "ptt_on",
+	"tcvr_frequency", "tcvr_mode"
+};
+
+/**
+ * Map signed value to unsigned so small negative numbers stay small
+ * @param int64_t value
+ * @return uint64_t
+ */
+static uint64_t zigzag(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+/**
+ * Map zigzag encoded value back to signed
+ * @param uint64_t value
+ * @return int64_t
+ */
+static int64_t unzigzag(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// public methods
+
+/**
+ * Build one frame
+ * @param uint8_t type FRAME_XXXXXX
+ * @param uint16_t request_id Echoed back in the reply, 0 for pushes
+ * @param string payload
+ * @return string
+ */
+string Protocol::Encode(uint8_t type, uint16_t request_id, const string & payload)
+{
+	string frame;
+	frame.reserve(6 + payload.length());
+
+	frame += (char)MAGIC;
+	frame += (char)VERSION;
+	frame += (char)type;
+	PutUint16(frame, request_id);
+	PutVarint(frame, payload.length());
+	frame += payload;
+
+	return frame;
+}
+
+/**
+ * Parse one frame from the start of a buffer
+ * @param char* data
+ * @param size_t length
+ * @param Frame frame
+ * @return int Bytes consumed, 0 if frame is incomplete, -1 on garbage
+ */
+int Protocol::Decode(const char * data, size_t length, Frame & frame)
+{
+	if (length < 1) {
+		return 0;
+	}
+
+	if ((unsigned char)data[0] != MAGIC) {
+		return -1;
+	}
+
+	if (length < 6) {
+		return 0;
+	}
+
+	if ((unsigned char)data[1] != VERSION) {
+		return -1;
+	}
+
+	string header(data, length < 16 ? length : 16);
+	size_t position = 5;
+	uint64_t payload_length;
+
+	if (!GetVarint(header, position, payload_length)) {
+		// varint not complete yet, or longer than any valid one
+		return header.length() < 16 ? 0 : -1;
+	}
+
+	if (payload_length > MAX_PAYLOAD) {
+		return -1;
+	}
+
+	if (length < position + payload_length) {
+		return 0;
+	}
+
+	frame.type = (unsigned char)data[2];
+	frame.request_id = GetUint16(header, 3);
+	frame.payload.assign(data + position, payload_length);
+
+	return position + payload_length;
+}
+
+/**
+ * Append LEB128 varint
+ * @param string output
+ * @param uint64_t value
+ * @return void
+ */
+void Protocol::PutVarint(string & output, uint64_t value)
+{
+	while (value >= 0x80) {
+		output += (char)((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+
+	output += (char)value;
+}
+
+/**
+ * Read LEB128 varint
+ * @param string input
+ * @param size_t position Advanced past the varint
+ * @param uint64_t value
+ * @return bool False if input ends early
+ */
+bool Protocol::GetVarint(const string & input, size_t & position, uint64_t & value)
+{
+	value = 0;
+
+	for (int shift = 0; shift < 64 && position < input.length(); shift += 7) {
+		unsigned char byte = input[position++];
+		value |= (uint64_t)(byte & 0x7f) << shift;
+
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void Protocol::PutUint16(string & output, uint16_t value)
+{
+	output += (char)(value & 0xff);
+	output += (char)(value >> 8);
+}
+
+void Protocol::PutUint32(string & output, uint32_t value)
+{
+	PutUint16(output, value & 0xffff);
+	PutUint16(output, value >> 16);
+}
+
+uint16_t Protocol::GetUint16(const string & input, size_t position)
+{
+	return (unsigned char)input[position] | ((unsigned char)input[position + 1] << 8);
+}
+
+uint32_t Protocol::GetUint32(const string & input, size_t position)
+{
+	return GetUint16(input, position) | ((uint32_t)GetUint16(input, position + 2) << 16);
+}
+
+/**
+ * Append one field of a FRAME_STATUS or FRAME_DELTA payload
+ * @param string output
+ * @param int field FIELD_XXXXXX
+ * @param int64_t value Wire value, or change of it in a delta
+ * @return void
+ */
+void Protocol::PutField(string & output, int field, int64_t value)
+{
+	output += (char)field;
+	PutVarint(output, zigzag(value));
+}
+
+/**
+ * Encode all status fields read so far, straight from the typed status
+ * @param TcvrStatus status
+ * @return string Payload of FRAME_STATUS
+ */
+string Protocol::EncodeStatus(const TcvrStatus & status)
+{
+	string payload;
+	int64_t value;
+
+	for (int field = 0; field < FIELD_COUNT; field++) {
+		if (StatusValue(status, field, value)) {
+			PutField(payload, field, value);
+		}
+	}
+
+	return payload;
+}
+
+/**
+ * Encode changed fields relative to previously pushed values
+ * @param uint64_t seq
+ * @param map changes Wire values by FIELD_XXXXXX
+ * @param int64_t[] last Previously pushed values, updated
+ * @return string Payload of FRAME_DELTA
+ */
+string Protocol::EncodeDelta(uint64_t seq, const map<int, int64_t> & changes, int64_t last[FIELD_COUNT])
+{
+	string payload;
+	PutVarint(payload, seq);
+
+	for (auto it = changes.begin(); it != changes.end(); ++it) {
+		int field = it->first;
+
+		if (field < 0 || field >= FIELD_COUNT) {
+			continue;
+		}
+
+		PutField(payload, field, it->second - last[field]);
+		last[field] = it->second;
+	}
+
+	return payload;
+}
+
+/**
+ * Decode FRAME_STATUS payload
+ * @param string payload
+ * @param map status
+ * @return bool
+ */
+bool Protocol::DecodeStatus(const string & payload, map<string, string> & status)
+{
+	size_t position = 0;
+
+	while (position < payload.length()) {
+		int field = (unsigned char)payload[position++];
+		uint64_t value;
+
+		if (field >= FIELD_COUNT || !GetVarint(payload, position, value)) {
+			return false;
+		}
+
+		status[FIELD_NAMES[field]] = FieldText(field, unzigzag(value));
+	}
+
+	return true;
+}
+
+/**
+ * Decode FRAME_DELTA payload
+ * @param string payload
+ * @param uint64_t seq
+ * @param map changes
+ * @param int64_t[] last Previously received values, updated
+ * @return bool
+ */
+bool Protocol::DecodeDelta(const string & payload, uint64_t & seq, map<string, string> & changes, int64_t last[FIELD_COUNT])
+{
+	size_t position = 0;
+
+	if (!GetVarint(payload, position, seq)) {
+		return false;
+	}
+
+	while (position < payload.length()) {
+		int field = (unsigned char)payload[position++];
+		uint64_t delta;
+
+		if (field >= FIELD_COUNT || !GetVarint(payload, position, delta)) {
+			return false;
+		}
+
+		last[field] += unzigzag(delta);
+		changes[FIELD_NAMES[field]] = FieldText(field, last[field]);
+	}
+
+	return true;
+}
+
+/**
+ * Field id by status key
+ * @param string name
+ * @return int FIELD_XXXXXX or -1
+ */
+int Protocol::FieldId(const string & name)
+{
+	for (int field = 0; field < FIELD_COUNT; field++) {
+		if (name == FIELD_NAMES[field]) {
+			return field;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Status key by field id
+ * @param int field
+ * @return const char*
+ */
+const char * Protocol::FieldName(int field)
+{
+	return field >= 0 && field < FIELD_COUNT ? FIELD_NAMES[field] : "";
+}
+
+/**
+ * Convert status text to wire integer
+ * @param int field
+ * @param string text
+ * @return int64_t
+ */
+int64_t Protocol::FieldValue(int field, const string & text)
+{
+	if (field == FIELD_FREQUENCY) {
+		return llround(atof(text.c_str()) * 1000000);
+	}
+
+	if (field == FIELD_MODE) {
+		return CatCodec::ModeCode(text.c_str());
+	}
+
+	return atoll(text.c_str());
+}
+
+/**
+ * Convert wire integer back to status text
+ * @param int field
+ * @param int64_t value
+ * @return string
+ */
+string Protocol::FieldText(int field, int64_t value)
+{
+	if (field == FIELD_FREQUENCY) {
+		return to_string(value / 1000000.0);
+	}
+
+	if (field == FIELD_MODE) {
+		return value >= 0 && value <= 0xff ? CatCodec::ModeName(value) : "";
+	}
+
+	return to_string(value);
+}
+
+/**
+ * Wire value of one field of the typed status
+ * @param TcvrStatus status
+ * @param int field FIELD_XXXXXX
+ * @param int64_t value
+ * @return bool False if the field was never read
+ */
+bool Protocol::StatusValue(const TcvrStatus & status, int field, int64_t & value)
+{
+	switch (field) {
+		case FIELD_RX_SIGNAL:
+			value = status.rx_signal;
+			return status.Has(TcvrStatus::GROUP_RX);
+		case FIELD_CENTERED:
+			value = status.centered;
+			return status.Has(TcvrStatus::GROUP_RX);
+		case FIELD_CTCSS_DCS:
+			value = status.ctcss_dcs;
+			return status.Has(TcvrStatus::GROUP_RX);
+		case FIELD_RX_SQUELCHED:
+			value = status.rx_squelched;
+			return status.Has(TcvrStatus::GROUP_RX);
+		case FIELD_TX_POWER:
+			value = status.tx_power;
+			return status.Has(TcvrStatus::GROUP_TX);
+		case FIELD_SPLIT:
+			value = status.split;
+			return status.Has(TcvrStatus::GROUP_TX);
+		case FIELD_SWR_HIGH:
+			value = status.swr_high;
+			return status.Has(TcvrStatus::GROUP_TX);
+		case FIELD_PTT_ON:
+			value = status.ptt_on;
+			return status.Has(TcvrStatus::GROUP_TX);
+		case FIELD_FREQUENCY:
+			value = status.frequency_hz;
+			return status.Has(TcvrStatus::GROUP_FREQUENCY_MODE);
+		case FIELD_MODE:
+			value = status.mode;
+			return status.Has(TcvrStatus::GROUP_FREQUENCY_MODE);
+	}
+
+	return false;
+}
@@ -0,0 +1,109 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "tcvr_status.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <map>
+
+using namespace std;
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+/**
+ * Binary client/server protocol.
+ *
+ * Frame: magic (0xa5), version, type, request id (uint16 LE), payload
+ * length (varint), payload. Requests carry fixed size payloads, status
+ * is sent as (field id, varint) pairs and pushed updates as zigzag
+ * varint deltas against the previous push, so a changed S-meter reading
+ * costs about 9 bytes on the wire.
+ */
+class Protocol
+{
+	public:
+		static const unsigned char MAGIC;
+		static const unsigned char VERSION;
+		static const size_t MAX_PAYLOAD;
+
+		enum FrameType {
+			// client -> server
+			FRAME_SET_FREQUENCY = 0x01,	// uint32 Hz
+			FRAME_SET_MODE = 0x02,		// uint8 OP_MODE_XXX
+			FRAME_PTT = 0x03,			// uint8 on/off
+			FRAME_LOCK = 0x04,			// uint8 on/off
+			FRAME_GET_STATUS = 0x05,	// uint8 CMD_GET_XXXXXX
+			FRAME_SUBSCRIBE = 0x06,		// uint16 field mask
+			FRAME_UNSUBSCRIBE = 0x07,	// empty
+			FRAME_HYSTERESIS = 0x08,	// uint8 field, uint32 threshold in wire units (Hz for FIELD_FREQUENCY)
+			FRAME_TUNE = 0x09,			// uint8 relative, uint32 Hz or signed step in Hz
+
+			// server -> client
+			FRAME_ACK = 0x80,			// empty
+			FRAME_ERROR = 0x81,			// uint8 error code
+			FRAME_STATUS = 0x82,		// (uint8 field, varint value)*
+			FRAME_DELTA = 0x83			// varint seq, (uint8 field, zigzag varint delta)*
+		};
+
+		enum ErrorCode {
+			ERROR_UNKNOWN_FRAME = 1,
+			ERROR_BAD_PAYLOAD,
+			ERROR_REJECTED,
+			ERROR_BUSY
+		};
+
+		enum Field {
+			FIELD_RX_SIGNAL = 0,
+			FIELD_CENTERED,
+			FIELD_CTCSS_DCS,
+			FIELD_RX_SQUELCHED,
+			FIELD_TX_POWER,
+			FIELD_SPLIT,
+			FIELD_SWR_HIGH,
+			FIELD_PTT_ON,
+			FIELD_FREQUENCY,		// Hz
+			FIELD_MODE,				// OP_MODE_XXX
+			FIELD_COUNT
+		};
+
+		struct Frame {
+			uint8_t type;
+			uint16_t request_id;
+			string payload;
+		};
+
+		static string Encode(uint8_t type, uint16_t request_id, const string & payload = "");
+		static int Decode(const char * data, size_t length, Frame & frame);
+
+		static void PutVarint(string & output, uint64_t value);
+		static bool GetVarint(const string & input, size_t & position, uint64_t & value);
+		static void PutUint16(string & output, uint16_t value);
+		static void PutUint32(string & output, uint32_t value);
+		static uint16_t GetUint16(const string & input, size_t position);
+		static uint32_t GetUint32(const string & input, size_t position);
+
+		static void PutField(string & output, int field, int64_t value);
+		static string EncodeStatus(const TcvrStatus & status);
+		static string EncodeDelta(uint64_t seq, const map<int, int64_t> & changes, int64_t last[FIELD_COUNT]);
+		static bool DecodeStatus(const string & payload, map<string, string> & status);
+		static bool DecodeDelta(const string & payload, uint64_t & seq, map<string, string> & changes, int64_t last[FIELD_COUNT]);
+
+		static int FieldId(const string & name);
+		static const char * FieldName(int field);
+		static int64_t FieldValue(int field, const string & text);
+		static string FieldText(int field, int64_t value);
+		static bool StatusValue(const TcvrStatus & status, int field, int64_t & value);
+};
+
+#endif
@@ -0,0 +1,240 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "reactor.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/timerfd.h>
+#include <iostream>
+
+using namespace std;
+
+// maximum events pulled from the kernel in one Poll() call
+static const int MAX_EVENTS = 64;
+
+// constructor
+
+Reactor::Reactor()
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	running = false;
+	generation = 0;
+
+	if (epoll_fd < 0) {
+		cout << "Can't create epoll instance." << endl;
+	}
+}
+
+// destructor
+
+Reactor::~Reactor()
+{
+	if (epoll_fd >= 0) {
+		close(epoll_fd);
+	}
+}
+
+// public methods
+
+/**
+ * Register file descriptor with the loop
+ * @param int fd
+ * @param uint32_t events EPOLLIN, EPOLLOUT, ...
+ * @param Handler handler Called with the ready event mask
+ * @return bool
+ */
+bool Reactor::Add(int fd, uint32_t events, Handler handler)
+{
+	shared_ptr<Entry> entry(new Entry());
+	entry->generation = ++generation;
+	entry->handler = handler;
+
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.u64 = ((uint64_t)entry->generation << 32) | (uint32_t)fd;
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		return false;
+	}
+
+	entries[fd] = entry;
+
+	return true;
+}
+
+/**
+ * Change the event mask of a registered descriptor
+ * @param int fd
+ * @param uint32_t events
+ * @return bool
+ */
+bool Reactor::Modify(int fd, uint32_t events)
+{
+	auto it = entries.find(fd);
+
+	if (it == entries.end()) {
+		return false;
+	}
+
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.u64 = ((uint64_t)it->second->generation << 32) | (uint32_t)fd;
+
+	return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+/**
+ * Unregister descriptor. Safe to call from inside a handler; events already
+ * fetched for this descriptor are dropped.
+ * @param int fd
+ * @return void
+ */
+void Reactor::Remove(int fd)
+{
+	if (entries.erase(fd)) {
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	}
+}
+
+/**
+ * Create periodic timer
+ * @param int interval_ms
+ * @param TimerHandler handler
+ * @return int Timer descriptor or -1
+ */
+int Reactor::AddTimer(int interval_ms, TimerHandler handler)
+{
+	int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if (timer_fd < 0) {
+		return -1;
+	}
+
+	bool added = Add(timer_fd, EPOLLIN, [timer_fd, handler](uint32_t) {
+		uint64_t expirations;
+
+		// drain the counter, several missed ticks still fire only once
+		if (read(timer_fd, &expirations, sizeof(expirations)) > 0) {
+			handler();
+		}
+	});
+
+	if (!added || !SetTimer(timer_fd, interval_ms)) {
+		Remove(timer_fd);
+		close(timer_fd);
+		return -1;
+	}
+
+	return timer_fd;
+}
+
+/**
+ * Re-arm timer with new interval, 0 disarms it
+ * @param int timer_fd
+ * @param int interval_ms
+ * @return bool
+ */
+bool Reactor::SetTimer(int timer_fd, int interval_ms)
+{
+	struct itimerspec spec;
+	spec.it_interval.tv_sec = interval_ms / 1000;
+	spec.it_interval.tv_nsec = (long)(interval_ms % 1000) * 1000000;
+	spec.it_value = spec.it_interval;
+
+	return timerfd_settime(timer_fd, 0, &spec, NULL) == 0;
+}
+
+/**
+ * Stop and close timer
+ * @param int timer_fd
+ * @return void
+ */
+void Reactor::RemoveTimer(int timer_fd)
+{
+	Remove(timer_fd);
+	close(timer_fd);
+}
+
+/**
+ * Wait for events and dispatch them
+ * @param int timeout_ms -1 waits forever
+ * @return bool False on fatal epoll error
+ */
+bool Reactor::Poll(int timeout_ms)
+{
+	struct epoll_event events[MAX_EVENTS];
+
+	int count = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+
+	if (count < 0) {
+		return errno == EINTR;
+	}
+
+	for (int i = 0; i < count; i++) {
+		int fd = (int)(uint32_t)events[i].data.u64;
+		uint32_t entry_generation = events[i].data.u64 >> 32;
+
+		auto it = entries.find(fd);
+
+		// removed (and maybe re-registered) by an earlier handler in this batch
+		if (it == entries.end() || it->second->generation != entry_generation) {
+			continue;
+		}
+
+		// keep handler alive even if it removes itself
+		shared_ptr<Entry> entry = it->second;
+		entry->handler(events[i].events);
+	}
+
+	return true;
+}
+
+/**
+ * Dispatch events until Stop() is called
+ * @return void
+ */
+void Reactor::Run()
+{
+	running = true;
+
+	while (running) {
+		if (!Poll(-1)) {
+			cout << "Event loop failed." << endl;
+			break;
+		}
+	}
+}
+
+/**
+ * Leave Run() after current batch
+ * @return void
+ */
+void Reactor::Stop()
+{
+	running = false;
+}
+
+/**
+ * Put descriptor into non-blocking mode
+ * @param int fd
+ * @return bool
+ */
+bool Reactor::SetNonBlocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+
+	if (flags < 0) {
+		return false;
+	}
+
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
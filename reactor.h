@@ -0,0 +1,65 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+using namespace std;
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+/**
+ * Single threaded epoll event loop. Sockets, the serial device and timers
+ * are all registered here and dispatched from one place, so nothing in the
+ * server ever has to sleep.
+ */
+class Reactor
+{
+	public:
+		typedef function<void(uint32_t events)> Handler;
+		typedef function<void()> TimerHandler;
+
+		Reactor();
+		~Reactor();
+
+		bool Add(int fd, uint32_t events, Handler handler);
+		bool Modify(int fd, uint32_t events);
+		void Remove(int fd);
+
+		int AddTimer(int interval_ms, TimerHandler handler);
+		bool SetTimer(int timer_fd, int interval_ms);
+		void RemoveTimer(int timer_fd);
+
+		bool Poll(int timeout_ms = -1);
+		void Run();
+		void Stop();
+
+		static bool SetNonBlocking(int fd);
+
+	private:
+		struct Entry {
+			uint32_t generation;
+			Handler handler;
+		};
+
+		int epoll_fd;
+		bool running;
+		uint32_t generation;
+		unordered_map<int, shared_ptr<Entry> > entries;
+};
+
+#endif
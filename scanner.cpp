@@ -0,0 +1,241 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "scanner.h"
+#include "clock.h"
+#include <stdlib.h>
+
+using namespace std;
+
+// constructor
+
+Scanner::Scanner(Cat * c)
+{
+	cat = c;
+	start_hz = 0;
+	stop_hz = 0;
+	step_hz = 0;
+	dwell_ms = 50;
+	hang_ms = 2000;
+	passes = 1;
+	squelch_stop = false;
+	steps = 0;
+	elapsed_ms = 0;
+}
+
+// setters & getters
+
+/**
+ * Set sweep range, all in MHz
+ * @param double start
+ * @param double stop
+ * @param double step
+ * @return bool
+ */
+bool Scanner::SetRange(double start, double stop, double step)
+{
+	// whole Hz, so long sweeps do not drift
+	start_hz = llround(start * 1000000);
+	stop_hz = llround(stop * 1000000);
+	step_hz = llround(step * 1000000);
+
+	return start_hz > 0 && stop_hz >= start_hz && step_hz > 0;
+}
+
+/**
+ * Time to let tcvr settle on a frequency before sampling
+ * @param int ms
+ * @return void
+ */
+void Scanner::SetDwell(int ms)
+{
+	dwell_ms = ms < 0 ? 0 : ms;
+}
+
+/**
+ * Stop on open squelch, resume once closed for hang time
+ * @param bool enabled
+ * @param int hang_time_ms
+ * @return void
+ */
+void Scanner::SetSquelchStop(bool enabled, int hang_time_ms)
+{
+	squelch_stop = enabled;
+	hang_ms = hang_time_ms < 0 ? 0 : hang_time_ms;
+}
+
+/**
+ * Number of sweeps, 0 sweeps forever
+ * @param int count
+ * @return void
+ */
+void Scanner::SetPasses(int count)
+{
+	passes = count < 0 ? 0 : count;
+}
+
+uint64_t Scanner::GetSteps()
+{
+	return steps;
+}
+
+/**
+ * Achieved scan speed of the last Run()
+ * @return double
+ */
+double Scanner::GetStepsPerSecond()
+{
+	return elapsed_ms > 0 ? steps * 1000.0 / elapsed_ms : 0;
+}
+
+// public methods
+
+/**
+ * Sweep range
+ * @param function output Called for every sample
+ * @return bool False if tcvr stopped responding
+ */
+bool Scanner::Run(function<void(const ScanSample &)> output)
+{
+	int64_t count = (stop_hz - start_hz) / step_hz + 1;
+	ScanSample sample;
+	TcvrStatus status;
+
+	steps = 0;
+	elapsed_ms = 0;
+
+	if (count <= 0) {
+		return false;
+	}
+
+	double started = Clock::MonotonicMs();
+
+	if (!cat->SetFrequency(start_hz / 1000000.0)) {
+		return false;
+	}
+
+	double tuned = Clock::MonotonicMs();
+
+	for (int pass = 0; passes == 0 || pass < passes; pass++) {
+		for (int64_t i = 0; i < count; i++) {
+			double frequency = (start_hz + i * step_hz) / 1000000.0;
+			double next_frequency = (start_hz + ((i + 1) % count) * step_hz) / 1000000.0;
+			bool last = passes != 0 && pass == passes - 1 && i == count - 1;
+
+			WaitUntil(tuned + dwell_ms);
+
+			if (!squelch_stop && !last) {
+				// sample and retune in one exchange
+				if (!cat->GetRxStatusAndSetFrequency(next_frequency)) {
+					elapsed_ms = Clock::MonotonicMs() - started;
+					return false;
+				}
+
+				tuned = Clock::MonotonicMs();
+
+				cat->GetStatus(status);
+				sample.frequency = frequency;
+				sample.signal = status.rx_signal;
+				sample.squelched = status.rx_squelched;
+				sample.time_ms = tuned;
+
+				steps++;
+				output(sample);
+				continue;
+			}
+
+			if (!Sample(sample, frequency)) {
+				elapsed_ms = Clock::MonotonicMs() - started;
+				return false;
+			}
+
+			steps++;
+			output(sample);
+
+			// activity, stay here until squelch was closed for hang time
+			if (squelch_stop && !sample.squelched) {
+				double quiet_since = -1;
+
+				while (quiet_since < 0 || Clock::MonotonicMs() - quiet_since < hang_ms) {
+					WaitUntil(Clock::MonotonicMs() + dwell_ms);
+
+					if (!Sample(sample, frequency)) {
+						elapsed_ms = Clock::MonotonicMs() - started;
+						return false;
+					}
+
+					output(sample);
+
+					if (!sample.squelched) {
+						quiet_since = -1;
+					} else if (quiet_since < 0) {
+						quiet_since = sample.time_ms;
+					}
+				}
+			}
+
+			if (last) {
+				break;
+			}
+
+			if (!cat->SetFrequency(next_frequency)) {
+				elapsed_ms = Clock::MonotonicMs() - started;
+				return false;
+			}
+
+			tuned = Clock::MonotonicMs();
+		}
+	}
+
+	elapsed_ms = Clock::MonotonicMs() - started;
+
+	return true;
+}
+
+// private methods
+
+/**
+ * Sleep until given time
+ * @param double time_ms
+ * @return void
+ */
+void Scanner::WaitUntil(double time_ms)
+{
+	double remaining = time_ms - Clock::MonotonicMs();
+
+	if (remaining > 0) {
+		usleep((useconds_t)(remaining * 1000));
+	}
+}
+
+/**
+ * Read receiver status on current frequency
+ * @param ScanSample sample
+ * @param double frequency
+ * @return bool
+ */
+bool Scanner::Sample(ScanSample & sample, double frequency)
+{
+	if (!cat->GetRxStatus()) {
+		return false;
+	}
+
+	TcvrStatus status;
+	cat->GetStatus(status);
+
+	sample.frequency = frequency;
+	sample.signal = status.rx_signal;
+	sample.squelched = status.rx_squelched;
+	sample.time_ms = Clock::MonotonicMs();
+
+	return true;
+}
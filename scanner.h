@@ -0,0 +1,63 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "cat.h"
+#include <stdint.h>
+#include <functional>
+
+using namespace std;
+
+#ifndef SCANNER_H
+#define SCANNER_H
+
+struct ScanSample {
+	double frequency;
+	int signal;
+	bool squelched;
+	double time_ms;
+};
+
+/**
+ * Band sweep. Steps through a frequency range, waits for the tcvr to
+ * settle, samples the S-meter and squelch. In plain sweeps the status
+ * read and the retune are sent together, in squelch mode the scan stops
+ * on activity and resumes after the hang time.
+ */
+class Scanner
+{
+	private:
+		Cat * cat;
+		int64_t start_hz, stop_hz, step_hz;
+		int dwell_ms, hang_ms, passes;
+		bool squelch_stop;
+
+		uint64_t steps;
+		double elapsed_ms;
+
+		void WaitUntil(double time_ms);
+		bool Sample(ScanSample & sample, double frequency);
+
+	public:
+		Scanner(Cat * c);
+
+		bool SetRange(double start, double stop, double step);
+		void SetDwell(int ms);
+		void SetSquelchStop(bool enabled, int hang_time_ms);
+		void SetPasses(int count);
+
+		bool Run(function<void(const ScanSample &)> output);
+
+		uint64_t GetSteps();
+		double GetStepsPerSecond();
+};
+
+#endif
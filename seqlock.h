@@ -0,0 +1,105 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+using namespace std;
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+/**
+ * Single writer, many readers. The writer never waits; readers copy the
+ * value and retry if a write overlapped. The value is kept as relaxed
+ * atomic words so a torn read is a retry, not a data race. Only for
+ * trivially copyable types.
+ */
+template <typename T>
+class SeqLock
+{
+	private:
+		static_assert(is_trivially_copyable<T>::value, "SeqLock copies values bytewise");
+
+		static const size_t WORD_COUNT = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+		atomic<uint32_t> sequence;
+		atomic<uint64_t> words[WORD_COUNT];
+
+	public:
+		SeqLock()
+		{
+			sequence.store(0);
+
+			for (size_t i = 0; i < WORD_COUNT; i++) {
+				words[i].store(0);
+			}
+		}
+
+		/**
+		 * Publish new value, only ever from one thread
+		 * @param T value
+		 * @return void
+		 */
+		void Write(const T & value)
+		{
+			uint64_t buffer[WORD_COUNT] = {0};
+			memcpy(buffer, &value, sizeof(T));
+
+			uint32_t start = sequence.load(memory_order_relaxed);
+			sequence.store(start + 1, memory_order_relaxed);
+			atomic_thread_fence(memory_order_release);
+
+			for (size_t i = 0; i < WORD_COUNT; i++) {
+				words[i].store(buffer[i], memory_order_relaxed);
+			}
+
+			sequence.store(start + 2, memory_order_release);
+		}
+
+		/**
+		 * Take consistent copy, from any thread
+		 * @param T value
+		 * @return void
+		 */
+		void Read(T & value) const
+		{
+			uint64_t buffer[WORD_COUNT];
+			uint32_t before, after;
+
+			do {
+				before = sequence.load(memory_order_acquire);
+
+				for (size_t i = 0; i < WORD_COUNT; i++) {
+					buffer[i] = words[i].load(memory_order_relaxed);
+				}
+
+				atomic_thread_fence(memory_order_acquire);
+				after = sequence.load(memory_order_relaxed);
+			} while ((before & 1) || before != after);
+
+			memcpy(&value, buffer, sizeof(T));
+		}
+
+		/**
+		 * Number of writes so far
+		 * @return uint32_t
+		 */
+		uint32_t GetVersion() const
+		{
+			return sequence.load(memory_order_acquire) / 2;
+		}
+};
+
+#endif
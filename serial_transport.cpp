@@ -0,0 +1,389 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "serial_transport.h"
+#include "clock.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+
+using namespace std;
+
+const size_t SerialTransport::FRAME_SIZE = 5;
+
+// constructor
+
+SerialTransport::SerialTransport()
+{
+	fd = -1;
+	write_started = 0;
+	write_done = 0;
+	outgoing_length = 0;
+	outgoing_sent = 0;
+	timing.write_ms = 0;
+	timing.first_byte_ms = 0;
+	timing.complete_ms = 0;
+}
+
+// destructor
+
+SerialTransport::~SerialTransport()
+{
+	Close();
+}
+
+// public methods
+
+/**
+ * Open device in raw non-blocking mode, 8 data bits and 2 stop bits
+ * @param string device
+ * @param speed_t speed B2400, B4800, B9600
+ * @return bool
+ */
+bool SerialTransport::Open(const string & device, speed_t speed)
+{
+	Close();
+
+	fd = open(device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+
+	if (fd == -1) {
+		return false;
+	}
+
+	struct termios options;
+	tcgetattr(fd, &options);
+
+	cfsetispeed(&options, speed);
+	cfsetospeed(&options, speed);
+
+	options.c_cflag = speed | CS8 | CLOCAL | CREAD | CSTOPB;
+	options.c_iflag = IGNPAR;
+	options.c_oflag = 0;
+	options.c_lflag = 0;
+
+	// reads never block in the driver, poll() does the waiting
+	options.c_cc[VMIN] = 0;
+	options.c_cc[VTIME] = 0;
+
+	tcflush(fd, TCIOFLUSH);
+
+	if (tcsetattr(fd, TCSANOW, &options) != 0) {
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Change baud rate of the open port, dropping anything in flight
+ * @param speed_t speed B2400, B4800, ...
+ * @return bool
+ */
+bool SerialTransport::SetSpeed(speed_t speed)
+{
+	struct termios options;
+
+	if (fd < 0 || tcgetattr(fd, &options) != 0) {
+		return false;
+	}
+
+	cfsetispeed(&options, speed);
+	cfsetospeed(&options, speed);
+
+	options.c_cflag = speed | CS8 | CLOCAL | CREAD | CSTOPB;
+
+	tcflush(fd, TCIOFLUSH);
+
+	return tcsetattr(fd, TCSANOW, &options) == 0;
+}
+
+void SerialTransport::Close()
+{
+	if (fd >= 0) {
+		close(fd);
+		fd = -1;
+	}
+
+	outgoing_length = 0;
+	outgoing_sent = 0;
+}
+
+bool SerialTransport::IsOpen()
+{
+	return fd >= 0;
+}
+
+int SerialTransport::GetFileDescriptor()
+{
+	return fd;
+}
+
+/**
+ * Send one 5 byte frame
+ * @param char* frame
+ * @return bool
+ */
+bool SerialTransport::WriteFrame(const char * frame)
+{
+	return WriteFrames((const char (*)[5])frame, 1);
+}
+
+/**
+ * Send several frames, waiting for the output buffer to drain if it is
+ * full; for callers that may block
+ * @param char[][5] frames
+ * @param int count
+ * @return bool
+ */
+bool SerialTransport::WriteFrames(const char frames[][5], int count)
+{
+	if (!StartWrite(frames, count)) {
+		return false;
+	}
+
+	// output buffer full, wait for the uart to drain
+	while (IsWriting()) {
+		struct pollfd pfd = {fd, POLLOUT, 0};
+		int ready = poll(&pfd, 1, 1000);
+
+		if (ready < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (ready <= 0 || !ContinueWrite()) {
+			CancelWrite();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Send several frames with a single write(), never waits; what the kernel
+ * did not take stays for ContinueWrite()
+ * @param char[][5] frames
+ * @param int count
+ * @return bool False on error
+ */
+bool SerialTransport::StartWrite(const char frames[][5], int count)
+{
+	if (fd < 0 || count <= 0 || count > 16) {
+		return false;
+	}
+
+	memcpy(outgoing, frames, count * FRAME_SIZE);
+	outgoing_length = count * FRAME_SIZE;
+	outgoing_sent = 0;
+	write_started = Clock::MonotonicMs();
+	timing.write_ms = 0;
+	timing.first_byte_ms = -1;
+	timing.complete_ms = -1;
+
+	return ContinueWrite();
+}
+
+/**
+ * Send what StartWrite() could not, call when the fd is writable
+ * @return bool False on error
+ */
+bool SerialTransport::ContinueWrite()
+{
+	if (!IsWriting()) {
+		return true;
+	}
+
+	while (outgoing_sent < outgoing_length) {
+		ssize_t n = write(fd, outgoing + outgoing_sent, outgoing_length - outgoing_sent);
+
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			// output buffer full, the rest goes once it drained
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return true;
+			}
+
+			CancelWrite();
+			return false;
+		}
+
+		// rare partial writes resume mid frame
+		outgoing_sent += n;
+	}
+
+	outgoing_length = 0;
+	outgoing_sent = 0;
+	write_done = Clock::MonotonicMs();
+	timing.write_ms = write_done - write_started;
+
+	return true;
+}
+
+/**
+ * Frames are still waiting for room in the output buffer
+ * @return bool
+ */
+bool SerialTransport::IsWriting()
+{
+	return outgoing_sent < outgoing_length;
+}
+
+/**
+ * Drop frames not sent yet, e.g. when their command timed out
+ * @return void
+ */
+void SerialTransport::CancelWrite()
+{
+	if (IsWriting() && fd >= 0) {
+		tcflush(fd, TCOFLUSH);
+	}
+
+	outgoing_length = 0;
+	outgoing_sent = 0;
+}
+
+/**
+ * Collect reply until expected length arrived or deadline passed
+ * @param char* buffer
+ * @param size_t expected
+ * @param int timeout_ms
+ * @return int Bytes read, less than expected on timeout, -1 on error
+ */
+int SerialTransport::ReadFrame(char * buffer, size_t expected, int timeout_ms)
+{
+	if (fd < 0) {
+		return -1;
+	}
+
+	double deadline = Clock::MonotonicMs() + timeout_ms;
+	size_t received = 0;
+
+	while (received < expected) {
+		int remaining = (int)(deadline - Clock::MonotonicMs() + 0.999);
+
+		if (remaining <= 0) {
+			break;
+		}
+
+		struct pollfd pfd = {fd, POLLIN, 0};
+		int ready = poll(&pfd, 1, remaining);
+
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return -1;
+		}
+
+		if (ready == 0) {
+			break;
+		}
+
+		// device went away (USB adapter unplugged)
+		if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			return -1;
+		}
+
+		int n = ReadAvailable(buffer, received, expected);
+
+		if (n < 0) {
+			return -1;
+		}
+
+		received = n;
+	}
+
+	return received;
+}
+
+/**
+ * Take reply bytes that already arrived, never waits
+ * @param char* buffer
+ * @param size_t received Bytes of the reply already in buffer
+ * @param size_t expected
+ * @return int Bytes of the reply in buffer now, -1 on error
+ */
+int SerialTransport::ReadAvailable(char * buffer, size_t received, size_t expected)
+{
+	if (fd < 0) {
+		return -1;
+	}
+
+	while (received < expected) {
+		ssize_t n = read(fd, buffer + received, expected - received);
+
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+
+			return -1;
+		}
+
+		if (n == 0) {
+			break;
+		}
+
+		if (received == 0) {
+			timing.first_byte_ms = Clock::MonotonicMs() - write_done;
+		}
+
+		received += n;
+	}
+
+	if (received == expected && timing.complete_ms < 0) {
+		timing.complete_ms = Clock::MonotonicMs() - write_done;
+	}
+
+	return received;
+}
+
+/**
+ * Throw away input nobody waits for, e.g. late replies of a timed out
+ * command, so they are not taken for the answer to the next one
+ * @return void
+ */
+void SerialTransport::Flush()
+{
+	if (fd < 0) {
+		return;
+	}
+
+	tcflush(fd, TCIFLUSH);
+
+	char discard[64];
+
+	while (read(fd, discard, sizeof(discard)) > 0) {
+	}
+}
+
+/**
+ * Timing of the last write/read
+ * @return TransportTiming
+ */
+TransportTiming SerialTransport::GetTiming()
+{
+	return timing;
+}
+
+// private methods
+
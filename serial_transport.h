@@ -0,0 +1,75 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include <unistd.h>
+#include <termios.h>
+#include <stddef.h>
+#include <string>
+
+using namespace std;
+
+#ifndef SERIAL_TRANSPORT_H
+#define SERIAL_TRANSPORT_H
+
+struct TransportTiming {
+	double write_ms;		// time to hand frames to the kernel
+	double first_byte_ms;	// write done -> first reply byte
+	double complete_ms;		// write done -> whole reply
+};
+
+/**
+ * Raw serial link to the tcvr. Every frame (or batch of frames) goes out
+ * in one syscall, replies are reassembled from partial reads until the
+ * expected length arrives or the deadline passes. Should the output buffer
+ * be full, StartWrite() keeps the rest for ContinueWrite() to send once
+ * the fd is writable, so an event loop never waits on the uart.
+ */
+class SerialTransport
+{
+	private:
+		int fd;
+		TransportTiming timing;
+		double write_started;
+		double write_done;
+
+		// frames not taken by the kernel yet
+		char outgoing[16 * 5];
+		size_t outgoing_length;
+		size_t outgoing_sent;
+
+
+	public:
+		static const size_t FRAME_SIZE;
+
+		SerialTransport();
+		~SerialTransport();
+
+		bool Open(const string & device, speed_t speed);
+		bool SetSpeed(speed_t speed);
+		void Close();
+		bool IsOpen();
+		int GetFileDescriptor();
+
+		bool WriteFrame(const char * frame);
+		bool WriteFrames(const char frames[][5], int count);
+		bool StartWrite(const char frames[][5], int count);
+		bool ContinueWrite();
+		bool IsWriting();
+		void CancelWrite();
+		int ReadFrame(char * buffer, size_t expected, int timeout_ms);
+		int ReadAvailable(char * buffer, size_t received, size_t expected);
+		void Flush();
+
+		TransportTiming GetTiming();
+};
+
+#endif
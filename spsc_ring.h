@@ -0,0 +1,148 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include <stddef.h>
+#include <atomic>
+
+using namespace std;
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+/**
+ * Lock-free ring between exactly one producer and one consumer thread.
+ * Slots are allocated once and filled in place: the producer Claim()s a
+ * slot, writes it and Publish()es it, the consumer Peek()s the oldest slot
+ * and Release()s it when done, so nothing is copied or allocated per item.
+ * Each side keeps a cached copy of the other side's index and only reloads
+ * it when the ring looks full or empty, which keeps the two cache lines
+ * from bouncing between cores on every item.
+ */
+template <typename T>
+class SpscRing
+{
+	private:
+		T * slots;
+		size_t mask;
+
+		// consumer side
+		atomic<size_t> head;
+		size_t cached_tail;
+
+		// keeps the sides on their own cache lines without needing aligned new
+		char padding[64];
+
+		// producer side
+		atomic<size_t> tail;
+		size_t cached_head;
+		char padding_end[64];
+
+	public:
+		/**
+		 * @param size_t capacity Rounded up to a power of two
+		 */
+		SpscRing(size_t capacity)
+		{
+			size_t size = 1;
+
+			while (size < capacity) {
+				size <<= 1;
+			}
+
+			slots = new T[size];
+			mask = size - 1;
+			head.store(0);
+			tail.store(0);
+			cached_head = 0;
+			cached_tail = 0;
+		}
+
+		~SpscRing()
+		{
+			delete[] slots;
+		}
+
+		/**
+		 * Free slot to fill, producer only
+		 * @return T* NULL when full
+		 */
+		T * Claim()
+		{
+			size_t t = tail.load(memory_order_relaxed);
+
+			if (t - cached_head > mask) {
+				cached_head = head.load(memory_order_acquire);
+
+				if (t - cached_head > mask) {
+					return NULL;
+				}
+			}
+
+			return &slots[t & mask];
+		}
+
+		/**
+		 * Hand the claimed slot to the consumer
+		 * @return void
+		 */
+		void Publish()
+		{
+			tail.store(tail.load(memory_order_relaxed) + 1, memory_order_release);
+		}
+
+		/**
+		 * Oldest published slot, consumer only
+		 * @return T* NULL when empty
+		 */
+		T * Peek()
+		{
+			size_t h = head.load(memory_order_relaxed);
+
+			if (h == cached_tail) {
+				cached_tail = tail.load(memory_order_acquire);
+
+				if (h == cached_tail) {
+					return NULL;
+				}
+			}
+
+			return &slots[h & mask];
+		}
+
+		/**
+		 * Give the peeked slot back to the producer
+		 * @return void
+		 */
+		void Release()
+		{
+			head.store(head.load(memory_order_relaxed) + 1, memory_order_release);
+		}
+
+		/**
+		 * Items queued, a snapshot from any thread
+		 * @return size_t
+		 */
+		size_t Size()
+		{
+			// head first, the tail read after it can only be further ahead
+			size_t h = head.load(memory_order_acquire);
+
+			return tail.load(memory_order_acquire) - h;
+		}
+
+		size_t GetCapacity()
+		{
+			return mask + 1;
+		}
+};
+
+#endif
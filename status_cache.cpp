@@ -0,0 +1,297 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "status_cache.h"
+#include "clock.h"
+#include <stdlib.h>
+
+using namespace std;
+
+const int StatusCache::CACHE_CLIENT = -1;
+
+// constructor
+
+/**
+ * Constructor, sets default TTLs
+ * @param CatQueue* q
+ */
+StatusCache::StatusCache(CatQueue * q)
+{
+	queue = q;
+
+	char opcodes[3] = {Cat::CMD_GET_FREQUENCY_MODE, Cat::CMD_GET_RX_STATUS, Cat::CMD_GET_TX_STATUS};
+	int ttls[3] = {1000, 200, 200};
+
+	for (int i = 0; i < 3; i++) {
+		Entry & entry = entries[opcodes[i]];
+		entry.ttl_ms = ttls[i];
+		entry.valid = false;
+		entry.in_flight = false;
+		entry.generation = 0;
+		entry.fetched = 0;
+		entry.flight = 0;
+		entry.flight_generation = 0;
+		entry.hits = 0;
+		entry.misses = 0;
+		entry.joined = 0;
+	}
+}
+
+// public methods
+
+/**
+ * Set freshness of one query type
+ * @param char opcode CMD_GET_XXXXXX
+ * @param int ttl_ms 0 disables caching
+ * @return bool
+ */
+bool StatusCache::SetTtl(char opcode, int ttl_ms)
+{
+	auto it = entries.find(opcode);
+
+	if (it == entries.end() || ttl_ms < 0) {
+		return false;
+	}
+
+	it->second.ttl_ms = ttl_ms;
+
+	return true;
+}
+
+/**
+ * Set TTLs from text such as "s:1000,r:200,t:200"
+ * @param string config
+ * @return bool
+ */
+bool StatusCache::SetTtl(const string & config)
+{
+	stringstream items(config);
+	string item;
+
+	while (getline(items, item, ',')) {
+		size_t colon = item.find(':');
+
+		if (colon != 1) {
+			return false;
+		}
+
+		char opcode;
+
+		switch (item[0]) {
+			case 's':
+				opcode = Cat::CMD_GET_FREQUENCY_MODE;
+				break;
+			case 'r':
+				opcode = Cat::CMD_GET_RX_STATUS;
+				break;
+			case 't':
+				opcode = Cat::CMD_GET_TX_STATUS;
+				break;
+			default:
+				return false;
+		}
+
+		if (!SetTtl(opcode, atoi(item.c_str() + 2))) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Answer status query from cache, or join/start the CAT query for it
+ * @param char opcode CMD_GET_XXXXXX
+ * @param Callback callback May be called before Query() returns
+ * @param bool refresh Ask the tcvr even if cached answer is still fresh
+ * @return bool False if query could not be queued
+ */
+bool StatusCache::Query(char opcode, Callback callback, bool refresh)
+{
+	auto it = entries.find(opcode);
+
+	if (it == entries.end()) {
+		return false;
+	}
+
+	Entry & entry = it->second;
+	double now = Clock::MonotonicMs();
+
+	if (!refresh && entry.valid && now - entry.fetched < entry.ttl_ms) {
+		entry.hits++;
+		callback(entry.result);
+		return true;
+	}
+
+	// single flight: somebody already asked the tcvr, and no set command
+	// ran since, which could make that answer stale
+	if (entry.in_flight && entry.flight_generation == entry.generation) {
+		entry.waiters[entry.flight].push_back(callback);
+		entry.joined++;
+		return true;
+	}
+
+	CatCommand command;
+	command.opcode = opcode;
+	command.frequency = 0;
+	command.client = CACHE_CLIENT;
+
+	uint64_t generation = entry.generation;
+	uint64_t flight = entry.flight + 1;
+
+	command.callback = [this, opcode, generation, flight](const CatResult & result) {
+		Entry & entry = entries[opcode];
+
+		if (flight == entry.flight) {
+			entry.in_flight = false;
+		}
+
+		// a set command may have changed the answer while we were waiting
+		if (result.ok && generation == entry.generation) {
+			entry.valid = true;
+			entry.fetched = Clock::MonotonicMs();
+			entry.result = result;
+		}
+
+		vector<Callback> waiters;
+		waiters.swap(entry.waiters[flight]);
+		entry.waiters.erase(flight);
+
+		for (auto it = waiters.begin(); it != waiters.end(); ++it) {
+			(*it)(result);
+		}
+	};
+
+	entry.waiters[flight].push_back(callback);
+
+	if (!queue->Submit(command)) {
+		entry.waiters.erase(flight);
+		return false;
+	}
+
+	entry.misses++;
+	entry.in_flight = true;
+	entry.flight = flight;
+	entry.flight_generation = generation;
+
+	return true;
+}
+
+/**
+ * Run set command and drop cached answers it makes stale
+ * @param CatCommand command
+ * @return bool
+ */
+bool StatusCache::Execute(CatCommand command)
+{
+	char opcode = command.opcode;
+	function<void(const CatResult &)> callback = command.callback;
+
+	command.callback = [this, opcode, callback](const CatResult & result) {
+		InvalidateAfter(opcode);
+
+		if (callback) {
+			callback(result);
+		}
+	};
+
+	if (!queue->Submit(command)) {
+		return false;
+	}
+
+	InvalidateAfter(opcode);
+
+	return true;
+}
+
+/**
+ * Forget cached answer of one query type
+ * @param char opcode CMD_GET_XXXXXX
+ * @return void
+ */
+void StatusCache::Invalidate(char opcode)
+{
+	auto it = entries.find(opcode);
+
+	if (it != entries.end()) {
+		it->second.valid = false;
+		it->second.generation++;
+	}
+}
+
+/**
+ * Age of cached answer
+ * @param char opcode CMD_GET_XXXXXX
+ * @return int Milliseconds, -1 if nothing valid is cached
+ */
+int StatusCache::Age(char opcode)
+{
+	auto it = entries.find(opcode);
+
+	if (it == entries.end() || !it->second.valid) {
+		return -1;
+	}
+
+	return (int)(Clock::MonotonicMs() - it->second.fetched);
+}
+
+/**
+ * Freshness of one query type
+ * @param char opcode CMD_GET_XXXXXX
+ * @return int Milliseconds, -1 for unknown query
+ */
+int StatusCache::GetTtl(char opcode)
+{
+	auto it = entries.find(opcode);
+
+	return it == entries.end() ? -1 : it->second.ttl_ms;
+}
+
+/**
+ * Cache statistics as key:value lines
+ * @return string
+ */
+string StatusCache::Stats()
+{
+	stringstream output;
+	const char * names[3] = {"s", "r", "t"};
+	char opcodes[3] = {Cat::CMD_GET_FREQUENCY_MODE, Cat::CMD_GET_RX_STATUS, Cat::CMD_GET_TX_STATUS};
+
+	for (int i = 0; i < 3; i++) {
+		Entry & entry = entries[opcodes[i]];
+
+		output << "cache_" << names[i] << "_ttl_ms:" << entry.ttl_ms << "\n";
+		output << "cache_" << names[i] << "_hits:" << entry.hits << "\n";
+		output << "cache_" << names[i] << "_misses:" << entry.misses << "\n";
+		output << "cache_" << names[i] << "_joined:" << entry.joined << "\n";
+	}
+
+	return output.str();
+}
+
+// private methods
+
+/**
+ * Invalidate queries answered differently after a set command
+ * @param char opcode CMD_SET_XXXXXX, CMD_PTT_XXX, ...
+ * @return void
+ */
+void StatusCache::InvalidateAfter(char opcode)
+{
+	if (opcode == Cat::CMD_SET_FREQUENCY || opcode == Cat::CMD_SET_MODE) {
+		Invalidate(Cat::CMD_GET_FREQUENCY_MODE);
+		Invalidate(Cat::CMD_GET_RX_STATUS);
+	} else if (opcode == Cat::CMD_PTT_ON || opcode == Cat::CMD_PTT_OFF) {
+		Invalidate(Cat::CMD_GET_TX_STATUS);
+		Invalidate(Cat::CMD_GET_RX_STATUS);
+	}
+}
@@ -0,0 +1,73 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "cat_queue.h"
+#include <map>
+#include <vector>
+
+using namespace std;
+
+#ifndef STATUS_CACHE_H
+#define STATUS_CACHE_H
+
+/**
+ * Status query cache sitting in front of CatQueue. Every query type has
+ * its own freshness TTL, identical queries arriving while one is on the
+ * wire share its result, and set commands invalidate what they change,
+ * including the answer of a query already on its way.
+ * Lives on the event loop thread, no locking.
+ */
+class StatusCache
+{
+	public:
+		typedef function<void(const CatResult &)> Callback;
+
+		// client id the cache uses for its own queue submissions
+		static const int CACHE_CLIENT;
+
+		StatusCache(CatQueue * q);
+
+		bool SetTtl(char opcode, int ttl_ms);
+		bool SetTtl(const string & config);
+
+		bool Query(char opcode, Callback callback, bool refresh = false);
+		bool Execute(CatCommand command);
+		void Invalidate(char opcode);
+		int Age(char opcode);
+		int GetTtl(char opcode);
+
+		string Stats();
+
+	private:
+		struct Entry {
+			int ttl_ms;
+			bool valid;
+			bool in_flight;
+			uint64_t generation;
+			double fetched;
+			CatResult result;
+			uint64_t flight;				// id of the latest query sent
+			uint64_t flight_generation;		// generation it was sent in
+			map<uint64_t, vector<Callback> > waiters;	// per query on the wire
+
+			uint64_t hits;
+			uint64_t misses;
+			uint64_t joined;
+		};
+
+		CatQueue * queue;
+		map<char, Entry> entries;
+
+		void InvalidateAfter(char opcode);
+};
+
+#endif
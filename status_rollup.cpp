@@ -0,0 +1,306 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "status_rollup.h"
+#include "clock.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+
+// ring lengths: an hour of seconds, a day of minutes, a month of hours
+static const int RESOLUTION_SECONDS[StatusRollup::RESOLUTION_COUNT] = {1, 60, 3600};
+static const int RESOLUTION_BUCKETS[StatusRollup::RESOLUTION_COUNT] = {3600, 1440, 744};
+
+// constructor
+
+StatusRollup::StatusRollup()
+{
+	for (int r = 0; r < RESOLUTION_COUNT; r++) {
+		rings[r] = new Bucket[RESOLUTION_BUCKETS[r]];
+
+		for (int i = 0; i < RESOLUTION_BUCKETS[r]; i++) {
+			rings[r][i].index = -1;
+		}
+	}
+
+	memset(last_generation, 0, sizeof(last_generation));
+}
+
+// destructor
+
+StatusRollup::~StatusRollup()
+{
+	for (int r = 0; r < RESOLUTION_COUNT; r++) {
+		delete[] rings[r];
+	}
+}
+
+// public methods
+
+/**
+ * Add the field groups that were read since the last call
+ * @param TcvrStatus status
+ * @param int64_t time_ms Wall clock
+ * @return bool False if nothing new
+ */
+bool StatusRollup::Add(const TcvrStatus & status, int64_t time_ms)
+{
+	uint8_t groups = 0;
+
+	for (int i = 0; i < TcvrStatus::GROUP_COUNT; i++) {
+		if (status.generation[i] != last_generation[i]) {
+			last_generation[i] = status.generation[i];
+			groups |= 1 << i;
+		}
+	}
+
+	if (groups == 0) {
+		return false;
+	}
+
+	Add(HistoryLog::FromStatus(status, time_ms, groups), groups);
+
+	return true;
+}
+
+/**
+ * Add selected field groups of a record
+ * @param HistoryRecord record
+ * @param uint8_t groups Bit per TcvrStatus::Group
+ * @return void
+ */
+void StatusRollup::Add(const HistoryRecord & record, uint8_t groups)
+{
+	groups &= record.groups;
+
+	if (groups & (1 << TcvrStatus::GROUP_FREQUENCY_MODE)) {
+		Record(FIELD_FREQUENCY, record.time_ms, record.frequency_hz);
+	}
+
+	if (groups & (1 << TcvrStatus::GROUP_RX)) {
+		Record(FIELD_RX_SIGNAL, record.time_ms, record.rx_signal);
+		Record(FIELD_RX_SQUELCHED, record.time_ms, record.Is(HistoryRecord::FLAG_RX_SQUELCHED));
+	}
+
+	if (groups & (1 << TcvrStatus::GROUP_TX)) {
+		Record(FIELD_TX_POWER, record.time_ms, record.tx_power);
+		Record(FIELD_SWR_HIGH, record.time_ms, record.Is(HistoryRecord::FLAG_SWR_HIGH));
+	}
+}
+
+/**
+ * Rebuild rollups from the history file after a restart, each record
+ * adding only the groups read for it
+ * @param HistoryLog history
+ * @return uint64_t Records loaded
+ */
+uint64_t StatusRollup::Load(HistoryLog & history)
+{
+	int64_t span_ms = (int64_t)RESOLUTION_SECONDS[RESOLUTION_HOUR] * RESOLUTION_BUCKETS[RESOLUTION_HOUR] * 1000;
+	uint64_t next = history.GetNextSequence(), loaded = 0;
+	HistoryRecord record;
+
+	for (uint64_t sequence = history.Find(Clock::WallClockMs() - span_ms); sequence < next; sequence++) {
+		if (history.Read(sequence, record)) {
+			Add(record, record.groups);
+			loaded++;
+		}
+	}
+
+	return loaded;
+}
+
+/**
+ * Points of one field between two times, empty buckets left out
+ * @param string field
+ * @param int64_t from Seconds since epoch
+ * @param int64_t to Seconds since epoch
+ * @param Resolution resolution
+ * @param vector points
+ * @return bool False for an unknown field
+ */
+bool StatusRollup::Query(const string & field, int64_t from, int64_t to, Resolution resolution, vector<RollupPoint> & points)
+{
+	Field id;
+	bool inverted;
+
+	points.clear();
+
+	if (!FieldByName(field, id, inverted)) {
+		return false;
+	}
+
+	int seconds = RESOLUTION_SECONDS[resolution];
+	int buckets = RESOLUTION_BUCKETS[resolution];
+	int64_t first = from / seconds, last = to / seconds;
+
+	// older buckets were overwritten already
+	if (last - first >= buckets) {
+		first = last - buckets + 1;
+	}
+
+	// nothing was recorded before the epoch, and a negative index would
+	// land before the ring
+	if (first < 0) {
+		first = 0;
+	}
+
+	for (int64_t index = first; index <= last; index++) {
+		const Bucket & bucket = rings[resolution][index % buckets];
+		const Aggregate & aggregate = bucket.fields[id];
+
+		if (bucket.index != index || aggregate.count == 0) {
+			continue;
+		}
+
+		RollupPoint point;
+		point.time = index * seconds;
+		point.count = aggregate.count;
+		point.min = aggregate.min;
+		point.max = aggregate.max;
+		point.avg = (double)aggregate.sum / aggregate.count;
+
+		if (inverted) {
+			point.min = 1 - aggregate.max;
+			point.max = 1 - aggregate.min;
+			point.avg = 1 - point.avg;
+		}
+
+		points.push_back(point);
+	}
+
+	return true;
+}
+
+/**
+ * Query result as lines, e.g. "time:1444000000 min:1 max:7 avg:3.250 count:60"
+ * @param string field
+ * @param vector points
+ * @return string
+ */
+string StatusRollup::Format(const string & field, const vector<RollupPoint> & points)
+{
+	bool frequency = field == "tcvr_frequency";
+	string text;
+	char line[128];
+
+	for (auto it = points.begin(); it != points.end(); ++it) {
+		if (frequency) {
+			snprintf(line, sizeof(line), "time:%lld min:%.6f max:%.6f avg:%.6f count:%u\n", (long long)it->time, it->min / 1000000, it->max / 1000000, it->avg / 1000000, it->count);
+		} else {
+			snprintf(line, sizeof(line), "time:%lld min:%g max:%g avg:%.3f count:%u\n", (long long)it->time, it->min, it->max, it->avg, it->count);
+		}
+
+		text += line;
+	}
+
+	return text;
+}
+
+/**
+ * Resolution from "1s", "1m", "1h" or seconds
+ * @param string text
+ * @param Resolution resolution
+ * @return bool
+ */
+bool StatusRollup::ParseResolution(const string & text, Resolution & resolution)
+{
+	if (text == "1s" || text == "1") {
+		resolution = RESOLUTION_SECOND;
+	} else if (text == "1m" || text == "60") {
+		resolution = RESOLUTION_MINUTE;
+	} else if (text == "1h" || text == "3600") {
+		resolution = RESOLUTION_HOUR;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+int StatusRollup::Seconds(Resolution resolution)
+{
+	return RESOLUTION_SECONDS[resolution];
+}
+
+int StatusRollup::Buckets(Resolution resolution)
+{
+	return RESOLUTION_BUCKETS[resolution];
+}
+
+// private methods
+
+/**
+ * Fold one value into its bucket at every resolution, recycling the
+ * bucket if it still holds an older period
+ * @param Field field
+ * @param int64_t time_ms
+ * @param int32_t value
+ * @return void
+ */
+void StatusRollup::Record(Field field, int64_t time_ms, int32_t value)
+{
+	for (int r = 0; r < RESOLUTION_COUNT; r++) {
+		int64_t index = time_ms / 1000 / RESOLUTION_SECONDS[r];
+		Bucket & bucket = rings[r][index % RESOLUTION_BUCKETS[r]];
+
+		if (bucket.index != index) {
+			bucket.index = index;
+			memset(bucket.fields, 0, sizeof(bucket.fields));
+		}
+
+		Aggregate & aggregate = bucket.fields[field];
+
+		if (aggregate.count == 0 || value < aggregate.min) {
+			aggregate.min = value;
+		}
+
+		if (aggregate.count == 0 || value > aggregate.max) {
+			aggregate.max = value;
+		}
+
+		aggregate.sum += value;
+		aggregate.count++;
+	}
+}
+
+/**
+ * Field names as in the status output, plus squelch_open
+ * @param string name
+ * @param Field field
+ * @param bool inverted
+ * @return bool
+ */
+bool StatusRollup::FieldByName(const string & name, Field & field, bool & inverted)
+{
+	inverted = false;
+
+	if (name == "rx_signal") {
+		field = FIELD_RX_SIGNAL;
+	} else if (name == "tx_power") {
+		field = FIELD_TX_POWER;
+	} else if (name == "swr_high") {
+		field = FIELD_SWR_HIGH;
+	} else if (name == "rx_squelched") {
+		field = FIELD_RX_SQUELCHED;
+	} else if (name == "squelch_open") {
+		field = FIELD_RX_SQUELCHED;
+		inverted = true;
+	} else if (name == "tcvr_frequency") {
+		field = FIELD_FREQUENCY;
+	} else {
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,98 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "history_log.h"
+#include "tcvr_status.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#ifndef STATUS_ROLLUP_H
+#define STATUS_ROLLUP_H
+
+/**
+ * One returned point of a history query
+ */
+struct RollupPoint {
+	int64_t time;			// bucket start, seconds since epoch
+	double min;
+	double max;
+	double avg;
+	uint32_t count;
+};
+
+/**
+ * Min/max/sum/count of the numeric status fields per 1 s, 1 min and 1 h
+ * bucket, each resolution in its own fixed ring indexed by bucket number.
+ * Adding a sample touches one bucket per resolution and a query reads one
+ * bucket per returned point, so neither depends on how many samples were
+ * taken. Boolean fields average to the fraction of samples they were
+ * set; squelch_open is rx_squelched inverted, i.e. the duty cycle.
+ * Lives on the event loop thread, no locking.
+ */
+class StatusRollup
+{
+	public:
+		enum Field {
+			FIELD_RX_SIGNAL = 0,
+			FIELD_TX_POWER,
+			FIELD_SWR_HIGH,
+			FIELD_RX_SQUELCHED,
+			FIELD_FREQUENCY,
+			FIELD_COUNT
+		};
+
+		enum Resolution {
+			RESOLUTION_SECOND = 0,
+			RESOLUTION_MINUTE,
+			RESOLUTION_HOUR,
+			RESOLUTION_COUNT
+		};
+
+		StatusRollup();
+		~StatusRollup();
+
+		bool Add(const TcvrStatus & status, int64_t time_ms);
+		void Add(const HistoryRecord & record, uint8_t groups);
+		uint64_t Load(HistoryLog & history);
+
+		bool Query(const string & field, int64_t from, int64_t to, Resolution resolution, vector<RollupPoint> & points);
+		string Format(const string & field, const vector<RollupPoint> & points);
+
+		static bool ParseResolution(const string & text, Resolution & resolution);
+		static int Seconds(Resolution resolution);
+		static int Buckets(Resolution resolution);
+
+	private:
+		struct Aggregate {
+			int32_t min;
+			int32_t max;
+			int64_t sum;
+			uint32_t count;
+		};
+
+		struct Bucket {
+			int64_t index;		// time / resolution, -1 when unused
+			Aggregate fields[FIELD_COUNT];
+		};
+
+		Bucket * rings[RESOLUTION_COUNT];
+		uint64_t last_generation[TcvrStatus::GROUP_COUNT];
+
+		void Record(Field field, int64_t time_ms, int32_t value);
+
+		static bool FieldByName(const string & name, Field & field, bool & inverted);
+};
+
+#endif
@@ -0,0 +1,233 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "subscription.h"
+#include <math.h>
+
+using namespace std;
+
+// constructor
+
+Subscription::Subscription()
+{
+	sequence = 0;
+}
+
+// public methods
+
+/**
+ * Add comma separated fields, "all" subscribes to everything
+ * @param string list
+ * @return bool False if a field is unknown
+ */
+bool Subscription::Subscribe(const string & list)
+{
+	stringstream items(list);
+	string field;
+	set<int> added;
+
+	while (getline(items, field, ',')) {
+		if (field == "all") {
+			for (int i = 0; i < Protocol::FIELD_COUNT; i++) {
+				added.insert(i);
+			}
+		} else if (Protocol::FieldId(field) >= 0) {
+			added.insert(Protocol::FieldId(field));
+		} else {
+			return false;
+		}
+	}
+
+	if (added.empty()) {
+		return false;
+	}
+
+	fields.insert(added.begin(), added.end());
+
+	// new fields are sent in full on the next update
+	for (auto it = added.begin(); it != added.end(); ++it) {
+		sent.erase(*it);
+	}
+
+	return true;
+}
+
+/**
+ * Stop all pushes
+ * @return void
+ */
+void Subscription::Unsubscribe()
+{
+	fields.clear();
+	sent.clear();
+}
+
+/**
+ * Forget what was pushed, the next delta carries every subscribed field
+ * @return void
+ */
+void Subscription::Resync()
+{
+	sent.clear();
+}
+
+/**
+ * Only push numeric field when it moved by at least threshold
+ * @param string field rx_signal, tx_power or tcvr_frequency
+ * @param double threshold In MHz for the frequency
+ * @return bool False for other fields, flags and the mode have no distance
+ */
+bool Subscription::SetHysteresis(const string & field, double threshold)
+{
+	int id = Protocol::FieldId(field);
+
+	if (threshold < 0) {
+		return false;
+	}
+
+	// the frequency is compared in Hz
+	return SetWireHysteresis(id, llround(id == Protocol::FIELD_FREQUENCY ? threshold * 1000000 : threshold));
+}
+
+/**
+ * Same as SetHysteresis(), threshold in the units fields have on the wire
+ * @param int field Protocol::FIELD_RX_SIGNAL, FIELD_TX_POWER or FIELD_FREQUENCY
+ * @param int64_t threshold Hz for the frequency
+ * @return bool
+ */
+bool Subscription::SetWireHysteresis(int field, int64_t threshold)
+{
+	if (threshold < 0 || (field != Protocol::FIELD_RX_SIGNAL && field != Protocol::FIELD_TX_POWER && field != Protocol::FIELD_FREQUENCY)) {
+		return false;
+	}
+
+	hysteresis[field] = threshold;
+
+	return true;
+}
+
+/**
+ * Is client subscribed to anything
+ * @return bool
+ */
+bool Subscription::IsActive()
+{
+	return !fields.empty();
+}
+
+/**
+ * Is client subscribed to a field answered by this query
+ * @param char opcode CMD_GET_XXXXXX
+ * @return bool
+ */
+bool Subscription::Wants(char opcode)
+{
+	for (auto it = fields.begin(); it != fields.end(); ++it) {
+		if (OpcodeOf(Protocol::FieldName(*it)) == opcode) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Collect subscribed fields that changed since last update
+ * @param TcvrStatus status Current tcvr status
+ * @param uint64_t seq Sequence number of this update
+ * @param map changes Changed fields, wire values by Protocol::FIELD_XXXXXX
+ * @return bool False if nothing changed
+ */
+bool Subscription::Delta(const TcvrStatus & status, uint64_t & seq, map<int, int64_t> & changes)
+{
+	changes.clear();
+
+	for (auto it = fields.begin(); it != fields.end(); ++it) {
+		int64_t value;
+
+		if (Protocol::StatusValue(status, *it, value) && Changed(*it, value)) {
+			changes[*it] = value;
+			sent[*it] = value;
+		}
+	}
+
+	if (changes.empty()) {
+		return false;
+	}
+
+	seq = ++sequence;
+
+	return true;
+}
+
+/**
+ * Burn a sequence number for an update the client could not take,
+ * so it sees a gap and knows to ask for full status
+ * @return uint64_t
+ */
+uint64_t Subscription::Skip()
+{
+	sent.clear();
+
+	return ++sequence;
+}
+
+/**
+ * Query that reports a field
+ * @param string field
+ * @return char CMD_GET_XXXXXX or 0 for unknown field
+ */
+char Subscription::OpcodeOf(const string & field)
+{
+	if (field == "rx_signal" || field == "centered" || field == "ctcss_dcs" || field == "rx_squelched") {
+		return Cat::CMD_GET_RX_STATUS;
+	}
+
+	if (field == "tx_power" || field == "split" || field == "swr_high" || field == "ptt_on") {
+		return Cat::CMD_GET_TX_STATUS;
+	}
+
+	if (field == "tcvr_frequency" || field == "tcvr_mode") {
+		return Cat::CMD_GET_FREQUENCY_MODE;
+	}
+
+	return 0;
+}
+
+// private methods
+
+/**
+ * Compare value against what client saw last
+ * @param int field Protocol::FIELD_XXXXXX
+ * @param int64_t value
+ * @return bool
+ */
+bool Subscription::Changed(int field, int64_t value)
+{
+	auto last = sent.find(field);
+
+	if (last == sent.end()) {
+		return true;
+	}
+
+	if (last->second == value) {
+		return false;
+	}
+
+	auto threshold = hysteresis.find(field);
+
+	if (threshold == hysteresis.end()) {
+		return true;
+	}
+
+	return fabs((double)(value - last->second)) >= threshold->second;
+}
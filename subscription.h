@@ -0,0 +1,58 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "cat.h"
+#include "protocol.h"
+#include <stdint.h>
+#include <set>
+
+using namespace std;
+
+#ifndef SUBSCRIPTION_H
+#define SUBSCRIPTION_H
+
+/**
+ * Status fields one client wants pushed to it. Remembers what was sent
+ * last so only changed fields go out, with optional hysteresis for noisy
+ * numeric fields, and numbers every update so gaps can be detected.
+ * Works on the typed status, text is only made for what is sent.
+ */
+class Subscription
+{
+	private:
+		// by Protocol::FIELD_XXXXXX, values as on the wire
+		set<int> fields;
+		map<int, double> hysteresis;
+		map<int, int64_t> sent;
+		uint64_t sequence;
+
+		bool Changed(int field, int64_t value);
+
+	public:
+		Subscription();
+
+		bool Subscribe(const string & list);
+		void Unsubscribe();
+		void Resync();
+		bool SetHysteresis(const string & field, double threshold);
+		bool SetWireHysteresis(int field, int64_t threshold);
+
+		bool IsActive();
+		bool Wants(char opcode);
+
+		bool Delta(const TcvrStatus & status, uint64_t & seq, map<int, int64_t> & changes);
+		uint64_t Skip();
+
+		static char OpcodeOf(const string & field);
+};
+
+#endif
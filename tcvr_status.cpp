@@ -0,0 +1,80 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "tcvr_status.h"
+#include "cat_codec.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+
+/**
+ * Forget everything
+ * @return void
+ */
+void TcvrStatus::Clear()
+{
+	memset(this, 0, sizeof(TcvrStatus));
+}
+
+/**
+ * Group was read at least once
+ * @param Group group
+ * @return bool
+ */
+bool TcvrStatus::Has(Group group) const
+{
+	return generation[group] > 0;
+}
+
+/**
+ * Old key:value view, only groups read so far, same formatting as before
+ * @return map
+ */
+map<string, string> TcvrStatus::Map() const
+{
+	map<string, string> fields;
+
+	if (Has(GROUP_FREQUENCY_MODE)) {
+		fields["tcvr_frequency"] = FormatFrequency(frequency_hz);
+		fields["tcvr_mode"] = CatCodec::ModeName(mode);
+	}
+
+	if (Has(GROUP_RX)) {
+		fields["rx_signal"] = to_string(rx_signal);
+		fields["centered"] = to_string(centered);
+		fields["ctcss_dcs"] = to_string(ctcss_dcs);
+		fields["rx_squelched"] = to_string(rx_squelched);
+	}
+
+	if (Has(GROUP_TX)) {
+		fields["tx_power"] = to_string(tx_power);
+		fields["split"] = to_string(split);
+		fields["swr_high"] = to_string(swr_high);
+		fields["ptt_on"] = to_string(ptt_on);
+	}
+
+	return fields;
+}
+
+/**
+ * Format Hz as MHz with six decimals, e.g. 14.190000
+ * @param uint32_t hz
+ * @return string
+ */
+string TcvrStatus::FormatFrequency(uint32_t hz)
+{
+	char text[16];
+	snprintf(text, sizeof(text), "%u.%06u", hz / 1000000, hz % 1000000);
+
+	return text;
+}
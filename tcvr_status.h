@@ -0,0 +1,61 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include <stdint.h>
+#include <map>
+#include <string>
+
+using namespace std;
+
+#ifndef TCVR_STATUS_H
+#define TCVR_STATUS_H
+
+/**
+ * Last known tcvr state, fixed layout so it can be copied without
+ * allocating. Each reply fills one field group; a group's generation goes
+ * up with every update and 0 means it was never read.
+ */
+struct TcvrStatus {
+	enum Group {
+		GROUP_FREQUENCY_MODE = 0,
+		GROUP_RX,
+		GROUP_TX,
+		GROUP_COUNT
+	};
+
+	// frequency & mode
+	uint32_t frequency_hz;
+	unsigned char mode;
+
+	// receiver
+	uint8_t rx_signal;
+	bool centered;
+	bool ctcss_dcs;
+	bool rx_squelched;
+
+	// transmitter
+	uint8_t tx_power;
+	bool split;
+	bool swr_high;
+	bool ptt_on;
+
+	uint64_t generation[GROUP_COUNT];
+	double updated_ms[GROUP_COUNT];		// monotonic clock
+
+	void Clear();
+	bool Has(Group group) const;
+	map<string, string> Map() const;
+
+	static string FormatFrequency(uint32_t hz);
+};
+
+#endif
@@ -0,0 +1,326 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "tune_stream.h"
+#include "clock.h"
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+
+const int TuneStream::TUNE_CLIENT = -4;
+
+// constructor
+
+TuneStream::TuneStream(StatusCache * c, CatQueue * q)
+{
+	cache = c;
+	queue = q;
+	reading = false;
+	read_overridden = false;
+	step_hz = 0;
+	has_target = false;
+	target_hz = 0;
+	target_seq = 0;
+	latest = make_shared<atomic<uint64_t> >(0);
+	applied_hz = 0;
+
+	updates = 0;
+	sent = 0;
+	coalesced = 0;
+	failed = 0;
+}
+
+// public methods
+
+/**
+ * New knob position, callback runs once it or a later one was applied
+ * @param int64_t hz Absolute, or a step when relative
+ * @param bool relative
+ * @param Callback callback
+ * @return bool False if out of range, or relative and the frequency is not known yet
+ */
+bool TuneStream::Tune(int64_t hz, bool relative, Callback callback)
+{
+	int64_t base = target_hz;
+	bool busy = !flights.empty() || reading || !pending.empty();
+
+	if (relative && !busy && !IdleBase(base)) {
+		reading = true;
+		read_overridden = false;
+		step_hz = 0;
+
+		if (!cache->Query(Cat::CMD_GET_FREQUENCY_MODE, [this](const CatResult & result) { FrequencyRead(result); }, true)) {
+			reading = false;
+			return false;
+		}
+	}
+
+	if (relative && reading && !read_overridden) {
+		// goes out with the target the read brings
+		step_hz += hz;
+		target_seq++;
+	} else {
+		int64_t next = relative ? base + hz : hz;
+
+		if (next <= 0 || next > CatCodec::MAX_FREQUENCY_HZ) {
+			return false;
+		}
+
+		read_overridden = reading;
+		target_seq++;
+		SetTarget(next);
+	}
+
+	updates++;
+
+	Waiter waiter;
+	waiter.callback = callback;
+	waiter.seq = target_seq;
+	waiter.arrived_ms = Clock::MonotonicMs();
+	pending.push_back(waiter);
+
+	SendNext();
+
+	return true;
+}
+
+/**
+ * Counters and latencies as key:value lines
+ * @return string
+ */
+string TuneStream::Stats()
+{
+	stringstream output;
+	output << fixed << setprecision(3);
+
+	output << "tune_updates:" << updates << "\n";
+	output << "tune_sent:" << sent << "\n";
+	output << "tune_coalesced:" << coalesced << "\n";
+	output << "tune_failed:" << failed << "\n";
+	output << "tune_target:" << TcvrStatus::FormatFrequency(target_hz) << "\n";
+	output << "tune_applied:" << TcvrStatus::FormatFrequency(applied_hz) << "\n";
+	output << "tune_wait_p50_ms:" << wait.Percentile(0.5) << "\n";
+	output << "tune_wait_p99_ms:" << wait.Percentile(0.99) << "\n";
+	output << "tune_wait_max_ms:" << wait.GetMaxMs() << "\n";
+	output << "tune_lag_p50_ms:" << lag.Percentile(0.5) << "\n";
+	output << "tune_lag_p99_ms:" << lag.Percentile(0.99) << "\n";
+	output << "tune_lag_max_ms:" << lag.GetMaxMs() << "\n";
+	output << "tune_round_trip_p50_ms:" << round_trip.Percentile(0.5) << "\n";
+	output << "tune_round_trip_p99_ms:" << round_trip.Percentile(0.99) << "\n";
+	output << "tune_round_trip_max_ms:" << round_trip.GetMaxMs() << "\n";
+
+	return output.str();
+}
+
+/**
+ * Frequency the tcvr ends up with for a target, CAT frames carry 10 Hz
+ * @param uint32_t hz
+ * @return uint32_t
+ */
+uint32_t TuneStream::AppliedHz(uint32_t hz)
+{
+	char bytes[4];
+	CatCodec::EncodeFrequency(hz, bytes);
+
+	return CatCodec::DecodeFrequency(bytes);
+}
+
+// private methods
+
+/**
+ * Where a relative step starts from when nothing is pending: a reading
+ * the cache still holds, which means it came after the last set command.
+ * Our own last target is kept while the tcvr shows it, so steps below
+ * 10 Hz keep adding up.
+ * @param int64_t base
+ * @return bool False if the tcvr has to be asked first
+ */
+bool TuneStream::IdleBase(int64_t & base)
+{
+	TcvrStatus status = queue->GetStatus();
+	int age = cache->Age(Cat::CMD_GET_FREQUENCY_MODE);
+
+	if (age < 0 || age >= cache->GetTtl(Cat::CMD_GET_FREQUENCY_MODE) || !status.Has(TcvrStatus::GROUP_FREQUENCY_MODE)) {
+		return false;
+	}
+
+	base = has_target && status.frequency_hz == AppliedHz(target_hz) ? target_hz : status.frequency_hz;
+
+	return true;
+}
+
+/**
+ * Make hz the target, a set command still queued picks it up
+ * @param uint32_t hz
+ * @return void
+ */
+void TuneStream::SetTarget(uint32_t hz)
+{
+	has_target = true;
+	target_hz = hz;
+	latest->store(((uint64_t)target_seq << 32) | hz);
+}
+
+/**
+ * Newest update the set commands out there carry
+ * @return uint32_t Sequence number, all of them while one is still queued
+ */
+uint32_t TuneStream::Covered()
+{
+	uint32_t covered = 0;
+
+	for (auto it = flights.begin(); it != flights.end(); ++it) {
+		uint64_t carried = (*it)->carried.load();
+
+		// not sent yet, it will take the newest target
+		if (carried == 0) {
+			return UINT32_MAX;
+		}
+
+		covered = max(covered, (uint32_t)(carried >> 32));
+	}
+
+	return covered;
+}
+
+/**
+ * Frequency to step from arrived, the steps so far go out as one target
+ * @param CatResult result
+ * @return void
+ */
+void TuneStream::FrequencyRead(const CatResult & result)
+{
+	reading = false;
+
+	// an absolute update made the read moot
+	if (read_overridden) {
+		SendNext();
+		return;
+	}
+
+	const TcvrStatus & status = result.status;
+	int64_t base = has_target && status.frequency_hz == AppliedHz(target_hz) ? target_hz : status.frequency_hz;
+	int64_t next = base + step_hz;
+
+	if (!result.ok || !status.Has(TcvrStatus::GROUP_FREQUENCY_MODE) || next <= 0 || next > CatCodec::MAX_FREQUENCY_HZ) {
+		Fail();
+		return;
+	}
+
+	SetTarget(next);
+	SendNext();
+}
+
+/**
+ * Queue another set command if an update is not carried by any yet;
+ * one on the wire and one queued behind it are enough
+ * @return void
+ */
+void TuneStream::SendNext()
+{
+	if ((reading && !read_overridden) || pending.empty() || flights.size() >= 2 || pending.back().seq <= Covered()) {
+		return;
+	}
+
+	shared_ptr<Flight> flight = make_shared<Flight>();
+	flight->carried = 0;
+	flight->started_ms = 0;
+
+	shared_ptr<atomic<uint64_t> > target = latest;
+
+	CatCommand command;
+	command.opcode = Cat::CMD_SET_FREQUENCY;
+	command.client = TUNE_CLIENT;
+
+	// worker thread: whatever the knob says by now goes out
+	command.prepare = [flight, target](CatCommand & command) {
+		uint64_t carried = target->load();
+
+		command.frequency = (uint32_t)carried / 1000000.0;
+		flight->started_ms = Clock::MonotonicMs();
+		flight->carried = carried;
+	};
+
+	command.callback = [this, flight](const CatResult & result) {
+		Landed(flight, result);
+	};
+
+	flights.push_back(flight);
+	sent++;
+
+	if (!cache->Execute(command)) {
+		flights.pop_back();
+		Fail();
+	}
+}
+
+/**
+ * Set command completed, answer every update it carried
+ * @param Flight flight
+ * @param CatResult result
+ * @return void
+ */
+void TuneStream::Landed(shared_ptr<Flight> flight, const CatResult & result)
+{
+	// commands of one client complete in order
+	if (!flights.empty() && flights.front() == flight) {
+		flights.pop_front();
+	}
+
+	uint64_t carried = flight->carried.load();
+	uint32_t seq = carried >> 32, hz = AppliedHz((uint32_t)carried);
+
+	round_trip.Record(result.wait_ms + result.service_ms);
+
+	if (result.ok) {
+		applied_hz = hz;
+	} else {
+		failed++;
+	}
+
+	vector<Waiter> answered, waiting;
+
+	for (auto it = pending.begin(); it != pending.end(); ++it) {
+		(it->seq <= seq ? answered : waiting).push_back(*it);
+	}
+
+	pending.swap(waiting);
+	coalesced += answered.size() > 1 ? answered.size() - 1 : 0;
+
+	// next target goes out before the answers, it is what the knob waits for
+	SendNext();
+
+	double now = Clock::MonotonicMs();
+
+	for (auto it = answered.begin(); it != answered.end(); ++it) {
+		wait.Record(max(0.0, flight->started_ms - it->arrived_ms));
+		lag.Record(now - it->arrived_ms);
+		it->callback(result.ok, result.ok ? hz : applied_hz);
+	}
+}
+
+/**
+ * Answer everything pending with an error
+ * @return void
+ */
+void TuneStream::Fail()
+{
+	vector<Waiter> answered;
+	answered.swap(pending);
+	failed++;
+
+	for (auto it = answered.begin(); it != answered.end(); ++it) {
+		it->callback(false, applied_hz);
+	}
+}
+
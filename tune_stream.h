@@ -0,0 +1,108 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ */
+#include "cat_queue.h"
+#include "cat_stats.h"
+#include "status_cache.h"
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#ifndef TUNE_STREAM_H
+#define TUNE_STREAM_H
+
+/**
+ * Frequency updates from a tuning knob, coalesced. At most two set
+ * frequency commands are queued or on the wire at a time, and a queued one
+ * takes the newest target only when the CatQueue worker sends it. So the
+ * next target goes out the moment the set ahead of it completes, with no
+ * hop through the event loop in between. A new target reaches the tcvr
+ * within one set round trip and is answered when its own set completes;
+ * updates arriving meanwhile only move the target, never build a backlog.
+ *
+ * Every update is answered once the set command carrying it or a later
+ * target completes, with the frequency the tcvr was given: the target at
+ * the 10 Hz CAT resolution. Relative steps add to the latest target, so
+ * steps smaller than 10 Hz still add up. The first step of a turn starts
+ * from a frequency read after the last set command, and reads it from the
+ * tcvr first when there is none, so a move on the front panel is never
+ * undone. All clients of a radio share one stream, the last update wins.
+ *
+ * Lives on the event loop thread, no locking; only the target handed to
+ * the worker is shared, through atomics.
+ */
+class TuneStream
+{
+	public:
+		typedef function<void(bool ok, uint32_t applied_hz)> Callback;
+
+		// CatQueue client id of the stream's set commands
+		static const int TUNE_CLIENT;
+
+		TuneStream(StatusCache * c, CatQueue * q);
+
+		bool Tune(int64_t hz, bool relative, Callback callback);
+		string Stats();
+
+		static uint32_t AppliedHz(uint32_t hz);
+
+	private:
+		struct Waiter {
+			Callback callback;
+			uint32_t seq;
+			double arrived_ms;
+		};
+
+		// one set command, filled in by the worker when it goes out
+		struct Flight {
+			atomic<uint64_t> carried;	// seq << 32 | hz, 0 while queued
+			double started_ms;
+		};
+
+		StatusCache * cache;
+		CatQueue * queue;
+
+		bool reading;
+		bool read_overridden;	// absolute update came in while reading
+		int64_t step_hz;		// relative steps waiting for the read
+		bool has_target;
+		uint32_t target_hz;		// latest update, sent or not
+		uint32_t target_seq;
+		shared_ptr<atomic<uint64_t> > latest;	// target_seq << 32 | target_hz
+		uint32_t applied_hz;
+		deque<shared_ptr<Flight> > flights;
+		vector<Waiter> pending;
+
+		uint64_t updates;
+		uint64_t sent;
+		uint64_t coalesced;
+		uint64_t failed;
+		LatencyHistogram wait;			// update to a set carrying it going out
+		LatencyHistogram lag;			// update to its answer
+		LatencyHistogram round_trip;	// set command queued to completed
+
+		bool IdleBase(int64_t & base);
+		void SetTarget(uint32_t hz);
+		uint32_t Covered();
+		void FrequencyRead(const CatResult & result);
+		void SendNext();
+		void Landed(shared_ptr<Flight> flight, const CatResult & result);
+		void Fail();
+};
+
+#endif
@@ -10,16 +10,32 @@
  * You are free to use, modify, extend, do whatever you like.
  * Please add attribution to your code.
  *
- * How to compile: g++ -O3 -std=c++0x -o yaesu yaesu.cpp cat.cpp
+ * How to compile: g++ -O3 -std=c++0x -o yaesu yaesu.cpp cat.cpp cat_stats.cpp link_health.cpp device_watch.cpp tcvr_status.cpp serial_transport.cpp scanner.cpp ndjson_writer.cpp
  */
 #include "cat.h"
+#include "clock.h"
+#include "ndjson_writer.h"
+#include "scanner.h"
+#include <signal.h>
 #include <sys/stat.h>
 #include <algorithm>
 #include <cstring>
+#include <fstream>
+#include <getopt.h>
 
 using namespace std;
 
 void show_help(char *s);
+int run_batch(Cat * cat, istream & input);
+bool run_command(Cat * cat, const string & line, string & error);
+string json_escape(const string & text);
+int run_scan(Cat * cat, const string & range, int dwell, int hang, int passes, bool json);
+void dump_stats(Cat * cat, const string & format);
+int run_monitor(Cat * cat, int period, uint64_t samples, int flush, bool frequency_mode, bool rx, bool tx);
+void stop_monitor(int signal_number);
+
+// set on SIGINT/SIGTERM, the monitor loop finishes and flushes
+static volatile sig_atomic_t monitor_stop = 0;
 
 int main(int argc, char **argv)
 {
@@ -27,12 +43,31 @@ int main(int argc, char **argv)
 
 	double frequency = -1;
 	int mode = -1;
-	string serial_device, lock_state, ptt_state;
-	int serial_speed;
+	string serial_device, lock_state, ptt_state, batch_file, scan_range, stats_format;
+	int scan_dwell = 50, scan_hang = -1, scan_passes = 1;
+	int monitor_period = -1, monitor_flush = 0;
+	uint64_t monitor_samples = 0;
+	int serial_speed = 9600;
 	bool status = false, rx_status = false, tx_status = false, verbose = false, json = false;
 
-	while ((option_char = getopt(argc, argv, ":f:m:d:b:l:uhtrsvjp:")) != -1) {
+	static struct option long_options[] = {
+		{"stats", optional_argument, NULL, 1},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((option_char = getopt_long(argc, argv, ":f:m:d:b:l:uhtrsvjp:x:S:w:q:c:M:n:F:", long_options, NULL)) != -1) {
 		switch(option_char) {
+			// dump transaction stats when done
+			case 1:
+				stats_format = optarg ? optarg : "json";
+
+				if (stats_format != "json" && stats_format != "prometheus") {
+					cout << argv[0] << ": Invalid stats format: " << stats_format << ". Allowed values: json/prometheus." << endl << endl;
+					return -1;
+				}
+
+				break;
+
 			// set frequency
 			case 'f':
 				frequency = stod(optarg, nullptr);
@@ -47,10 +82,9 @@ int main(int argc, char **argv)
 			// set operating mode
 			case 'm': {
 					string text_mode = optarg;
+					mode = CatCodec::ModeCode(optarg);
 
-					try {
-						mode = Cat::OP_MODES.at(text_mode);
-					} catch (const out_of_range& oor) {
+					if (mode < 0) {
 						cout << argv[0]  << ": Invalid operating mode: " << text_mode << endl << endl;
 						return -1;
 					}
@@ -80,9 +114,9 @@ int main(int argc, char **argv)
 
 			// set serial speed
 			case 'b':
-				serial_speed = stoi(optarg, nullptr);
+				serial_speed = strcmp(optarg, "auto") == 0 ? 0 : atoi(optarg);
 
-				if (serial_speed != 2400 && serial_speed != 4800 && serial_speed != 9600) {
+				if (serial_speed != 0 && serial_speed != 2400 && serial_speed != 4800 && serial_speed != 9600 && serial_speed != 38400) {
 					cout << argv[0] << ": Setting port speed to 9600 bauds." << endl << endl;
 					serial_speed = 9600;
 				}
@@ -129,6 +163,52 @@ int main(int argc, char **argv)
 				json = true;
 				break;
 
+			// run commands from file or stdin
+			case 'x':
+				batch_file = optarg;
+				break;
+
+			// scan frequency range
+			case 'S':
+				scan_range = optarg;
+				break;
+
+			// scan dwell time
+			case 'w':
+				scan_dwell = stoi(optarg, nullptr);
+				break;
+
+			// stop scan on activity, resume after hang time
+			case 'q':
+				scan_hang = stoi(optarg, nullptr);
+				break;
+
+			// number of scan passes
+			case 'c':
+				scan_passes = stoi(optarg, nullptr);
+				break;
+
+			// stream status as NDJSON, one sample every period ms
+			case 'M':
+				monitor_period = stoi(optarg, nullptr);
+
+				if (monitor_period < 0) {
+					cout << argv[0] << ": Invalid monitor period: " << monitor_period << endl << endl;
+					return -1;
+				}
+
+				break;
+
+			// number of monitor samples
+			case 'n':
+				monitor_samples = stoull(optarg, nullptr);
+				break;
+
+			// monitor output flush interval
+			case 'F':
+				monitor_flush = stoi(optarg, nullptr);
+				break;
+
 			// missing required value
 			case ':':
 				cout << argv[0] << ": Missing required parameter!" << endl << endl;
@@ -147,6 +227,13 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
+	// keying the transmitter around a scan, stream or batch would not be
+	// what anybody asked for, batch files have their own p command
+	if (!ptt_state.empty() && (!batch_file.empty() || !scan_range.empty() || monitor_period >= 0)) {
+		cout << argv[0] << ": -p can't be combined with -x, -S or -M!" << endl << endl;
+		return -1;
+	}
+
 	// create CAT object
 	Cat * cat = new Cat();
 	cat->SetVerbose(verbose && !json);
@@ -157,9 +244,34 @@ int main(int argc, char **argv)
 
 	if (!tcvr_responding) {
 		cout << argv[0] << ": Transciever is not responding!" << endl << endl;
+		dump_stats(cat, stats_format);
 		return -1;
 	}
 
+	// batch mode, port stays open for all commands
+	if (!batch_file.empty()) {
+		int result;
+
+		if (batch_file == "-") {
+			result = run_batch(cat, cin);
+		} else {
+			ifstream input(batch_file.c_str());
+
+			if (!input.is_open()) {
+				cout << argv[0] << ": Can't open command file: " << batch_file << endl << endl;
+				delete cat;
+				return -1;
+			}
+
+			result = run_batch(cat, input);
+		}
+
+		dump_stats(cat, stats_format);
+		delete cat;
+
+		return result;
+	}
+
 	// lock
 	if (!lock_state.empty()) {
 		if (lock_state == "on") {
@@ -179,6 +291,27 @@ int main(int argc, char **argv)
 		cat->SetFrequency(frequency);
 	}
 
+	// sweep the band, nothing else to do afterwards
+	if (!scan_range.empty()) {
+		int result = run_scan(cat, scan_range, scan_dwell, scan_hang, scan_passes, json);
+		dump_stats(cat, stats_format);
+		delete cat;
+
+		return result;
+	}
+
+	// stream status until sample count reached
+	if (monitor_period >= 0) {
+		// a long running stream rides out an unplugged adapter
+		cat->SetReconnectHold(-1);
+
+		int result = run_monitor(cat, monitor_period, monitor_samples, monitor_flush, status, rx_status, tx_status);
+		dump_stats(cat, stats_format);
+		delete cat;
+
+		return result;
+	}
+
 	// key the transmitter
 	if (!ptt_state.empty()) {
 		if (ptt_state == "on") {
@@ -208,6 +341,7 @@ int main(int argc, char **argv)
 		cat->Json();
 	}
 
+	dump_stats(cat, stats_format);
 	delete cat;
 
 	return 1;
@@ -223,11 +357,14 @@ void show_help(char *s)
 	cout << "Raspberry Pi and Yeasu FT8xx fusion" << endl << endl;
 
 	cout << "Usage: " << endl;
-	cout << " " << s << " -d <serial device> [-b <serial speed>] [-f <frequency in MHz>] [-m <operating mode>] [-p <on/off>] [-l <on/off>] [-rtsvj]" << endl << endl;
+	cout << " " << s << " -d <serial device> [-b <serial speed>] [-f <frequency in MHz>] [-m <operating mode>] [-p <on/off>] [-l <on/off>] [-rtsvj]" << endl;
+	cout << " " << s << " -d <serial device> [-b <serial speed>] -x <command file or - for stdin>" << endl;
+	cout << " " << s << " -d <serial device> [-b <serial speed>] [-m <operating mode>] -S <start:stop:step MHz> [-w <dwell ms>] [-q <hang ms>] [-c <passes>] [-j]" << endl;
+	cout << " " << s << " -d <serial device> [-b <serial speed>] [-f <frequency in MHz>] [-m <operating mode>] -M <period ms> [-n <samples>] [-F <flush ms>] [-rts]" << endl << endl;
 
 	cout << "Options:" << endl;
 	cout << " -d serial device (e.g. /dev/ttyUSB0)" << endl;
-	cout << " -b serial speed (2400, 4800, 9600)" << endl;
+	cout << " -b serial speed (2400, 4800, 9600, 38400 or auto to probe)" << endl;
 	cout << " -l <on/off> lock transciever" << endl;
 	cout << " -p <on/off> key transmitter" << endl;
 	cout << " -m set operaring mode (CW, USB, LSB, ...)" << endl;
@@ -236,11 +373,290 @@ void show_help(char *s)
 	cout << " -t get transmitter status" << endl;
 	cout << " -s get current frequency and mode" << endl;
 	cout << " -v verbose output" << endl;
-	cout << " -j output JSON formatted text" << endl << endl;
+	cout << " -j output JSON formatted text" << endl;
+	cout << " -x run commands (f 14.190, m USB, p on, l off, r, t, s), one per line, print one JSON line per command" << endl;
+	cout << " -S scan range start:stop:step in MHz, prints CSV (NDJSON with -j)" << endl;
+	cout << " -w scan dwell time per step in ms (default 50)" << endl;
+	cout << " -q stop scan on open squelch, resume after squelch was closed for this many ms" << endl;
+	cout << " -c number of scan passes, 0 scans forever (default 1)" << endl;
+	cout << " -M stream status as NDJSON, one record every period ms (0 as fast as the tcvr answers), polls -r/-t/-s or all of them" << endl;
+	cout << " -n number of monitor samples, 0 streams forever (default 0)" << endl;
+	cout << " -F flush monitor output at most every this many ms (default 0, every record)" << endl;
+	cout << " --stats[=json|prometheus] print CAT transaction counters and latencies to stderr when done" << endl << endl;
 
 	cout << "Examples:" << endl;
 	cout << " Set transciever to 14.190 MHz USB:" << endl;
 	cout << " " << s << " -d /dev/ttyUSB0 -f 14.190 -m USB" << endl << endl;
 	cout << " Get RX, frequency and mode status in json format:" << endl;
-	cout << " " << s << " -d /dev/ttyUSB0 -s -r -j" << endl;
+	cout << " " << s << " -d /dev/ttyUSB0 -s -r -j" << endl << endl;
+	cout << " Run commands from stdin:" << endl;
+	cout << " printf 'f 14.190\\nm USB\\nr\\n' | " << s << " -d /dev/ttyUSB0 -x -" << endl << endl;
+	cout << " Scan 2m FM repeaters, stop on activity:" << endl;
+	cout << " " << s << " -d /dev/ttyUSB0 -m FM -S 145.600:145.800:0.025 -w 100 -q 3000 -c 0" << endl << endl;
+	cout << " Log S-meter as fast as possible:" << endl;
+	cout << " " << s << " -d /dev/ttyUSB0 -M 0 -r -F 1000 | jq -c '[.ts, .rx_signal]'" << endl;
+}
+
+/**
+ * Sweep frequency range and print one record per sample
+ * @param Cat* cat
+ * @param string range start:stop:step in MHz
+ * @param int dwell Settling time per step in ms
+ * @param int hang Squelch hang time in ms, -1 for plain sweep
+ * @param int passes
+ * @param bool json NDJSON instead of CSV
+ * @return int
+ */
+int run_scan(Cat * cat, const string & range, int dwell, int hang, int passes, bool json)
+{
+	double start, stop, step;
+	char separator;
+	istringstream parts(range);
+
+	parts >> start >> separator >> stop >> separator >> step;
+
+	Scanner scanner(cat);
+
+	if (parts.fail() || !scanner.SetRange(start, stop, step)) {
+		cout << "Invalid scan range: " << range << ". Use start:stop:step in MHz." << endl;
+		return -1;
+	}
+
+	scanner.SetDwell(dwell);
+	scanner.SetSquelchStop(hang >= 0, hang);
+	scanner.SetPasses(passes);
+
+	if (!json) {
+		cout << "frequency,signal,squelched,time_ms" << endl;
+	}
+
+	double first = -1;
+
+	bool ok = scanner.Run([json, &first](const ScanSample & sample) {
+		if (first < 0) {
+			first = sample.time_ms;
+		}
+
+		if (json) {
+			cout << "{\"frequency\":" << fixed << setprecision(6) << sample.frequency << ",\"signal\":" << sample.signal
+				<< ",\"squelched\":" << (sample.squelched ? "true" : "false") << ",\"time_ms\":" << setprecision(1) << sample.time_ms - first << "}" << endl;
+		} else {
+			cout << fixed << setprecision(6) << sample.frequency << "," << sample.signal << "," << sample.squelched << "," << setprecision(1) << sample.time_ms - first << endl;
+		}
+	});
+
+	// summary goes to stderr so the table stays machine readable
+	cerr << "Scanned " << scanner.GetSteps() << " steps, " << setprecision(2) << scanner.GetStepsPerSecond() << " steps/s" << endl;
+
+	if (!ok) {
+		cerr << "Transciever stopped responding." << endl;
+		return -1;
+	}
+
+	return 1;
+}
+
+/**
+ * Run commands line by line and print one NDJSON record for each
+ * @param Cat* cat
+ * @param istream input
+ * @return int 1 if all commands succeeded, -1 otherwise
+ */
+int run_batch(Cat * cat, istream & input)
+{
+	string line, error;
+	int line_number = 0;
+	bool all_ok = true;
+
+	while (getline(input, line)) {
+		line_number++;
+
+		if (!line.empty() && line[line.length() - 1] == '\r') {
+			line.erase(line.length() - 1);
+		}
+
+		// skip blank lines and comments
+		size_t first = line.find_first_not_of(" \t");
+
+		if (first == string::npos || line[first] == '#') {
+			continue;
+		}
+
+		bool ok = run_command(cat, line, error);
+		all_ok = all_ok && ok;
+
+		cout << "{\"line\":" << line_number << ",\"command\":\"" << json_escape(line) << "\",\"ok\":" << (ok ? "true" : "false");
+
+		if (ok) {
+			cout << ",\"status\":" << cat->Json(false);
+		} else {
+			cout << ",\"error\":\"" << json_escape(error) << "\"";
+		}
+
+		// flush so a reading process gets every result right away
+		cout << "}" << endl;
+	}
+
+	return all_ok ? 1 : -1;
+}
+
+/**
+ * Execute one batch command
+ * @param Cat* cat
+ * @param string line e.g. "f 14.190"
+ * @param string error Reason if command failed
+ * @return bool
+ */
+bool run_command(Cat * cat, const string & line, string & error)
+{
+	istringstream tokens(line);
+	string command, argument;
+	tokens >> command >> argument;
+
+	bool ok;
+
+	if (command == "f") {
+		double frequency = atof(argument.c_str());
+
+		if (frequency <= 0 || frequency >= 1000) {
+			error = "Invalid frequency";
+			return false;
+		}
+
+		ok = cat->SetFrequency(frequency);
+	} else if (command == "m") {
+		if (CatCodec::ModeCode(argument.c_str()) < 0) {
+			error = "Invalid operating mode";
+			return false;
+		}
+
+		ok = cat->SetOperatingMode(argument);
+	} else if ((command == "p" || command == "l") && (argument == "on" || argument == "off")) {
+		ok = command == "p" ? cat->Ptt(argument == "on") : cat->Lock(argument == "on");
+	} else if (command == "r") {
+		ok = cat->GetRxStatus();
+	} else if (command == "t") {
+		ok = cat->GetTxStatus();
+	} else if (command == "s") {
+		ok = cat->GetFrequencyModeStatus();
+	} else {
+		error = "Unknown command";
+		return false;
+	}
+
+	if (!ok) {
+		error = "Transciever did not accept command";
+	}
+
+	return ok;
+}
+
+/**
+ * Escape text for use inside a JSON string
+ * @param string text
+ * @return string
+ */
+string json_escape(const string & text)
+{
+	string escaped;
+
+	for (size_t i = 0; i < text.length(); i++) {
+		unsigned char c = text[i];
+
+		if (c == '"' || c == '\\') {
+			escaped += '\\';
+			escaped += c;
+		} else if (c < 0x20) {
+			char code[8];
+			snprintf(code, sizeof(code), "\\u%04x", c);
+			escaped += code;
+		} else {
+			escaped += c;
+		}
+	}
+
+	return escaped;
+}
+
+/**
+ * Print transaction stats to stderr, so they never mix with command output
+ * @param Cat* cat
+ * @param string format json, prometheus or empty for none
+ * @return void
+ */
+void dump_stats(Cat * cat, const string & format)
+{
+	if (format == "json") {
+		cerr << cat->Stats(format) << endl;
+	} else if (format == "prometheus") {
+		cerr << cat->Stats(format);
+	}
+}
+
+/**
+ * Poll status and write one NDJSON record per sample to stdout
+ * @param Cat* cat
+ * @param int period Milliseconds between samples
+ * @param uint64_t samples 0 for no limit
+ * @param int flush Milliseconds between writes
+ * @param bool frequency_mode
+ * @param bool rx
+ * @param bool tx
+ * @return int
+ */
+int run_monitor(Cat * cat, int period, uint64_t samples, int flush, bool frequency_mode, bool rx, bool tx)
+{
+	NdjsonWriter writer;
+	TcvrStatus status;
+
+	// nothing picked, follow everything
+	if (!frequency_mode && !rx && !tx) {
+		frequency_mode = rx = tx = true;
+	}
+
+	cout.flush();
+	writer.SetOutput(1, flush);
+
+	// buffered records must still reach stdout when interrupted
+	signal(SIGINT, stop_monitor);
+	signal(SIGTERM, stop_monitor);
+
+	double next = Clock::MonotonicMs();
+
+	for (uint64_t i = 0; !monitor_stop && (samples == 0 || i < samples); i++) {
+		bool ok = (!frequency_mode || cat->GetFrequencyModeStatus()) && (!rx || cat->GetRxStatus()) && (!tx || cat->GetTxStatus());
+
+		if (!ok) {
+			writer.Flush();
+			cerr << "Transciever stopped responding." << endl;
+			return -1;
+		}
+
+		cat->GetStatus(status);
+		writer.Status(status);
+
+		// fixed rate, late samples do not push the schedule back
+		next += period;
+		double remaining = next - Clock::MonotonicMs();
+
+		if (remaining > 0) {
+			usleep((useconds_t)(remaining * 1000));
+		} else {
+			next = Clock::MonotonicMs();
+		}
+	}
+
+	writer.Flush();
+
+	return 1;
+}
+
+/**
+ * Signal handler, ends the monitor loop
+ * @param int signal_number
+ * @return void
+ */
+void stop_monitor(int)
+{
+	monitor_stop = 1;
 }
@@ -0,0 +1,753 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ *
+ * How to compile: g++ -O3 -std=c++0x -pthread -o yaesu_audio yaesu_audio.cpp audio_packet.cpp audio_codec.cpp audio_device.cpp audio_fec.cpp jitter_buffer.cpp cat.cpp cat_stats.cpp link_health.cpp device_watch.cpp tcvr_status.cpp serial_transport.cpp
+ */
+#include "audio_device.h"
+#include "audio_fec.h"
+#include "audio_packet.h"
+#include "cat_stats.h"
+#include "clock.h"
+#include "jitter_buffer.h"
+#include "spsc_ring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// UDP session: the socket, parity both ways and the simulated bad network
+struct UdpLink {
+	int fd;
+	double loss_percent;
+	int delay_ms;
+	int jitter_ms;
+	multimap<uint64_t, vector<uint8_t> > outbound;
+	multimap<uint64_t, vector<uint8_t> > inbound;
+	AudioFec tx_fec;
+	AudioFec rx_fec;
+	uint64_t impaired_drops;
+	uint64_t fec_sent;
+	uint64_t recovered;
+};
+
+void show_help(char *s);
+bool write_all(int fd, const uint8_t * data, size_t length);
+void receive_audio(int fd, AudioDevice * sink, long frame_limit, LatencyHistogram * latency, atomic<long> * received, atomic<uint64_t> * bytes);
+bool send_codec(int fd, int codec);
+void send_audio(int fd, AudioDevice * source, int rate, int codec, LatencyHistogram * latency);
+void stream_udp(UdpLink * link, AudioDevice * sink, AudioDevice * source, int rate, int codec, long frame_limit, JitterBuffer * jitter, LatencyHistogram * rx_latency, LatencyHistogram * tx_latency, atomic<long> * received, atomic<uint64_t> * bytes);
+void impair(UdpLink * link, multimap<uint64_t, vector<uint8_t> > & queue, const uint8_t * data, size_t length);
+void deliver(UdpLink * link, const uint8_t * data, size_t length, SpscRing<AudioFrame> * ring);
+void read_audio(AudioDevice * source, int rate, SpscRing<AudioFrame> * ring, int event_fd, atomic<bool> * done, atomic<bool> * running);
+void play_audio(SpscRing<AudioFrame> * ring, JitterBuffer * jitter, AudioDevice * sink, long frame_limit, LatencyHistogram * latency, atomic<long> * played, atomic<bool> * running);
+void sleep_until(uint64_t due_us);
+
+int main(int argc, char **argv)
+{
+	int option_char;
+	int rate = 8000, codec = AudioCodec::CODEC_PCM;
+	long frame_limit = 0;
+	string playback_spec, source_spec;
+	bool udp = false;
+	UdpLink link;
+
+	link.loss_percent = 0;
+	link.delay_ms = 0;
+	link.jitter_ms = 0;
+	link.impaired_drops = 0;
+	link.fec_sent = 0;
+	link.recovered = 0;
+	link.tx_fec.SetGroup(4);
+
+	while ((option_char = getopt(argc, argv, "o:i:n:r:c:uF:l:d:j:h")) != -1) {
+		switch(option_char) {
+			// where received audio goes
+			case 'o':
+				playback_spec = optarg;
+				break;
+
+			// audio to transmit
+			case 'i':
+				source_spec = optarg;
+				break;
+
+			// quit after this many received frames
+			case 'n':
+				frame_limit = atol(optarg);
+				break;
+
+			// sample rate of the audio to transmit
+			case 'r':
+				rate = atoi(optarg);
+				break;
+
+			// codec both ways
+			case 'c':
+				codec = AudioCodec::CodecByName(optarg);
+
+				if (codec < 0) {
+					cerr << argv[0] << ": Unknown codec " << optarg << endl << endl;
+					show_help(argv[0]);
+					return -1;
+				}
+
+				break;
+
+			// UDP instead of TCP
+			case 'u':
+				udp = true;
+				break;
+
+			// frames per parity packet we send over UDP
+			case 'F':
+				link.tx_fec.SetGroup(atoi(optarg));
+				break;
+
+			// simulated network: loss in percent, delay and jitter in ms, both ways
+			case 'l':
+				link.loss_percent = atof(optarg);
+				break;
+
+			case 'd':
+				link.delay_ms = atoi(optarg);
+				break;
+
+			case 'j':
+				link.jitter_ms = atoi(optarg);
+				break;
+
+			case 'h':
+				show_help(argv[0]);
+				return 0;
+
+			default:
+				show_help(argv[0]);
+				return -1;
+		}
+	}
+
+	if (argc - optind < 2) {
+		show_help(argv[0]);
+		return -1;
+	}
+
+	if (AudioPacket::FrameSamples(rate) > AUDIO_MAX_SAMPLES || rate < 8000) {
+		cerr << argv[0] << ": Unsupported rate " << rate << " Hz" << endl;
+		return -1;
+	}
+
+	struct hostent *server = gethostbyname(argv[optind]);
+
+	if (server == NULL) {
+		cerr << argv[0] << ": No such host: " << argv[optind] << endl;
+		return -1;
+	}
+
+	struct sockaddr_in serv_addr;
+	memset(&serv_addr, 0, sizeof(serv_addr));
+	serv_addr.sin_family = AF_INET;
+	memcpy(&serv_addr.sin_addr.s_addr, server->h_addr, server->h_length);
+	serv_addr.sin_port = htons(atoi(argv[optind + 1]));
+
+	int sockfd = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+
+	if (sockfd < 0 || connect(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+		perror("ERROR connecting");
+		return -1;
+	}
+
+	int nodelay = 1;
+
+	if (!udp) {
+		setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	}
+
+	AudioDevice sink, source;
+	bool has_sink = !playback_spec.empty(), has_source = !source_spec.empty();
+
+	if (has_sink && !sink.Open(playback_spec, AudioDevice::PLAYBACK, rate)) {
+		return -1;
+	}
+
+	if (has_source && !source.Open(source_spec, AudioDevice::CAPTURE, rate)) {
+		return -1;
+	}
+
+	if (!send_codec(sockfd, codec)) {
+		perror("ERROR writing to socket");
+		return -1;
+	}
+
+	LatencyHistogram rx_latency, tx_latency;
+	JitterBuffer jitter;
+	atomic<long> received(0);
+	atomic<uint64_t> bytes(0);
+	uint64_t started_us = Clock::MonotonicUs();
+
+	if (udp) {
+		link.fd = sockfd;
+		srand48(started_us);
+		stream_udp(&link, has_sink ? &sink : NULL, has_source ? &source : NULL, rate, codec, frame_limit, &jitter, &rx_latency, &tx_latency, &received, &bytes);
+	} else {
+		thread receiver(receive_audio, sockfd, has_sink ? &sink : NULL, frame_limit, &rx_latency, &received, &bytes);
+
+		if (has_source) {
+			send_audio(sockfd, &source, rate, codec, &tx_latency);
+
+			// without a frame count we are done once TX is
+			if (frame_limit == 0) {
+				shutdown(sockfd, SHUT_RDWR);
+			}
+		}
+
+		receiver.join();
+	}
+
+	close(sockfd);
+
+	double seconds = (Clock::MonotonicUs() - started_us) / 1000000.0;
+
+	cerr << fixed << setprecision(3);
+	cerr << "rx_frames:" << received.load() << endl;
+	cerr << "rx_bytes:" << bytes.load() << endl;
+	cerr << "rx_kbit_per_s:" << (seconds > 0 ? bytes * 8 / seconds / 1000 : 0) << endl;
+
+	if (rx_latency.GetCount() > 0) {
+		cerr << "rx_latency_p50_ms:" << rx_latency.Percentile(0.5) << endl;
+		cerr << "rx_latency_p99_ms:" << rx_latency.Percentile(0.99) << endl;
+		cerr << "rx_latency_max_ms:" << rx_latency.GetMaxMs() << endl;
+	}
+
+	if (has_source) {
+		cerr << "tx_frames:" << tx_latency.GetCount() << endl;
+		cerr << "tx_send_p99_ms:" << tx_latency.Percentile(0.99) << endl;
+	}
+
+	if (udp) {
+		cerr << jitter.Stats("rx_buffer_");
+		cerr << "rx_recovered:" << link.recovered << endl;
+		cerr << "tx_fec_sent:" << link.fec_sent << endl;
+		cerr << "impaired_drops:" << link.impaired_drops << endl;
+	}
+
+	return 1;
+}
+
+/**
+ * Show help message
+ * @param char* s This executable
+ * @return void
+ */
+void show_help(char *s)
+{
+	cout << "Raspberry Pi and Yeasu FT8xx fusion - audio client" << endl << endl;
+
+	cout << "Usage: " << endl;
+	cout << " " << s << " [-o <playback>] [-i <tx audio>] [-n <frames>] [-r <rate>] [-c <codec>] [-u [-F <frames>] [-l <loss %>] [-d <ms>] [-j <ms>]] <hostname> <audio port>" << endl << endl;
+
+	cout << "Options:" << endl;
+	cout << " -o play received audio: alsa:<pcm>, - for stdout, a FIFO or a raw/.wav file" << endl;
+	cout << " -i transmit this audio once, PTT is keyed for it: alsa:<pcm>, - for stdin, a FIFO or a raw/.wav file" << endl;
+	cout << " -n quit after playing this many 20 ms frames" << endl;
+	cout << " -r sample rate of the transmitted audio, must match the server (default 8000)" << endl;
+	cout << " -c codec both ways: pcm (default), ulaw, alaw (8 bit) or adpcm (4 bit)" << endl;
+	cout << " -u use UDP: received audio goes through a jitter buffer, lost frames are concealed" << endl;
+	cout << " -F frames per XOR parity packet sent with UDP TX audio, 0 for none (default 4)" << endl;
+	cout << " -l drop this percentage of UDP packets each way, for testing" << endl;
+	cout << " -d delay UDP packets each way by this many ms, for testing" << endl;
+	cout << " -j add up to this many ms of random delay to each UDP packet, for testing" << endl << endl;
+
+	cout << "Latency is printed to stderr on exit. Receive latency compares the" << endl;
+	cout << "server's capture time with ours, so it is only valid on the same host." << endl;
+}
+
+/**
+ * Write whole buffer to socket, a closed one is an error rather than SIGPIPE
+ * @param int fd
+ * @param uint8_t* data
+ * @param size_t length
+ * @return bool
+ */
+bool write_all(int fd, const uint8_t * data, size_t length)
+{
+	size_t written = 0;
+
+	while (written < length) {
+		ssize_t n = send(fd, data + written, length - written, MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (n <= 0) {
+			return false;
+		}
+
+		written += n;
+	}
+
+	return true;
+}
+
+/**
+ * Decode RX frames until the server goes away or enough were received
+ * @param int fd
+ * @param AudioDevice* sink NULL to discard the audio
+ * @param long frame_limit 0 for no limit
+ * @param LatencyHistogram* latency
+ * @param atomic<long>* received
+ * @param atomic<uint64_t>* bytes Received on the wire
+ * @return void
+ */
+void receive_audio(int fd, AudioDevice * sink, long frame_limit, LatencyHistogram * latency, atomic<long> * received, atomic<uint64_t> * bytes)
+{
+	static uint8_t buffer[4 * AudioPacket::MAX_SIZE];
+	size_t length = 0;
+	AudioFrame frame;
+
+	while (frame_limit == 0 || *received < frame_limit) {
+		ssize_t n = read(fd, buffer + length, sizeof(buffer) - length);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (n <= 0) {
+			break;
+		}
+
+		length += n;
+		*bytes += n;
+		size_t offset = 0;
+		uint8_t type, codec;
+		int consumed;
+
+		while ((consumed = AudioPacket::Decode(buffer + offset, length - offset, type, codec, frame)) > 0) {
+			offset += consumed;
+
+			if (type != AudioPacket::TYPE_RX_AUDIO) {
+				continue;
+			}
+
+			latency->Record((Clock::MonotonicUs() - frame.time_us) / 1000.0);
+
+			if (sink != NULL) {
+				sink->Write(frame.pcm, frame.samples);
+			}
+
+			if (++*received == frame_limit) {
+				break;
+			}
+		}
+
+		if (consumed < 0) {
+			cerr << "Audio protocol error, closing." << endl;
+			break;
+		}
+
+		memmove(buffer, buffer + offset, length - offset);
+		length -= offset;
+	}
+
+	shutdown(fd, SHUT_RDWR);
+}
+
+/**
+ * Ask for RX audio in a codec
+ * @param int fd
+ * @param int codec
+ * @return bool
+ */
+bool send_codec(int fd, int codec)
+{
+	uint8_t packet[AudioPacket::MAX_SIZE];
+	AudioCodec::AdpcmState state = {0, 0};
+	AudioFrame frame;
+
+	frame.sequence = 0;
+	frame.time_us = Clock::MonotonicUs();
+	frame.rate = 0;
+	frame.samples = 0;
+
+	return write_all(fd, packet, AudioPacket::Encode(AudioPacket::TYPE_CODEC, frame, packet, codec, state));
+}
+
+/**
+ * Send the source as TX frames at its own pace, then end the burst
+ * @param int fd
+ * @param AudioDevice* source
+ * @param int rate
+ * @param int codec
+ * @param LatencyHistogram* latency Time spent handing each frame to the socket
+ * @return void
+ */
+void send_audio(int fd, AudioDevice * source, int rate, int codec, LatencyHistogram * latency)
+{
+	uint8_t packet[AudioPacket::MAX_SIZE];
+	AudioCodec::AdpcmState state = {0, 0};
+	AudioFrame frame;
+	int samples = AudioPacket::FrameSamples(rate);
+	uint32_t sequence = 0;
+	int n;
+
+	while ((n = source->Read(frame.pcm, samples)) > 0) {
+		frame.sequence = sequence++;
+		frame.time_us = Clock::MonotonicUs() - (uint64_t)n * 1000000 / rate;
+		frame.rate = rate;
+		frame.samples = n;
+
+		uint64_t start_us = Clock::MonotonicUs();
+
+		if (!write_all(fd, packet, AudioPacket::Encode(AudioPacket::TYPE_TX_AUDIO, frame, packet, codec, state))) {
+			return;
+		}
+
+		latency->Record((Clock::MonotonicUs() - start_us) / 1000.0);
+	}
+
+	frame.samples = 0;
+	write_all(fd, packet, AudioPacket::Encode(AudioPacket::TYPE_TX_END, frame, packet, codec, state));
+}
+
+/**
+ * UDP session: received packets are repaired, decoded and played through
+ * the jitter buffer on a thread of its own; TX audio is read on another.
+ * This thread does the socket, parity and simulated network.
+ * @param UdpLink* link
+ * @param AudioDevice* sink NULL to discard the audio
+ * @param AudioDevice* source NULL to not transmit
+ * @param int rate
+ * @param int codec
+ * @param long frame_limit 0 for no limit
+ * @param JitterBuffer* jitter
+ * @param LatencyHistogram* rx_latency Capture to playout
+ * @param LatencyHistogram* tx_latency Time spent handing each frame to the socket
+ * @param atomic<long>* received Frames played
+ * @param atomic<uint64_t>* bytes Received on the wire
+ * @return void
+ */
+void stream_udp(UdpLink * link, AudioDevice * sink, AudioDevice * source, int rate, int codec, long frame_limit, JitterBuffer * jitter, LatencyHistogram * rx_latency, LatencyHistogram * tx_latency, atomic<long> * received, atomic<uint64_t> * bytes)
+{
+	SpscRing<AudioFrame> rx_ring(16), tx_ring(16);
+	int tx_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	atomic<bool> running(true), tx_done(source == NULL);
+	uint8_t packet[AudioPacket::MAX_PARITY_SIZE], parity[AudioPacket::MAX_PARITY_SIZE];
+	AudioCodec::AdpcmState state = {0, 0};
+	uint32_t sequence = 0;
+	bool tx_ended = source == NULL;
+	uint64_t keepalive_us = 0;
+
+	thread player(play_audio, &rx_ring, jitter, sink, frame_limit, rx_latency, received, &running);
+	thread reader;
+
+	if (source != NULL) {
+		reader = thread(read_audio, source, rate, &tx_ring, tx_event, &tx_done, &running);
+	}
+
+	// without a frame count we are done once TX is
+	while (running && (frame_limit > 0 || !tx_ended || !link->outbound.empty())) {
+		uint64_t now = Clock::MonotonicUs();
+
+		// registers us with the server and keeps us registered, not impaired
+		if (now >= keepalive_us) {
+			send_codec(link->fd, codec);
+			keepalive_us = now + 1000000;
+		}
+
+		struct pollfd fds[2];
+		fds[0].fd = link->fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = tx_event;
+		fds[1].events = POLLIN;
+
+		// wake for the next impaired packet that falls due, at least every 10 ms
+		uint64_t wake_us = now + 10000;
+
+		if (!link->outbound.empty() && link->outbound.begin()->first < wake_us) {
+			wake_us = link->outbound.begin()->first;
+		}
+
+		if (!link->inbound.empty() && link->inbound.begin()->first < wake_us) {
+			wake_us = link->inbound.begin()->first;
+		}
+
+		int timeout_ms = wake_us > now ? (wake_us - now) / 1000 : 0;
+
+		if (poll(fds, 2, timeout_ms) < 0 && errno != EINTR) {
+			perror("ERROR on poll");
+			break;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			ssize_t n;
+
+			while ((n = recv(link->fd, packet, sizeof(packet), MSG_DONTWAIT)) >= 0) {
+				*bytes += n;
+				impair(link, link->inbound, packet, n);
+			}
+		}
+
+		if (fds[1].revents & POLLIN) {
+			uint64_t value;
+
+			if (read(tx_event, &value, sizeof(value)) < 0) {
+				// nothing new
+			}
+
+			for (AudioFrame * frame; (frame = tx_ring.Peek()) != NULL; tx_ring.Release()) {
+				uint64_t start_us = Clock::MonotonicUs();
+
+				frame->sequence = sequence++;
+				size_t length = AudioPacket::Encode(AudioPacket::TYPE_TX_AUDIO, *frame, packet, codec, state);
+				impair(link, link->outbound, packet, length);
+
+				size_t parity_length = link->tx_fec.Protect(packet, length, parity);
+
+				if (parity_length > 0) {
+					impair(link, link->outbound, parity, parity_length);
+					link->fec_sent++;
+				}
+
+				tx_latency->Record((Clock::MonotonicUs() - start_us) / 1000.0);
+			}
+
+			// end of burst; sent a few times as it may get lost
+			if (tx_done && tx_ring.Peek() == NULL && !tx_ended) {
+				AudioFrame frame;
+				frame.sequence = sequence;
+				frame.time_us = Clock::MonotonicUs();
+				frame.rate = rate;
+				frame.samples = 0;
+
+				size_t length = AudioPacket::Encode(AudioPacket::TYPE_TX_END, frame, packet, codec, state);
+
+				for (int i = 0; i < 3; i++) {
+					impair(link, link->outbound, packet, length);
+				}
+
+				tx_ended = true;
+			}
+		}
+
+		now = Clock::MonotonicUs();
+
+		while (!link->outbound.empty() && link->outbound.begin()->first <= now) {
+			vector<uint8_t> & data = link->outbound.begin()->second;
+
+			if (send(link->fd, data.data(), data.size(), MSG_DONTWAIT) < 0) {
+				// the server is not there (yet), UDP does not care
+			}
+
+			link->outbound.erase(link->outbound.begin());
+		}
+
+		while (!link->inbound.empty() && link->inbound.begin()->first <= now) {
+			vector<uint8_t> & data = link->inbound.begin()->second;
+
+			deliver(link, data.data(), data.size(), &rx_ring);
+			link->inbound.erase(link->inbound.begin());
+		}
+	}
+
+	running = false;
+	player.join();
+
+	if (reader.joinable()) {
+		reader.join();
+	}
+
+	close(tx_event);
+}
+
+/**
+ * Queue a packet through the simulated network, it may be lost
+ * @param UdpLink* link
+ * @param multimap queue Keyed by when it falls due
+ * @param uint8_t* data
+ * @param size_t length
+ * @return void
+ */
+void impair(UdpLink * link, multimap<uint64_t, vector<uint8_t> > & queue, const uint8_t * data, size_t length)
+{
+	if (link->loss_percent > 0 && drand48() * 100 < link->loss_percent) {
+		link->impaired_drops++;
+		return;
+	}
+
+	uint64_t delay_us = link->delay_ms * 1000ull;
+
+	// random delay also reorders, like a real network does
+	if (link->jitter_ms > 0) {
+		delay_us += (uint64_t)(drand48() * link->jitter_ms * 1000);
+	}
+
+	queue.insert(make_pair(Clock::MonotonicUs() + delay_us, vector<uint8_t>(data, data + length)));
+}
+
+/**
+ * A received datagram and whatever its parity rebuilds, to the player
+ * @param UdpLink* link
+ * @param uint8_t* data
+ * @param size_t length
+ * @param SpscRing ring
+ * @return void
+ */
+void deliver(UdpLink * link, const uint8_t * data, size_t length, SpscRing<AudioFrame> * ring)
+{
+	uint8_t recovered[AudioPacket::MAX_SIZE];
+	size_t recovered_length = link->rx_fec.Receive(data, length, recovered);
+	uint64_t now = Clock::MonotonicUs();
+
+	for (int i = 0; i < 2; i++) {
+		const uint8_t * packet = i == 0 ? data : recovered;
+		size_t packet_length = i == 0 ? length : recovered_length;
+		AudioFrame * frame = ring->Claim();
+		uint8_t type, codec;
+
+		if (packet_length == 0 || frame == NULL) {
+			continue;
+		}
+
+		if (AudioPacket::Decode(packet, packet_length, type, codec, *frame) <= 0 || type != AudioPacket::TYPE_RX_AUDIO) {
+			continue;
+		}
+
+		// a rebuilt frame arrived late, it says nothing about the network
+		if (i == 0) {
+			frame->arrival_us = now;
+		} else {
+			link->recovered++;
+		}
+
+		ring->Publish();
+	}
+}
+
+/**
+ * Read the TX source at its own pace into the ring
+ * @param AudioDevice* source
+ * @param int rate
+ * @param SpscRing ring
+ * @param int event_fd Signalled for every frame and at the end
+ * @param atomic<bool>* done Set at the end of the source
+ * @param atomic<bool>* running Stop early when cleared
+ * @return void
+ */
+void read_audio(AudioDevice * source, int rate, SpscRing<AudioFrame> * ring, int event_fd, atomic<bool> * done, atomic<bool> * running)
+{
+	int samples = AudioPacket::FrameSamples(rate);
+	uint64_t one = 1;
+
+	while (*running) {
+		AudioFrame * frame = ring->Claim();
+
+		if (frame == NULL) {
+			usleep(1000);
+			continue;
+		}
+
+		int n = source->Read(frame->pcm, samples);
+
+		if (n <= 0) {
+			break;
+		}
+
+		frame->time_us = Clock::MonotonicUs() - (uint64_t)n * 1000000 / rate;
+		frame->rate = rate;
+		frame->samples = n;
+		ring->Publish();
+
+		if (write(event_fd, &one, sizeof(one)) < 0) {
+			// counter full, the reader is awake anyway
+		}
+	}
+
+	*done = true;
+
+	if (write(event_fd, &one, sizeof(one)) < 0) {
+		// counter full, the reader is awake anyway
+	}
+}
+
+/**
+ * Play one frame every 20 ms from the jitter buffer
+ * @param SpscRing ring Received frames
+ * @param JitterBuffer* jitter
+ * @param AudioDevice* sink NULL to discard the audio
+ * @param long frame_limit 0 for no limit
+ * @param LatencyHistogram* latency Capture to playout of received frames
+ * @param atomic<long>* played Frames played, received or concealed
+ * @param atomic<bool>* running Cleared when done, either way
+ * @return void
+ */
+void play_audio(SpscRing<AudioFrame> * ring, JitterBuffer * jitter, AudioDevice * sink, long frame_limit, LatencyHistogram * latency, atomic<long> * played, atomic<bool> * running)
+{
+	AudioFrame frame;
+	uint64_t due_us = Clock::MonotonicUs();
+
+	while (*running && (frame_limit == 0 || *played < frame_limit)) {
+		due_us += AUDIO_FRAME_MS * 1000;
+		sleep_until(due_us);
+
+		for (AudioFrame * received; (received = ring->Peek()) != NULL; ring->Release()) {
+			jitter->Put(*received);
+		}
+
+		JitterBuffer::Playout playout = jitter->Get(frame, false);
+
+		if (playout == JitterBuffer::PLAYOUT_NONE) {
+			continue;
+		}
+
+		if (playout == JitterBuffer::PLAYOUT_FRAME) {
+			latency->Record((Clock::MonotonicUs() - frame.time_us) / 1000.0);
+		}
+
+		if (sink != NULL) {
+			sink->Write(frame.pcm, frame.samples);
+		}
+
+		++*played;
+	}
+
+	*running = false;
+}
+
+/**
+ * Sleep until a point on the frame clock
+ * @param uint64_t due_us
+ * @return void
+ */
+void sleep_until(uint64_t due_us)
+{
+	struct timespec due;
+	due.tv_sec = due_us / 1000000;
+	due.tv_nsec = (due_us % 1000000) * 1000;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR);
+}
@@ -0,0 +1,832 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ *
+ * How to compile: g++ -O3 -std=c++0x -pthread -o yaesu_bench yaesu_bench.cpp ft8xx_sim.cpp eeprom_image.cpp audio_codec.cpp cat.cpp cat_stats.cpp link_health.cpp device_watch.cpp tcvr_status.cpp serial_transport.cpp
+ */
+#include "audio_codec.h"
+#include "cat.h"
+#include "clock.h"
+#include "ft8xx_sim.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/epoll.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+using namespace std;
+
+struct Workload {
+	string name;
+	function<bool(Cat *, int)> run;
+};
+
+void show_help(char *s);
+void run_workload(Cat * cat, const Workload & workload, int iterations, bool json);
+bool run_async(Cat * cat, int epoll_fd, int i);
+void run_codec(int iterations, bool json);
+void print_codec(const string & name, int iterations, double elapsed, bool json);
+bool run_audio(int iterations, bool json);
+bool check_audio(const vector<AudioCodec::Simd> & levels);
+void print_audio(const string & name, AudioCodec::Simd level, long samples, double elapsed, bool json);
+double tone_level(const int16_t * samples, int count, double frequency, int rate);
+void legacy_encode(double frequency, char * bytes);
+double legacy_decode(char * bytes);
+
+int main(int argc, char **argv)
+{
+	int option_char;
+	int baud = 9600, iterations = 200;
+	double processing = 2, drop = 0, shortened = 0;
+	string serial_device, only;
+	bool json = false, codec = false, audio = false;
+
+	while ((option_char = getopt(argc, argv, ":d:b:n:D:r:s:w:cajh")) != -1) {
+		switch(option_char) {
+			// real tcvr instead of the simulator
+			case 'd':
+				serial_device = optarg;
+				break;
+
+			case 'b':
+				baud = stoi(optarg, nullptr);
+				break;
+
+			// commands per workload
+			case 'n':
+				iterations = stoi(optarg, nullptr);
+				break;
+
+			// simulator processing delay and faults
+			case 'D':
+				processing = atof(optarg);
+				break;
+
+			case 'r':
+				drop = atof(optarg) / 100;
+				break;
+
+			case 's':
+				shortened = atof(optarg) / 100;
+				break;
+
+			// run single workload
+			case 'w':
+				only = optarg;
+				break;
+
+			// frame codec microbenchmark, no serial port needed
+			case 'c':
+				codec = true;
+				break;
+
+			// audio codec checks and throughput, no serial port needed
+			case 'a':
+				audio = true;
+				break;
+
+			case 'j':
+				json = true;
+				break;
+
+			case 'h':
+				show_help(argv[0]);
+				return 0;
+
+			case ':':
+				cout << argv[0] << ": Missing required parameter!" << endl << endl;
+				show_help(argv[0]);
+				return -1;
+
+			case '?':
+				cout << argv[0] << ": Unknown parameter!" << endl << endl;
+				show_help(argv[0]);
+				return -1;
+		}
+	}
+
+	if (iterations <= 0) {
+		cout << argv[0] << ": Invalid iteration count: " << iterations << endl << endl;
+		return -1;
+	}
+
+	if (codec) {
+		run_codec(iterations, json);
+		return 0;
+	}
+
+	if (audio) {
+		return run_audio(iterations, json) ? 0 : -1;
+	}
+
+	FT8xxSim * sim = NULL;
+
+	if (serial_device.empty()) {
+		sim = new FT8xxSim();
+		sim->SetBaud(baud);
+		sim->SetProcessingDelay(processing);
+		sim->SetFaults(drop, shortened);
+
+		if (!sim->Open() || !sim->Start()) {
+			delete sim;
+			return -1;
+		}
+
+		serial_device = sim->GetDevice();
+	}
+
+	Cat * cat = new Cat();
+
+	if (!cat->Connect(serial_device, baud)) {
+		delete cat;
+		delete sim;
+		return -1;
+	}
+
+	// host loop for the async workload, the serial fd sits next to whatever else it waits on
+	int epoll_fd = epoll_create1(0);
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.fd = cat->GetFileDescriptor();
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, cat->GetFileDescriptor(), &event);
+
+	vector<Workload> workloads = {
+		{"lock", [](Cat * c, int i) { return c->Lock(i % 2 == 0); }},
+		{"ptt", [](Cat * c, int i) { return c->Ptt(i % 2 == 0); }},
+		{"set_frequency", [](Cat * c, int i) { return c->SetFrequency(14.0 + (i % 350) * 0.001); }},
+		{"set_mode", [](Cat * c, int i) { return c->SetOperatingMode(i % 2 ? Cat::OP_MODE_USB : Cat::OP_MODE_LSB); }},
+		{"get_frequency_mode", [](Cat * c, int) { return c->GetFrequencyModeStatus(); }},
+		{"get_rx_status", [](Cat * c, int) { return c->GetRxStatus(); }},
+		{"get_tx_status", [](Cat * c, int) { return c->GetTxStatus(); }},
+		{"rx_status_and_set_frequency", [](Cat * c, int i) { return c->GetRxStatusAndSetFrequency(14.0 + (i % 350) * 0.001); }},
+
+		// two bytes per round trip against a whole block per round trip, read only so it is safe on a real radio
+		{"read_eeprom_word", [](Cat * c, int i) { uint8_t data[2]; return c->ReadEeprom(0x484 + 2 * (i % 64), data, 2); }},
+		{"read_eeprom_block", [](Cat * c, int i) { uint8_t data[Cat::MAX_EEPROM_BLOCK]; return c->ReadEeprom(0x484 + Cat::MAX_EEPROM_BLOCK * (i % 64), data, Cat::MAX_EEPROM_BLOCK); }},
+
+		// one set per four polls, roughly what a busy server sees
+		{"mixed", [](Cat * c, int i) {
+			switch (i % 5) {
+				case 0:
+					return c->SetFrequency(14.0 + (i % 350) * 0.001);
+				case 1:
+				case 3:
+					return c->GetRxStatus();
+				case 2:
+					return c->GetTxStatus();
+				default:
+					return c->GetFrequencyModeStatus();
+			}
+		}},
+
+		// same mix through the async API, completed from epoll
+		{"async_mixed", [epoll_fd](Cat * c, int i) { return run_async(c, epoll_fd, i); }}
+	};
+
+	if (!json) {
+		cout << left << setw(30) << "workload" << right << setw(8) << "ops" << setw(8) << "fail" << setw(10) << "ops/s" << setw(10) << "p50 ms" << setw(10) << "p99 ms" << setw(10) << "max ms" << endl;
+	}
+
+	for (size_t i = 0; i < workloads.size(); i++) {
+		if (only.empty() || only == workloads[i].name) {
+			run_workload(cat, workloads[i], iterations, json);
+		}
+	}
+
+	// leave the transmitter off
+	cat->Ptt(false);
+	close(epoll_fd);
+
+	if (sim != NULL) {
+		SimStats stats = sim->GetStats();
+		cerr << "simulator frames:" << stats.frames << " replies:" << stats.replies << " dropped:" << stats.dropped << " shortened:" << stats.shortened << endl;
+	}
+
+	delete cat;
+	delete sim;
+
+	return 0;
+}
+
+/**
+ * Show help message
+ * @param char* s This executable
+ * @return void
+ */
+void show_help(char *s)
+{
+	cout << "Raspberry Pi and Yeasu FT8xx fusion - CAT benchmark" << endl << endl;
+
+	cout << "Usage: " << endl;
+	cout << " " << s << " [-d <serial device>] [-b <serial speed>] [-n <iterations>] [-D <processing ms>] [-r <drop %>] [-s <short %>] [-w <workload>] [-j]" << endl;
+	cout << " " << s << " -c [-n <iterations>] [-j]" << endl;
+	cout << " " << s << " -a [-n <seconds of audio>] [-j]" << endl << endl;
+
+	cout << "Options:" << endl;
+	cout << " -d benchmark a real tcvr instead of the built in simulator" << endl;
+	cout << " -b serial speed (2400, 4800, 9600), the simulator emulates its wire time" << endl;
+	cout << " -n commands per workload (default 200)" << endl;
+	cout << " -D simulator processing delay per command in ms (default 2)" << endl;
+	cout << " -r percent of commands the simulator does not answer" << endl;
+	cout << " -s percent of frequency/mode replies the simulator cuts short" << endl;
+	cout << " -w run single workload (lock, ptt, set_frequency, set_mode, get_frequency_mode, get_rx_status, get_tx_status, rx_status_and_set_frequency, read_eeprom_word, read_eeprom_block, mixed, async_mixed)" << endl;
+	cout << " -c benchmark frequency/mode codec and status snapshots per call instead, compared with the old string based code" << endl;
+	cout << " -a check every SIMD audio codec path against the scalar one, then measure samples per second on one core" << endl;
+	cout << " -j one JSON line per workload" << endl;
+}
+
+/**
+ * Run workload and print throughput and latency percentiles
+ * @param Cat* cat
+ * @param Workload workload
+ * @param int iterations
+ * @param bool json
+ * @return void
+ */
+void run_workload(Cat * cat, const Workload & workload, int iterations, bool json)
+{
+	vector<double> latencies;
+	int failed = 0;
+
+	latencies.reserve(iterations);
+
+	double started = Clock::MonotonicMs();
+
+	for (int i = 0; i < iterations; i++) {
+		double before = Clock::MonotonicMs();
+
+		if (!workload.run(cat, i)) {
+			failed++;
+		}
+
+		latencies.push_back(Clock::MonotonicMs() - before);
+	}
+
+	double elapsed = Clock::MonotonicMs() - started;
+
+	sort(latencies.begin(), latencies.end());
+
+	double rate = elapsed > 0 ? iterations * 1000.0 / elapsed : 0;
+	double p50 = latencies[(latencies.size() - 1) / 2];
+	double p99 = latencies[(size_t)((latencies.size() - 1) * 0.99)];
+	double max = latencies.back();
+
+	if (json) {
+		cout << fixed << setprecision(3) << "{\"workload\":\"" << workload.name << "\",\"ops\":" << iterations << ",\"failed\":" << failed << ",\"ops_per_second\":" << rate << ",\"p50_ms\":" << p50 << ",\"p99_ms\":" << p99 << ",\"max_ms\":" << max << "}" << endl;
+	} else {
+		cout << fixed << setprecision(2) << left << setw(30) << workload.name << right << setw(8) << iterations << setw(8) << failed << setw(10) << rate << setw(10) << p50 << setw(10) << p99 << setw(10) << max << endl;
+	}
+}
+
+/**
+ * One command of the mixed workload through the async API, waiting for
+ * its callback in epoll the way an event loop would
+ * @param Cat* cat
+ * @param int epoll_fd Serial fd registered for EPOLLIN
+ * @param int i
+ * @return bool
+ */
+bool run_async(Cat * cat, int epoll_fd, int i)
+{
+	bool done = false, result = false;
+	Cat::Callback callback = [&done, &result](bool ok) { done = true; result = ok; };
+	bool submitted;
+
+	switch (i % 5) {
+		case 0:
+			submitted = cat->SetFrequencyAsync(14.0 + (i % 350) * 0.001, callback);
+			break;
+		case 1:
+		case 3:
+			submitted = cat->GetRxStatusAsync(callback);
+			break;
+		case 2:
+			submitted = cat->GetTxStatusAsync(callback);
+			break;
+		default:
+			submitted = cat->GetFrequencyModeStatusAsync(callback);
+	}
+
+	// writability only matters while a write waits for the uart
+	static uint32_t watched = EPOLLIN;
+
+	while (submitted && !done) {
+		struct epoll_event event;
+
+		if (cat->GetEvents() != watched) {
+			watched = cat->GetEvents();
+			event.events = watched;
+			event.data.fd = cat->GetFileDescriptor();
+			epoll_ctl(epoll_fd, EPOLL_CTL_MOD, cat->GetFileDescriptor(), &event);
+		}
+
+		if (epoll_wait(epoll_fd, &event, 1, cat->GetTimeoutMs()) > 0) {
+			cat->HandleEvents(event.events);
+		}
+
+		cat->HandleTimeout();
+	}
+
+	return result;
+}
+
+/**
+ * Time frame encode/decode and mode lookups, the sweep and logging loops
+ * run these on every sample
+ * @param int iterations Multiplied by 10000
+ * @param bool json
+ * @return void
+ */
+void run_codec(int iterations, bool json)
+{
+	const int count = iterations * 10000;
+	const int legacy_count = count / 100;
+	volatile uint32_t sink = 0;
+	char bytes[5];
+	double started;
+
+	if (!json) {
+		cout << left << setw(30) << "codec" << right << setw(12) << "ops" << setw(12) << "ns/op" << endl;
+	}
+
+	started = Clock::MonotonicMs();
+
+	for (int i = 0; i < count; i++) {
+		CatCodec::EncodeFrequency(14000000 + (i % 350000) * 10, bytes);
+		sink += bytes[3];
+	}
+
+	print_codec("encode_frequency", count, Clock::MonotonicMs() - started, json);
+
+	started = Clock::MonotonicMs();
+
+	for (int i = 0; i < count; i++) {
+		bytes[3] = CatCodec::BCD_ENCODE[i % 100];
+		sink += CatCodec::DecodeFrequency(bytes);
+	}
+
+	print_codec("decode_frequency", count, Clock::MonotonicMs() - started, json);
+
+	started = Clock::MonotonicMs();
+
+	for (int i = 0; i < count; i++) {
+		sink += *CatCodec::ModeName(CatCodec::MODES[i % CatCodec::MODE_COUNT].code);
+	}
+
+	print_codec("mode_name", count, Clock::MonotonicMs() - started, json);
+
+	started = Clock::MonotonicMs();
+
+	for (int i = 0; i < count; i++) {
+		sink += CatCodec::ModeCode(CatCodec::MODES[i % CatCodec::MODE_COUNT].name);
+	}
+
+	print_codec("mode_code", count, Clock::MonotonicMs() - started, json);
+
+	// status readers, typed snapshot vs the string map view, all groups filled
+	FT8xxSim * sim = new FT8xxSim();
+	Cat * cat = new Cat();
+	TcvrStatus status;
+
+	if (sim->Open() && sim->Start() && cat->Connect(sim->GetDevice())) {
+		cat->GetFrequencyModeStatus();
+		cat->GetRxStatus();
+		cat->GetTxStatus();
+	}
+
+	started = Clock::MonotonicMs();
+
+	for (int i = 0; i < count; i++) {
+		cat->GetStatus(status);
+		sink += status.rx_signal;
+	}
+
+	print_codec("status_snapshot", count, Clock::MonotonicMs() - started, json);
+
+	started = Clock::MonotonicMs();
+
+	for (int i = 0; i < legacy_count; i++) {
+		sink += cat->GetTcvrStatus().size();
+	}
+
+	print_codec("status_map", legacy_count, Clock::MonotonicMs() - started, json);
+
+	delete cat;
+	delete sim;
+
+	// what Cat did before, fewer rounds as it is much slower
+	started = Clock::MonotonicMs();
+
+	for (int i = 0; i < legacy_count; i++) {
+		legacy_encode(14.0 + (i % 350000) * 0.00001, bytes);
+		sink += bytes[3];
+	}
+
+	print_codec("legacy_encode_frequency", legacy_count, Clock::MonotonicMs() - started, json);
+
+	started = Clock::MonotonicMs();
+
+	for (int i = 0; i < legacy_count; i++) {
+		bytes[3] = CatCodec::BCD_ENCODE[i % 100];
+		sink += (uint32_t)legacy_decode(bytes);
+	}
+
+	print_codec("legacy_decode_frequency", legacy_count, Clock::MonotonicMs() - started, json);
+
+	// check old code against the tables over the 2m band
+	int encode_wrong = 0, decode_wrong = 0;
+
+	for (uint32_t hz = 144000000; hz < 146000000; hz += 50) {
+		char legacy[5], exact[5];
+		legacy_encode(hz / 1000000.0, legacy);
+		CatCodec::EncodeFrequency(hz, exact);
+
+		encode_wrong += memcmp(legacy, exact, 4) != 0;
+		decode_wrong += llround(legacy_decode(exact) * 1000000) != hz;
+	}
+
+	cerr << "old code, 2m band in 50 Hz steps: " << encode_wrong << " of 40000 encoded wrong, " << decode_wrong << " decoded wrong" << endl;
+}
+
+/**
+ * Print one codec result
+ * @param string name
+ * @param int iterations
+ * @param double elapsed Milliseconds
+ * @param bool json
+ * @return void
+ */
+void print_codec(const string & name, int iterations, double elapsed, bool json)
+{
+	double per_op = elapsed * 1000000.0 / iterations;
+
+	if (json) {
+		cout << fixed << setprecision(3) << "{\"codec\":\"" << name << "\",\"ops\":" << iterations << ",\"ns_per_op\":" << per_op << "}" << endl;
+	} else {
+		cout << fixed << setprecision(2) << left << setw(30) << name << right << setw(12) << iterations << setw(12) << per_op << endl;
+	}
+}
+
+/**
+ * Audio codecs and resampler: bit-exactness of every SIMD path this CPU
+ * runs, then throughput of each on one core
+ * @param int iterations Seconds of 48 kHz audio per run
+ * @param bool json
+ * @return bool False if any path differs from scalar
+ */
+bool run_audio(int iterations, bool json)
+{
+	vector<AudioCodec::Simd> levels;
+	AudioCodec::Simd best = AudioCodec::BestSimd();
+
+	levels.push_back(AudioCodec::SIMD_SCALAR);
+
+	if (best == AudioCodec::SIMD_AVX2) {
+		levels.push_back(AudioCodec::SIMD_SSE2);
+	}
+
+	if (best != AudioCodec::SIMD_SCALAR) {
+		levels.push_back(best);
+	}
+
+	if (!check_audio(levels)) {
+		AudioCodec::SetSimd(best);
+		return false;
+	}
+
+	// speech-like test signal: two tones and some noise
+	const int count = iterations * 48000;
+	int16_t * pcm = new int16_t[count];
+	int16_t * out = new int16_t[count];
+	uint8_t * data = new uint8_t[count * 2];
+	volatile uint32_t sink = 0;
+
+	srand(1);
+
+	for (int i = 0; i < count; i++) {
+		pcm[i] = 6000 * sin(2 * M_PI * 440 * i / 48000) + 3000 * sin(2 * M_PI * 1870 * i / 48000) + rand() % 2001 - 1000;
+	}
+
+	if (!json) {
+		cout << left << setw(24) << "audio" << setw(8) << "simd" << right << setw(14) << "samples" << setw(14) << "Msamples/s" << setw(10) << "channels" << endl;
+	}
+
+	for (size_t l = 0; l < levels.size(); l++) {
+		AudioCodec::Simd level = levels[l];
+		AudioCodec::SetSimd(level);
+		double started;
+
+		started = Clock::MonotonicMs();
+		AudioCodec::EncodeUlaw(pcm, count, data);
+		print_audio("encode_ulaw", level, count, Clock::MonotonicMs() - started, json);
+		sink += data[count / 2];
+
+		started = Clock::MonotonicMs();
+		AudioCodec::EncodeAlaw(pcm, count, data);
+		print_audio("encode_alaw", level, count, Clock::MonotonicMs() - started, json);
+		sink += data[count / 2];
+
+		Resampler to8, to12;
+		to8.Setup(48000, 8000);
+		to12.Setup(48000, 12000);
+
+		// in 20 ms frames as the capture thread feeds it
+		started = Clock::MonotonicMs();
+
+		for (int i = 0; i + 960 <= count; i += 960) {
+			sink += to8.Process(pcm + i, 960, out);
+		}
+
+		print_audio("resample_48k_8k", level, count, Clock::MonotonicMs() - started, json);
+
+		started = Clock::MonotonicMs();
+
+		for (int i = 0; i + 960 <= count; i += 960) {
+			sink += to12.Process(pcm + i, 960, out);
+		}
+
+		print_audio("resample_48k_12k", level, count, Clock::MonotonicMs() - started, json);
+	}
+
+	// the rest has no SIMD path
+	AudioCodec::SetSimd(best);
+	AudioCodec::AdpcmState state = {0, 0};
+	double started = Clock::MonotonicMs();
+
+	for (int i = 0; i + 160 <= count; i += 160) {
+		AudioCodec::EncodeAdpcm(state, pcm + i, 160, data + i / 2 + i / 160 * AudioCodec::ADPCM_HEADER_SIZE);
+	}
+
+	print_audio("encode_adpcm", AudioCodec::SIMD_SCALAR, count, Clock::MonotonicMs() - started, json);
+
+	started = Clock::MonotonicMs();
+
+	for (int i = 0; i + 160 <= count; i += 160) {
+		AudioCodec::DecodeAdpcm(data + i / 2 + i / 160 * AudioCodec::ADPCM_HEADER_SIZE, 160, out + i);
+	}
+
+	print_audio("decode_adpcm", AudioCodec::SIMD_SCALAR, count, Clock::MonotonicMs() - started, json);
+
+	// quality of the round trip, for the record
+	double signal = 0, noise = 0;
+
+	for (int i = 0; i + 160 <= count; i++) {
+		signal += (double)pcm[i] * pcm[i];
+		noise += (double)(pcm[i] - out[i]) * (pcm[i] - out[i]);
+	}
+
+	AudioCodec::EncodeUlaw(pcm, count, data);
+	started = Clock::MonotonicMs();
+	AudioCodec::DecodeUlaw(data, count, out);
+	print_audio("decode_ulaw", AudioCodec::SIMD_SCALAR, count, Clock::MonotonicMs() - started, json);
+
+	cerr << fixed << setprecision(1) << "adpcm round trip SNR: " << 10 * log10(signal / noise) << " dB" << endl;
+
+	delete[] pcm;
+	delete[] out;
+	delete[] data;
+
+	return true;
+}
+
+/**
+ * Compare every level with scalar: all 65536 samples through G.711, noise
+ * through the resamplers in odd block sizes so the history is exercised
+ * @param vector levels
+ * @return bool
+ */
+bool check_audio(const vector<AudioCodec::Simd> & levels)
+{
+	const int count = 65536;
+	int16_t pcm[count];
+	uint8_t reference[2][count], data[count];
+	bool ok = true;
+
+	for (int i = 0; i < count; i++) {
+		pcm[i] = i - 32768;
+	}
+
+	// G.711 reference points
+	struct {
+		int16_t sample;
+		uint8_t ulaw;
+		uint8_t alaw;
+	} points[] = {{0, 0xFF, 0xD5}, {-1, 0x7F, 0x55}, {32767, 0x80, 0xAA}, {-32768, 0x00, 0x2A}, {1000, 0xCE, 0xFA}, {-1000, 0x4E, 0x7A}};
+
+	AudioCodec::SetSimd(AudioCodec::SIMD_SCALAR);
+
+	for (size_t i = 0; i < sizeof(points) / sizeof(points[0]); i++) {
+		uint8_t u, a;
+		AudioCodec::EncodeUlaw(&points[i].sample, 1, &u);
+		AudioCodec::EncodeAlaw(&points[i].sample, 1, &a);
+
+		if (u != points[i].ulaw || a != points[i].alaw) {
+			cerr << "G.711 of " << points[i].sample << ": ulaw " << (int)u << " alaw " << (int)a << ", expected " << (int)points[i].ulaw << " and " << (int)points[i].alaw << endl;
+			ok = false;
+		}
+	}
+
+	AudioCodec::EncodeUlaw(pcm, count, reference[0]);
+	AudioCodec::EncodeAlaw(pcm, count, reference[1]);
+
+	// noise, resampled in one go by the scalar path
+	const int noise_count = 48000;
+	vector<int16_t> noise(noise_count), expected[2], out(noise_count);
+	const int rates[2] = {8000, 12000};
+
+	srand(2);
+
+	for (int i = 0; i < noise_count; i++) {
+		noise[i] = rand() % 65536 - 32768;
+	}
+
+	for (int r = 0; r < 2; r++) {
+		Resampler resampler;
+		resampler.Setup(48000, rates[r]);
+		expected[r].resize(noise_count);
+		expected[r].resize(resampler.Process(&noise[0], noise_count, &expected[r][0]));
+	}
+
+	for (size_t l = 0; l < levels.size(); l++) {
+		const char * name = AudioCodec::SimdName(levels[l]);
+		AudioCodec::SetSimd(levels[l]);
+
+		// odd start and length run the scalar tail too
+		for (int offset = 0; offset < 3; offset++) {
+			AudioCodec::EncodeUlaw(pcm + offset, count - offset * 5, data);
+
+			if (memcmp(data, reference[0] + offset, count - offset * 5) != 0) {
+				cerr << name << " ulaw differs from scalar" << endl;
+				ok = false;
+			}
+
+			AudioCodec::EncodeAlaw(pcm + offset, count - offset * 5, data);
+
+			if (memcmp(data, reference[1] + offset, count - offset * 5) != 0) {
+				cerr << name << " alaw differs from scalar" << endl;
+				ok = false;
+			}
+		}
+
+		for (int r = 0; r < 2; r++) {
+			Resampler resampler;
+			resampler.Setup(48000, rates[r]);
+			int produced = 0;
+
+			for (int i = 0, block = 1; i < noise_count; i += block, block = block * 7 % 2011 + 1) {
+				produced += resampler.Process(&noise[i], min(block, noise_count - i), &out[produced]);
+			}
+
+			if (produced != (int)expected[r].size() || memcmp(&out[0], &expected[r][0], produced * sizeof(int16_t)) != 0) {
+				cerr << name << " resampler to " << rates[r] << " Hz differs from scalar" << endl;
+				ok = false;
+			}
+		}
+	}
+
+	// ADPCM has no SIMD path, check it decodes what it encoded
+	int16_t tone[160], decoded[160];
+	uint8_t block[AudioCodec::ADPCM_HEADER_SIZE + 80];
+	AudioCodec::AdpcmState state = {0, 0};
+
+	for (int frame = 0; frame < 10; frame++) {
+		for (int i = 0; i < 160; i++) {
+			tone[i] = 10000 * sin(2 * M_PI * 1000 * (frame * 160 + i) / 8000);
+		}
+
+		int16_t predictor = state.predictor;
+		AudioCodec::EncodeAdpcm(state, tone, 160, block);
+		AudioCodec::DecodeAdpcm(block, 160, decoded);
+
+		// the block carries the state it started from, the decoder ends where the encoder did
+		if ((int16_t)(block[0] | block[1] << 8) != predictor || decoded[159] != state.predictor) {
+			cerr << "adpcm decoder out of step with the encoder" << endl;
+			ok = false;
+		}
+	}
+
+	// the low pass does its job: 1 kHz passes, 5 kHz would alias to 3 kHz
+	int16_t in[4800], low[800];
+
+	for (int i = 0; i < 4800; i++) {
+		in[i] = 16000 * sin(2 * M_PI * 1000 * i / 48000);
+	}
+
+	Resampler check;
+	check.Setup(48000, 8000);
+	int n = check.Process(in, 4800, low);
+	double pass = tone_level(low + 100, n - 100, 1000, 8000);
+
+	for (int i = 0; i < 4800; i++) {
+		in[i] = 16000 * sin(2 * M_PI * 5000 * i / 48000);
+	}
+
+	check.Reset();
+	n = check.Process(in, 4800, low);
+	double stop = tone_level(low + 100, n - 100, 3000, 8000);
+
+	cerr << fixed << setprecision(1) << "48k -> 8k: 1 kHz at " << 20 * log10(pass / 16000) << " dB, 5 kHz alias at " << 20 * log10(stop / 16000 + 1e-9) << " dB" << endl;
+
+	if (pass < 16000 * 0.9 || stop > 16000 * 0.01) {
+		cerr << "resampler response out of bounds" << endl;
+		ok = false;
+	}
+
+	cerr << (ok ? "audio paths bit-exact with scalar: " : "audio paths FAILED, checked: ");
+
+	for (size_t l = 0; l < levels.size(); l++) {
+		cerr << AudioCodec::SimdName(levels[l]) << (l + 1 < levels.size() ? " " : "\n");
+	}
+
+	return ok;
+}
+
+/**
+ * Print one audio throughput result. Channels is how many 8 kHz streams
+ * (or 48 kHz for the resamplers) one core keeps up with.
+ * @param string name
+ * @param Simd level
+ * @param long samples
+ * @param double elapsed Milliseconds
+ * @param bool json
+ * @return void
+ */
+void print_audio(const string & name, AudioCodec::Simd level, long samples, double elapsed, bool json)
+{
+	double rate = samples / elapsed / 1000.0;
+	double channels = rate * 1000000 / (name.compare(0, 8, "resample") == 0 ? 48000 : 8000);
+
+	if (json) {
+		cout << fixed << setprecision(3) << "{\"audio\":\"" << name << "\",\"simd\":\"" << AudioCodec::SimdName(level) << "\",\"samples\":" << samples << ",\"msamples_per_s\":" << rate << ",\"channels\":" << (long)channels << "}" << endl;
+	} else {
+		cout << fixed << setprecision(2) << left << setw(24) << name << setw(8) << AudioCodec::SimdName(level) << right << setw(14) << samples << setw(14) << rate << setw(10) << (long)channels << endl;
+	}
+}
+
+/**
+ * Amplitude of one frequency, correlation with sine and cosine
+ * @param int16_t* samples
+ * @param int count
+ * @param double frequency
+ * @param int rate
+ * @return double
+ */
+double tone_level(const int16_t * samples, int count, double frequency, int rate)
+{
+	double re = 0, im = 0;
+
+	for (int i = 0; i < count; i++) {
+		re += samples[i] * cos(2 * M_PI * frequency * i / rate);
+		im += samples[i] * sin(2 * M_PI * frequency * i / rate);
+	}
+
+	return 2 * sqrt(re * re + im * im) / count;
+}
+
+/**
+ * Frequency encoder Cat used before the BCD tables, kept for comparison
+ * @param double frequency MHz
+ * @param char* bytes
+ * @return void
+ */
+void legacy_encode(double frequency, char * bytes)
+{
+	double intpart;
+
+	double f = modf(frequency * 1000, &intpart) * 100;
+	bytes[3] = stoi(to_string(f), nullptr, 16);
+
+	f = modf(intpart / 100, &intpart) * 100;
+	bytes[2] = stoi(to_string(f), nullptr, 16);
+
+	f = modf(intpart / 100, &intpart) * 100;
+	bytes[1] = stoi(to_string(f), nullptr, 16);
+
+	f = modf(intpart / 100, &intpart) * 100;
+	bytes[0] = stoi(to_string(f), nullptr, 16);
+}
+
+/**
+ * Frequency decoder Cat used before the BCD tables, kept for comparison
+ * @param char* bytes
+ * @return double MHz
+ */
+double legacy_decode(char * bytes)
+{
+	stringstream strs;
+	strs << setfill('0') << setw(2) << std::hex << (int)bytes[0] << setw(2) << std::hex << (int)bytes[1] << setw(2) << std::hex << (int)bytes[2] << setw(2) << std::hex << (int)bytes[3];
+
+	double f;
+	strs >> f;
+	return f / 100000;
+}
@@ -1,60 +1,376 @@
-#include <stdio.h>
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ *
+ * How to compile: g++ -O3 -std=c++0x -o yaesu_client yaesu_client.cpp protocol.cpp cat.cpp cat_stats.cpp link_health.cpp device_watch.cpp tcvr_status.cpp serial_transport.cpp
+ */
+#include "cat.h"
+#include "protocol.h"
 #include <stdlib.h>
-#include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/select.h>
 #include <netinet/in.h>
-#include <netdb.h> 
+#include <netdb.h>
 
+using namespace std;
+
+void error(const char *msg);
+void show_help(char *s);
+bool write_all(int fd, const string & data);
+bool line_to_frame(const string & line, uint16_t request_id, string & frame);
+void print_frame(const Protocol::Frame & frame, uint64_t & last_seq, int64_t last[Protocol::FIELD_COUNT]);
+
+int main(int argc, char **argv)
+{
+	int option_char;
+	bool text = false;
+
+	while ((option_char = getopt(argc, argv, "th")) != -1) {
+		switch(option_char) {
+			// talk plain text protocol
+			case 't':
+				text = true;
+				break;
+
+			case 'h':
+				show_help(argv[0]);
+				return 0;
+
+			default:
+				show_help(argv[0]);
+				return -1;
+		}
+	}
+
+	if (argc - optind < 2) {
+		show_help(argv[0]);
+		return -1;
+	}
+
+	struct hostent *server = gethostbyname(argv[optind]);
+
+	if (server == NULL) {
+		cout << argv[0] << ": No such host: " << argv[optind] << endl;
+		return -1;
+	}
+
+	struct sockaddr_in serv_addr;
+	memset(&serv_addr, 0, sizeof(serv_addr));
+	serv_addr.sin_family = AF_INET;
+	memcpy(&serv_addr.sin_addr.s_addr, server->h_addr, server->h_length);
+	serv_addr.sin_port = htons(atoi(argv[optind + 1]));
+
+	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (sockfd < 0) {
+		error("ERROR opening socket");
+	}
+
+	if (connect(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+		error("ERROR connecting");
+	}
+
+	string input, received;
+	uint16_t request_id = 0;
+	uint64_t last_seq = 0;
+	int64_t last[Protocol::FIELD_COUNT] = {0};
+	bool stdin_open = true;
+
+	while (true) {
+		fd_set read_fds;
+		FD_ZERO(&read_fds);
+		FD_SET(sockfd, &read_fds);
+
+		if (stdin_open) {
+			FD_SET(0, &read_fds);
+		}
+
+		if (select(sockfd + 1, &read_fds, NULL, NULL, NULL) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			error("ERROR on select");
+		}
+
+		char buffer[4096];
+
+		// forward commands typed by user to the server
+		if (FD_ISSET(0, &read_fds)) {
+			ssize_t n = read(0, buffer, sizeof(buffer));
+
+			if (n <= 0) {
+				// keep listening for replies and pushes
+				stdin_open = false;
+				shutdown(sockfd, SHUT_WR);
+			} else if (text) {
+				if (!write_all(sockfd, string(buffer, n))) {
+					error("ERROR writing to socket");
+				}
+			} else {
+				input.append(buffer, n);
+				size_t end;
+
+				while ((end = input.find('\n')) != string::npos) {
+					string line = input.substr(0, end), frame;
+					input.erase(0, end + 1);
+
+					if (line.empty()) {
+						continue;
+					}
+
+					if (!line_to_frame(line, ++request_id, frame)) {
+						cout << "Unknown command: " << line << endl;
+						continue;
+					}
+
+					if (!write_all(sockfd, frame)) {
+						error("ERROR writing to socket");
+					}
+				}
+			}
+		}
+
+		// print whatever the server sends back
+		if (FD_ISSET(sockfd, &read_fds)) {
+			ssize_t n = read(sockfd, buffer, sizeof(buffer));
+
+			if (n < 0) {
+				error("ERROR reading from socket");
+			}
+
+			if (n == 0) {
+				break;
+			}
+
+			if (text) {
+				cout.write(buffer, n);
+				cout.flush();
+				continue;
+			}
+
+			received.append(buffer, n);
+
+			while (true) {
+				Protocol::Frame frame;
+				int consumed = Protocol::Decode(received.data(), received.length(), frame);
+
+				if (consumed < 0) {
+					cout << "Protocol error, closing." << endl;
+					close(sockfd);
+					return -1;
+				}
+
+				if (consumed == 0) {
+					break;
+				}
+
+				received.erase(0, consumed);
+				print_frame(frame, last_seq, last);
+			}
+		}
+	}
+
+	close(sockfd);
+
+	return 0;
+}
+
+/**
+ * Print error and quit
+ * @param char* msg
+ * @return void
+ */
 void error(const char *msg)
 {
-    perror(msg);
-    exit(0);
+	perror(msg);
+	exit(0);
 }
 
-int main(int argc, char *argv[])
+/**
+ * Show help message
+ * @param char* s This executable
+ * @return void
+ */
+void show_help(char *s)
 {
-    int sockfd, portno, n;
-    struct sockaddr_in serv_addr;
-    struct hostent *server;
-
-    char buffer[256];
-    if (argc < 3) {
-       fprintf(stderr,"usage %s hostname port\n", argv[0]);
-       exit(0);
-    }
-    portno = atoi(argv[2]);
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) 
-        error("ERROR opening socket");
-    server = gethostbyname(argv[1]);
-    if (server == NULL) {
-        fprintf(stderr,"ERROR, no such host\n");
-        exit(0);
-    }
-    bzero((char *) &serv_addr, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    bcopy((char *)server->h_addr, 
-         (char *)&serv_addr.sin_addr.s_addr,
-         server->h_length);
-    serv_addr.sin_port = htons(portno);
-    if (connect(sockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr)) < 0) 
-        error("ERROR connecting");
-    printf("Please enter the message: ");
-    bzero(buffer,256);
-//    fgets(buffer,255,stdin);
-//    n = write(sockfd,buffer,strlen(buffer));
-    if (n < 0) 
-         error("ERROR writing to socket");
-while (true) {
-    bzero(buffer,256);
-    n = read(sockfd,buffer,255);
-    if (n < 0) 
-         error("ERROR reading from socket");
-    printf("%s\n",buffer);
-sleep(1);
+	cout << "Raspberry Pi and Yeasu FT8xx fusion - TCP client" << endl << endl;
+
+	cout << "Usage: " << endl;
+	cout << " " << s << " [-t] <hostname> <port>" << endl << endl;
+
+	cout << "Options:" << endl;
+	cout << " -t talk text protocol (default is binary)" << endl << endl;
+
+	cout << "Commands are read from stdin, one per line, same as the server's text mode:" << endl;
+	cout << " s | r | t | f <MHz> | m <mode> | p <on/off> | l <on/off>" << endl;
+	cout << " subscribe <field,field,...|all> | unsubscribe | hysteresis <field> <threshold>" << endl;
 }
-    close(sockfd);
-    return 0;
+
+/**
+ * Write whole buffer to socket
+ * @param int fd
+ * @param string data
+ * @return bool
+ */
+bool write_all(int fd, const string & data)
+{
+	size_t written = 0;
+
+	while (written < data.length()) {
+		ssize_t n = write(fd, data.data() + written, data.length() - written);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (n <= 0) {
+			return false;
+		}
+
+		written += n;
+	}
+
+	return true;
+}
+
+/**
+ * Translate text command into binary request
+ * @param string line
+ * @param uint16_t request_id
+ * @param string frame
+ * @return bool False for unknown command
+ */
+bool line_to_frame(const string & line, uint16_t request_id, string & frame)
+{
+	istringstream tokens(line);
+	string command, argument, value, payload;
+	tokens >> command >> argument >> value;
+
+	uint8_t type;
+
+	if (command == "s" || command == "r" || command == "t") {
+		type = Protocol::FRAME_GET_STATUS;
+		payload += command == "s" ? Cat::CMD_GET_FREQUENCY_MODE : command == "r" ? Cat::CMD_GET_RX_STATUS : Cat::CMD_GET_TX_STATUS;
+	} else if (command == "f") {
+		type = Protocol::FRAME_SET_FREQUENCY;
+		Protocol::PutUint32(payload, (uint32_t)llround(atof(argument.c_str()) * 1000000));
+	} else if (command == "m") {
+		int64_t mode = Protocol::FieldValue(Protocol::FIELD_MODE, argument);
+
+		if (mode < 0) {
+			return false;
+		}
+
+		type = Protocol::FRAME_SET_MODE;
+		payload += (char)mode;
+	} else if ((command == "p" || command == "l") && (argument == "on" || argument == "off")) {
+		type = command == "p" ? Protocol::FRAME_PTT : Protocol::FRAME_LOCK;
+		payload += (char)(argument == "on");
+	} else if (command == "subscribe") {
+		uint16_t mask = 0;
+		stringstream items(argument);
+		string field;
+
+		while (getline(items, field, ',')) {
+			int id = Protocol::FieldId(field);
+
+			if (field == "all") {
+				mask = (1 << Protocol::FIELD_COUNT) - 1;
+			} else if (id >= 0) {
+				mask |= 1 << id;
+			} else {
+				return false;
+			}
+		}
+
+		type = Protocol::FRAME_SUBSCRIBE;
+		Protocol::PutUint16(payload, mask);
+	} else if (command == "unsubscribe") {
+		type = Protocol::FRAME_UNSUBSCRIBE;
+	} else if (command == "tune" && !argument.empty()) {
+		bool relative = argument[0] == '+' || argument[0] == '-';
+		double number = atof(argument.c_str());
+
+		type = Protocol::FRAME_TUNE;
+		payload += (char)relative;
+		Protocol::PutUint32(payload, relative ? (uint32_t)(int32_t)llround(number) : (uint32_t)llround(number * 1000000));
+	} else if (command == "hysteresis" && Protocol::FieldId(argument) >= 0) {
+		int field = Protocol::FieldId(argument);
+
+		// same units as the text protocol, sent as wire values
+		type = Protocol::FRAME_HYSTERESIS;
+		payload += (char)field;
+		Protocol::PutUint32(payload, (uint32_t)Protocol::FieldValue(field, value));
+	} else {
+		return false;
+	}
+
+	frame = Protocol::Encode(type, request_id, payload);
+
+	return true;
+}
+
+/**
+ * Print binary reply the way text mode would show it
+ * @param Frame frame
+ * @param uint64_t last_seq Sequence of last pushed update
+ * @param int64_t[] last Values of last pushed update
+ * @return void
+ */
+void print_frame(const Protocol::Frame & frame, uint64_t & last_seq, int64_t last[Protocol::FIELD_COUNT])
+{
+	map<string, string> fields;
+	uint64_t seq;
+
+	switch (frame.type) {
+		case Protocol::FRAME_ACK:
+			cout << "OK [" << frame.request_id << "]" << endl;
+			break;
+
+		case Protocol::FRAME_ERROR:
+			cout << "E: error " << (frame.payload.empty() ? 0 : (int)frame.payload[0]) << " [" << frame.request_id << "]" << endl;
+			break;
+
+		case Protocol::FRAME_STATUS:
+			if (Protocol::DecodeStatus(frame.payload, fields)) {
+				for (auto it = fields.begin(); it != fields.end(); ++it) {
+					cout << it->first << ":" << it->second << endl;
+				}
+			}
+
+			cout << "OK [" << frame.request_id << "]" << endl;
+			break;
+
+		case Protocol::FRAME_DELTA:
+			if (!Protocol::DecodeDelta(frame.payload, seq, fields, last)) {
+				cout << "E: malformed update" << endl;
+				break;
+			}
+
+			if (last_seq && seq != last_seq + 1) {
+				cout << "# missed " << (seq - last_seq - 1) << " update(s)" << endl;
+			}
+
+			last_seq = seq;
+			cout << "#" << seq;
+
+			for (auto it = fields.begin(); it != fields.end(); ++it) {
+				cout << " " << it->first << ":" << it->second;
+			}
+
+			cout << endl;
+			break;
+	}
 }
@@ -0,0 +1,245 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ *
+ * How to compile: g++ -O3 -std=c++0x -o yaesu_history yaesu_history.cpp history_log.cpp ndjson_writer.cpp tcvr_status.cpp
+ */
+#include "history_log.h"
+#include "cat_codec.h"
+#include "clock.h"
+#include "ndjson_writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+
+using namespace std;
+
+void show_help(char *s);
+int64_t parse_time(const char * text, int64_t now);
+void print_csv(const HistoryRecord & record);
+void print_json(NdjsonWriter & writer, const HistoryRecord & record);
+
+int main(int argc, char **argv)
+{
+	int option_char;
+	string path;
+	int64_t now = Clock::WallClockMs();
+	int64_t from = 0, to = INT64_MAX;
+	bool json = false, info = false;
+
+	while ((option_char = getopt(argc, argv, ":f:s:e:jih")) != -1) {
+		switch(option_char) {
+			// history file
+			case 'f':
+				path = optarg;
+				break;
+
+			// range start
+			case 's':
+				from = parse_time(optarg, now);
+				break;
+
+			// range end
+			case 'e':
+				to = parse_time(optarg, now);
+				break;
+
+			// output NDJSON instead of CSV
+			case 'j':
+				json = true;
+				break;
+
+			// print file summary
+			case 'i':
+				info = true;
+				break;
+
+			case 'h':
+				show_help(argv[0]);
+				return 0;
+
+			case ':':
+				cout << argv[0] << ": Missing required parameter!" << endl << endl;
+				show_help(argv[0]);
+				return -1;
+
+			case '?':
+				cout << argv[0] << ": Unknown parameter!" << endl << endl;
+				show_help(argv[0]);
+				return -1;
+		}
+	}
+
+	if (path.empty()) {
+		cout << argv[0] << ": Please specify history file!" << endl << endl;
+		show_help(argv[0]);
+		return -1;
+	}
+
+	HistoryLog history;
+
+	if (!history.OpenReadOnly(path)) {
+		return -1;
+	}
+
+	uint64_t first = history.GetFirstSequence(), next = history.GetNextSequence();
+	HistoryRecord record;
+
+	if (info) {
+		cout << "capacity:" << history.GetCapacity() << endl;
+		cout << "records:" << next - first << endl;
+		cout << "first_sequence:" << first << endl;
+		cout << "next_sequence:" << next << endl;
+		cout << "created:" << history.GetCreatedMs() / 1000 << endl;
+
+		if (history.Read(first, record)) {
+			cout << "oldest:" << record.time_ms / 1000 << endl;
+		}
+
+		if (history.Read(next - 1, record)) {
+			cout << "newest:" << record.time_ms / 1000 << endl;
+		}
+
+		return 1;
+	}
+
+	NdjsonWriter writer;
+
+	if (json) {
+		writer.SetOutput(1, 1000);
+	} else {
+		cout << "time,frequency,mode,rx_signal,rx_squelched,tx_power,swr_high,ptt_on" << endl;
+	}
+
+	// records are in time order, seek to the start and stream to the end
+	for (uint64_t sequence = history.Find(from); sequence < next; sequence++) {
+		if (!history.Read(sequence, record)) {
+			continue;
+		}
+
+		if (record.time_ms > to) {
+			break;
+		}
+
+		if (json) {
+			print_json(writer, record);
+		} else {
+			print_csv(record);
+		}
+	}
+
+	writer.Flush();
+
+	return 1;
+}
+
+/**
+ * Epoch seconds, or seconds relative to now when zero or negative
+ * @param char* text
+ * @param int64_t now Milliseconds since epoch
+ * @return int64_t Milliseconds since epoch
+ */
+int64_t parse_time(const char * text, int64_t now)
+{
+	double seconds = atof(text);
+
+	return seconds <= 0 ? now + (int64_t)(seconds * 1000) : (int64_t)(seconds * 1000);
+}
+
+/**
+ * One CSV line, fields of groups not read for this record left empty
+ * @param HistoryRecord record
+ * @return void
+ */
+void print_csv(const HistoryRecord & record)
+{
+	char line[128];
+	int length = snprintf(line, sizeof(line), "%lld.%03d,", (long long)(record.time_ms / 1000), (int)(record.time_ms % 1000));
+
+	if (record.Has(TcvrStatus::GROUP_FREQUENCY_MODE)) {
+		length += snprintf(line + length, sizeof(line) - length, "%u.%06u,%s,", record.frequency_hz / 1000000, record.frequency_hz % 1000000, CatCodec::ModeName(record.mode));
+	} else {
+		length += snprintf(line + length, sizeof(line) - length, ",,");
+	}
+
+	if (record.Has(TcvrStatus::GROUP_RX)) {
+		length += snprintf(line + length, sizeof(line) - length, "%d,%d,", record.rx_signal, record.Is(HistoryRecord::FLAG_RX_SQUELCHED));
+	} else {
+		length += snprintf(line + length, sizeof(line) - length, ",,");
+	}
+
+	if (record.Has(TcvrStatus::GROUP_TX)) {
+		snprintf(line + length, sizeof(line) - length, "%d,%d,%d", record.tx_power, record.Is(HistoryRecord::FLAG_SWR_HIGH), record.Is(HistoryRecord::FLAG_PTT_ON));
+	} else {
+		snprintf(line + length, sizeof(line) - length, ",,");
+	}
+
+	cout << line << '\n';
+}
+
+/**
+ * One NDJSON record, same field names as yaesu -M
+ * @param NdjsonWriter writer
+ * @param HistoryRecord record
+ * @return void
+ */
+void print_json(NdjsonWriter & writer, const HistoryRecord & record)
+{
+	writer.Begin();
+	writer.Integer("seq", record.sequence);
+	writer.Fixed("ts", record.time_ms, 3);
+
+	if (record.Has(TcvrStatus::GROUP_FREQUENCY_MODE)) {
+		writer.Integer("tcvr_frequency_hz", record.frequency_hz);
+		writer.Fixed("tcvr_frequency", record.frequency_hz, 6);
+		writer.String("tcvr_mode", CatCodec::ModeName(record.mode));
+	}
+
+	if (record.Has(TcvrStatus::GROUP_RX)) {
+		writer.Integer("rx_signal", record.rx_signal);
+		writer.Bool("centered", record.Is(HistoryRecord::FLAG_CENTERED));
+		writer.Bool("ctcss_dcs", record.Is(HistoryRecord::FLAG_CTCSS_DCS));
+		writer.Bool("rx_squelched", record.Is(HistoryRecord::FLAG_RX_SQUELCHED));
+	}
+
+	if (record.Has(TcvrStatus::GROUP_TX)) {
+		writer.Integer("tx_power", record.tx_power);
+		writer.Bool("split", record.Is(HistoryRecord::FLAG_SPLIT));
+		writer.Bool("swr_high", record.Is(HistoryRecord::FLAG_SWR_HIGH));
+		writer.Bool("ptt_on", record.Is(HistoryRecord::FLAG_PTT_ON));
+	}
+
+	writer.End();
+}
+
+/**
+ * Show help message
+ * @param char* s This executable
+ * @return void
+ */
+void show_help(char *s)
+{
+	cout << "Raspberry Pi and Yeasu FT8xx fusion - status history reader" << endl << endl;
+
+	cout << "Usage: " << endl;
+	cout << " " << s << " -f <history file> [-s <from>] [-e <to>] [-j]" << endl;
+	cout << " " << s << " -f <history file> -i" << endl << endl;
+
+	cout << "Options:" << endl;
+	cout << " -f history file written by yaesu_server -H" << endl;
+	cout << " -s range start, epoch seconds or seconds before now when 0 or negative (default oldest record)" << endl;
+	cout << " -e range end, same format (default newest record)" << endl;
+	cout << " -j output NDJSON instead of CSV" << endl;
+	cout << " -i print capacity, record count and time span" << endl << endl;
+
+	cout << "Example, last hour: " << s << " -f /var/lib/yaesu/history.bin -s -3600" << endl;
+}
@@ -1,80 +1,1813 @@
-/* A simple server in the internet domain using TCP
-   The port number is passed as an argument */
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ *
+ * How to compile: g++ -O3 -std=c++0x -pthread -o yaesu_server yaesu_server.cpp cat.cpp cat_stats.cpp link_health.cpp device_watch.cpp tcvr_status.cpp serial_transport.cpp cat_queue.cpp reactor.cpp status_cache.cpp poll_scheduler.cpp subscription.cpp protocol.cpp ndjson_writer.cpp history_log.cpp status_rollup.cpp audio_packet.cpp audio_codec.cpp audio_device.cpp audio_stream.cpp audio_fec.cpp jitter_buffer.cpp eeprom_image.cpp eeprom_sync.cpp tune_stream.cpp
+ */
+#include "audio_stream.h"
 #include "cat.h"
-#include <stdio.h>
+#include "cat_queue.h"
+#include "clock.h"
+#include "eeprom_sync.h"
+#include "history_log.h"
+#include "ndjson_writer.h"
+#include "poll_scheduler.h"
+#include "protocol.h"
+#include "reactor.h"
+#include "status_cache.h"
+#include "status_rollup.h"
+#include "subscription.h"
+#include "tune_stream.h"
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
-#include <sys/types.h> 
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fstream>
 
-void error(const char *msg)
-{
-    perror(msg);
-    exit(1);
-}
-
-int main(int argc, char *argv[])
-{
-     int sockfd, newsockfd, portno;
-     socklen_t clilen;
-     char buffer[256];
-     struct sockaddr_in serv_addr, cli_addr;
-     int n;
-     if (argc < 2) {
-         fprintf(stderr,"ERROR, no port provided\n");
-         exit(1);
-     }
-     sockfd = socket(AF_INET, SOCK_STREAM, 0);
-     if (sockfd < 0) 
-        error("ERROR opening socket");
-     bzero((char *) &serv_addr, sizeof(serv_addr));
-     portno = atoi(argv[1]);
-     serv_addr.sin_family = AF_INET;
-     serv_addr.sin_addr.s_addr = INADDR_ANY;
-     serv_addr.sin_port = htons(portno);
-     if (bind(sockfd, (struct sockaddr *) &serv_addr,
-              sizeof(serv_addr)) < 0) 
-              error("ERROR on binding");
-     listen(sockfd,5);
-     clilen = sizeof(cli_addr);
-     newsockfd = accept(sockfd, 
-                 (struct sockaddr *) &cli_addr, 
-                 &clilen);
-     if (newsockfd < 0) 
-          error("ERROR on accept");
-     bzero(buffer,256);
-
-	Cat * cat = new Cat(B9600, "/dev/ttyUSB0");
-
-	bool tcvr_responding = cat->GetFrequencyModeStatus();
-
-	if (!tcvr_responding) {
-		string error = "E: Transciever is offline\n";
-		n = write(newsockfd, error.c_str(), error.length());
+using namespace std;
+
+// longest command line a client may send
+static const size_t MAX_LINE_LENGTH = 1024;
+
+// drop clients that do not read their replies
+static const size_t MAX_OUTPUT_BUFFER = 1024 * 1024;
+
+// skip status pushes to clients this far behind
+static const size_t MAX_PUSH_BACKLOG = 64 * 1024;
+
+/**
+ * One transciever: serial port owned by its own pinned worker thread,
+ * with its own status cache, poller, tuning stream, history, rollups and
+ * EEPROM image
+ */
+struct Radio {
+	size_t index;
+	string name;
+	string device;
+	int baud;
+	int cpu;
+	string history_path;
+
+	Cat * cat;
+	CatQueue * queue;
+	StatusCache * cache;
+	PollScheduler * scheduler;
+	HistoryLog * history;
+	EepromSync * eeprom;
+	TuneStream * tuner;
+	StatusRollup rollup;
+	uint64_t stream_generation;
+};
+
+struct Client {
+	int fd;
+	int id;
+	size_t radio;
+	string input;
+	string output;
+	bool closing;
+	bool detected;
+	bool binary;
+	Subscription subscription;
+
+	// last values pushed in binary deltas
+	int64_t pushed[Protocol::FIELD_COUNT];
+
+	// NDJSON status stream, records held back until flush is due
+	bool streaming;
+	int stream_flush_ms;
+	string stream_pending;
+	double stream_last_flush;
+};
+
+class Server
+{
+	private:
+		Reactor reactor;
+		vector<Radio *> radios;
+		int listen_fd;
+		int next_client_id;
+		bool verbose;
+		string eeprom_dir;
+		map<int, Client> clients;
+		NdjsonWriter stream_writer;
+		AudioStream * audio;
+
+		void Accept();
+		void HandleClient(int fd, uint32_t events);
+		void ProcessLines(Client & client);
+		void ProcessFrames(Client & client);
+		void HandleFrame(Client & client, const Protocol::Frame & frame);
+		void Submit(Client & client, Radio & radio, CatCommand command, bool reply_status, uint16_t request_id = 0);
+		void Tune(Client & client, Radio & radio, int64_t hz, bool relative, uint16_t request_id = 0);
+		Client * FindClient(int fd, int id);
+		int FindRadio(const string & name);
+		void HandleLine(Client & client, const string & line);
+		void HandleCommand(Client & client, Radio & radio, const string & line);
+		void HandleEeprom(Client & client, Radio & radio, const string & action, const string & name);
+		bool LoadEeprom(const string & name, EepromImage & image, string & error);
+		bool SnapshotPath(const string & name, string & path, string & error);
+		void Send(Client & client, const string & message);
+		void Flush(Client & client);
+		void Disconnect(int fd);
+		void SendStatus(Client & client, Radio & radio, uint16_t request_id = 0);
+		void SendRadios(Client & client);
+		void SendOk(Client & client, uint16_t request_id = 0);
+		void SendError(Client & client, uint16_t request_id, int code, const string & message);
+		void UpdateDemand();
+		void Publish(Radio & radio, const TcvrStatus & status);
+		void Push(Client & client, const TcvrStatus & status);
+		void Stream(Radio & radio, const TcvrStatus & status);
+		void FlushStream(Client & client);
+
+	public:
+		Server(const vector<Radio *> & r, AudioStream * a, bool v);
+		~Server();
+
+		void SetEepromDir(const string & dir);
+		bool Listen(int port);
+		void Run();
+};
+
+void show_help(char *s);
+bool load_radios(const string & path, vector<Radio *> & radios);
+bool start_radio(Radio * radio, const string & cache_ttl, int link_share, int history_mb, int reconnect_hold, const string & eeprom_dir, bool verbose);
+void delete_radios(vector<Radio *> & radios);
+
+int main(int argc, char **argv)
+{
+	int option_char;
+	int port = -1, serial_speed = 9600, link_share = 50, history_mb = 16, reconnect_hold = 30;
+	int audio_port = -1, audio_rate = 8000, capture_rate = 0, fec_group = AudioStream::FEC_GROUP;
+	string serial_device, cache_ttl, history_path, radio_list, audio_capture, audio_playback, eeprom_dir;
+	bool verbose = false;
+
+	while ((option_char = getopt(argc, argv, ":d:b:P:C:U:H:L:R:W:A:i:I:o:r:F:E:vh")) != -1) {
+		switch(option_char) {
+			// set serial device
+			case 'd':
+				serial_device = optarg;
+				break;
+
+			// set serial speed
+			case 'b':
+				serial_speed = string(optarg) == "auto" ? 0 : stoi(optarg, nullptr);
+				break;
+
+			// keep commands while the serial device is gone
+			case 'W':
+				reconnect_hold = stoi(optarg, nullptr);
+				break;
+
+			// TCP port to listen on
+			case 'P':
+				port = stoi(optarg, nullptr);
+				break;
+
+			// status cache TTLs
+			case 'C':
+				cache_ttl = optarg;
+				break;
+
+			// share of serial link used for background polling
+			case 'U':
+				link_share = stoi(optarg, nullptr);
+
+				if (link_share <= 0 || link_share > 100) {
+					cout << argv[0] << ": Invalid link share: " << link_share << ". Allowed range: 1 - 100 %." << endl << endl;
+					return -1;
+				}
+
+				break;
+
+			// status history file
+			case 'H':
+				history_path = optarg;
+				break;
+
+			// history file size
+			case 'L':
+				history_mb = stoi(optarg, nullptr);
+
+				if (history_mb <= 0) {
+					cout << argv[0] << ": Invalid history size: " << history_mb << " MB" << endl << endl;
+					return -1;
+				}
+
+				break;
+
+			// list of radios
+			case 'R':
+				radio_list = optarg;
+				break;
+
+			// TCP and UDP port for audio clients
+			case 'A':
+				audio_port = stoi(optarg, nullptr);
+				break;
+
+			// receiver audio source
+			case 'i':
+				audio_capture = optarg;
+				break;
+
+			// sound card rate of the receiver audio, decimated to -r
+			case 'I':
+				capture_rate = stoi(optarg, nullptr);
+				break;
+
+			// transmitter audio sink
+			case 'o':
+				audio_playback = optarg;
+				break;
+
+			// audio sample rate
+			case 'r':
+				audio_rate = stoi(optarg, nullptr);
+				break;
+
+			// RX frames per parity packet to UDP clients
+			case 'F':
+				fec_group = stoi(optarg, nullptr);
+				break;
+
+			// EEPROM caches and snapshots
+			case 'E':
+				eeprom_dir = optarg;
+				break;
+
+			// verbose output
+			case 'v':
+				verbose = true;
+				break;
+
+			// show help
+			case 'h':
+				show_help(argv[0]);
+				return 0;
+
+			case ':':
+				cout << argv[0] << ": Missing required parameter!" << endl << endl;
+				show_help(argv[0]);
+				return -1;
+
+			case '?':
+				cout << argv[0] << ": Unknown parameter!" << endl << endl;
+				show_help(argv[0]);
+				return -1;
+		}
+	}
+
+	if (port <= 0 || port > 65535) {
+		cout << argv[0] << ": Please specify TCP port to listen on!" << endl << endl;
+		return -1;
+	}
+
+	if (audio_port > 65535 || (audio_port > 0 && audio_capture.empty() && audio_playback.empty())) {
+		cout << argv[0] << ": Audio port needs a valid port and -i and/or -o!" << endl << endl;
+		return -1;
+	}
+
+	vector<Radio *> radios;
+
+	if (!radio_list.empty()) {
+		if (!load_radios(radio_list, radios)) {
+			delete_radios(radios);
+			return -1;
+		}
 	} else {
+		// single radio from the command line
+		Radio * radio = new Radio();
+		radio->name = "radio";
+		radio->device = serial_device.empty() ? "/dev/ttyUSB0" : serial_device;
+		radio->baud = serial_speed;
+		radio->cpu = -1;
+		radio->history_path = history_path;
+		radios.push_back(radio);
+	}
+
+	// clients that vanish must not kill the daemon
+	signal(SIGPIPE, SIG_IGN);
+
+	// spread CAT workers over the cores, core 0 is left to the event loop
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (size_t i = 0; i < radios.size(); i++) {
+		radios[i]->index = i;
+
+		if (radios[i]->cpu < 0 && cores > 1 && radios.size() > 1) {
+			radios[i]->cpu = 1 + i % (cores - 1);
+		}
+
+		if (!start_radio(radios[i], cache_ttl, link_share, history_mb, reconnect_hold, eeprom_dir, verbose)) {
+			delete_radios(radios);
+			return -1;
+		}
+	}
+
+	// audio goes with the first radio, its PTT is keyed for TX audio
+	AudioStream * audio = NULL;
+
+	if (audio_port > 0) {
+		audio = new AudioStream(radios[0]->queue);
+
+		if (!audio->Open(audio_capture, audio_playback, audio_rate, capture_rate) || !audio->Listen(audio_port)) {
+			delete audio;
+			delete_radios(radios);
+			return -1;
+		}
+
+		audio->SetFecGroup(fec_group);
+	}
+
+	Server * server = new Server(radios, audio, verbose);
+	server->SetEepromDir(eeprom_dir);
+
+	if (!server->Listen(port) || (audio && !audio->Start())) {
+		delete server;
+		delete audio;
+		delete_radios(radios);
+		return -1;
+	}
+
+	server->Run();
+
+	delete server;
+	delete audio;
+	delete_radios(radios);
+
+	return 0;
+}
+
+/**
+ * Read radio list, one radio per line: name device [baud] [cpu] [history file]
+ * Use - to skip an optional column, # starts a comment.
+ * @param string path
+ * @param vector radios
+ * @return bool
+ */
+bool load_radios(const string & path, vector<Radio *> & radios)
+{
+	ifstream file(path.c_str());
+	string line;
+	int line_number = 0;
+
+	if (!file.is_open()) {
+		cout << "Unable to open radio list " << path << endl;
+		return false;
+	}
+
+	while (getline(file, line)) {
+		line_number++;
+		line = line.substr(0, line.find('#'));
+
+		istringstream tokens(line);
+		string name, device, baud = "-", cpu = "-", history = "-";
+		tokens >> name >> device >> baud >> cpu >> history;
+
+		if (name.empty()) {
+			continue;
+		}
+
+		if (device.empty()) {
+			cout << path << ":" << line_number << ": Missing serial device" << endl;
+			return false;
+		}
+
+		for (auto it = radios.begin(); it != radios.end(); ++it) {
+			if ((*it)->name == name) {
+				cout << path << ":" << line_number << ": Duplicate radio name " << name << endl;
+				return false;
+			}
+		}
+
+		Radio * radio = new Radio();
+		radio->name = name;
+		radio->device = device;
+		radio->baud = baud == "-" ? 9600 : atoi(baud.c_str());
+		radio->cpu = cpu == "-" ? -1 : atoi(cpu.c_str());
+		radio->history_path = history == "-" ? "" : history;
+		radios.push_back(radio);
+	}
+
+	if (radios.empty()) {
+		cout << "No radios in " << path << endl;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Open serial port and start the radio's worker thread
+ * @param Radio* radio
+ * @param string cache_ttl
+ * @param int link_share Percent
+ * @param int history_mb
+ * @param int reconnect_hold Seconds, -1 forever
+ * @param string eeprom_dir Where the EEPROM image is cached, empty for memory only
+ * @param bool verbose
+ * @return bool
+ */
+bool start_radio(Radio * radio, const string & cache_ttl, int link_share, int history_mb, int reconnect_hold, const string & eeprom_dir, bool verbose)
+{
+	radio->cat = new Cat();
+	radio->cat->SetVerbose(verbose);
+
+	if (!radio->cat->Connect(radio->device, radio->baud)) {
+		return false;
+	}
+
+	// an unplugged adapter holds the queue, it is reopened when it returns
+	radio->cat->SetReconnectHold(reconnect_hold < 0 ? -1 : reconnect_hold * 1000);
+
+	// from now on only the queue's worker thread talks to the tcvr
+	radio->queue = new CatQueue(radio->cat);
+	radio->queue->SetCpu(radio->cpu);
+	radio->cache = new StatusCache(radio->queue);
+
+	if (!cache_ttl.empty() && !radio->cache->SetTtl(cache_ttl)) {
+		cout << "Invalid cache TTL list: " << cache_ttl << endl;
+		return false;
+	}
+
+	if (!radio->history_path.empty()) {
+		radio->history = new HistoryLog();
+
+		if (!radio->history->Open(radio->history_path, (size_t)history_mb * 1024 * 1024)) {
+			return false;
+		}
+
+		uint64_t loaded = radio->rollup.Load(*radio->history);
+
+		if (verbose) {
+			cout << radio->name << ": loaded " << loaded << " history records into rollups" << endl;
+		}
+	}
+
+	radio->scheduler = new PollScheduler(radio->cache, radio->baud, link_share / 100.0);
+	radio->tuner = new TuneStream(radio->cache, radio->queue);
+	radio->eeprom = new EepromSync(radio->queue);
+
+	if (!eeprom_dir.empty() && radio->eeprom->SetCachePath(eeprom_dir + "/" + radio->name + ".cache") && verbose) {
+		cout << radio->name << ": " << radio->eeprom->GetImage().GetKnownCount() << " EEPROM bytes cached" << endl;
+	}
+
+	radio->queue->Start();
+
+	if (verbose) {
+		cout << radio->name << ": " << radio->device << " at " << radio->baud << " bauds, CPU " << radio->cpu << endl;
+	}
+
+	return true;
+}
+
+/**
+ * Stop workers and free radios, also half started ones
+ * @param vector radios
+ * @return void
+ */
+void delete_radios(vector<Radio *> & radios)
+{
+	for (auto it = radios.begin(); it != radios.end(); ++it) {
+		Radio * radio = *it;
+
+		delete radio->scheduler;
+		delete radio->tuner;
+		delete radio->eeprom;
+		delete radio->history;
+		delete radio->cache;
+		delete radio->queue;
+		delete radio->cat;
+		delete radio;
+	}
+
+	radios.clear();
+}
+
+/**
+ * Show help message
+ * @param char* s This executable
+ * @return void
+ */
+void show_help(char *s)
+{
+	cout << "Raspberry Pi and Yeasu FT8xx fusion - TCP server" << endl << endl;
+
+	cout << "Usage: " << endl;
+	cout << " " << s << " -P <tcp port> [-d <serial device>] [-b <serial speed>] [-C <cache TTLs>] [-U <link share>] [-H <history file> [-L <MB>]] [-W <seconds>] [-A <audio port> [-i <capture> [-I <rate>]] [-o <playback>] [-r <rate>] [-F <frames>]] [-E <dir>] [-v]" << endl;
+	cout << " " << s << " -P <tcp port> -R <radio list> [-C <cache TTLs>] [-U <link share>] [-L <MB>] [-W <seconds>] [-A <audio port> [-i <capture> [-I <rate>]] [-o <playback>] [-r <rate>] [-F <frames>]] [-E <dir>] [-v]" << endl << endl;
+
+	cout << "Options:" << endl;
+	cout << " -P TCP port to listen on" << endl;
+	cout << " -d serial device (default /dev/ttyUSB0)" << endl;
+	cout << " -b serial speed (2400, 4800, 9600, 38400 or auto to probe)" << endl;
+	cout << " -R file listing radios, one per line: name device [baud|auto] [cpu] [history file], - skips a column" << endl;
+	cout << " -C status cache TTLs in ms (default s:1000,r:200,t:200)" << endl;
+	cout << " -U percent of serial link used for background polling (default 50)" << endl;
+	cout << " -H record every status reading to this file, read it with yaesu_history" << endl;
+	cout << " -L history file size in MB, oldest records are overwritten (default 16)" << endl;
+	cout << " -W seconds commands wait for an unplugged serial device to return, -1 forever (default 30)" << endl;
+	cout << " -A TCP and UDP port for audio clients, audio goes with the first radio" << endl;
+	cout << " -i receiver audio: alsa:<pcm>, - for stdin, a FIFO or a raw/.wav file played in a loop" << endl;
+	cout << " -I sample rate of the receiver audio if higher than -r, e.g. 48000, it is decimated to -r" << endl;
+	cout << " -o transmitter audio: alsa:<pcm>, - for stdout, a FIFO or a raw/.wav file" << endl;
+	cout << " -r audio sample rate in Hz (default 8000)" << endl;
+	cout << " -F audio frames per XOR parity packet to UDP clients, 0 for none (default 4)" << endl;
+	cout << " -E directory for EEPROM caches (<radio>.cache) and snapshots (<name>.eep)" << endl;
+	cout << " -v verbose output" << endl << endl;
+
+	cout << "Commands (one per line):" << endl;
+	cout << " status | s | r | t | f <MHz> | m <mode> | p <on/off> | l <on/off> | queue | cache | poll | stats [json|prometheus] | audio | quit" << endl;
+	cout << " subscribe <field,field,...|all> | unsubscribe | hysteresis <field> <threshold>" << endl;
+	cout << " stream [flush ms] | stream off" << endl;
+	cout << " history <rx_signal|tx_power|swr_high|rx_squelched|squelch_open|tcvr_frequency> <from> <to> <1s|1m|1h>" << endl;
+	cout << " tune <MHz> | tune +<Hz> | tune -<Hz> | tune" << endl;
+	cout << " eeprom | eeprom read [full] | eeprom channels | eeprom snapshot <name> | eeprom diff <name|@radio> | eeprom restore <name|@radio>" << endl;
+	cout << " radios | status all | use <radio> | @<radio> <command>" << endl;
+}
+
+// Server
+
+Server::Server(const vector<Radio *> & r, AudioStream * a, bool v)
+{
+	radios = r;
+	audio = a;
+	verbose = v;
+	listen_fd = -1;
+	next_client_id = 0;
+}
+
+Server::~Server()
+{
+	for (auto it = clients.begin(); it != clients.end(); ++it) {
+		close(it->first);
+	}
+
+	if (listen_fd >= 0) {
+		close(listen_fd);
+	}
+}
+
+/**
+ * Directory of EEPROM snapshots, empty disables them
+ * @param string dir
+ * @return void
+ */
+void Server::SetEepromDir(const string & dir)
+{
+	eeprom_dir = dir;
+}
+
+/**
+ * Open listening socket and register it together with the CAT queues
+ * @param int port
+ * @return bool
+ */
+bool Server::Listen(int port)
+{
+	struct sockaddr_in serv_addr;
+	int reuse = 1;
+
+	listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (listen_fd < 0) {
+		perror("ERROR opening socket");
+		return false;
+	}
+
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	memset(&serv_addr, 0, sizeof(serv_addr));
+	serv_addr.sin_family = AF_INET;
+	serv_addr.sin_addr.s_addr = INADDR_ANY;
+	serv_addr.sin_port = htons(port);
+
+	if (bind(listen_fd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+		perror("ERROR on binding");
+		return false;
+	}
+
+	if (listen(listen_fd, SOMAXCONN) < 0) {
+		perror("ERROR on listen");
+		return false;
+	}
+
+	reactor.Add(listen_fd, EPOLLIN, [this](uint32_t) {
+		Accept();
+	});
+
+	for (auto it = radios.begin(); it != radios.end(); ++it) {
+		Radio * radio = *it;
+
+		reactor.Add(radio->queue->GetEventFd(), EPOLLIN, [radio](uint32_t) {
+			radio->queue->DispatchCompletions();
+		});
+
+		radio->queue->SetStatusListener([this, radio](const TcvrStatus & status) {
+			Publish(*radio, status);
+			Stream(*radio, status);
+			radio->rollup.Add(status, Clock::WallClockMs());
+
+			if (radio->history) {
+				radio->history->Append(status);
+			}
+		});
+	}
+
+	if (audio) {
+		reactor.Add(audio->GetPttEventFd(), EPOLLIN, [this](uint32_t) {
+			audio->HandlePttEvent();
+		});
+	}
+
+	reactor.AddTimer(PollScheduler::TICK_MS, [this]() {
+		for (auto it = radios.begin(); it != radios.end(); ++it) {
+			(*it)->scheduler->Tick();
+
+			if ((*it)->history) {
+				(*it)->history->Tick();
+			}
+		}
+
+		// FlushStream() may disconnect clients
+		vector<int> fds;
+
+		for (auto it = clients.begin(); it != clients.end(); ++it) {
+			if (!it->second.stream_pending.empty()) {
+				fds.push_back(it->first);
+			}
+		}
+
+		for (auto it = fds.begin(); it != fds.end(); ++it) {
+			auto client = clients.find(*it);
+
+			if (client != clients.end()) {
+				FlushStream(client->second);
+			}
+		}
+	});
+
+	if (verbose) {
+		cout << "Listening on port " << port << endl;
+	}
+
+	return true;
+}
+
+/**
+ * Enter event loop
+ * @return void
+ */
+void Server::Run()
+{
+	reactor.Run();
+}
+
+/**
+ * Accept all pending connections
+ * @return void
+ */
+void Server::Accept()
+{
+	while (true) {
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (fd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				perror("ERROR on accept");
+			}
+
+			return;
+		}
+
+		int nodelay = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+		Client & client = clients[fd];
+		client.fd = fd;
+		client.id = ++next_client_id;
+		client.radio = 0;
+		client.closing = false;
+		client.detected = false;
+		client.binary = false;
+		client.streaming = false;
+		client.stream_flush_ms = 0;
+		client.stream_last_flush = 0;
+
+		for (int i = 0; i < Protocol::FIELD_COUNT; i++) {
+			client.pushed[i] = 0;
+		}
+
+		reactor.Add(fd, EPOLLIN | EPOLLRDHUP, [this, fd](uint32_t events) {
+			HandleClient(fd, events);
+		});
+
+		if (verbose) {
+			cout << "Client " << fd << " connected, " << clients.size() << " total" << endl;
+		}
+
+		UpdateDemand();
+	}
+}
+
+/**
+ * Read from client and execute complete commands
+ * @param int fd
+ * @param uint32_t events
+ * @return void
+ */
+void Server::HandleClient(int fd, uint32_t events)
+{
+	auto it = clients.find(fd);
+
+	if (it == clients.end()) {
+		return;
+	}
+
+	Client & client = it->second;
+
+	if (events & EPOLLOUT) {
+		Flush(client);
+
+		if (clients.find(fd) == clients.end()) {
+			return;
+		}
+	}
+
+	if (events & EPOLLIN) {
+		char buffer[4096];
+		bool eof = false;
 
 		while (true) {
-			map<string, string> tcvr_status = cat->GetTcvrStatus();
+			ssize_t n = read(fd, buffer, sizeof(buffer));
+
+			if (n > 0) {
+				client.input.append(buffer, n);
+				continue;
+			}
+
+			if (n == 0) {
+				eof = true;
+				break;
+			}
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				Disconnect(fd);
+				return;
+			}
 
-			for (auto it = tcvr_status.begin(); it != tcvr_status.end(); ++it) {
-				string message = it->first + ":" + it->second + "\n";
-				n = write(newsockfd, message.c_str(), message.length());
+			if (errno != EINTR) {
+				break;
 			}
+		}
 
-			n = read(newsockfd, buffer, 255);
+		// first byte tells us which protocol the client speaks
+		if (!client.detected && !client.input.empty()) {
+			client.detected = true;
+			client.binary = (unsigned char)client.input[0] == Protocol::MAGIC;
+		}
 
-     if (n < 0) error("ERROR reading from socket");
-     printf("Here is the message: %s\n",buffer);
-     n = write(newsockfd,"I got your message",18);
-     if (n < 0) error("ERROR writing to socket");
+		if (client.binary) {
+			ProcessFrames(client);
+		} else {
+			ProcessLines(client);
+		}
 
-			sleep(10);
-		}//while
-	}//if
+		if (clients.find(fd) == clients.end() || client.closing) {
+			return;
+		}
 
-     close(newsockfd);
-     close(sockfd);
-     return 0; 
+		// peer is done sending, go away once replies are out
+		if (eof) {
+			client.closing = true;
+			Flush(client);
+			return;
+		}
+	}
+
+	if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+		Disconnect(fd);
+	}
+}
+
+/**
+ * Execute all complete text lines
+ * @param Client client
+ * @return void
+ */
+void Server::ProcessLines(Client & client)
+{
+	int fd = client.fd;
+	size_t start = 0, end;
+
+	while ((end = client.input.find('\n', start)) != string::npos) {
+		string line = client.input.substr(start, end - start);
+		start = end + 1;
+
+		if (!line.empty() && line[line.length() - 1] == '\r') {
+			line.erase(line.length() - 1);
+		}
+
+		HandleLine(client, line);
+
+		// client asked to quit or was dropped
+		if (clients.find(fd) == clients.end() || client.closing) {
+			return;
+		}
+	}
+
+	client.input.erase(0, start);
+
+	if (client.input.length() > MAX_LINE_LENGTH) {
+		Send(client, "E: Line too long\n");
+		Disconnect(fd);
+	}
+}
+
+/**
+ * Execute all complete binary frames
+ * @param Client client
+ * @return void
+ */
+void Server::ProcessFrames(Client & client)
+{
+	int fd = client.fd;
+	size_t start = 0;
+
+	while (start < client.input.length()) {
+		Protocol::Frame frame;
+		int consumed = Protocol::Decode(client.input.data() + start, client.input.length() - start, frame);
+
+		if (consumed == 0) {
+			break;
+		}
+
+		// lost framing, nothing sensible can follow
+		if (consumed < 0) {
+			Disconnect(fd);
+			return;
+		}
+
+		start += consumed;
+
+		HandleFrame(client, frame);
+
+		if (clients.find(fd) == clients.end() || client.closing) {
+			return;
+		}
+	}
+
+	client.input.erase(0, start);
+}
+
+/**
+ * Execute one binary request
+ * @param Client client
+ * @param Frame frame
+ * @return void
+ */
+void Server::HandleFrame(Client & client, const Protocol::Frame & frame)
+{
+	const string & payload = frame.payload;
+	size_t expected;
+
+	switch (frame.type) {
+		case Protocol::FRAME_SET_FREQUENCY:
+			expected = 4;
+			break;
+		case Protocol::FRAME_SET_MODE:
+		case Protocol::FRAME_PTT:
+		case Protocol::FRAME_LOCK:
+		case Protocol::FRAME_GET_STATUS:
+			expected = 1;
+			break;
+		case Protocol::FRAME_SUBSCRIBE:
+			expected = 2;
+			break;
+		case Protocol::FRAME_UNSUBSCRIBE:
+			expected = 0;
+			break;
+		case Protocol::FRAME_HYSTERESIS:
+			expected = 5;
+			break;
+		case Protocol::FRAME_TUNE:
+			expected = 5;
+			break;
+		default:
+			SendError(client, frame.request_id, Protocol::ERROR_UNKNOWN_FRAME, "Unknown command");
+			return;
+	}
+
+	if (payload.length() != expected) {
+		SendError(client, frame.request_id, Protocol::ERROR_BAD_PAYLOAD, "Invalid payload");
+		return;
+	}
+
+	Radio & radio = *radios[client.radio];
+	CatCommand cat_command;
+	cat_command.opcode = 0;
+	cat_command.frequency = 0;
+	cat_command.client = client.id;
+
+	if (frame.type == Protocol::FRAME_SUBSCRIBE) {
+		uint16_t mask = Protocol::GetUint16(payload, 0);
+		string list;
+
+		for (int field = 0; field < Protocol::FIELD_COUNT; field++) {
+			if (mask & (1 << field)) {
+				list += string(list.empty() ? "" : ",") + Protocol::FieldName(field);
+			}
+		}
+
+		if (!client.subscription.Subscribe(list)) {
+			SendError(client, frame.request_id, Protocol::ERROR_BAD_PAYLOAD, "Unknown status field");
+			return;
+		}
+
+		UpdateDemand();
+		SendOk(client, frame.request_id);
+		Push(client, radio.queue->GetTcvrStatus());
+		return;
+	} else if (frame.type == Protocol::FRAME_UNSUBSCRIBE) {
+		client.subscription.Unsubscribe();
+		UpdateDemand();
+		SendOk(client, frame.request_id);
+		return;
+	} else if (frame.type == Protocol::FRAME_HYSTERESIS) {
+		if (!client.subscription.SetWireHysteresis((unsigned char)payload[0], Protocol::GetUint32(payload, 1))) {
+			SendError(client, frame.request_id, Protocol::ERROR_BAD_PAYLOAD, "Invalid hysteresis");
+			return;
+		}
+
+		SendOk(client, frame.request_id);
+		return;
+	} else if (frame.type == Protocol::FRAME_TUNE) {
+		uint32_t value = Protocol::GetUint32(payload, 1);
+		Tune(client, radio, payload[0] ? (int64_t)(int32_t)value : (int64_t)value, payload[0], frame.request_id);
+		return;
+	} else if (frame.type == Protocol::FRAME_GET_STATUS) {
+		cat_command.opcode = payload[0];
+
+		if (cat_command.opcode != Cat::CMD_GET_FREQUENCY_MODE && cat_command.opcode != Cat::CMD_GET_RX_STATUS && cat_command.opcode != Cat::CMD_GET_TX_STATUS) {
+			SendError(client, frame.request_id, Protocol::ERROR_BAD_PAYLOAD, "Invalid payload");
+			return;
+		}
+
+		Submit(client, radio, cat_command, true, frame.request_id);
+		return;
+	} else if (frame.type == Protocol::FRAME_SET_FREQUENCY) {
+		cat_command.opcode = Cat::CMD_SET_FREQUENCY;
+		cat_command.frequency = Protocol::GetUint32(payload, 0) / 1000000.0;
+
+		if (cat_command.frequency <= 0 || cat_command.frequency >= 1000) {
+			SendError(client, frame.request_id, Protocol::ERROR_BAD_PAYLOAD, "Invalid frequency");
+			return;
+		}
+	} else if (frame.type == Protocol::FRAME_SET_MODE) {
+		cat_command.opcode = Cat::CMD_SET_MODE;
+		cat_command.mode = Protocol::FieldText(Protocol::FIELD_MODE, (unsigned char)payload[0]);
+	} else if (frame.type == Protocol::FRAME_PTT) {
+		cat_command.opcode = payload[0] ? Cat::CMD_PTT_ON : Cat::CMD_PTT_OFF;
+	} else if (frame.type == Protocol::FRAME_LOCK) {
+		cat_command.opcode = payload[0] ? Cat::CMD_LOCK_ON : Cat::CMD_LOCK_OFF;
+	}
+
+	Submit(client, radio, cat_command, false, frame.request_id);
+}
+
+/**
+ * Execute one command line, "@<radio> <command>" sends a single command to
+ * another radio than the selected one
+ * @param Client client
+ * @param string line
+ * @return void
+ */
+void Server::HandleLine(Client & client, const string & line)
+{
+	istringstream tokens(line);
+	string command, argument;
+	tokens >> command >> argument;
+
+	if (command.empty()) {
+		return;
+	}
+
+	if (command[0] == '@') {
+		int index = FindRadio(command.substr(1));
+
+		if (index < 0) {
+			Send(client, "E: Unknown radio\n");
+			return;
+		}
+
+		size_t start = line.find(command) + command.length();
+		HandleCommand(client, *radios[index], line.substr(start));
+		return;
+	}
+
+	if (command == "use") {
+		int index = FindRadio(argument);
+
+		if (index < 0) {
+			Send(client, "E: Unknown radio\n");
+			return;
+		}
+
+		// subscription and stream follow the selected radio
+		client.radio = index;
+		client.subscription.Resync();
+		UpdateDemand();
+		Send(client, "OK\n");
+		Push(client, radios[index]->queue->GetTcvrStatus());
+		return;
+	} else if (command == "radios") {
+		SendRadios(client);
+		return;
+	}
+
+	HandleCommand(client, *radios[client.radio], line);
+}
+
+/**
+ * Execute one command against a radio
+ * @param Client client
+ * @param Radio radio
+ * @param string line
+ * @return void
+ */
+void Server::HandleCommand(Client & client, Radio & radio, const string & line)
+{
+	istringstream tokens(line);
+	string command, argument, value;
+	tokens >> command >> argument >> value;
+
+	if (command.empty()) {
+		Send(client, "E: Unknown command\n");
+		return;
+	}
+
+	CatCommand cat_command;
+	cat_command.frequency = 0;
+	cat_command.client = client.id;
+
+	if (command == "status" && argument == "all") {
+		SendRadios(client);
+		return;
+	} else if (command == "status") {
+		SendStatus(client, radio);
+		return;
+	} else if (command == "queue") {
+		Send(client, radio.queue->Stats() + "OK\n");
+		return;
+	} else if (command == "cache") {
+		Send(client, radio.cache->Stats() + "OK\n");
+		return;
+	} else if (command == "poll") {
+		Send(client, radio.scheduler->Stats() + "OK\n");
+		return;
+	} else if (command == "stats") {
+		if (argument == "json") {
+			Send(client, radio.cat->Stats(argument) + "\nOK\n");
+		} else if (argument == "prometheus" || argument.empty()) {
+			Send(client, radio.cat->Stats(argument) + "OK\n");
+		} else {
+			Send(client, "E: Unknown stats format\n");
+		}
+
+		return;
+	} else if (command == "audio") {
+		if (audio) {
+			Send(client, audio->Stats() + "OK\n");
+		} else {
+			Send(client, "E: Audio not enabled\n");
+		}
+
+		return;
+	} else if (command == "subscribe") {
+		if (!client.subscription.Subscribe(argument)) {
+			Send(client, "E: Unknown status field\n");
+			return;
+		}
+
+		UpdateDemand();
+		Send(client, "OK\n");
+		Push(client, radio.queue->GetTcvrStatus());
+		return;
+	} else if (command == "unsubscribe") {
+		client.subscription.Unsubscribe();
+		UpdateDemand();
+		Send(client, "OK\n");
+		return;
+	} else if (command == "history") {
+		string to_text, resolution_text;
+		tokens >> to_text >> resolution_text;
+
+		StatusRollup::Resolution resolution;
+		vector<RollupPoint> points;
+
+		if (!StatusRollup::ParseResolution(resolution_text, resolution)) {
+			Send(client, "E: Invalid resolution\n");
+			return;
+		}
+
+		// seconds since epoch, or relative to now when zero or negative
+		int64_t now = Clock::WallClockMs() / 1000;
+		int64_t from = atoll(value.c_str()), to = atoll(to_text.c_str());
+		from = from <= 0 ? now + from : from;
+		to = to <= 0 ? now + to : to;
+
+		if (from < 0 || to < from) {
+			Send(client, "E: Invalid time range\n");
+			return;
+		}
+
+		if (!radio.rollup.Query(argument, from, to, resolution, points)) {
+			Send(client, "E: Unknown history field\n");
+			return;
+		}
+
+		Send(client, radio.rollup.Format(argument, points) + "OK\n");
+		return;
+	} else if (command == "stream") {
+		if (client.binary) {
+			Send(client, "E: Streaming is text only\n");
+			return;
+		}
+
+		if (argument == "off") {
+			// records still held back go out ahead of the reply
+			string message = client.stream_pending + "OK\n";
+			client.stream_pending.clear();
+			client.streaming = false;
+			UpdateDemand();
+			Send(client, message);
+			return;
+		}
+
+		int flush_ms = atoi(argument.c_str());
+
+		if (flush_ms < 0) {
+			Send(client, "E: Invalid flush interval\n");
+			return;
+		}
+
+		client.streaming = true;
+		client.stream_flush_ms = flush_ms;
+		client.stream_last_flush = Clock::MonotonicMs();
+		client.stream_pending.reserve(MAX_PUSH_BACKLOG);
+		UpdateDemand();
+		Send(client, "OK\n");
+		return;
+	} else if (command == "hysteresis") {
+		if (value.empty() || !client.subscription.SetHysteresis(argument, atof(value.c_str()))) {
+			Send(client, "E: Invalid hysteresis, use rx_signal, tx_power or tcvr_frequency\n");
+			return;
+		}
+
+		Send(client, "OK\n");
+		return;
+	} else if (command == "eeprom") {
+		HandleEeprom(client, radio, argument, value);
+		return;
+	} else if (command == "tune" && argument.empty()) {
+		Send(client, radio.tuner->Stats() + "OK\n");
+		return;
+	} else if (command == "tune") {
+		// +/- steps in Hz, otherwise MHz like f
+		char * end;
+		bool relative = argument[0] == '+' || argument[0] == '-';
+		double number = strtod(argument.c_str(), &end);
+
+		if (*end != '\0') {
+			Send(client, "E: Invalid frequency\n");
+			return;
+		}
+
+		Tune(client, radio, relative ? llround(number) : llround(number * 1000000), relative);
+		return;
+	} else if (command == "quit") {
+		client.closing = true;
+		Send(client, "OK\n");
+		return;
+	} else if (command == "s") {
+		cat_command.opcode = Cat::CMD_GET_FREQUENCY_MODE;
+	} else if (command == "r") {
+		cat_command.opcode = Cat::CMD_GET_RX_STATUS;
+	} else if (command == "t") {
+		cat_command.opcode = Cat::CMD_GET_TX_STATUS;
+	} else if (command == "f") {
+		cat_command.opcode = Cat::CMD_SET_FREQUENCY;
+		cat_command.frequency = atof(argument.c_str());
+
+		if (cat_command.frequency <= 0 || cat_command.frequency >= 1000) {
+			Send(client, "E: Invalid frequency\n");
+			return;
+		}
+	} else if (command == "m") {
+		cat_command.opcode = Cat::CMD_SET_MODE;
+		cat_command.mode = argument;
+	} else if (command == "p" && (argument == "on" || argument == "off")) {
+		cat_command.opcode = argument == "on" ? Cat::CMD_PTT_ON : Cat::CMD_PTT_OFF;
+	} else if (command == "l" && (argument == "on" || argument == "off")) {
+		cat_command.opcode = argument == "on" ? Cat::CMD_LOCK_ON : Cat::CMD_LOCK_OFF;
+	} else {
+		Send(client, "E: Unknown command\n");
+		return;
+	}
+
+	Submit(client, radio, cat_command, command == "s" || command == "r" || command == "t");
+}
+
+/**
+ * EEPROM image commands, transfers reply once they are done
+ * @param Client client
+ * @param Radio radio
+ * @param string action
+ * @param string name Snapshot name or @radio
+ * @return void
+ */
+void Server::HandleEeprom(Client & client, Radio & radio, const string & action, const string & name)
+{
+	EepromSync * eeprom = radio.eeprom;
+	EepromImage target;
+	string error, path;
+	int fd = client.fd, id = client.id;
+
+	// reply to whoever started a transfer, if still connected
+	EepromSync::Callback reply = [this, fd, id](bool ok, const string & message) {
+		Client * client = FindClient(fd, id);
+
+		if (client != NULL) {
+			Send(*client, ok ? message + "OK\n" : "E: " + message + "\n");
+		}
+	};
+
+	if (action.empty() || action == "stats") {
+		Send(client, eeprom->Stats() + "OK\n");
+	} else if (action == "channels") {
+		Send(client, eeprom->GetImage().ChannelsText() + "OK\n");
+	} else if (eeprom->IsBusy() && (action == "read" || action == "restore")) {
+		Send(client, "E: EEPROM transfer running\n");
+	} else if (action == "read" && (name.empty() || name == "full")) {
+		eeprom->Read(name == "full", reply);
+	} else if (action == "snapshot") {
+		if (!eeprom->GetImage().IsComplete()) {
+			Send(client, "E: EEPROM not read yet\n");
+		} else if (!SnapshotPath(name, path, error)) {
+			Send(client, "E: " + error + "\n");
+		} else if (!eeprom->GetImage().Save(path)) {
+			Send(client, "E: Can not write snapshot\n");
+		} else {
+			Send(client, "eeprom_snapshot:" + path + "\nOK\n");
+		}
+	} else if (action == "diff" || action == "restore") {
+		if (!LoadEeprom(name, target, error)) {
+			Send(client, "E: " + error + "\n");
+		} else if (action == "diff") {
+			Send(client, eeprom->GetImage().DiffText(target) + "OK\n");
+		} else if (!target.IsComplete()) {
+			Send(client, "E: Source EEPROM not read yet\n");
+		} else {
+			StatusCache * cache = radio.cache;
+
+			// VFO and memory bytes may have changed what the tcvr reports
+			eeprom->Restore(target, [cache, reply](bool ok, const string & message) {
+				cache->Invalidate(Cat::CMD_GET_FREQUENCY_MODE);
+				reply(ok, message);
+			});
+		}
+	} else {
+		Send(client, "E: Unknown eeprom command\n");
+	}
+}
+
+/**
+ * Image to compare with or restore from: a snapshot by name or the image
+ * of another radio as @name
+ * @param string name
+ * @param EepromImage image
+ * @param string error Set when false is returned
+ * @return bool
+ */
+bool Server::LoadEeprom(const string & name, EepromImage & image, string & error)
+{
+	if (name.size() > 1 && name[0] == '@') {
+		int index = FindRadio(name.substr(1));
+
+		if (index < 0) {
+			error = "Unknown radio";
+			return false;
+		}
+
+		image = radios[index]->eeprom->GetImage();
+		return true;
+	}
+
+	string path;
+
+	if (!SnapshotPath(name, path, error)) {
+		return false;
+	}
+
+	if (access(path.c_str(), F_OK) != 0) {
+		error = "No such snapshot";
+		return false;
+	}
+
+	if (!image.Load(path)) {
+		error = "Invalid snapshot";
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * File of a named snapshot
+ * @param string name
+ * @param string path
+ * @param string error Set when false is returned
+ * @return bool
+ */
+bool Server::SnapshotPath(const string & name, string & path, string & error)
+{
+	if (eeprom_dir.empty()) {
+		error = "Snapshots need -E";
+		return false;
+	}
+
+	// names become file names, keep them inside the directory
+	if (name.empty() || name[0] == '.' || name.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789._-") != string::npos) {
+		error = "Invalid snapshot name";
+		return false;
+	}
+
+	path = eeprom_dir + "/" + name + ".eep";
+
+	return true;
+}
+
+/**
+ * Hand frequency update to the radio's tuning stream, reply with the
+ * frequency applied once it, or a later update, went through
+ * @param Client client
+ * @param Radio radio
+ * @param int64_t hz Absolute, or a step when relative
+ * @param bool relative
+ * @param uint16_t request_id Echoed to binary clients
+ * @return void
+ */
+void Server::Tune(Client & client, Radio & radio, int64_t hz, bool relative, uint16_t request_id)
+{
+	int fd = client.fd, id = client.id;
+
+	bool accepted = radio.tuner->Tune(hz, relative, [this, fd, id, request_id](bool ok, uint32_t applied_hz) {
+		Client * client = FindClient(fd, id);
+
+		if (client == NULL) {
+			return;
+		}
+
+		if (!ok) {
+			SendError(*client, request_id, Protocol::ERROR_REJECTED, "Transciever did not accept command");
+		} else if (client->binary) {
+			string payload;
+			Protocol::PutField(payload, Protocol::FIELD_FREQUENCY, applied_hz);
+			Send(*client, Protocol::Encode(Protocol::FRAME_STATUS, request_id, payload));
+		} else {
+			Send(*client, "tcvr_frequency:" + TcvrStatus::FormatFrequency(applied_hz) + "\nOK\n");
+		}
+	});
+
+	if (!accepted) {
+		SendError(client, request_id, Protocol::ERROR_BAD_PAYLOAD, relative ? "Frequency not known yet, tune to an absolute one first" : "Invalid frequency");
+	}
+}
+
+/**
+ * Hand command over to the status cache / CAT queue, reply once it was executed
+ * @param Client client
+ * @param Radio radio
+ * @param CatCommand command
+ * @param bool reply_status Reply with status fields instead of plain OK
+ * @param uint16_t request_id Echoed to binary clients
+ * @return void
+ */
+void Server::Submit(Client & client, Radio & radio, CatCommand command, bool reply_status, uint16_t request_id)
+{
+	int fd = client.fd, id = client.id;
+	Radio * target = &radio;
+
+	command.callback = [this, fd, id, target, reply_status, request_id](const CatResult & result) {
+		Client * client = FindClient(fd, id);
+
+		if (client == NULL) {
+			return;
+		}
+
+		if (!result.ok) {
+			SendError(*client, request_id, Protocol::ERROR_REJECTED, "Transciever did not accept command");
+		} else if (reply_status) {
+			SendStatus(*client, *target, request_id);
+		} else {
+			SendOk(*client, request_id);
+		}
+	};
+
+	bool queued;
+
+	if (reply_status) {
+		queued = radio.cache->Query(command.opcode, command.callback);
+	} else {
+		queued = radio.cache->Execute(command);
+	}
+
+	if (!queued) {
+		SendError(client, request_id, Protocol::ERROR_BUSY, "Too many pending commands");
+	}
+}
+
+/**
+ * Look up client, making sure descriptor was not reused meanwhile
+ * @param int fd
+ * @param int id
+ * @return Client*
+ */
+Client * Server::FindClient(int fd, int id)
+{
+	auto it = clients.find(fd);
+
+	if (it == clients.end() || it->second.id != id) {
+		return NULL;
+	}
+
+	return &it->second;
+}
+
+/**
+ * Radio index by name
+ * @param string name
+ * @return int -1 if unknown
+ */
+int Server::FindRadio(const string & name)
+{
+	for (size_t i = 0; i < radios.size(); i++) {
+		if (radios[i]->name == name) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Send all known status fields, as key:value lines in text mode
+ * @param Client client
+ * @param Radio radio
+ * @param uint16_t request_id
+ * @return void
+ */
+void Server::SendStatus(Client & client, Radio & radio, uint16_t request_id)
+{
+	TcvrStatus status = radio.queue->GetTcvrStatus();
+
+	if (client.binary) {
+		Send(client, Protocol::Encode(Protocol::FRAME_STATUS, request_id, Protocol::EncodeStatus(status)));
+		return;
+	}
+
+	// key:value text is the only place the old map is still made
+	map<string, string> tcvr_status = status.Map();
+	string message;
+
+	for (auto it = tcvr_status.begin(); it != tcvr_status.end(); ++it) {
+		message += it->first + ":" + it->second + "\n";
+	}
+
+	message += "OK\n";
+
+	Send(client, message);
+}
+
+/**
+ * Last known status of every radio in one reply, as <radio>.key:value
+ * lines; read from the status snapshots, no serial traffic
+ * @param Client client
+ * @return void
+ */
+void Server::SendRadios(Client & client)
+{
+	string message;
+
+	for (auto it = radios.begin(); it != radios.end(); ++it) {
+		Radio * radio = *it;
+		map<string, string> tcvr_status = radio->queue->GetStatus().Map();
+
+		message += radio->name + ".device:" + radio->device + "\n";
+		message += radio->name + ".queue_depth:" + to_string(radio->queue->GetDepth()) + "\n";
+		message += radio->name + ".link_state:" + LinkHealth::StateName(radio->cat->GetLinkHealth()->GetState()) + "\n";
+
+		for (auto field = tcvr_status.begin(); field != tcvr_status.end(); ++field) {
+			message += radio->name + "." + field->first + ":" + field->second + "\n";
+		}
+	}
+
+	Send(client, message + "OK\n");
+}
+
+/**
+ * Acknowledge command
+ * @param Client client
+ * @param uint16_t request_id
+ * @return void
+ */
+void Server::SendOk(Client & client, uint16_t request_id)
+{
+	if (client.binary) {
+		Send(client, Protocol::Encode(Protocol::FRAME_ACK, request_id));
+	} else {
+		Send(client, "OK\n");
+	}
+}
+
+/**
+ * Report failed command
+ * @param Client client
+ * @param uint16_t request_id
+ * @param int code Protocol::ERROR_XXXXXX
+ * @param string message Text mode reason
+ * @return void
+ */
+void Server::SendError(Client & client, uint16_t request_id, int code, const string & message)
+{
+	if (client.binary) {
+		Send(client, Protocol::Encode(Protocol::FRAME_ERROR, request_id, string(1, (char)code)));
+	} else {
+		Send(client, "E: " + message + "\n");
+	}
+}
+
+/**
+ * Queue message for client and try to write it right away
+ * @param Client client
+ * @param string message
+ * @return void
+ */
+void Server::Send(Client & client, const string & message)
+{
+	bool was_empty = client.output.empty();
+	client.output += message;
+
+	if (was_empty) {
+		Flush(client);
+	}
+}
+
+/**
+ * Write as much buffered output as socket accepts
+ * @param Client client
+ * @return void
+ */
+void Server::Flush(Client & client)
+{
+	int fd = client.fd;
+
+	while (!client.output.empty()) {
+		ssize_t n = write(fd, client.output.data(), client.output.length());
+
+		if (n > 0) {
+			client.output.erase(0, n);
+			continue;
+		}
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (client.output.length() > MAX_OUTPUT_BUFFER) {
+				Disconnect(fd);
+				return;
+			}
+
+			// wait for socket to drain
+			reactor.Modify(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+			return;
+		}
+
+		Disconnect(fd);
+		return;
+	}
+
+	if (client.closing) {
+		Disconnect(fd);
+		return;
+	}
+
+	reactor.Modify(fd, EPOLLIN | EPOLLRDHUP);
+}
+
+/**
+ * Close client connection
+ * @param int fd
+ * @return void
+ */
+void Server::Disconnect(int fd)
+{
+	auto it = clients.find(fd);
+
+	if (it != clients.end()) {
+		for (auto radio = radios.begin(); radio != radios.end(); ++radio) {
+			(*radio)->queue->Forget(it->second.id);
+		}
+	}
+
+	reactor.Remove(fd);
+	close(fd);
+	clients.erase(fd);
+
+	if (verbose) {
+		cout << "Client " << fd << " disconnected, " << clients.size() << " left" << endl;
+	}
+
+	UpdateDemand();
+}
+
+/**
+ * Count subscribers of each status query, streaming clients want all of them for the poll scheduler
+ * @return void
+ */
+void Server::UpdateDemand()
+{
+	char opcodes[3] = {Cat::CMD_GET_RX_STATUS, Cat::CMD_GET_TX_STATUS, Cat::CMD_GET_FREQUENCY_MODE};
+
+	for (auto radio = radios.begin(); radio != radios.end(); ++radio) {
+		for (int i = 0; i < 3; i++) {
+			int subscribers = 0;
+
+			for (auto it = clients.begin(); it != clients.end(); ++it) {
+				if (it->second.radio == (*radio)->index && (it->second.streaming || it->second.subscription.Wants(opcodes[i]))) {
+					subscribers++;
+				}
+			}
+
+			(*radio)->scheduler->SetDemand(opcodes[i], subscribers);
+		}
+	}
+}
+
+/**
+ * Push changed fields to all clients subscribed to this radio
+ * @param Radio radio
+ * @param TcvrStatus status
+ * @return void
+ */
+void Server::Publish(Radio & radio, const TcvrStatus & status)
+{
+	vector<int> fds;
+
+	// Push() may disconnect clients
+	for (auto it = clients.begin(); it != clients.end(); ++it) {
+		if (it->second.radio == radio.index && it->second.subscription.IsActive()) {
+			fds.push_back(it->first);
+		}
+	}
+
+	for (auto it = fds.begin(); it != fds.end(); ++it) {
+		auto client = clients.find(*it);
+
+		if (client != clients.end()) {
+			Push(client->second, status);
+		}
+	}
+}
+
+/**
+ * Send one delta update, in text mode "#<seq> field:value field:value"
+ * @param Client client
+ * @param TcvrStatus status
+ * @return void
+ */
+void Server::Push(Client & client, const TcvrStatus & status)
+{
+	// slow reader, let it notice the sequence gap instead of piling up
+	if (client.output.length() > MAX_PUSH_BACKLOG) {
+		client.subscription.Skip();
+		return;
+	}
+
+	map<int, int64_t> changes;
+	uint64_t seq;
+
+	if (!client.subscription.Delta(status, seq, changes)) {
+		return;
+	}
+
+	if (client.binary) {
+		Send(client, Protocol::Encode(Protocol::FRAME_DELTA, 0, Protocol::EncodeDelta(seq, changes, client.pushed)));
+		return;
+	}
+
+	string message = "#" + to_string(seq);
+
+	for (auto it = changes.begin(); it != changes.end(); ++it) {
+		message += " " + string(Protocol::FieldName(it->first)) + ":" + Protocol::FieldText(it->first, it->second);
+	}
+
+	Send(client, message + "\n");
+}
+
+/**
+ * Format one NDJSON record for a new status and queue it for every
+ * client streaming this radio, the record is built once no matter how
+ * many there are
+ * @param Radio radio
+ * @param TcvrStatus status
+ * @return void
+ */
+void Server::Stream(Radio & radio, const TcvrStatus & status)
+{
+	uint64_t generation = 0;
+
+	for (int i = 0; i < TcvrStatus::GROUP_COUNT; i++) {
+		generation += status.generation[i];
+	}
+
+	// set commands complete without new readings
+	if (generation == radio.stream_generation) {
+		return;
+	}
+
+	radio.stream_generation = generation;
+	bool formatted = false;
+	vector<int> fds;
+
+	for (auto it = clients.begin(); it != clients.end(); ++it) {
+		Client & client = it->second;
+
+		// slow reader, drop records rather than piling them up
+		if (!client.streaming || client.radio != radio.index || client.output.length() > MAX_PUSH_BACKLOG || client.stream_pending.length() > MAX_PUSH_BACKLOG) {
+			continue;
+		}
+
+		if (!formatted) {
+			stream_writer.Clear();
+			stream_writer.Status(status, radios.size() > 1 ? radio.name.c_str() : NULL);
+			formatted = true;
+		}
+
+		client.stream_pending.append(stream_writer.GetData(), stream_writer.GetLength());
+		fds.push_back(it->first);
+	}
+
+	// FlushStream() may disconnect clients
+	for (auto it = fds.begin(); it != fds.end(); ++it) {
+		auto client = clients.find(*it);
+
+		if (client != clients.end()) {
+			FlushStream(client->second);
+		}
+	}
+}
+
+/**
+ * Hand held back stream records to the socket once flush interval passed
+ * @param Client client
+ * @return void
+ */
+void Server::FlushStream(Client & client)
+{
+	if (client.stream_pending.empty()) {
+		return;
+	}
+
+	double now = Clock::MonotonicMs();
+
+	if (now - client.stream_last_flush < client.stream_flush_ms) {
+		return;
+	}
+
+	client.stream_last_flush = now;
+
+	// swap keeps both buffers allocated
+	if (client.output.empty()) {
+		client.output.swap(client.stream_pending);
+		Flush(client);
+	} else {
+		client.output.append(client.stream_pending);
+		client.stream_pending.clear();
+	}
 }
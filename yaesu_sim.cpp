@@ -0,0 +1,155 @@
+/**
+ * Raspberry Pi and Yeasu FT8xx fusion project
+ *
+ * This file is part of Yaesu-Pi
+ *
+ * (c) 2015 David Ponevac (david at davidus dot sk) www.davidus.sk
+ *
+ * https://github.com/davidus-sk/Yaesu-Pi
+ *
+ * You are free to use, modify, extend, do whatever you like.
+ * Please add attribution to your code.
+ *
+ * How to compile: g++ -O3 -std=c++0x -pthread -o yaesu_sim yaesu_sim.cpp ft8xx_sim.cpp eeprom_image.cpp cat.cpp cat_stats.cpp link_health.cpp device_watch.cpp tcvr_status.cpp serial_transport.cpp
+ */
+#include "cat.h"
+#include "ft8xx_sim.h"
+#include <stdlib.h>
+#include <signal.h>
+
+using namespace std;
+
+void show_help(char *s);
+
+int main(int argc, char **argv)
+{
+	int option_char;
+	int baud = 9600;
+	double processing = 2, drop = 0, shortened = 0, frequency = 14.190;
+	string link_path;
+	uint32_t seed = 1;
+	bool verbose = false;
+
+	while ((option_char = getopt(argc, argv, ":b:D:r:s:f:l:S:vh")) != -1) {
+		switch(option_char) {
+			// emulated serial speed
+			case 'b':
+				baud = stoi(optarg, nullptr);
+
+				if (baud != 2400 && baud != 4800 && baud != 9600) {
+					cout << argv[0] << ": Invalid serial speed: " << baud << ". Allowed values: 2400, 4800, 9600." << endl << endl;
+					return -1;
+				}
+
+				break;
+
+			// radio processing delay
+			case 'D':
+				processing = atof(optarg);
+				break;
+
+			// percent of frames without reply
+			case 'r':
+				drop = atof(optarg) / 100;
+				break;
+
+			// percent of frequency/mode replies cut short
+			case 's':
+				shortened = atof(optarg) / 100;
+				break;
+
+			// initial frequency
+			case 'f':
+				frequency = atof(optarg);
+				break;
+
+			// stable path for the pty
+			case 'l':
+				link_path = optarg;
+				break;
+
+			// fault injection seed
+			case 'S':
+				seed = strtoul(optarg, NULL, 10);
+				break;
+
+			// print every frame
+			case 'v':
+				verbose = true;
+				break;
+
+			case 'h':
+				show_help(argv[0]);
+				return 0;
+
+			case ':':
+				cout << argv[0] << ": Missing required parameter!" << endl << endl;
+				show_help(argv[0]);
+				return -1;
+
+			case '?':
+				cout << argv[0] << ": Unknown parameter!" << endl << endl;
+				show_help(argv[0]);
+				return -1;
+		}
+	}
+
+	// signals are taken with sigwait, the sim thread must not see them
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	FT8xxSim * sim = new FT8xxSim();
+	sim->SetBaud(baud);
+	sim->SetProcessingDelay(processing);
+	sim->SetFaults(drop, shortened);
+	sim->SetSeed(seed);
+	sim->SetVerbose(verbose);
+	sim->SetFrequency((uint32_t)llround(frequency * 1000000));
+
+	if (!sim->Open(link_path) || !sim->Start()) {
+		delete sim;
+		return -1;
+	}
+
+	cout << sim->GetDevice() << endl;
+
+	int received;
+	sigwait(&signals, &received);
+
+	sim->Stop();
+
+	SimStats stats = sim->GetStats();
+	cerr << "frames:" << stats.frames << " replies:" << stats.replies << " dropped:" << stats.dropped << " shortened:" << stats.shortened << endl;
+
+	delete sim;
+
+	return 0;
+}
+
+/**
+ * Show help message
+ * @param char* s This executable
+ * @return void
+ */
+void show_help(char *s)
+{
+	cout << "Raspberry Pi and Yeasu FT8xx fusion - FT-817/857/897 simulator" << endl << endl;
+
+	cout << "Usage: " << endl;
+	cout << " " << s << " [-b <serial speed>] [-D <processing ms>] [-r <drop %>] [-s <short %>] [-f <MHz>] [-l <link>] [-S <seed>] [-v]" << endl << endl;
+
+	cout << "Options:" << endl;
+	cout << " -b emulated serial speed (2400, 4800, 9600), sets wire delay" << endl;
+	cout << " -D radio processing delay per command in ms (default 2)" << endl;
+	cout << " -r percent of commands that get no reply" << endl;
+	cout << " -s percent of frequency/mode and EEPROM replies cut short" << endl;
+	cout << " -f initial frequency in MHz (default 14.190)" << endl;
+	cout << " -l create symlink to the pty, e.g. /tmp/ft817" << endl;
+	cout << " -S fault injection seed" << endl;
+	cout << " -v print every frame received" << endl << endl;
+
+	cout << "Prints the pty device to use with -d and runs until interrupted." << endl;
+}